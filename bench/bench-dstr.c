@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include <util/dstr.h>
+
+#include "bench.h"
+
+#define PIECES 100000
+
+/* appending many short pieces, the way diagnostics and output are built */
+static void dstr_cat_pieces(void *data)
+{
+	struct dstr str = {0};
+	size_t      i;
+
+	for (i = 0; i < PIECES; i++)
+		dstr_cat(&str, "piece ");
+	dstr_free(&str);
+}
+
+static void dstr_cat_ch_pieces(void *data)
+{
+	struct dstr str = {0};
+	size_t      i;
+
+	for (i = 0; i < PIECES; i++)
+		dstr_cat_ch(&str, (char)('a' + (i % 26)));
+	dstr_free(&str);
+}
+
+static void dstr_catf_pieces(void *data)
+{
+	struct dstr str = {0};
+	size_t      i;
+
+	for (i = 0; i < PIECES; i++)
+		dstr_catf(&str, "%s:%zu:%zu: ", "file.celes", i, i & 63);
+	dstr_free(&str);
+}
+
+/* many short-lived small strings, the common case for names and keys */
+static void dstr_copy_small(void *data)
+{
+	const char *name = "identifier_name";
+	size_t      i;
+
+	for (i = 0; i < PIECES; i++) {
+		struct dstr str = {0};
+		dstr_copy(&str, name);
+		dstr_cat(&str, "_suffix");
+		dstr_free(&str);
+	}
+}
+
+/* the same, reusing one scratch string the way the parsers do */
+static void dstr_copy_scratch(void *data)
+{
+	const char *name    = "identifier_name";
+	struct dstr scratch = {0};
+	size_t      i;
+
+	for (i = 0; i < PIECES; i++) {
+		dstr_clear(&scratch);
+		dstr_copy(&scratch, name);
+		dstr_cat(&scratch, "_suffix");
+	}
+	dstr_free(&scratch);
+}
+
+/* the same, with every string kept in an arena until the end */
+static void dstr_copy_arena(void *data)
+{
+	const char   *name = "identifier_name";
+	struct barena arena;
+	size_t        i;
+
+	barena_init(&arena, 0);
+	for (i = 0; i < PIECES; i++) {
+		struct dstr str;
+		dstr_init_arena(&str, &arena);
+		dstr_copy(&str, name);
+		dstr_cat(&str, "_suffix");
+	}
+	barena_free(&arena);
+}
+
+static void dstr_replace_all(void *data)
+{
+	const struct dstr *text = data;
+	struct dstr        copy = {0};
+
+	dstr_copy_dstr(&copy, text);
+	dstr_replace(&copy, "needle", "replacement");
+	dstr_free(&copy);
+}
+
+static void dstr_find_last(void *data)
+{
+	const struct dstr *text = data;
+
+	if (!dstr_find(text, "sentinel"))
+		printf("dstr_find: sentinel not found\n");
+}
+
+void bench_dstr(void)
+{
+	struct dstr text = {0};
+	size_t      i;
+
+	for (i = 0; i < 10000; i++)
+		dstr_cat(&text, "some text with a needle in it, ");
+	dstr_cat(&text, "sentinel");
+
+	bench_run("dstr_cat", dstr_cat_pieces, NULL, 0, PIECES);
+	bench_run("dstr_cat_ch", dstr_cat_ch_pieces, NULL, 0, PIECES);
+	bench_run("dstr_catf", dstr_catf_pieces, NULL, 0, PIECES);
+	bench_run("dstr_copy + dstr_cat + dstr_free", dstr_copy_small, NULL, 0, PIECES);
+	bench_run("dstr_copy + dstr_cat (scratch)", dstr_copy_scratch, NULL, 0, PIECES);
+	bench_run("dstr_copy + dstr_cat (arena)", dstr_copy_arena, NULL, 0, PIECES);
+	bench_run("dstr_replace (10K matches)", dstr_replace_all, &text, text.size, 10000);
+	bench_run("dstr_find", dstr_find_last, &text, text.size, 0);
+
+	dstr_free(&text);
+}
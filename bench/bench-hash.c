@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include <util/hash.h>
+#include <util/hash-map.h>
+#include <util/dstr.h>
+
+#include "bench.h"
+
+struct hash_data {
+	struct dstr  keys;
+	size_t      *offsets;
+	size_t      *sizes;
+	size_t       count;
+	hash_table_t table;
+	hash_map_t   map;
+};
+
+/* identifier-like keys, in an order unrelated to their text */
+static void generate_keys(struct hash_data *hd, size_t count)
+{
+	size_t i;
+
+	hd->offsets = bmalloc(count * sizeof(size_t));
+	hd->sizes   = bmalloc(count * sizeof(size_t));
+	hd->count   = count;
+
+	for (i = 0; i < count; i++) {
+		size_t offset = hd->keys.size;
+
+		dstr_catf(&hd->keys, "symbol_%zx_%zu", (i * 2654435761u) & 0xFFFFFFFF, i);
+		hd->offsets[i] = offset;
+		hd->sizes[i]   = hd->keys.size - offset;
+	}
+}
+
+static void fill_table(hash_table_t *ht, struct hash_data *hd)
+{
+	size_t i;
+
+	for (i = 0; i < hd->count; i++) {
+		uint64_t val = i;
+		hash_table_set_n(ht, hd->keys.array + hd->offsets[i], hd->sizes[i], &val);
+	}
+}
+
+static void hash_insert(void *data)
+{
+	struct hash_data *hd = data;
+	hash_table_t      ht;
+
+	hash_table_init(&ht, sizeof(uint64_t), NULL);
+	fill_table(&ht, hd);
+	hash_table_free(&ht);
+}
+
+static void hash_lookup(void *data)
+{
+	struct hash_data *hd    = data;
+	size_t            found = 0;
+	size_t            i;
+
+	for (i = 0; i < hd->count; i++) {
+		if (hash_table_get_n(&hd->table, hd->keys.array + hd->offsets[i], hd->sizes[i]))
+			found++;
+	}
+
+	if (found != hd->count)
+		printf("hash_table_get_n: only found %zu of %zu keys\n", found, hd->count);
+}
+
+static void fill_map(hash_map_t *map, struct hash_data *hd)
+{
+	size_t i;
+
+	for (i = 0; i < hd->count; i++) {
+		uint64_t val = i;
+		hash_map_set_n(map, hd->keys.array + hd->offsets[i], hd->sizes[i], &val);
+	}
+}
+
+static void map_insert(void *data)
+{
+	struct hash_data *hd = data;
+	hash_map_t        map;
+
+	hash_map_init(&map, sizeof(uint64_t), NULL);
+	fill_map(&map, hd);
+	hash_map_free(&map);
+}
+
+static void map_lookup(void *data)
+{
+	struct hash_data *hd    = data;
+	size_t            found = 0;
+	size_t            i;
+
+	for (i = 0; i < hd->count; i++) {
+		if (hash_map_get_n(&hd->map, hd->keys.array + hd->offsets[i], hd->sizes[i]))
+			found++;
+	}
+
+	if (found != hd->count)
+		printf("hash_map_get_n: only found %zu of %zu keys\n", found, hd->count);
+}
+
+static void bench_hash_size(size_t count, const char *label)
+{
+	struct hash_data hd = {0};
+	char             name[64];
+
+	generate_keys(&hd, count);
+
+	snprintf(name, sizeof(name), "hash_table_set_n (%s keys)", label);
+	bench_run(name, hash_insert, &hd, 0, count);
+
+	hash_table_init(&hd.table, sizeof(uint64_t), NULL);
+	fill_table(&hd.table, &hd);
+
+	snprintf(name, sizeof(name), "hash_table_get_n (%s keys)", label);
+	bench_run(name, hash_lookup, &hd, 0, count);
+
+	hash_table_free(&hd.table);
+
+	snprintf(name, sizeof(name), "hash_map_set_n (%s keys)", label);
+	bench_run(name, map_insert, &hd, 0, count);
+
+	hash_map_init(&hd.map, sizeof(uint64_t), NULL);
+	fill_map(&hd.map, &hd);
+
+	snprintf(name, sizeof(name), "hash_map_get_n (%s keys)", label);
+	bench_run(name, map_lookup, &hd, 0, count);
+
+	hash_map_free(&hd.map);
+	bfree(hd.offsets);
+	bfree(hd.sizes);
+	dstr_free(&hd.keys);
+}
+
+void bench_hash(void)
+{
+	bench_hash_size(1000, "1K");
+	bench_hash_size(100000, "100K");
+	bench_hash_size(10000000, "10M");
+}
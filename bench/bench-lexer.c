@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include <celes-parser.h>
+#include <util/lexer.h>
+#include <util/dstr.h>
+
+#include "bench.h"
+
+static void generate_source(struct dstr *str, size_t target_size)
+{
+	uint32_t seed = 1;
+	size_t   i    = 0;
+
+	while (str->size < target_size) {
+		seed = seed * 1103515245 + 12345;
+
+		dstr_catf(str,
+		          "\tvariable_%u = call_%u(%u, other.member_%u) + %u.%u;\n",
+		          (seed >> 8) & 0xFFF,
+		          (seed >> 12) & 0xFF,
+		          seed & 0xFFFF,
+		          (seed >> 4) & 0xFF,
+		          seed & 0xFF,
+		          (seed >> 16) & 0xFF);
+
+		if ((++i & 15) == 0)
+			dstr_cat(str, "}\n\nfunction something() {\n");
+	}
+}
+
+/* blocks nested 64 deep, a few tokens per level */
+static void generate_nested(struct dstr *str, size_t target_size)
+{
+	static const char open[]  = "{([";
+	static const char close[] = "})]";
+	int               depth;
+
+	while (str->size < target_size) {
+		for (depth = 0; depth < 64; depth++)
+			dstr_catf(str, "level_%d %c ", depth, open[depth % 3]);
+		dstr_cat(str, "x = 1;");
+		for (depth = 63; depth >= 0; depth--)
+			dstr_catf(str, " %c", close[depth % 3]);
+		dstr_cat_ch(str, '\n');
+	}
+}
+
+static void generate_long_idents(struct dstr *str, size_t target_size)
+{
+	uint32_t seed = 1;
+
+	while (str->size < target_size) {
+		seed = seed * 1103515245 + 12345;
+
+		dstr_catf(str,
+		          "\tthis_is_a_rather_long_identifier_name_for_the_lexer_to_chew_through_%u = "
+		          "another_identifier_that_is_also_quite_long_indeed_%u.member_with_a_long_name_%u;\n",
+		          seed & 0xFFFF,
+		          (seed >> 8) & 0xFFFF,
+		          (seed >> 16) & 0xFF);
+	}
+}
+
+/* mostly comments, with a line of code here and there */
+static void generate_comments(struct dstr *str, size_t target_size)
+{
+	size_t i = 0;
+
+	while (str->size < target_size) {
+		dstr_cat(str, "// a line comment that goes on for a while to describe the code below it\n");
+		dstr_cat(str, "/* a block comment\n * spanning a few lines\n * of text */\n");
+		if ((++i & 3) == 0)
+			dstr_catf(str, "value_%zu = %zu;\n", i, i);
+	}
+}
+
+static void generate_non_ascii(struct dstr *str, size_t target_size)
+{
+	size_t i = 0;
+
+	while (str->size < target_size) {
+		dstr_catf(str, "\tgreeting_%zu = 'Grüße, 世界 — ça va? ✓';\n", i++);
+		dstr_cat(str, "\t// コメント: ünïcödé everywhere, Ελληνικά, русский\n");
+	}
+}
+
+struct corpus {
+	const char *name;
+	void (*generate)(struct dstr *str, size_t target_size);
+};
+
+static const struct corpus corpora[] = {
+	{"code", generate_source},
+	{"nested", generate_nested},
+	{"long idents", generate_long_idents},
+	{"comments", generate_comments},
+	{"non-ascii", generate_non_ascii},
+};
+
+static void lex_get(void *data)
+{
+	struct lexer *lexx = data;
+
+	lexer_reset(lexx);
+	while (lexer_get_token(lexx, NULL, IGNORE_WHITESPACE))
+		;
+}
+
+/* the access pattern of the parsers: peek a token, then decide to take it */
+static void lex_peek_get(void *data)
+{
+	struct lexer     *lexx = data;
+	struct base_token token;
+
+	lexer_reset(lexx);
+	while (lexer_peek_token(lexx, &token, IGNORE_WHITESPACE))
+		lexer_get_token(lexx, NULL, IGNORE_WHITESPACE);
+}
+
+/* same as above, but throwing away the lookahead cache before every get so
+ * each token is scanned twice, as it was before the lexer had a cache */
+static void lex_peek_get_uncached(void *data)
+{
+	struct lexer     *lexx = data;
+	struct base_token token;
+
+	lexer_reset(lexx);
+	while (lexer_peek_token(lexx, &token, IGNORE_WHITESPACE)) {
+		lexx->peek_offset = NULL;
+		lexer_get_token(lexx, NULL, IGNORE_WHITESPACE);
+	}
+}
+
+/* stands in for what a parser does with each token, so there's something to
+ * overlap with the lexing */
+static inline uint32_t consume_token(uint32_t hash, const struct base_token *token)
+{
+	size_t i;
+
+	for (i = 0; i < token->text.size; i++)
+		hash = (hash ^ (uint8_t)token->text.array[i]) * 16777619u;
+	return hash;
+}
+
+static volatile uint32_t consumed_hash;
+
+static void lex_consume(void *data)
+{
+	struct lexer     *lexx = data;
+	struct base_token token;
+	uint32_t          hash = 2166136261u;
+
+	lexer_reset(lexx);
+	while (lexer_get_token(lexx, &token, IGNORE_WHITESPACE))
+		hash = consume_token(hash, &token);
+	consumed_hash = hash;
+}
+
+static void lex_consume_piped(void *data)
+{
+	struct lexer     *lexx = data;
+	struct lexer_pipe pipe;
+	struct base_token token;
+	uint32_t          hash = 2166136261u;
+
+	lexer_reset(lexx);
+	if (!lexer_pipe_start(&pipe, lexx, IGNORE_WHITESPACE, 0))
+		return;
+	while (lexer_pipe_next(&pipe, &token))
+		hash = consume_token(hash, &token);
+	lexer_pipe_stop(&pipe);
+	consumed_hash = hash;
+}
+
+struct parse_data {
+	const char *text;
+	size_t      size;
+};
+
+static void parse_tree(void *data)
+{
+	struct parse_data *pd     = data;
+	struct cel_parser  parser = {0};
+
+	cel_parser_build_tree(&parser, bstrdup_n(pd->text, pd->size), pd->size, "bench");
+	cel_parser_free(&parser);
+}
+
+static void parse_tree_interned(void *data)
+{
+	struct parse_data *pd     = data;
+	struct cel_parser  parser = {0};
+	struct atom_table  atoms;
+
+	atom_table_init(&atoms);
+	parser.atoms = &atoms;
+
+	cel_parser_build_tree(&parser, bstrdup_n(pd->text, pd->size), pd->size, "bench");
+	cel_parser_free(&parser);
+	atom_table_free(&atoms);
+}
+
+struct edit_data {
+	struct cel_parser parser;
+	size_t            offset;
+};
+
+/* types a character into an identifier in the middle of the text and takes
+ * it out again */
+static void edit_tree(void *data)
+{
+	struct edit_data *ed = data;
+
+	cel_parser_edit(&ed->parser, ed->offset, 0, "x", 1, "bench");
+	cel_parser_edit(&ed->parser, ed->offset, 1, "", 0, "bench");
+}
+
+static size_t count_tokens(struct lexer *lexx)
+{
+	size_t count = 0;
+
+	lexer_reset(lexx);
+	while (lexer_get_token(lexx, NULL, IGNORE_WHITESPACE))
+		count++;
+	return count;
+}
+
+static size_t count_tree_tokens(const struct dstr *source)
+{
+	struct cel_parser parser = {0};
+	size_t            count;
+
+	cel_parser_build_tree(&parser, bstrdup_n(source->array, source->size), source->size, "bench");
+	count = parser.tokens.size;
+	cel_parser_free(&parser);
+	return count;
+}
+
+static void bench_corpus(const struct corpus *corpus)
+{
+	struct dstr       source = {0};
+	struct lexer      lexx;
+	struct parse_data pd;
+	char              name[64];
+
+	corpus->generate(&source, 4 * 1024 * 1024);
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, source.array, source.size);
+
+	snprintf(name, sizeof(name), "lexer_get_token [%s]", corpus->name);
+	bench_run(name, lex_get, &lexx, source.size, count_tokens(&lexx));
+
+	pd.text = source.array;
+	pd.size = source.size;
+	snprintf(name, sizeof(name), "cel_parser_build_tree [%s]", corpus->name);
+	bench_run(name, parse_tree, &pd, source.size, count_tree_tokens(&source));
+
+	lexer_free(&lexx);
+	dstr_free(&source);
+}
+
+void bench_lexer(void)
+{
+	struct dstr       source = {0};
+	struct lexer      lexx;
+	struct parse_data pd;
+	struct edit_data  ed;
+	size_t            tokens;
+	size_t            i;
+
+	generate_source(&source, 4 * 1024 * 1024);
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, source.array, source.size);
+	tokens = count_tokens(&lexx);
+
+	bench_run("lexer_peek_token + get", lex_peek_get, &lexx, source.size, tokens);
+	bench_run("lexer_peek_token + get (uncached)", lex_peek_get_uncached, &lexx, source.size, tokens);
+	bench_run("lexer_get_token + consume", lex_consume, &lexx, source.size, tokens);
+	bench_run("lexer_pipe_next + consume", lex_consume_piped, &lexx, source.size, tokens);
+
+	pd.text = source.array;
+	pd.size = source.size;
+	bench_run("cel_parser_build_tree (interning)", parse_tree_interned, &pd, source.size, count_tree_tokens(&source));
+
+	memset(&ed, 0, sizeof(ed));
+	ed.offset = (size_t)(strstr(source.array + source.size / 2, "variable_") - source.array) + 1;
+	cel_parser_build_tree(&ed.parser, bstrdup_n(source.array, source.size), source.size, "bench");
+	bench_run("cel_parser_edit (2 edits)", edit_tree, &ed, 0, 2);
+	cel_parser_free(&ed.parser);
+
+	lexer_free(&lexx);
+	dstr_free(&source);
+
+	for (i = 0; i < sizeof(corpora) / sizeof(corpora[0]); i++)
+		bench_corpus(&corpora[i]);
+}
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <celes-parser.h>
+#include <util/bmem.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include <util/lexer.h>
+#include <util/platform.h>
+#include <util/toml.h>
+
+#include "bench.h"
+
+/*
+ * Replays the fuzzing corpus, to catch inputs that take more than linear
+ * time.  Each input is repeated to BASE_SIZE, then to SCALE times that, and
+ * the time per byte of the two is compared.  Repeating an input that leaves
+ * blocks or comments open nests them deeper as well, so this covers depth
+ * as much as length.
+ *
+ * Inputs the TOML parser rejects stop at their first error, and a repeated
+ * document has duplicate keys, so most of its cases only show that nothing
+ * gets slower.
+ */
+
+#define BASE_SIZE (16 * 1024)
+#define SCALE 8
+#define MAX_SCALING 3.0 /* slower per byte than this at SCALE times the size fails */
+
+#define MIN_RUNS 3
+#define MAX_RUNS 100
+#define MIN_TIME_NS 20000000ULL
+
+struct corpus_input {
+	const char *text;
+	size_t      size;
+};
+
+/* bench_run wants half a second per case, which is too long for every input
+ * times every parser times two sizes.  the fastest run is steadier anyway */
+static uint64_t time_fastest(bench_func_t func, void *data)
+{
+	uint64_t fastest = UINT64_MAX;
+	uint64_t total   = 0;
+	size_t   runs    = 0;
+
+	func(data);
+
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME_NS)) {
+		uint64_t start = os_gettime_ns();
+		uint64_t time;
+
+		func(data);
+		time = os_gettime_ns() - start;
+		if (time < fastest)
+			fastest = time;
+		total += time;
+		runs++;
+	}
+
+	return fastest;
+}
+
+static void corpus_lex(void *data)
+{
+	struct corpus_input *input = data;
+	struct lexer         lexx;
+	struct base_token    token;
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, input->text, input->size);
+	while (lexer_get_token(&lexx, &token, IGNORE_WHITESPACE))
+		;
+	lexer_free(&lexx);
+}
+
+static void corpus_parse(void *data)
+{
+	struct corpus_input *input  = data;
+	struct cel_parser    parser = {0};
+
+	cel_parser_build_tree(&parser, bstrdup_n(input->text, input->size), input->size, "corpus");
+	cel_parser_free(&parser);
+}
+
+static void corpus_toml(void *data)
+{
+	struct corpus_input *input = data;
+	toml_t              *toml  = NULL;
+
+	toml_parse_buffer(&toml, input->text, input->size, "corpus", NULL);
+	toml_release(toml);
+}
+
+static void repeat(struct dstr *dst, const char *text, size_t size, size_t min_size)
+{
+	dstr_clear(dst);
+	while (dst->size < min_size)
+		dstr_ncat(dst, text, size);
+}
+
+static int compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/* returns false if it took too much longer per byte at the larger size */
+static bool check_scaling(const char *name, bench_func_t func, const struct dstr *base, const struct dstr *scaled)
+{
+	struct corpus_input base_input   = {base->array, base->size};
+	struct corpus_input scaled_input = {scaled->array, scaled->size};
+	uint64_t            base_time    = time_fastest(func, &base_input);
+	uint64_t            scaled_time  = time_fastest(func, &scaled_input);
+	double              base_rate    = (double)base_time / (double)base->size;
+	double              scaled_rate  = (double)scaled_time / (double)scaled->size;
+	double              scaling      = base_rate > 0.0 ? scaled_rate / base_rate : 1.0;
+	bool                linear       = scaling <= MAX_SCALING;
+
+	printf("%-44s %10.3f ms  x%d %10.3f ms  scaling %6.2f%s\n",
+	       name,
+	       (double)base_time / 1000000.0,
+	       SCALE,
+	       (double)scaled_time / 1000000.0,
+	       scaling,
+	       linear ? "" : "  SUPERLINEAR");
+	return linear;
+}
+
+bool bench_scaling(const char *corpus_dir)
+{
+	static const struct {
+		const char  *name;
+		bench_func_t func;
+	} parsers[] = {
+	        {"lexer", corpus_lex},
+	        {"parser", corpus_parse},
+	        {"toml", corpus_toml},
+	};
+
+	DARRAY(char *) names = {0};
+
+	struct dstr       path    = {0};
+	struct dstr       name    = {0};
+	struct dstr       base    = {0};
+	struct dstr       scaled  = {0};
+	os_dir_t         *dir;
+	struct os_dirent *ent;
+	bool              success = true;
+	size_t            i;
+	size_t            j;
+
+	dir = os_opendir(corpus_dir);
+	if (!dir) {
+		printf("could not open corpus directory %s\n", corpus_dir);
+		return false;
+	}
+	while ((ent = os_readdir(dir)) != NULL) {
+		if (!ent->directory) {
+			char *file_name = bstrdup(ent->d_name);
+			da_push_back(names, &file_name);
+		}
+	}
+	os_closedir(dir);
+
+	qsort(names.array, names.size, sizeof(*names.array), compare_names);
+
+	for (i = 0; i < names.size; i++) {
+		size_t size;
+		char  *text;
+
+		dstr_printf(&path, "%s/%s", corpus_dir, names.array[i]);
+		text = os_quick_read_utf8_file(path.array, &size);
+		if (text && size) {
+			repeat(&base, text, size, BASE_SIZE);
+			repeat(&scaled, base.array, base.size, base.size * SCALE);
+
+			for (j = 0; j < sizeof(parsers) / sizeof(parsers[0]); j++) {
+				dstr_printf(&name, "%s %s", parsers[j].name, names.array[i]);
+				if (!check_scaling(name.array, parsers[j].func, &base, &scaled))
+					success = false;
+			}
+		}
+
+		bfree(text);
+		bfree(names.array[i]);
+	}
+
+	da_free(names);
+	dstr_free(&path);
+	dstr_free(&name);
+	dstr_free(&base);
+	dstr_free(&scaled);
+	return success;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+
+#include <util/toml.h>
+#include <util/dstr.h>
+#include <util/bmem.h>
+#include <util/platform.h>
+
+#include "bench.h"
+
+#define TABLES 100
+#define KEYS_PER_TABLE 50
+
+static const char *toml_path = "celes-bench.toml";
+
+struct toml_data {
+	toml_t     *toml;
+	struct dstr names; /* "table\0key\0" pairs for every integer */
+	size_t      count;
+};
+
+/* every table has a mix of value types, with every fifth key an integer. */
+static void generate_toml(struct dstr *str)
+{
+	size_t table;
+	size_t key;
+
+	dstr_cat(str, "title = \"benchmark\"\n\n");
+
+	for (table = 0; table < TABLES; table++) {
+		dstr_catf(str, "[section_%zu]\n", table);
+
+		for (key = 0; key < KEYS_PER_TABLE; key++) {
+			switch (key % 5) {
+			case 0:
+				dstr_catf(str, "int_key_%zu = %zu\n", key, table * 1000 + key);
+				break;
+			case 1:
+				dstr_catf(str, "string_key_%zu = \"plain string value %zu\"\n", key, key);
+				break;
+			case 2:
+				dstr_catf(str, "escaped_key_%zu = \"tab\\tquote\\\" %zu\"\n", key, key);
+				break;
+			case 3:
+				dstr_catf(str, "real_key_%zu = %zu.25\n", key, key);
+				break;
+			case 4:
+				dstr_catf(str, "literal_key_%zu = 'C:\\literal\\path\\%zu'\n", key, key);
+				break;
+			}
+		}
+
+		dstr_cat_ch(str, '\n');
+	}
+}
+
+static void toml_load(void *data)
+{
+	toml_t *toml = NULL;
+
+	if (toml_open(&toml, toml_path, NULL) != TOML_SUCCESS) {
+		printf("toml_open failed\n");
+		return;
+	}
+	toml_release(toml);
+}
+
+/* what celes build does: open the file and read a single table of it */
+static void toml_load_lazy(void *data)
+{
+	toml_t *toml = NULL;
+
+	if (toml_open_lazy(&toml, toml_path, NULL) != TOML_SUCCESS) {
+		printf("toml_open_lazy failed\n");
+		return;
+	}
+	if (!toml_get_int(toml, "section_50", "int_key_0"))
+		printf("toml_open_lazy: found nothing\n");
+	toml_release(toml);
+}
+
+static bool count_event(void *param, const struct toml_event *event)
+{
+	size_t *count = param;
+
+	if (event->type == TOML_EVENT_VALUE)
+		(*count)++;
+	return true;
+}
+
+static void toml_stream(void *data)
+{
+	size_t count = 0;
+
+	if (toml_parse_stream(toml_path, count_event, &count, NULL) != TOML_SUCCESS || !count)
+		printf("toml_parse_stream failed\n");
+}
+
+static void toml_lookup(void *data)
+{
+	struct toml_data *td    = data;
+	const char       *name  = td->names.array;
+	int64_t           total = 0;
+	size_t            i;
+
+	for (i = 0; i < td->count; i++) {
+		const char *key = name + strlen(name) + 1;
+
+		total += toml_get_int(td->toml, name, key);
+		name = key + strlen(key) + 1;
+	}
+
+	if (total == 0)
+		printf("toml_get_int: found nothing\n");
+}
+
+void bench_toml(void)
+{
+	struct toml_data td     = {0};
+	struct dstr      source = {0};
+	size_t           table;
+	size_t           key;
+
+	generate_toml(&source);
+	if (!os_quick_write_utf8_file(toml_path, source.array, source.size, false)) {
+		printf("could not write %s\n", toml_path);
+		dstr_free(&source);
+		return;
+	}
+
+	if (toml_open(&td.toml, toml_path, NULL) != TOML_SUCCESS) {
+		printf("toml_open: could not parse the generated file\n");
+		goto cleanup;
+	}
+
+	bench_run("toml_open (5K keys)", toml_load, NULL, source.size, TABLES * KEYS_PER_TABLE);
+	bench_run("toml_open_lazy + one table", toml_load_lazy, NULL, source.size, 0);
+	bench_run("toml_parse_stream (5K keys)", toml_stream, NULL, source.size, TABLES * KEYS_PER_TABLE);
+
+	for (table = 0; table < TABLES; table++) {
+		for (key = 0; key < KEYS_PER_TABLE; key += 5) {
+			dstr_catf(&td.names, "section_%zu", table);
+			dstr_cat_ch(&td.names, 0);
+			dstr_catf(&td.names, "int_key_%zu", key);
+			dstr_cat_ch(&td.names, 0);
+			td.count++;
+		}
+	}
+
+	bench_run("toml_get_int", toml_lookup, &td, 0, td.count);
+	toml_release(td.toml);
+
+cleanup:
+	os_unlink(toml_path);
+	dstr_free(&td.names);
+	dstr_free(&source);
+}
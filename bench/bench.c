@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/platform.h>
+
+#include "bench.h"
+
+#define WARMUP_RUNS 3
+#define MIN_RUNS 5
+#define MAX_RUNS 1000
+#define MIN_TIME_NS 500000000ULL
+
+static const char *group_filter = NULL;
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t val_a = *(const uint64_t *)a;
+	uint64_t val_b = *(const uint64_t *)b;
+	return (val_a > val_b) - (val_a < val_b);
+}
+
+void bench_run(const char *name, bench_func_t func, void *data, size_t bytes, size_t ops)
+{
+	static uint64_t times[MAX_RUNS];
+	uint64_t        total = 0;
+	uint64_t        median;
+	uint64_t        p99;
+	size_t          runs = 0;
+	size_t          i;
+
+	for (i = 0; i < WARMUP_RUNS; i++)
+		func(data);
+
+	while (runs < MAX_RUNS && (runs < MIN_RUNS || total < MIN_TIME_NS)) {
+		uint64_t start = os_gettime_ns();
+		func(data);
+		times[runs] = os_gettime_ns() - start;
+		total += times[runs++];
+	}
+
+	qsort(times, runs, sizeof(*times), compare_u64);
+	median = times[runs / 2];
+	p99    = times[(runs * 99) / 100];
+
+	printf("%-44s %10.3f ms  p99 %10.3f ms", name, (double)median / 1000000.0, (double)p99 / 1000000.0);
+	if (bytes && median)
+		printf(" %10.2f MB/s", ((double)bytes / (1024.0 * 1024.0)) / ((double)median / 1000000000.0));
+	if (ops)
+		printf(" %10.2f ns/op", (double)median / (double)ops);
+	printf("   (%zu runs)\n", runs);
+}
+
+bool bench_group_enabled(const char *group)
+{
+	return !group_filter || strcmp(group_filter, group) == 0;
+}
+
+/* celes-bench [group] [corpus directory] */
+int main(int argc, char *argv[])
+{
+	const char *corpus_dir = CELES_FUZZ_CORPUS;
+	bool        success    = true;
+
+	if (argc > 1)
+		group_filter = argv[1];
+	if (argc > 2)
+		corpus_dir = argv[2];
+
+	if (bench_group_enabled("lexer"))
+		bench_lexer();
+	if (bench_group_enabled("hash"))
+		bench_hash();
+	if (bench_group_enabled("toml"))
+		bench_toml();
+	if (bench_group_enabled("dstr"))
+		bench_dstr();
+	if (bench_group_enabled("scaling"))
+		success = bench_scaling(corpus_dir);
+	return success ? 0 : 1;
+}
@@ -0,0 +1,40 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include <util/util-defs.h>
+
+typedef void (*bench_func_t)(void *data);
+
+/*
+ * Runs a benchmark a few times to warm up, then repeatedly until enough time
+ * has passed, and prints the median and 99th percentile time per run. If
+ * bytes is not zero, the throughput is printed as well, and if ops is not
+ * zero, the median time per operation (one run doing ops operations).
+ */
+extern void bench_run(const char *name, bench_func_t func, void *data, size_t bytes, size_t ops);
+
+/* returns false if the benchmark group was filtered out on the command line */
+extern bool bench_group_enabled(const char *group);
+
+extern void bench_lexer(void);
+extern void bench_hash(void);
+extern void bench_toml(void);
+extern void bench_dstr(void);
+
+/* returns false if an input in the directory took more than linear time */
+extern bool bench_scaling(const char *corpus_dir);
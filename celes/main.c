@@ -1,25 +1,355 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <celes-parser.h>
+#include <celes-build-cache.h>
+#include <util/bmem.h>
 #include <util/hash.h>
+#include <util/job-pool.h>
 #include <util/platform.h>
+#include <util/stats.h>
 #include <util/toml.h>
 
+enum stats_output {
+	STATS_OUTPUT_NONE,
+	STATS_OUTPUT_TEXT,
+	STATS_OUTPUT_JSON,
+};
+
+struct build_options {
+	size_t            num_threads; /* 0 for one per core */
+	enum stats_output stats;
+};
+
+struct build_worker {
+	struct cel_parser parser;
+	struct barena     arena;
+};
+
+struct build_state {
+	DARRAY(char *) sources;
+	struct build_worker    *workers;
+	struct cel_build_cache *cache; /* NULL if caching is disabled */
+};
+
+struct source_file {
+	struct build_state *state;
+	char               *path;
+	struct error_data   errors;
+};
+
+static bool is_source_file(const char *name)
+{
+	size_t len = strlen(name);
+	return len > 6 && strcmp(name + len - 6, ".celes") == 0;
+}
+
+static void find_sources(struct build_state *state, const char *dir_path, struct dstr *path)
+{
+	os_dir_t         *dir = os_opendir(dir_path);
+	struct os_dirent *ent;
+
+	if (!dir)
+		return;
+
+	while ((ent = os_readdir(dir)) != NULL) {
+		size_t dir_size = path->size;
+
+		/* skip hidden files, and .git and the like */
+		if (*ent->d_name == '.')
+			continue;
+
+		if (path->size)
+			dstr_cat_ch(path, '/');
+		dstr_cat(path, ent->d_name);
+
+		if (ent->directory) {
+			find_sources(state, path->array, path);
+		} else if (is_source_file(ent->d_name)) {
+			char *source = bstrdup_n(path->array, path->size);
+			da_push_back(state->sources, &source);
+		}
+
+		dstr_resize(path, dir_size);
+	}
+
+	os_closedir(dir);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static void parse_source_file(void *param, size_t worker_idx)
+{
+	struct source_file   *file   = param;
+	struct build_worker  *worker = &file->state->workers[worker_idx];
+	struct os_mapped_file mapping;
+
+	struct cel_build_cache *cache  = file->state->cache;
+	struct cel_cache_key    key;
+
+	STATS_PHASE_START(read_timer);
+	if (!os_mmap_file(file->path, &mapping)) {
+		error_data_add(&file->errors, file->path, 0, 0, "Could not open file", LEX_ERROR);
+		return;
+	}
+	STATS_PHASE_END(read_timer, STATS_PHASE_FILE_READ);
+
+	if (cache) {
+		STATS_PHASE_START(lookup_timer);
+		cel_build_cache_key(cache, mapping.data, mapping.size, &key);
+		bool hit = cel_build_cache_has(cache, &key);
+		STATS_PHASE_END(lookup_timer, STATS_PHASE_CACHE_LOOKUP);
+
+		if (hit) {
+			os_munmap_file(&mapping);
+			return;
+		}
+	}
+
+	worker->parser.arena = &worker->arena;
+	cel_parser_build_tree_mapped(&worker->parser, &mapping, file->path);
+
+	/* only clean files are cached, so a cache hit never has diagnostics
+	 * that would have to be replayed */
+	if (cache && !worker->parser.error_list.errors.size) {
+		STATS_PHASE_START(store_timer);
+		cel_build_cache_store(cache, &key, &worker->parser);
+		STATS_PHASE_END(store_timer, STATS_PHASE_CACHE_STORE);
+	}
+
+	/* errors are kept per file and merged in file order afterward, so the
+	 * output doesn't depend on which thread parsed what */
+	error_data_append(&file->errors, &worker->parser.error_list);
+
+	cel_parser_free(&worker->parser);
+	barena_clear(&worker->arena);
+}
+
+static bool parse_sources(const char *source_dir, struct cel_build_cache *cache, size_t num_threads)
+{
+	struct build_state  state  = {0};
+	struct error_data   errors = {0};
+	struct dstr         path   = {0};
+	struct job_pool    *pool   = NULL;
+	struct source_file *files  = NULL;
+	size_t              i;
+	bool                success;
+
+	STATS_PHASE_START(find_timer);
+	if (strcmp(source_dir, ".") != 0)
+		dstr_copy(&path, source_dir);
+	find_sources(&state, source_dir, &path);
+	dstr_free(&path);
+	STATS_PHASE_END(find_timer, STATS_PHASE_FIND_SOURCES);
+
+	if (!state.sources.size) {
+		printf("No source files found in '%s'\n", source_dir);
+		da_free(state.sources);
+		return true;
+	}
+
+	/* directory order is arbitrary, so sort to keep builds reproducible */
+	qsort(state.sources.array, state.sources.size, sizeof(char *), compare_paths);
+
+	state.cache   = cache;
+	pool          = job_pool_create(num_threads);
+	state.workers = bzalloc(sizeof(struct build_worker) * job_pool_thread_count(pool));
+	files         = bzalloc(sizeof(struct source_file) * state.sources.size);
+
+	for (i = 0; i < job_pool_thread_count(pool); i++)
+		barena_init(&state.workers[i].arena, 0);
+
+	for (i = 0; i < state.sources.size; i++) {
+		files[i].state = &state;
+		files[i].path  = state.sources.array[i];
+		job_pool_push(pool, parse_source_file, &files[i]);
+	}
+
+	job_pool_wait(pool);
+
+	for (i = 0; i < state.sources.size; i++)
+		error_data_append(&errors, &files[i].errors);
+
+	success = !error_data_has_errors(&errors);
+	if (errors.errors.size) {
+		char *str = error_data_buildstring(&errors);
+		printf("%s", str);
+		bfree(str);
+	}
+
+	for (i = 0; i < job_pool_thread_count(pool); i++) {
+		cel_parser_free(&state.workers[i].parser);
+		barena_free(&state.workers[i].arena);
+	}
+	job_pool_destroy(pool);
+
+	/* the error items point to the paths */
+	error_data_free(&errors);
+	for (i = 0; i < state.sources.size; i++)
+		bfree(state.sources.array[i]);
+	da_free(state.sources);
+	bfree(state.workers);
+	bfree(files);
+	return success;
+}
+
+static bool parse_build_args(int argc, char *argv[], struct build_options *options)
+{
+	int i;
+
+	memset(options, 0, sizeof(*options));
+
+	for (i = 2; i < argc; i++) {
+		const char *arg   = argv[i];
+		const char *value = NULL;
+		char       *end   = NULL;
+		long        jobs;
+
+		if (strcmp(arg, "--stats") == 0 || strcmp(arg, "--stats=text") == 0) {
+			options->stats = STATS_OUTPUT_TEXT;
+			continue;
+		} else if (strcmp(arg, "--stats=json") == 0) {
+			options->stats = STATS_OUTPUT_JSON;
+			continue;
+		} else if (strcmp(arg, "-j") == 0) {
+			if (++i == argc) {
+				printf("-j expects a number of jobs\n");
+				return false;
+			}
+			value = argv[i];
+		} else if (astrcmp_n(arg, "-j", 2) == 0) {
+			value = arg + 2;
+		} else {
+			printf("Unknown build option '%s'\n", arg);
+			return false;
+		}
+
+		jobs = strtol(value, &end, 10);
+		if (*end || jobs < 1) {
+			printf("Invalid number of jobs '%s'\n", value);
+			return false;
+		}
+
+		options->num_threads = (size_t)jobs;
+	}
+
+	if (options->stats != STATS_OUTPUT_NONE && !STATS_ENABLED) {
+		fprintf(stderr, "celes was built without ENABLE_STATS, so statistics will all be zero\n");
+	}
+
+	return true;
+}
+
+/* call sites listed with --stats, when built with ENABLE_BMEM_TRACKING */
+#define STATS_MEMORY_SITES 10
+
+static void print_stats(enum stats_output output, uint64_t wall_ns)
+{
+	struct stats stats;
+	size_t       i;
+
+	stats_collect(&stats);
+
+	if (output == STATS_OUTPUT_JSON) {
+		printf("{\"wall_ns\":%llu,\"phases\":{", (unsigned long long)wall_ns);
+		for (i = 0; i < STATS_PHASE_COUNT; i++) {
+			printf("%s\"%s\":{\"calls\":%llu,\"ns\":%llu}",
+			       i ? "," : "",
+			       stats_phase_name(i),
+			       (unsigned long long)stats.phase_calls[i],
+			       (unsigned long long)stats.phase_ns[i]);
+		}
+		printf("},\"counters\":{");
+		for (i = 0; i < STATS_COUNTER_COUNT; i++) {
+			printf("%s\"%s\":%llu", i ? "," : "", stats_counter_name(i), (unsigned long long)stats.counters[i]);
+		}
+		printf("}");
+		if (BMEM_TRACKING_ENABLED) {
+			struct bmem_stats mem;
+
+			bmem_get_stats(&mem);
+			printf(",\"memory\":{\"allocs\":%llu,\"frees\":%llu,\"live_bytes\":%llu,\"peak_bytes\":%llu}",
+			       (unsigned long long)mem.allocs,
+			       (unsigned long long)mem.frees,
+			       (unsigned long long)mem.live_bytes,
+			       (unsigned long long)mem.peak_bytes);
+		}
+		printf("}\n");
+		return;
+	}
+
+	/* phase times are summed over all threads */
+	printf("Build statistics, %.3f ms wall time:\n", (double)wall_ns / 1000000.0);
+	for (i = 0; i < STATS_PHASE_COUNT; i++) {
+		printf("  %-14s %10llu calls %12.3f ms\n",
+		       stats_phase_name(i),
+		       (unsigned long long)stats.phase_calls[i],
+		       (double)stats.phase_ns[i] / 1000000.0);
+	}
+	for (i = 0; i < STATS_COUNTER_COUNT; i++) {
+		printf("  %-14s %10llu\n", stats_counter_name(i), (unsigned long long)stats.counters[i]);
+	}
+
+	if (BMEM_TRACKING_ENABLED) {
+		struct bmem_stats mem;
+		struct bmem_site  sites[STATS_MEMORY_SITES];
+		size_t            count;
+
+		bmem_get_stats(&mem);
+		printf("Memory, %llu bytes at peak, %llu live:\n",
+		       (unsigned long long)mem.peak_bytes,
+		       (unsigned long long)mem.live_bytes);
+
+		count = bmem_get_sites(sites, STATS_MEMORY_SITES);
+		for (i = 0; i < count; i++) {
+			printf("  %12llu bytes at peak %10llu allocs  %s:%d\n",
+			       (unsigned long long)sites[i].peak_bytes,
+			       (unsigned long long)sites[i].allocs,
+			       sites[i].file,
+			       sites[i].line);
+		}
+	}
+}
+
+/* nothing in the project file affects parsing yet, so any change to it
+ * conservatively invalidates the whole cache */
+static bool init_cache(struct cel_build_cache *cache, const char *cache_dir)
+{
+	char  *settings;
+	size_t size = 0;
+	bool   success;
+
+	settings = os_quick_read_utf8_file("Project.toml", &size);
+	success  = cel_build_cache_init(cache, cache_dir, settings ? settings : "", size);
+	bfree(settings);
+
+	if (!success) {
+		printf("Could not create cache directory '%s', building without a cache\n", cache_dir);
+	}
+	return success;
+}
+
 static bool build(int argc, char *argv[])
 {
-	toml_t *config;
-	char   *file_string;
-	char   *errors = NULL;
-	size_t  size;
-	int     err;
+	struct build_options   options;
+	struct cel_build_cache cache;
+	bool                   use_cache;
+	toml_t                *config;
+	char                  *errors = NULL;
+	uint64_t               start_ns;
+	int                    err;
+	bool                   success;
+
+	if (!parse_build_args(argc, argv, &options)) {
+		return false;
+	}
 
-	/*file_string = os_quick_read_utf8_file("../../other/test/font.celes", &size);
-	if (file_string) {
-		struct cel_parser parser = {0};
-		cel_parser_build_tree(&parser, file_string, size, "some dumb file");
-		cel_parser_free(&parser);
-	}*/
+	start_ns = os_gettime_ns();
 
-	err = toml_open(&config, "Project.toml", &errors);
+	/* only [Build] is read, so the rest of the file is never parsed */
+	err = toml_open_lazy(&config, "Project.toml", &errors);
 	if (err == TOML_FILE_NOT_FOUND) {
 		printf("Could not find file dingus\n");
 		return false;
@@ -31,26 +361,525 @@ static bool build(int argc, char *argv[])
 		return false;
 	}
 
-	const char *name = toml_get_string(config, "Build", "Name");
+	const char *name = toml_get_string_k(config, HASH_KEY("Build"), HASH_KEY("Name"));
+
+	errors = toml_get_errors(config);
+	if (errors) {
+		printf("Error parsing file:\n%s\n", errors);
+		bfree(errors);
+		toml_release(config);
+		return false;
+	}
+
 	if (!name) {
 		printf("No program name specified\n");
+		toml_release(config);
 		return false;
 	}
 
-	// find like, program.celes or something. I donno.
+	const char *source_dir = toml_get_string_k(config, HASH_KEY("Build"), HASH_KEY("SourceDir"));
+	if (!source_dir) {
+		source_dir = ".";
+	}
+
+	/* an empty CacheDir disables the cache */
+	const char *cache_dir = toml_get_string(config, "Build", "CacheDir");
+	if (!cache_dir) {
+		cache_dir = ".celes-cache";
+	}
+
+	use_cache = *cache_dir && init_cache(&cache, cache_dir);
+	success   = parse_sources(source_dir, use_cache ? &cache : NULL, options.num_threads);
+
+	if (use_cache) {
+		cel_build_cache_free(&cache);
+	}
+	toml_release(config);
+
+	if (options.stats != STATS_OUTPUT_NONE) {
+		print_stats(options.stats, os_gettime_ns() - start_ns);
+	}
+	return success;
+}
+
+/*
+ * Watch mode keeps every source's token tree, the identifiers interned from
+ * them and the project file in memory, and only reparses what the file watch
+ * reports, so rebuilds don't pay for startup or for files that didn't change.
+ */
+
+/* editors tend to save in several steps, so changes are left to settle for
+ * this long before rebuilding */
+#define WATCH_SETTLE_MS 10
+
+struct watch_file {
+	char             *path;
+	struct cel_parser parser;
+	bool              dirty;
+};
+
+struct watch_change {
+	char *path;
+	bool  removed;
+};
+
+struct watch_state {
+	DARRAY(struct watch_file) files; /* sorted by path, like a build */
+	DARRAY(struct watch_change) changes; /* in the order they were reported */
+	struct atom_table atoms;
+	toml_t           *config;
+
+	/* normalized the way find_sources builds paths, empty for ".", so it can
+	 * be compared with what the watch reports */
+	struct dstr source_dir;
+	bool        rescan;
+};
+
+static bool find_watch_file(struct watch_state *state, const char *path, size_t *idx)
+{
+	size_t lo = 0;
+	size_t hi = state->files.size;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		int    cmp = strcmp(state->files.array[mid].path, path);
+
+		if (cmp == 0) {
+			*idx = mid;
+			return true;
+		} else if (cmp < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	*idx = lo;
+	return false;
+}
+
+/* only new files are marked dirty here, known ones are reported by
+ * themselves when they change */
+static struct watch_file *add_watch_file(struct watch_state *state, const char *path)
+{
+	struct watch_file *file;
+	size_t             idx;
+
+	if (find_watch_file(state, path, &idx))
+		return &state->files.array[idx];
+
+	file        = da_insert_new(state->files, idx);
+	file->path  = bstrdup(path);
+	file->dirty = true;
+	return file;
+}
+
+static void free_watch_file(struct watch_file *file)
+{
+	cel_parser_free(&file->parser);
+	bfree(file->path);
+}
+
+/* drops the file, or everything in it if it was a directory */
+static void remove_watch_files(struct watch_state *state, const char *path)
+{
+	size_t len = strlen(path);
+	size_t i   = state->files.size;
+
+	while (i--) {
+		const char *file_path = state->files.array[i].path;
 
+		if (astrcmp_n(file_path, path, len) == 0 && (!file_path[len] || file_path[len] == '/')) {
+			free_watch_file(&state->files.array[i]);
+			da_erase(state->files, i);
+		}
+	}
+}
+
+static void scan_watch_dir(struct watch_state *state, const char *dir_path)
+{
+	struct build_state scan = {0};
+	struct dstr        path = {0};
+	size_t             i;
+
+	if (strcmp(dir_path, ".") != 0)
+		dstr_copy(&path, dir_path);
+	find_sources(&scan, dir_path, &path);
+	dstr_free(&path);
+
+	for (i = 0; i < scan.sources.size; i++) {
+		add_watch_file(state, scan.sources.array[i]);
+		bfree(scan.sources.array[i]);
+	}
+	da_free(scan.sources);
+}
+
+static void rescan_sources(struct watch_state *state)
+{
+	while (state->files.size) {
+		free_watch_file(da_end(state->files));
+		da_pop_back(state->files);
+	}
+
+	scan_watch_dir(state, state->source_dir.size ? state->source_dir.array : ".");
+	state->rescan = false;
+}
+
+static bool in_source_dir(struct watch_state *state, const char *path)
+{
+	size_t len = state->source_dir.size;
+	return !len || (astrcmp_n(path, state->source_dir.array, len) == 0 && (!path[len] || path[len] == '/'));
+}
+
+static bool load_watch_project(struct watch_state *state)
+{
+	struct dstr source_dir = {0};
+	const char *dir;
+	char       *text;
+	char       *errors = NULL;
+	size_t      size   = 0;
+
+	text = os_quick_read_utf8_file("Project.toml", &size);
+	if (!text) {
+		printf("Could not find file dingus\n");
+		return false;
+	}
+
+	/* reparsed in place, the old settings aren't needed past this */
+	toml_reparse(&state->config, text, size, "Project.toml", &errors);
+	bfree(text);
+
+	if (!state->config) {
+		if (errors) {
+			printf("Error parsing file:\n%s\n", errors);
+			bfree(errors);
+		}
+		return false;
+	}
+
+	if (!toml_get_string_k(state->config, HASH_KEY("Build"), HASH_KEY("Name"))) {
+		printf("No program name specified\n");
+		return false;
+	}
+
+	dir = toml_get_string_k(state->config, HASH_KEY("Build"), HASH_KEY("SourceDir"));
+	if (!dir) {
+		dir = ".";
+	}
+
+	while (dir[0] == '.' && dir[1] == '/')
+		dir += 2;
+	dstr_copy(&source_dir, strcmp(dir, ".") == 0 ? "" : dir);
+	while (source_dir.size && source_dir.array[source_dir.size - 1] == '/')
+		dstr_resize(&source_dir, source_dir.size - 1);
+
+	if (dstr_cmp(&state->source_dir, source_dir.array) != 0) {
+		if (*dir == '/' || astrcmp_n(dir, "..", 2) == 0 || strchr(dir, ':')) {
+			printf("SourceDir '%s' is outside the project directory, so changes to it won't be seen\n", dir);
+		}
+
+		dstr_move(&state->source_dir, &source_dir);
+		state->rescan = true;
+	}
+
+	dstr_free(&source_dir);
 	return true;
 }
 
+static void on_watch_change(void *param, const char *path, enum os_watch_action action)
+{
+	struct watch_state  *state  = param;
+	struct watch_change *change = da_push_back_new(state->changes);
+
+	change->path    = bstrdup(path);
+	change->removed = action == OS_WATCH_REMOVED;
+}
+
+static bool is_directory(const char *path)
+{
+	os_dir_t *dir = os_opendir(path);
+	os_closedir(dir);
+	return !!dir;
+}
+
+/* returns false if nothing that affects the build changed */
+static bool apply_watch_changes(struct watch_state *state)
+{
+	bool   changed = false;
+	size_t i;
+
+	for (i = 0; i < state->changes.size; i++) {
+		const char *path    = state->changes.array[i].path;
+		bool        removed = state->changes.array[i].removed;
+
+		/* the project file going away for a moment is usually an editor
+		 * replacing it, so the old settings are kept until it's back */
+		if (strcmp(path, "Project.toml") == 0) {
+			if (!removed) {
+				load_watch_project(state);
+				changed = true;
+			}
+
+		} else if (strcmp(path, ".") == 0) {
+			/* changes were lost, so nothing known can be trusted */
+			state->rescan = true;
+
+		} else if (!in_source_dir(state, path)) {
+			continue;
+
+		} else if (removed) {
+			remove_watch_files(state, path);
+			changed = true;
+
+		} else if (is_directory(path)) {
+			scan_watch_dir(state, path);
+			changed = true;
+
+		} else if (is_source_file(path)) {
+			add_watch_file(state, path)->dirty = true;
+			changed = true;
+		}
+	}
+
+	for (i = 0; i < state->changes.size; i++)
+		bfree(state->changes.array[i].path);
+	da_clear(state->changes);
+
+	if (state->rescan) {
+		rescan_sources(state);
+		changed = true;
+	}
+
+	return changed;
+}
+
+/* a save usually only changes one part of a file, so the text between the
+ * common start and end is handed to the parser as a single edit */
+static void edit_watch_file(struct watch_file *file, const char *text, size_t size)
+{
+	struct lexer *lexx   = &file->parser.lexx;
+	size_t        prefix = 0;
+	size_t        suffix = 0;
+
+	while (prefix < size && prefix < lexx->size && text[prefix] == lexx->text[prefix])
+		prefix++;
+	while (suffix < size - prefix && suffix < lexx->size - prefix &&
+	       text[size - suffix - 1] == lexx->text[lexx->size - suffix - 1])
+		suffix++;
+
+	if (prefix == size && size == lexx->size)
+		return;
+
+	cel_parser_edit(&file->parser, prefix, lexx->size - prefix - suffix, text + prefix, size - prefix - suffix,
+	                file->path);
+}
+
+/* read rather than mapped, since the trees are kept and editors may truncate
+ * a file while it's mapped */
+static void parse_watch_file(void *param, size_t worker_idx)
+{
+	struct watch_file *file = param;
+	FILE              *f;
+	char              *text;
+	size_t             size;
+
+	UNUSED_PARAMETER(worker_idx);
+
+	f = os_fopen(file->path, "rb");
+	if (!f) {
+		cel_parser_free(&file->parser);
+		error_data_add(&file->parser.error_list, file->path, 0, 0, "Could not open file", LEX_ERROR);
+		return;
+	}
+
+	size = os_fread_utf8(f, &text);
+	fclose(f);
+
+	/* os_fread_utf8 returns NULL for empty files as well, and an empty file
+	 * is just one with no tokens */
+	if (!text) {
+		text = bstrdup("");
+		size = 0;
+	}
+
+	if (file->parser.lexx.text) {
+		edit_watch_file(file, text, size);
+		bfree(text);
+	} else {
+		/* a failed read left its error in the list */
+		error_data_free(&file->parser.error_list);
+		cel_parser_build_tree(&file->parser, text, size, file->path);
+	}
+}
+
+/* the atom table isn't thread safe, so identifiers are interned on this
+ * thread once their files are parsed */
+static void intern_identifiers(struct cel_parser *parser, struct atom_table *atoms)
+{
+	size_t i;
+
+	da_resize(parser->token_atoms, parser->tokens.size);
+	for (i = 0; i < parser->tokens.size; i++) {
+		struct cel_token *token = &parser->tokens.array[i];
+		atom_t            atom  = ATOM_NONE;
+
+		if (token->type == CEL_TOKEN_IDENT)
+			atom = atom_intern_n(atoms, parser->lexx.text + token->offset, token->data);
+		parser->token_atoms.array[i] = atom;
+	}
+}
+
+static size_t parse_dirty_files(struct watch_state *state, struct job_pool *pool)
+{
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; i < state->files.size; i++) {
+		if (state->files.array[i].dirty) {
+			job_pool_push(pool, parse_watch_file, &state->files.array[i]);
+			count++;
+		}
+	}
+
+	job_pool_wait(pool);
+
+	for (i = 0; i < state->files.size; i++) {
+		struct watch_file *file = &state->files.array[i];
+
+		if (file->dirty) {
+			intern_identifiers(&file->parser, &state->atoms);
+			file->dirty = false;
+		}
+	}
+
+	return count;
+}
+
+/* every file's diagnostics are printed each time, not just those of the
+ * files that changed, so the output is always the state of the whole tree */
+static void print_watch_errors(struct watch_state *state)
+{
+	size_t i;
+
+	for (i = 0; i < state->files.size; i++) {
+		struct error_data *errors = &state->files.array[i].parser.error_list;
+
+		if (errors->errors.size) {
+			char *str = error_data_buildstring(errors);
+			printf("%s", str);
+			bfree(str);
+		}
+	}
+}
+
+static void free_watch_state(struct watch_state *state)
+{
+	size_t i;
+
+	for (i = 0; i < state->files.size; i++)
+		free_watch_file(&state->files.array[i]);
+	for (i = 0; i < state->changes.size; i++)
+		bfree(state->changes.array[i].path);
+	da_free(state->files);
+	da_free(state->changes);
+	atom_table_free(&state->atoms);
+	toml_release(state->config);
+	dstr_free(&state->source_dir);
+}
+
+static bool watch(int argc, char *argv[])
+{
+	struct build_options options;
+	struct watch_state   state = {0};
+	struct job_pool     *pool;
+	os_watch_t          *watcher;
+	uint64_t             start_ns;
+	size_t               count;
+
+	if (!parse_build_args(argc, argv, &options)) {
+		return false;
+	}
+
+	atom_table_init(&state.atoms);
+	if (!load_watch_project(&state)) {
+		free_watch_state(&state);
+		return false;
+	}
+
+	/* the project directory is watched rather than SourceDir, so changes
+	 * to Project.toml are seen as well */
+	watcher = os_watch_create(".");
+	if (!watcher) {
+		printf("Could not watch the project directory for changes\n");
+		free_watch_state(&state);
+		return false;
+	}
+
+	pool     = job_pool_create(options.num_threads);
+	start_ns = os_gettime_ns();
+
+	rescan_sources(&state);
+	count = parse_dirty_files(&state, pool);
+	print_watch_errors(&state);
+	printf("Built %zu files in %.3f ms, watching for changes\n", count, (double)(os_gettime_ns() - start_ns) / 1000000.0);
+	fflush(stdout);
+
+	for (;;) {
+		int changes = os_watch_wait(watcher, UINT32_MAX, on_watch_change, &state);
+		if (changes < 0) {
+			printf("Lost track of changes to the project directory\n");
+			break;
+		} else if (!changes) {
+			continue;
+		}
+
+		while (os_watch_wait(watcher, WATCH_SETTLE_MS, on_watch_change, &state) > 0)
+			;
+
+		/* the statistics cover one rebuild, like the time next to them.
+		 * the workers are idle in between, so nothing is adding to them */
+		stats_reset();
+		start_ns = os_gettime_ns();
+		if (!apply_watch_changes(&state)) {
+			continue;
+		}
+
+		count = parse_dirty_files(&state, pool);
+		print_watch_errors(&state);
+		printf("Rebuilt %zu of %zu files in %.3f ms\n",
+		       count,
+		       state.files.size,
+		       (double)(os_gettime_ns() - start_ns) / 1000000.0);
+
+		if (options.stats != STATS_OUTPUT_NONE) {
+			print_stats(options.stats, os_gettime_ns() - start_ns);
+		}
+		fflush(stdout);
+	}
+
+	job_pool_destroy(pool);
+	os_watch_destroy(watcher);
+	free_watch_state(&state);
+	return false;
+}
+
 int main(int argc, char *argv[])
 {
 	if (argc < 2) {
-		printf("Celes transpiler\n\nUse: celes [command]\n\nCommands:\n\tbuild   build stuff\n");
+		printf("Celes transpiler\n\nUse: celes [command]\n\nCommands:\n"
+		       "\tbuild [-j N] [--stats[=json]]\n"
+		       "\t               build stuff, parsing sources on N threads (default: one per core),\n"
+		       "\t               and print where the time went\n"
+		       "\twatch [-j N] [--stats[=json]]\n"
+		       "\t               build, then keep everything in memory and rebuild only\n"
+		       "\t               what changes until interrupted\n");
 		return 0;
 	}
 
 	if (astrcmpi(argv[1], "build") == 0) {
 		return build(argc, argv) ? 0 : -1;
+	} else if (astrcmpi(argv[1], "watch") == 0) {
+		return watch(argc, argv) ? 0 : -1;
 	}
 
 	printf("You appear to have entered something that celes does not appear to understand. "
@@ -0,0 +1,126 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * A main for the fuzz targets when they aren't built with libFuzzer.  Runs the
+ * target once on each file named on the command line, on every file in each
+ * directory, or on stdin if there are no arguments.  That's enough to replay
+ * a corpus or a crash, and to fuzz with AFL:
+ *
+ *   afl-fuzz -i fuzz/corpus -o findings -- ./fuzz-parser @@
+ */
+
+#include <util/bmem.h>
+#include <util/dstr.h>
+#include <util/platform.h>
+
+#include "fuzz.h"
+
+static uint8_t *read_all(FILE *file, size_t *size)
+{
+	uint8_t *data     = NULL;
+	size_t   capacity = 0;
+
+	*size = 0;
+	for (;;) {
+		size_t read;
+
+		if (*size == capacity) {
+			capacity = capacity ? capacity * 2 : 4096;
+			data     = brealloc(data, capacity);
+		}
+
+		read = fread(data + *size, 1, capacity - *size, file);
+		if (!read)
+			break;
+		*size += read;
+	}
+
+	return data;
+}
+
+static bool run_file(const char *path)
+{
+	FILE    *file = os_fopen(path, "rb");
+	uint8_t *data;
+	size_t   size;
+
+	if (!file) {
+		fprintf(stderr, "could not open %s\n", path);
+		return false;
+	}
+
+	data = read_all(file, &size);
+	fclose(file);
+
+	LLVMFuzzerTestOneInput(data, size);
+	bfree(data);
+	return true;
+}
+
+/* returns the number of files run, or -1 if the directory couldn't be opened */
+static long run_dir(const char *path)
+{
+	os_dir_t         *dir = os_opendir(path);
+	struct os_dirent *ent;
+	struct dstr       file_path = {0};
+	long              count     = 0;
+
+	if (!dir)
+		return -1;
+
+	while ((ent = os_readdir(dir)) != NULL) {
+		if (ent->directory)
+			continue;
+
+		dstr_printf(&file_path, "%s/%s", path, ent->d_name);
+		if (run_file(file_path.array))
+			count++;
+	}
+
+	os_closedir(dir);
+	dstr_free(&file_path);
+	return count;
+}
+
+int main(int argc, char *argv[])
+{
+	long count = 0;
+	int  i;
+
+	if (argc < 2) {
+		size_t   size;
+		uint8_t *data = read_all(stdin, &size);
+
+		LLVMFuzzerTestOneInput(data, size);
+		bfree(data);
+		return 0;
+	}
+
+	for (i = 1; i < argc; i++) {
+		long dir_count = run_dir(argv[i]);
+
+		if (dir_count >= 0)
+			count += dir_count;
+		else if (run_file(argv[i]))
+			count++;
+		else
+			return 1;
+	}
+
+	printf("ran %ld inputs\n", count);
+	return 0;
+}
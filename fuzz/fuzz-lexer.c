@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <util/bmem.h>
+#include <util/lexer.h>
+
+#include "fuzz.h"
+
+/* every token has to be within the text and follow the one before it, and
+ * a peek has to return the same token as the get after it */
+static void lex_all(struct lexer *lexx, enum ignore_whitespace iws, bool peek)
+{
+	struct base_token token;
+	struct base_token peeked;
+	const char       *end  = lexx->text + lexx->size;
+	const char       *last = lexx->text;
+
+	base_token_clear(&token);
+	base_token_clear(&peeked);
+	lexer_reset(lexx);
+
+	for (;;) {
+		bool peek_result = peek && lexer_peek_token(lexx, &peeked, iws);
+
+		if (!lexer_get_token(lexx, &token, iws)) {
+			FUZZ_CHECK(!peek_result);
+			break;
+		}
+
+		FUZZ_CHECK(token.text.array >= last);
+		FUZZ_CHECK(token.text.size > 0);
+		FUZZ_CHECK(token.text.array + token.text.size <= end);
+		if (peek) {
+			FUZZ_CHECK(peek_result);
+			FUZZ_CHECK(peeked.text.array == token.text.array);
+			FUZZ_CHECK(peeked.text.size == token.text.size);
+			FUZZ_CHECK(peeked.type == token.type);
+		}
+
+		last = token.text.array + token.text.size;
+	}
+}
+
+/* lexes the input every way the parsers do: with and without whitespace,
+ * peeking or not, and before and after the text is known to be valid UTF-8 */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct lexer lexx;
+	size_t       error_offset;
+
+	lexer_init(&lexx);
+	lexer_start_move(&lexx, bstrdup_n((const char *)data, size), size);
+
+	lex_all(&lexx, PARSE_WHITESPACE, false);
+	lex_all(&lexx, IGNORE_WHITESPACE, true);
+
+	if (lexer_validate_utf8(&lexx, &error_offset)) {
+		lex_all(&lexx, PARSE_WHITESPACE, true);
+		lex_all(&lexx, IGNORE_WHITESPACE, false);
+	} else {
+		FUZZ_CHECK(error_offset < size);
+	}
+
+	lexer_free(&lexx);
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include <celes-parser.h>
+#include <util/bmem.h>
+
+#include "fuzz.h"
+
+/* the pieces that change how things nest, same as parser_test_edit */
+static const char *const snippets[] = {
+        "x", " ", "1.5", "_y", "{", "}", "(", ")", "[", "]", "'", "\"", "\\", "//", "/*", "*/", "\n", ",",
+};
+
+#define EDITS 8
+
+static void check_tree(struct cel_parser *parser)
+{
+	size_t i;
+
+	for (i = 0; i < parser->tokens.size; i++) {
+		const struct cel_token *token = parser->tokens.array + i;
+
+		FUZZ_CHECK(token->offset + cel_token_size(parser, token) <= parser->lexx.size);
+		FUZZ_CHECK(cel_token_next_sibling(parser, i) <= parser->tokens.size);
+		FUZZ_CHECK(token->type != CEL_TOKEN_NONE);
+	}
+}
+
+/* an edited tree has to be the same as a tree built from the edited text */
+static void check_same_tree(struct cel_parser *parser)
+{
+	struct cel_parser fresh = {0};
+	size_t            i;
+
+	cel_parser_build_tree(&fresh, bstrdup_n(parser->lexx.text, parser->lexx.size), parser->lexx.size, "fuzz");
+
+	FUZZ_CHECK(parser->error_list.errors.size == fresh.error_list.errors.size);
+	FUZZ_CHECK(parser->tokens.size == fresh.tokens.size);
+	for (i = 0; i < fresh.tokens.size; i++) {
+		const struct cel_token *a = parser->tokens.array + i;
+		const struct cel_token *b = fresh.tokens.array + i;
+
+		FUZZ_CHECK(a->type == b->type);
+		FUZZ_CHECK(a->offset == b->offset);
+		FUZZ_CHECK(cel_token_size(parser, a) == cel_token_size(&fresh, b));
+		FUZZ_CHECK(cel_token_subtree_size(parser, a) == cel_token_subtree_size(&fresh, b));
+		FUZZ_CHECK(a->passed_whitespace == b->passed_whitespace);
+	}
+
+	cel_parser_free(&fresh);
+}
+
+/*
+ * Builds the tree, then makes a few edits to it and checks each against a
+ * tree built from scratch.  The edits are picked by a seed made from the
+ * input itself rather than from bytes taken off it, so the same corpus works
+ * for the other targets and every input always gets the same edits.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	struct cel_parser parser = {0};
+	uint32_t          seed   = 2166136261U;
+	size_t            i;
+
+	for (i = 0; i < size; i++)
+		seed = (seed ^ data[i]) * 16777619U;
+
+	cel_parser_build_tree(&parser, bstrdup_n((const char *)data, size), size, "fuzz");
+	check_tree(&parser);
+
+	for (i = 0; i < EDITS; i++) {
+		const char *snippet;
+		size_t      offset;
+		size_t      remove;
+
+		seed    = seed * 1103515245 + 12345;
+		snippet = snippets[(seed >> 16) % (sizeof(snippets) / sizeof(snippets[0]))];
+		seed    = seed * 1103515245 + 12345;
+		offset  = (seed >> 16) % (parser.lexx.size + 1);
+		seed    = seed * 1103515245 + 12345;
+		remove  = (seed >> 16) % 4;
+		if (remove > parser.lexx.size - offset)
+			remove = parser.lexx.size - offset;
+
+		cel_parser_edit(&parser, offset, remove, snippet, strlen(snippet), "fuzz");
+		check_tree(&parser);
+		check_same_tree(&parser);
+	}
+
+	cel_parser_free(&parser);
+	return 0;
+}
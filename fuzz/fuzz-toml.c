@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <util/bmem.h>
+#include <util/toml.h>
+
+#include "fuzz.h"
+
+static size_t walk_table(toml_t *table);
+
+/* reads every value the way a caller would, returns how many there were */
+static size_t walk_value(toml_value_t *value)
+{
+	toml_array_t *array;
+	size_t        count = 1;
+	size_t        i;
+
+	switch (toml_value_get_type(value)) {
+	case TOML_TYPE_STRING:
+		FUZZ_CHECK(toml_value_get_string(value) != NULL);
+		break;
+	case TOML_TYPE_INTEGER:
+		toml_value_get_int(value);
+		break;
+	case TOML_TYPE_REAL:
+		toml_value_get_double(value);
+		break;
+	case TOML_TYPE_BOOLEAN:
+		toml_value_get_bool(value);
+		break;
+	case TOML_TYPE_TABLE:
+		count += walk_table(toml_value_get_table(value));
+		break;
+	case TOML_TYPE_ARRAY:
+		array = toml_value_get_array(value);
+		for (i = 0; i < toml_array_count(array); i++)
+			count += walk_value(toml_array_get_value(array, i));
+		break;
+	default:
+		FUZZ_CHECK(!"invalid value type");
+	}
+
+	return count;
+}
+
+static size_t walk_table(toml_t *table)
+{
+	size_t count = 0;
+	size_t i;
+
+	for (i = 0; i < toml_table_get_pair_count(table); i++) {
+		struct toml_pair pair = toml_table_get_pair(table, i);
+
+		FUZZ_CHECK(pair.key != NULL);
+		FUZZ_CHECK(toml_table_get_value(table, pair.key) == pair.value);
+		count += walk_value(pair.value);
+	}
+
+	return count;
+}
+
+static bool count_event(void *param, const struct toml_event *event)
+{
+	size_t *count = param;
+
+	FUZZ_CHECK(event->path_size > 0);
+	(*count)++;
+	return true;
+}
+
+/*
+ * Parses the input into a document and reads all of it, then parses it again
+ * into the same document, which has to come out the same.  The streaming
+ * parser has to accept anything the full parser does; it can accept more,
+ * since it doesn't check for duplicate keys.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	const char *text   = (const char *)data;
+	toml_t     *toml   = NULL;
+	char       *errors = NULL;
+	size_t      events = 0;
+	size_t      count;
+	int         result;
+	int         stream_result;
+
+	result = toml_parse_buffer(&toml, text, size, "fuzz", &errors);
+	FUZZ_CHECK(result == TOML_SUCCESS || result == TOML_ERROR);
+	FUZZ_CHECK((result == TOML_SUCCESS) == (toml != NULL));
+	bfree(errors);
+	errors = NULL;
+
+	stream_result = toml_parse_stream_string(text, size, count_event, &events, NULL);
+	if (result != TOML_SUCCESS)
+		return 0;
+
+	FUZZ_CHECK(stream_result == TOML_SUCCESS);
+
+	count = walk_table(toml);
+
+	result = toml_reparse(&toml, text, size, "fuzz", &errors);
+	FUZZ_CHECK(result == TOML_SUCCESS && toml != NULL);
+	FUZZ_CHECK(walk_table(toml) == count);
+	bfree(errors);
+
+	toml_release(toml);
+	return 0;
+}
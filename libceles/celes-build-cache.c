@@ -0,0 +1,207 @@
+#include "celes-build-cache.h"
+#include "celes-tree-file.h"
+#include "util/threading.h"
+#include "util/platform.h"
+#include "util/bmem.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+/* entries are token tree files, see celes-tree-file.h.  atoms are specific to
+ * one atom table, so they aren't stored */
+
+static volatile long temp_counter = 0;
+
+static void get_entry_path(const struct cel_build_cache *cache, const struct cel_cache_key *key, struct dstr *path)
+{
+	char hex[SHA256_HEX_SIZE];
+
+	sha256_to_hex(key->digest, hex);
+	dstr_copy_dstr(path, &cache->dir);
+	dstr_cat_ch(path, '/');
+	dstr_cat(path, hex);
+	dstr_cat(path, ".celt");
+}
+
+static bool open_entry(const struct cel_build_cache *cache, const struct cel_cache_key *key, struct cel_tree_view *view)
+{
+	struct dstr path = {0};
+	bool        success;
+
+	get_entry_path(cache, key, &path);
+	success = cel_tree_view_open(view, path.array);
+	dstr_free(&path);
+	return success;
+}
+
+bool cel_build_cache_init(struct cel_build_cache *cache, const char *dir, const void *settings, size_t size)
+{
+	memset(cache, 0, sizeof(*cache));
+
+	if (!dir || !*dir || os_mkdirs(dir) == MKDIR_ERROR)
+		return false;
+
+	dstr_copy(&cache->dir, dir);
+	sha256(settings, size, cache->settings_hash);
+	return true;
+}
+
+void cel_build_cache_free(struct cel_build_cache *cache)
+{
+	dstr_free(&cache->dir);
+	memset(cache, 0, sizeof(*cache));
+}
+
+void cel_build_cache_key(const struct cel_build_cache *cache,
+                         const char                   *source,
+                         size_t                        size,
+                         struct cel_cache_key         *key)
+{
+	struct sha256_ctx ctx;
+	uint16_t          version = CEL_TREE_VERSION_MAJOR;
+
+	/* the format version is part of the key too, so entries written by
+	 * other versions are simply never found */
+	sha256_init(&ctx);
+	sha256_update(&ctx, &version, sizeof(version));
+	sha256_update(&ctx, cache->settings_hash, sizeof(cache->settings_hash));
+	sha256_update(&ctx, source, size);
+	sha256_final(&ctx, key->digest);
+}
+
+bool cel_build_cache_has(const struct cel_build_cache *cache, const struct cel_cache_key *key)
+{
+	struct cel_tree_view view;
+
+	if (open_entry(cache, key, &view)) {
+		cel_tree_view_free(&view);
+		return true;
+	}
+
+	return false;
+}
+
+bool cel_build_cache_store(const struct cel_build_cache *cache,
+                           const struct cel_cache_key   *key,
+                           const struct cel_parser      *parser)
+{
+	struct dstr path      = {0};
+	struct dstr temp_path = {0};
+	bool        success   = false;
+	uint8_t    *data;
+	size_t      size;
+	FILE       *file;
+
+	/* entries are shared by every file with the same text, so they carry
+	 * no name */
+	data = cel_tree_serialize(parser, NULL, &size);
+
+	/* unique among threads by the counter, and among processes by time */
+	get_entry_path(cache, key, &path);
+	dstr_printf(&temp_path,
+	            "%s.%llx-%lx.tmp",
+	            path.array,
+	            (unsigned long long)os_gettime_ns(),
+	            (unsigned long)os_atomic_inc_long(&temp_counter));
+
+	file = os_fopen(temp_path.array, "wb");
+	if (file) {
+		success = fwrite(data, 1, size, file) == size;
+		success = fclose(file) == 0 && success;
+		success = success && os_rename(temp_path.array, path.array);
+		if (!success)
+			os_unlink(temp_path.array);
+	}
+
+	dstr_free(&temp_path);
+	dstr_free(&path);
+	bfree(data);
+	return success;
+}
+
+bool cel_build_cache_load(const struct cel_build_cache *cache,
+                          const struct cel_cache_key   *key,
+                          struct cel_parser            *parser)
+{
+	struct cel_tree_view view;
+
+	if (!open_entry(cache, key, &view))
+		return false;
+
+	cel_tree_view_load(&view, parser);
+	cel_tree_view_free(&view);
+	return true;
+}
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+void build_cache_test_store_load(void **state)
+{
+	struct cel_build_cache cache;
+	struct cel_cache_key   key;
+	struct cel_cache_key   other_key;
+	struct cel_parser      parser = {0};
+	struct cel_parser      loaded = {0};
+	struct dstr            path   = {0};
+	const char            *dir    = "build-cache-test/entries";
+	const char            *text   = "a { b(c, 1.5) } 'str' d";
+	size_t                 i;
+
+	assert_false(cel_build_cache_init(&cache, "", "", 0));
+	assert_true(cel_build_cache_init(&cache, dir, "settings", 8));
+
+	cel_build_cache_key(&cache, text, strlen(text), &key);
+	cel_build_cache_key(&cache, text, strlen(text) - 1, &other_key);
+	assert_true(memcmp(key.digest, other_key.digest, SHA256_SIZE) != 0);
+
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+	assert_true(parser.tokens.size > 0);
+
+	assert_false(cel_build_cache_has(&cache, &key));
+	assert_false(cel_build_cache_load(&cache, &key, &loaded));
+	assert_true(cel_build_cache_store(&cache, &key, &parser));
+	assert_true(cel_build_cache_has(&cache, &key));
+	assert_false(cel_build_cache_has(&cache, &other_key));
+
+	/* storing again just replaces the entry */
+	assert_true(cel_build_cache_store(&cache, &key, &parser));
+
+	assert_true(cel_build_cache_load(&cache, &key, &loaded));
+	assert_int_equal(loaded.tokens.size, parser.tokens.size);
+	for (i = 0; i < parser.tokens.size; i++) {
+		const struct cel_token *a = parser.tokens.array + i;
+		const struct cel_token *b = loaded.tokens.array + i;
+
+		assert_int_equal(a->type, b->type);
+		assert_int_equal(a->offset, b->offset);
+		assert_int_equal(a->data, b->data);
+		assert_int_equal(cel_token_size(&parser, a), cel_token_size(&loaded, b));
+		assert_int_equal(cel_token_subtree_size(&parser, a), cel_token_subtree_size(&loaded, b));
+		assert_int_equal(a->passed_whitespace, b->passed_whitespace);
+	}
+
+	/* different settings never see the entry */
+	cel_build_cache_free(&cache);
+	assert_true(cel_build_cache_init(&cache, dir, "settings2", 9));
+	cel_build_cache_key(&cache, text, strlen(text), &other_key);
+	assert_false(cel_build_cache_has(&cache, &other_key));
+
+	get_entry_path(&cache, &key, &path);
+	assert_true(os_unlink(path.array));
+	dstr_free(&path);
+	assert_true(os_rmdir(dir));
+	assert_true(os_rmdir("build-cache-test"));
+
+	cel_parser_free(&loaded);
+	cel_parser_free(&parser);
+	cel_build_cache_free(&cache);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "celes-parser.h"
+#include "util/dstr.h"
+#include "util/sha256.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Persistent cache of parse output.  Entries are keyed on the SHA-256 of the
+ * build settings and the source text, so an entry can only ever be found for
+ * the exact input it was made from and nothing ever has to be invalidated.
+ * Stale entries are just never looked up again.
+ *
+ * Entries are written to a temporary file and renamed into place, so
+ * concurrent builds sharing a cache never see a partial entry.
+ */
+
+struct cel_build_cache {
+	struct dstr dir;
+	uint8_t     settings_hash[SHA256_SIZE];
+};
+
+struct cel_cache_key {
+	uint8_t digest[SHA256_SIZE];
+};
+
+/* settings are whatever besides the source text affects the parse output.
+ * creates the directory if it doesn't exist yet */
+EXPORT bool cel_build_cache_init(struct cel_build_cache *cache, const char *dir, const void *settings, size_t size);
+EXPORT void cel_build_cache_free(struct cel_build_cache *cache);
+
+EXPORT void cel_build_cache_key(const struct cel_build_cache *cache,
+                                const char                   *source,
+                                size_t                        size,
+                                struct cel_cache_key         *key);
+
+EXPORT bool cel_build_cache_has(const struct cel_build_cache *cache, const struct cel_cache_key *key);
+EXPORT bool cel_build_cache_store(const struct cel_build_cache *cache,
+                                  const struct cel_cache_key   *key,
+                                  const struct cel_parser      *parser);
+
+/* replaces the parser's tokens with the cached ones.  the source text isn't
+ * part of the entry, so start the lexer on it to get at token text */
+EXPORT bool cel_build_cache_load(const struct cel_build_cache *cache,
+                                 const struct cel_cache_key   *key,
+                                 struct cel_parser            *parser);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,289 +1,448 @@
 #include "celes-parser.h"
 
 #include "util/lexer.h"
+#include "util/stats.h"
 
-static void cel_token_free(struct cel_token *token)
-{
-	size_t i;
-	for (i = 0; i < token->tokens.size; i++)
-		cel_token_free(&token->tokens.array[i]);
-	da_free(token->tokens);
-}
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
 
 void cel_parser_free(struct cel_parser *parser)
 {
-	size_t i;
-
 	lexer_free(&parser->lexx);
 	error_data_free(&parser->error_list);
-	for (i = 0; i < parser->tokens.size; i++)
-		cel_token_free(&parser->tokens.array[i]);
-	da_free(parser->tokens);
+	if (!parser->arena) {
+		da_free(parser->tokens);
+		da_free(parser->blocks);
+		da_free(parser->token_atoms);
+		da_free(parser->open_blocks);
+	}
 	memset(parser, 0, sizeof(*parser));
 }
 
-static bool get_ident(struct lexer *lexx, struct cel_token *token)
+static void add_error(struct cel_parser *parser, size_t offset, const char *msg)
 {
-	struct base_token bt = {0};
+	uint32_t row;
+	uint32_t col;
 
-	token->type = CEL_TOKEN_IDENT;
+	lexer_get_position(&parser->lexx, parser->lexx.text + offset, &row, &col);
+	error_data_add(&parser->error_list, parser->file_name, row, col, msg, LEX_ERROR);
+}
+
+/* grows an array from the arena so da_push_back_new never has to */
+static inline void reserve_from_arena(struct barena *arena, struct darray *da, size_t element_size)
+{
+	if (arena && da->size == da->capacity) {
+		size_t old_cap = da->capacity;
+		size_t new_cap = old_cap ? old_cap * 2 : 256;
+
+		da->array    = barena_realloc(arena, da->array, old_cap * element_size, new_cap * element_size);
+		da->capacity = new_cap;
+	}
+}
+
+/* the size shares its word with the type, so the rare token that doesn't
+ * fit is cut short and reported */
+static void set_token_size(struct cel_parser *parser, struct cel_token *token, size_t size)
+{
+	if (size > CEL_TOKEN_MAX_SIZE) {
+		add_error(parser, token->offset, "Token is too long");
+		size = CEL_TOKEN_MAX_SIZE;
+	}
+
+	token->data = (uint32_t)size;
+}
+
+static struct cel_token *push_token(struct cel_parser       *parser,
+                                    enum cel_token_type      type,
+                                    const struct base_token *bt,
+                                    size_t                  *p_idx)
+{
+	struct cel_token *token;
+
+	if (p_idx) {
+		*p_idx = parser->tokens.size;
+	}
+
+	/* token_atoms is kept in step once there's an atom table, or once an
+	 * edit is made to a tree that had its atoms filled in */
+	if (parser->atoms || parser->token_atoms.size) {
+		reserve_from_arena(parser->arena, (struct darray *)&parser->token_atoms, sizeof(atom_t));
+		*(atom_t *)da_push_back_new(parser->token_atoms) = ATOM_NONE;
+	}
+
+	reserve_from_arena(parser->arena, (struct darray *)&parser->tokens, sizeof(struct cel_token));
+	token                    = da_push_back_new(parser->tokens);
+	token->type              = type;
+	token->offset            = (uint32_t)(bt->text.array - parser->lexx.text);
+	token->passed_whitespace = bt->passed_whitespace;
+
+	if (type == CEL_TOKEN_BLOCK) {
+		struct cel_block *block;
+
+		reserve_from_arena(parser->arena, (struct darray *)&parser->blocks, sizeof(struct cel_block));
+		block               = da_push_back_new(parser->blocks);
+		block->size         = (uint32_t)bt->text.size;
+		block->subtree_size = 0;
+		token->data         = (uint32_t)(parser->blocks.size - 1);
+	} else {
+		/* set once the whole token has been read */
+		token->data = 0;
+	}
+
+	return token;
+}
+
+/* only ever a block's closing delimiter, which isn't a block itself */
+static void pop_token(struct cel_parser *parser)
+{
+	parser->tokens.size--;
+	if (parser->token_atoms.size)
+		parser->token_atoms.size--;
+}
+
+static bool get_ident(struct cel_parser *parser, size_t *p_idx)
+{
+	struct lexer     *lexx  = &parser->lexx;
+	struct cel_token *token = NULL;
+	struct base_token bt    = {0};
+	size_t            size  = 0;
 
 	while (lexer_peek_token(lexx, &bt, IGNORE_WHITESPACE)) {
 
 		if (bt.type != BASE_TOKEN_ALPHA && bt.type != BASE_TOKEN_DIGIT && *bt.text.array != '_') {
-			return true;
+			break;
 		}
 
-		if (!token->text.array) {
-			token->text              = bt.text;
-			token->row               = bt.row;
-			token->col               = bt.col;
-			token->passed_whitespace = bt.passed_whitespace;
-		} else {
-			if (bt.passed_whitespace) {
-				return true;
-			}
-			token->text.size += bt.text.size;
+		if (!token) {
+			token = push_token(parser, CEL_TOKEN_IDENT, &bt, p_idx);
+		} else if (bt.passed_whitespace) {
+			break;
 		}
+		size += bt.text.size;
 
 		lexer_get_token(lexx, NULL, IGNORE_WHITESPACE);
 	}
 
-	return false;
+	if (!token) {
+		return false;
+	}
+
+	set_token_size(parser, token, size);
+	if (parser->atoms) {
+		size_t idx = token - parser->tokens.array;
+
+		parser->token_atoms.array[idx] = atom_intern_n(parser->atoms, lexx->text + token->offset, token->data);
+	}
+
+	return true;
 }
 
-static bool get_number(struct lexer *lexx, struct cel_token *token)
+static bool get_number(struct cel_parser *parser, size_t *p_idx)
 {
+	struct lexer     *lexx          = &parser->lexx;
+	struct cel_token *token         = NULL;
 	struct base_token bt            = {0};
 	bool              found_decimal = false;
-
-	token->type = CEL_TOKEN_NUMBER;
+	size_t            size          = 0;
 
 	while (lexer_peek_token(lexx, &bt, IGNORE_WHITESPACE)) {
 		if (bt.type != BASE_TOKEN_ALPHA && bt.type != BASE_TOKEN_DIGIT && *bt.text.array != '_') {
 			if (!found_decimal && *bt.text.array == '.') {
 				found_decimal = true;
 			} else {
-				return true;
+				break;
 			}
 		}
 
-		if (!token->text.array) {
-			token->text              = bt.text;
-			token->row               = bt.row;
-			token->col               = bt.col;
-			token->passed_whitespace = bt.passed_whitespace;
-		} else {
-			if (bt.passed_whitespace) {
-				return true;
-			}
-			token->text.size += bt.text.size;
+		if (!token) {
+			token = push_token(parser, CEL_TOKEN_NUMBER, &bt, p_idx);
+		} else if (bt.passed_whitespace) {
+			break;
 		}
+		size += bt.text.size;
 
 		lexer_get_token(lexx, NULL, IGNORE_WHITESPACE);
 	}
 
-	return false;
+	if (token) {
+		set_token_size(parser, token, size);
+	}
+
+	return !!token;
 }
 
-static bool get_token(struct lexer *lexx, struct cel_token *token);
+static inline char block_delimiter(char open)
+{
+	if (open == '{') {
+		return '}';
+	} else if (open == '[') {
+		return ']';
+	}
+	return ')';
+}
 
-static bool get_block(struct lexer *lexx, struct cel_token *token)
+/* pushes a block's token and opens it.  its children are the tokens read
+ * after it, until one of them is its closing delimiter.  depth is how many
+ * blocks are open besides the ones on open_blocks */
+static bool open_block(struct cel_parser *parser, size_t *p_idx, size_t depth)
 {
-	struct cel_token  sub_token = {0};
+	struct lexer     *lexx      = &parser->lexx;
 	struct base_token bt        = {0};
+	size_t            max_depth = parser->max_depth ? parser->max_depth : CEL_DEFAULT_MAX_DEPTH;
 
 	lexer_get_token(lexx, &bt, IGNORE_WHITESPACE);
-	token->passed_whitespace = bt.passed_whitespace;
-	token->text              = bt.text;
-	token->row               = bt.row;
-	token->col               = bt.col;
-	token->type              = CEL_TOKEN_BLOCK;
-
-	char delimiter = *bt.text.array;
-	if (delimiter == '{') {
-		delimiter = '}';
-	} else if (delimiter == '[') {
-		delimiter = ']';
-	} else {
-		delimiter = ')';
+	if (parser->blocks.size == CEL_MAX_BLOCKS) {
+		add_error(parser, bt.text.array - lexx->text, "Too many blocks");
+		return false;
 	}
-
-	while (get_token(lexx, &sub_token)) {
-		token->text.size = sub_token.text.array - token->text.array + sub_token.text.size;
-
-		if (*sub_token.text.array == delimiter) {
-			return true;
-		}
-
-		da_push_back(token->tokens, &sub_token);
-		memset(&sub_token, 0, sizeof(sub_token));
+	if (depth + parser->open_blocks.size >= max_depth) {
+		add_error(parser, bt.text.array - lexx->text, "Blocks are nested too deeply");
+		return false;
 	}
 
-	return false;
+	push_token(parser, CEL_TOKEN_BLOCK, &bt, p_idx);
+
+	reserve_from_arena(parser->arena, (struct darray *)&parser->open_blocks, sizeof(size_t));
+	da_push_back(parser->open_blocks, p_idx);
+	return true;
 }
 
-static bool get_string(struct lexer *lexx, struct cel_token *token)
+static bool get_string(struct cel_parser *parser, size_t *p_idx)
 {
+	struct lexer     *lexx = &parser->lexx;
+	struct cel_token *token;
 	struct base_token bt = {0};
 
 	lexer_get_token(lexx, &bt, IGNORE_WHITESPACE);
-	token->text              = bt.text;
-	token->type              = CEL_TOKEN_STRING;
-	token->row               = bt.row;
-	token->col               = bt.col;
-	token->passed_whitespace = bt.passed_whitespace;
+	token = push_token(parser, CEL_TOKEN_STRING, &bt, p_idx);
 
-	char delimiter = *bt.text.array;
+	const char stops[] = {*bt.text.array, '\\', 0};
+	bool       success = false;
 
-	while (lexer_get_token(lexx, &bt, PARSE_WHITESPACE)) {
-		token->text.size += bt.text.size;
-
-		if (*bt.text.array == delimiter) {
-			return true;
+	while (lexer_skip_to_any(lexx, stops)) {
+		bool escape = *lexx->offset == '\\';
 
-		} else if (*bt.text.array == '\\') {
-			if (!lexer_get_token(lexx, &bt, PARSE_WHITESPACE)) {
-				return false;
-			}
+		lexer_skip_to(lexx, lexx->offset + 1);
+		if (!escape) {
+			success = true;
+			break;
+		}
 
-			/* ignore potential delimiters */
-			token->text.size += bt.text.size;
+		/* ignore potential delimiters */
+		if (!lexer_skip_char(lexx)) {
+			break;
 		}
 	}
 
-	return false;
+	set_token_size(parser, token, lexx->offset - bt.text.array);
+	return success;
 }
 
-static bool get_other(struct lexer *lexx, struct cel_token *token)
+static bool get_other(struct cel_parser *parser, size_t *p_idx)
 {
 	struct base_token bt = {0};
 
-	token->type = CEL_TOKEN_OTHER;
-
-	if (lexer_get_token(lexx, &bt, IGNORE_WHITESPACE)) {
-		token->text              = bt.text;
-		token->row               = bt.row;
-		token->col               = bt.col;
-		token->passed_whitespace = bt.passed_whitespace;
+	if (lexer_get_token(&parser->lexx, &bt, IGNORE_WHITESPACE)) {
+		set_token_size(parser, push_token(parser, CEL_TOKEN_OTHER, &bt, p_idx), bt.text.size);
 		return true;
 	}
 
 	return false;
 }
 
-static bool parse_single_line_comment_then_get_token(struct lexer *lexx, struct cel_token *token)
+static bool skip_single_line_comment(struct lexer *lexx)
 {
-	struct base_token bt = {0};
-
 	/* We have already tested for and know the first two character */
 	lexer_get_token(lexx, NULL, IGNORE_WHITESPACE); // '/'
 	lexer_get_token(lexx, NULL, IGNORE_WHITESPACE); // '/'
 
-	while (lexer_get_token(lexx, &bt, PARSE_WHITESPACE)) {
-		if (bt.type == BASE_TOKEN_WHITESPACE && bt.ws_type == WHITESPACE_TYPE_NEWLINE) {
-			return get_token(lexx, token);
-		}
-	}
-
-	return false;
+	return lexer_skip_line(lexx);
 }
 
-static bool parse_mutli_line_comment_recurse(struct lexer *lexx)
+/* comments nest, but only the depth matters, so there's nothing to keep on a
+ * stack */
+static bool skip_multi_line_comment(struct lexer *lexx)
 {
-	struct base_token bt = {0};
+	size_t depth = 1;
 
 	/* We have already tested for and know the first two character */
 	lexer_get_token(lexx, NULL, IGNORE_WHITESPACE); // '/'
 	lexer_get_token(lexx, NULL, IGNORE_WHITESPACE); // '*'
 
-	while (lexer_peek_token(lexx, &bt, IGNORE_WHITESPACE)) {
-		if (bt.type == BASE_TOKEN_OTHER) {
-			const char *ch = bt.text.array;
+	while (lexer_skip_to_any(lexx, "/*")) {
+		const char *ch = lexx->offset;
 
-			if (astrcmp_n(ch, "/*", 2) == 0) {
-				if (!parse_mutli_line_comment_recurse(lexx)) {
-					return false;
-				}
-				continue;
+		if (astrcmp_n(ch, "/*", 2) == 0) {
+			lexer_skip_to(lexx, ch + 2);
+			depth++;
 
-			} else if (astrcmp_n(ch, "*/", 2) == 0) {
-				lexer_get_token(lexx, NULL, IGNORE_WHITESPACE);
+		} else if (astrcmp_n(ch, "*/", 2) == 0) {
+			lexer_skip_to(lexx, ch + 2);
+			if (--depth == 0) {
 				return true;
 			}
-		}
 
-		lexer_get_token(lexx, NULL, IGNORE_WHITESPACE);
+		} else {
+			lexer_skip_to(lexx, ch + 1);
+		}
 	}
 
 	return false;
 }
 
-static inline bool parse_multi_line_comment_then_get_token(struct lexer *lexx, struct cel_token *token)
-{
-	if (parse_mutli_line_comment_recurse(lexx)) {
-		return get_token(lexx, token);
-	}
-	return false;
-}
-
-static bool get_token(struct lexer *lexx, struct cel_token *token)
+/* skips any comments and reads the next token, of which a block is only
+ * opened */
+static bool get_next_token(struct cel_parser *parser, size_t *p_idx, size_t depth)
 {
 	struct base_token bt = {0};
 
-	if (lexer_peek_token(lexx, &bt, IGNORE_WHITESPACE)) {
+	while (lexer_peek_token(&parser->lexx, &bt, IGNORE_WHITESPACE)) {
 		const char *ch = bt.text.array;
 
 		switch (bt.type) {
 		case BASE_TOKEN_ALPHA:
-			return get_ident(lexx, token);
+			return get_ident(parser, p_idx);
 
 		case BASE_TOKEN_DIGIT:
-			return get_number(lexx, token);
+			return get_number(parser, p_idx);
 
 		case BASE_TOKEN_OTHER:
 			if (*ch == '.' && iswdigit(*(ch + 1))) {
-				return get_number(lexx, token);
+				return get_number(parser, p_idx);
 
 			} else if (*ch == '/') {
 				ch++;
 				if (*ch == '/') {
-					return parse_single_line_comment_then_get_token(lexx, token);
+					if (!skip_single_line_comment(&parser->lexx)) {
+						return false;
+					}
+					continue;
 
 				} else if (*ch == '*') {
-					return parse_multi_line_comment_then_get_token(lexx, token);
+					if (!skip_multi_line_comment(&parser->lexx)) {
+						return false;
+					}
+					continue;
 
 				} else {
-					return get_other(lexx, token);
+					return get_other(parser, p_idx);
 				}
 
 			} else if (*ch == '_') {
-				return get_ident(lexx, token);
+				return get_ident(parser, p_idx);
 
 			} else if (*ch == '{' || *ch == '(' || *ch == '[') {
-				return get_block(lexx, token);
+				return open_block(parser, p_idx, depth);
 
 			} else if (*ch == '\'' || *ch == '"') {
-				return get_string(lexx, token);
+				return get_string(parser, p_idx);
 
 			} else {
-				return get_other(lexx, token);
+				return get_other(parser, p_idx);
+			}
+		}
+
+		break;
+	}
+
+	return false;
+}
+
+/*
+ * Reads a token, and if it's a block, everything in it.  The blocks it's in
+ * the middle of are kept on open_blocks rather than on the C stack, so how
+ * deeply they nest is only limited by max_depth.  depth is how many blocks
+ * the token itself is inside of.
+ *
+ * Returns false at the end of the text, or if something in the token stops
+ * it early, e.g. a string or a block that's never closed.  Blocks that are
+ * still open then end with the last child that was read.
+ */
+static bool get_token(struct cel_parser *parser, size_t *p_idx, size_t depth)
+{
+	struct lexer *lexx = &parser->lexx;
+	size_t        idx;
+
+	while (get_next_token(parser, &idx, depth)) {
+		if (parser->tokens.array[idx].type == CEL_TOKEN_BLOCK) {
+			if (p_idx && parser->open_blocks.size == 1) {
+				*p_idx = idx;
+			}
+			continue;
+		}
+
+		/* the token is a child of the innermost open block, which grows
+		 * to contain it.  if it's the delimiter that closes the block,
+		 * the block is done, and a child of the one around it */
+		while (parser->open_blocks.size) {
+			size_t                  block_idx   = parser->open_blocks.array[parser->open_blocks.size - 1];
+			const struct cel_token *block_token = parser->tokens.array + block_idx;
+			const struct cel_token *token       = parser->tokens.array + idx;
+			struct cel_block       *block       = parser->blocks.array + block_token->data;
+
+			block->size = token->offset - block_token->offset + cel_token_size(parser, token);
+			if (lexx->text[token->offset] != block_delimiter(lexx->text[block_token->offset])) {
+				break;
+			}
+
+			pop_token(parser);
+			block->subtree_size = (uint32_t)(parser->tokens.size - block_idx - 1);
+			da_pop_back(parser->open_blocks);
+			idx = block_idx;
+		}
+
+		if (!parser->open_blocks.size) {
+			if (p_idx) {
+				*p_idx = idx;
 			}
+			return true;
 		}
 	}
 
+	while (parser->open_blocks.size) {
+		struct cel_block *block;
+
+		idx                 = parser->open_blocks.array[parser->open_blocks.size - 1];
+		block               = parser->blocks.array + parser->tokens.array[idx].data;
+		block->subtree_size = (uint32_t)(parser->tokens.size - idx - 1);
+		da_pop_back(parser->open_blocks);
+	}
+
 	return false;
 }
 
 static bool build_tree(struct cel_parser *parser, const char *file_name)
 {
-	struct cel_token token = {0};
+	size_t error_offset;
+
+	STATS_PHASE_START(timer);
 
-	while (get_token(&parser->lexx, &token)) {
-		da_push_back(parser->tokens, &token);
-		memset(&token, 0, sizeof(token));
+	parser->file_name = file_name;
+
+	/* token offsets are 32 bits */
+	if (parser->lexx.size > UINT32_MAX) {
+		error_data_add(&parser->error_list, file_name, 0, 0, "File is too large", LEX_ERROR);
+		STATS_PHASE_END(timer, STATS_PHASE_PARSE);
+		return false;
+	}
+
+	/* checked once up front, so the lexer doesn't have to check every
+	 * character it decodes */
+	if (!lexer_validate_utf8(&parser->lexx, &error_offset)) {
+		add_error(parser, error_offset, "Invalid UTF-8");
+		STATS_PHASE_END(timer, STATS_PHASE_PARSE);
+		return false;
 	}
 
+	while (get_token(parser, NULL, 0))
+		;
+
+	STATS_ADD(STATS_TOKENS, parser->tokens.size);
+	STATS_ADD(STATS_BYTES_LEXED, parser->lexx.size);
+	STATS_PHASE_END(timer, STATS_PHASE_PARSE);
 	return true;
 }
 
@@ -292,3 +451,768 @@ void cel_parser_build_tree(struct cel_parser *parser, char *file_string, size_t
 	lexer_start_move(&parser->lexx, file_string, size);
 	build_tree(parser, file_name);
 }
+
+void cel_parser_build_tree_mapped(struct cel_parser *parser, struct os_mapped_file *file, const char *file_name)
+{
+	lexer_start_mapped(&parser->lexx, file);
+	build_tree(parser, file_name);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Incremental edits                                                         */
+
+/* the replaced range, in offsets into the old text */
+struct tree_edit {
+	size_t  start;
+	size_t  end;
+	int64_t delta;
+};
+
+/* a block that ran into the end of the text doesn't end with its delimiter,
+ * or only seems to because its last child does */
+static bool block_is_closed(const struct cel_parser *parser, size_t idx)
+{
+	const struct cel_token *block = parser->tokens.array + idx;
+	const struct cel_token *last  = NULL;
+	size_t                  end   = cel_token_next_sibling(parser, idx);
+	size_t                  child;
+
+	for (child = cel_token_first_child(idx); child < end; child = cel_token_next_sibling(parser, child))
+		last = parser->tokens.array + child;
+
+	if (!last)
+		return cel_token_size(parser, block) > 1;
+	return last->offset + cel_token_size(parser, last) < block->offset + cel_token_size(parser, block);
+}
+
+/* finds the child block whose delimiters are both outside of the edit, if
+ * there is one, or returns SIZE_MAX */
+static size_t find_child_block(const struct cel_parser *parser, size_t first, size_t end, const struct tree_edit *edit)
+{
+	size_t i;
+
+	for (i = first; i < end && parser->tokens.array[i].offset < edit->start; i = cel_token_next_sibling(parser, i)) {
+		const struct cel_token *token = parser->tokens.array + i;
+
+		if (edit->end < token->offset + cel_token_size(parser, token)) {
+			if (token->type == CEL_TOKEN_BLOCK && block_is_closed(parser, i))
+				return i;
+			break;
+		}
+	}
+
+	return SIZE_MAX;
+}
+
+/*
+ * Lexes the children of a block (or of the whole file, if block is SIZE_MAX)
+ * again in the new text, from the last one that starts before the edit,
+ * until the lexer lines up with a child that starts after it.  Everything
+ * from there on is lexed from identical text, so it's kept.  The new tokens
+ * are appended to the array, and [*p_start, *p_end) is the range of old
+ * tokens they replace.  Fails if the block doesn't close where it used to.
+ * depth is how many blocks the children are inside of.
+ */
+static bool relex_children(struct cel_parser      *parser,
+                           size_t                  block,
+                           size_t                  depth,
+                           const struct tree_edit *edit,
+                           size_t                 *p_start,
+                           size_t                 *p_end)
+{
+	struct lexer     *lexx       = &parser->lexx;
+	size_t            old_size   = parser->tokens.size;
+	size_t            old_blocks = parser->blocks.size;
+	size_t            first      = block == SIZE_MAX ? 0 : cel_token_first_child(block);
+	size_t            end        = block == SIZE_MAX ? old_size : cel_token_next_sibling(parser, block);
+	size_t            restart    = SIZE_MAX;
+	int64_t           close_pos  = -1;
+	char              delimiter  = 0;
+	size_t            i;
+	size_t            next;
+	struct base_token bt;
+
+	for (i = first; i < end && parser->tokens.array[i].offset < edit->start; i = cel_token_next_sibling(parser, i))
+		restart = i;
+
+	if (block != SIZE_MAX) {
+		const struct cel_token *token = parser->tokens.array + block;
+
+		close_pos = (int64_t)(token->offset + cel_token_size(parser, token) - 1) + edit->delta;
+		delimiter = block_delimiter(lexx->text[token->offset]);
+		lexer_skip_to(lexx, lexx->text + token->offset + 1);
+	} else {
+		lexer_skip_to(lexx, lexx->text);
+	}
+
+	/* the restart token's own start and what's before it haven't changed */
+	if (restart != SIZE_MAX)
+		lexer_skip_to(lexx, lexx->text + parser->tokens.array[restart].offset);
+
+	*p_start = restart != SIZE_MAX ? restart : first;
+	*p_end   = end;
+	next     = *p_start;
+
+	for (;;) {
+		struct cel_token *token;
+		size_t            idx;
+
+		if (!lexer_peek_token(lexx, &bt, IGNORE_WHITESPACE)) {
+			if (block != SIZE_MAX)
+				goto fail;
+			break;
+		}
+
+		/* a comment isn't a token, whatever follows it is only found by
+		 * lexing it */
+		if (*bt.text.array != '/' || (bt.text.array[1] != '/' && bt.text.array[1] != '*')) {
+			int64_t pos = bt.text.array - lexx->text;
+
+			while (next < end && (parser->tokens.array[next].offset < edit->end ||
+			                      (int64_t)parser->tokens.array[next].offset + edit->delta < pos))
+				next = cel_token_next_sibling(parser, next);
+
+			if (next < end && (int64_t)parser->tokens.array[next].offset + edit->delta == pos) {
+				parser->tokens.array[next].passed_whitespace = bt.passed_whitespace;
+				*p_end                                       = next;
+				break;
+			}
+		}
+
+		if (!get_token(parser, &idx, depth)) {
+			if (block != SIZE_MAX)
+				goto fail;
+			break;
+		}
+
+		token = parser->tokens.array + idx;
+		if (block != SIZE_MAX) {
+			if (lexx->text[token->offset] == delimiter) {
+				if ((int64_t)token->offset != close_pos)
+					goto fail;
+
+				pop_token(parser);
+				break;
+			}
+
+			if ((int64_t)(token->offset + cel_token_size(parser, token)) > close_pos)
+				goto fail;
+		}
+	}
+
+	/* lexing started right at the restart token, so whatever was before it
+	 * wasn't seen.  unless the edit turned it into a comment */
+	if (restart != SIZE_MAX && parser->tokens.size > old_size &&
+	    parser->tokens.array[old_size].offset == parser->tokens.array[restart].offset)
+		parser->tokens.array[old_size].passed_whitespace = parser->tokens.array[restart].passed_whitespace;
+	return true;
+
+fail:
+	parser->tokens.size = old_size;
+	parser->blocks.size = old_blocks;
+	if (parser->token_atoms.size)
+		parser->token_atoms.size = old_size;
+	return false;
+}
+
+/* moves the items appended from new_start on into the place of those in
+ * [start, end), shifting everything between, and returns the new size */
+static size_t splice_array(void *array, size_t item_size, size_t start, size_t end, size_t new_start, size_t size)
+{
+	char  *items     = array;
+	size_t new_count = size - new_start;
+	size_t old_count = end - start;
+
+	/* nothing to move, and the array may not even be allocated, e.g. the
+	 * blocks of a file that has none */
+	if (start == end && new_count == 0)
+		return size;
+
+	/* the new items are past the old ones, so unless there are more of
+	 * them they can go straight into place.  an edit usually changes
+	 * tokens rather than adding them, and then the tail doesn't move */
+	if (new_count <= old_count) {
+		if (new_count)
+			memcpy(items + start * item_size, items + new_start * item_size, new_count * item_size);
+		if (new_count < old_count && new_start != end)
+			memmove(items + (start + new_count) * item_size,
+			        items + end * item_size,
+			        (new_start - end) * item_size);
+	} else {
+		void *copy = bmemdup(items + new_start * item_size, new_count * item_size);
+
+		if (new_start != end)
+			memmove(items + (start + new_count) * item_size,
+			        items + end * item_size,
+			        (new_start - end) * item_size);
+		memcpy(items + start * item_size, copy, new_count * item_size);
+		bfree(copy);
+	}
+
+	return new_start - old_count + new_count;
+}
+
+/*
+ * Swaps the old tokens in [start, end) for the ones appended after new_start,
+ * and shifts everything after them.  Blocks are kept in the same order as
+ * their tokens, so the new blocks (from new_blocks on) are swapped in where
+ * the old ones were the same way, and the blocks after them are renumbered.
+ */
+static void splice_tokens(struct cel_parser      *parser,
+                          size_t                  start,
+                          size_t                  end,
+                          size_t                  new_start,
+                          size_t                  new_blocks,
+                          const size_t           *ancestors,
+                          size_t                  ancestor_count,
+                          const struct tree_edit *edit)
+{
+	struct cel_token *tokens      = parser->tokens.array;
+	size_t            new_count   = parser->tokens.size - new_start;
+	size_t            old_count   = end - start;
+	size_t            first_block = SIZE_MAX;
+	size_t            old_blocks  = 0;
+	int64_t           block_shift;
+	size_t            i;
+
+	for (i = start; i < end; i++) {
+		if (tokens[i].type == CEL_TOKEN_BLOCK) {
+			if (first_block == SIZE_MAX)
+				first_block = tokens[i].data;
+			old_blocks++;
+		}
+	}
+
+	block_shift = (int64_t)(parser->blocks.size - new_blocks) - (int64_t)old_blocks;
+	for (i = end; i < new_start; i++) {
+		tokens[i].offset = (uint32_t)((int64_t)tokens[i].offset + edit->delta);
+		if (tokens[i].type == CEL_TOKEN_BLOCK) {
+			if (first_block == SIZE_MAX)
+				first_block = tokens[i].data;
+			tokens[i].data = (uint32_t)((int64_t)tokens[i].data + block_shift);
+		}
+	}
+
+	if (first_block == SIZE_MAX)
+		first_block = new_blocks;
+	for (i = new_start; i < parser->tokens.size; i++) {
+		if (tokens[i].type == CEL_TOKEN_BLOCK)
+			tokens[i].data = (uint32_t)(first_block + tokens[i].data - new_blocks);
+	}
+
+	/* the ancestors come before all of it, so they keep their blocks */
+	for (i = 0; i < ancestor_count; i++) {
+		struct cel_block *block = parser->blocks.array + tokens[ancestors[i]].data;
+
+		block->size         = (uint32_t)((int64_t)block->size + edit->delta);
+		block->subtree_size = (uint32_t)(block->subtree_size + new_count - old_count);
+	}
+
+	parser->blocks.size = splice_array(parser->blocks.array,
+	                                   sizeof(struct cel_block),
+	                                   first_block,
+	                                   first_block + old_blocks,
+	                                   new_blocks,
+	                                   parser->blocks.size);
+	if (parser->token_atoms.size)
+		parser->token_atoms.size = splice_array(parser->token_atoms.array,
+		                                        sizeof(atom_t),
+		                                        start,
+		                                        end,
+		                                        new_start,
+		                                        parser->token_atoms.size);
+	parser->tokens.size = splice_array(tokens, sizeof(*tokens), start, end, new_start, parser->tokens.size);
+}
+
+static void rebuild_tree(struct cel_parser *parser, const char *file_name)
+{
+	lexer_reset(&parser->lexx);
+	error_data_free(&parser->error_list);
+	parser->tokens.size      = 0;
+	parser->blocks.size      = 0;
+	parser->token_atoms.size = 0;
+	build_tree(parser, file_name);
+}
+
+bool cel_parser_edit(struct cel_parser *parser,
+                     size_t             offset,
+                     size_t             remove,
+                     const char        *text,
+                     size_t             size,
+                     const char        *file_name)
+{
+	struct lexer    *lexx  = &parser->lexx;
+	bool             valid = lexx->utf8_valid && !parser->error_list.errors.size;
+	struct tree_edit edit;
+	size_t           start;
+	size_t           end;
+	size_t           old_size;
+	size_t           old_blocks;
+
+	DARRAY_INLINE(size_t, 16) blocks;
+
+	if (offset > lexx->size)
+		offset = lexx->size;
+	if (remove > lexx->size - offset)
+		remove = lexx->size - offset;
+
+	lexer_replace(lexx, offset, remove, text, size);
+
+	/* anything the tree can't be trusted for, or can't cover, is built
+	 * again from scratch */
+	if (!valid || !lexx->utf8_valid || lexx->size > UINT32_MAX) {
+		rebuild_tree(parser, file_name);
+		return false;
+	}
+
+	parser->file_name = file_name;
+
+	STATS_PHASE_START(timer);
+
+	edit.start = offset;
+	edit.end   = offset + remove;
+	edit.delta = (int64_t)size - (int64_t)remove;
+
+	/* find the smallest block the edit is inside of */
+	da_init(blocks);
+	start = 0;
+	end   = parser->tokens.size;
+	for (;;) {
+		size_t block = find_child_block(parser, start, end, &edit);
+		if (block == SIZE_MAX)
+			break;
+
+		da_push_back(blocks, &block);
+		start = cel_token_first_child(block);
+		end   = cel_token_next_sibling(parser, block);
+	}
+
+	/* if the edit leaks out of a block, e.g. by opening a comment, the
+	 * block around that one is tried.  the top level always works */
+	old_size   = parser->tokens.size;
+	old_blocks = parser->blocks.size;
+	for (;;) {
+		size_t block = blocks.size ? blocks.array[blocks.size - 1] : SIZE_MAX;
+
+		if (relex_children(parser, block, blocks.size, &edit, &start, &end))
+			break;
+		da_pop_back(blocks);
+	}
+
+	/* errors would have to be taken out of the list again along with the
+	 * tokens they're about, so they're left to a full build */
+	if (parser->error_list.errors.size) {
+		da_free(blocks);
+		STATS_PHASE_END(timer, STATS_PHASE_PARSE);
+		rebuild_tree(parser, file_name);
+		return false;
+	}
+
+	STATS_ADD(STATS_TOKENS, parser->tokens.size - old_size);
+	splice_tokens(parser, start, end, old_size, old_blocks, blocks.array, blocks.size, &edit);
+	da_free(blocks);
+
+	STATS_PHASE_END(timer, STATS_PHASE_PARSE);
+	return true;
+}
+
+#ifdef ENABLE_TESTS
+
+static void check_token(struct cel_parser  *parser,
+                        size_t              idx,
+                        enum cel_token_type type,
+                        const char         *text,
+                        uint32_t            subtree_size)
+{
+	struct cel_token *token = parser->tokens.array + idx;
+	struct strref     ref;
+
+	cel_token_get_text(parser, token, &ref);
+	assert_int_equal(token->type, type);
+	assert_int_equal(strref_cmp(&ref, text), 0);
+	assert_int_equal(cel_token_subtree_size(parser, token), subtree_size);
+}
+
+void parser_test_build_tree(void **state)
+{
+	struct cel_parser parser = {0};
+	const char       *text   = "a { b(c, 1.5) // comment\n [x] } /* x /* y */ */ 'st\\'r' d";
+	uint32_t          row;
+	uint32_t          col;
+
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+
+	assert_int_equal(parser.tokens.size, 11);
+	check_token(&parser, 0, CEL_TOKEN_IDENT, "a", 0);
+	check_token(&parser, 1, CEL_TOKEN_BLOCK, "{ b(c, 1.5) // comment\n [x] }", 7);
+	check_token(&parser, 2, CEL_TOKEN_IDENT, "b", 0);
+	check_token(&parser, 3, CEL_TOKEN_BLOCK, "(c, 1.5)", 3);
+	check_token(&parser, 4, CEL_TOKEN_IDENT, "c", 0);
+	check_token(&parser, 5, CEL_TOKEN_OTHER, ",", 0);
+	check_token(&parser, 6, CEL_TOKEN_NUMBER, "1.5", 0);
+	check_token(&parser, 7, CEL_TOKEN_BLOCK, "[x]", 1);
+	check_token(&parser, 8, CEL_TOKEN_IDENT, "x", 0);
+	check_token(&parser, 9, CEL_TOKEN_STRING, "'st\\'r'", 0);
+	check_token(&parser, 10, CEL_TOKEN_IDENT, "d", 0);
+
+	/* walk the top level */
+	assert_int_equal(cel_token_next_sibling(&parser, 0), 1);
+	assert_int_equal(cel_token_next_sibling(&parser, 1), 9);
+	assert_int_equal(cel_token_next_sibling(&parser, 3), 7);
+	assert_int_equal(cel_token_first_child(1), 2);
+
+	cel_token_get_position(&parser, &parser.tokens.array[7], &row, &col);
+	assert_int_equal(row, 2);
+	assert_int_equal(col, 2);
+
+	cel_parser_free(&parser);
+
+	/* unterminated strings and comments run to the end of the text */
+	text = "x 'a\\'b";
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+	assert_int_equal(parser.tokens.size, 2);
+	check_token(&parser, 1, CEL_TOKEN_STRING, "'a\\'b", 0);
+	cel_parser_free(&parser);
+
+	text = "x /* a /* b */ c";
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+	assert_int_equal(parser.tokens.size, 1);
+	cel_parser_free(&parser);
+
+	text = "a // comment";
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+	assert_int_equal(parser.tokens.size, 1);
+	check_token(&parser, 0, CEL_TOKEN_IDENT, "a", 0);
+
+	/* no atom table, no atoms */
+	assert_int_equal(cel_token_atom(&parser, 0), ATOM_NONE);
+	assert_int_equal(parser.token_atoms.size, 0);
+
+	cel_parser_free(&parser);
+
+	UNUSED_PARAMETER(state);
+}
+
+void parser_test_arena(void **state)
+{
+	struct barena     arena;
+	struct cel_parser parser = {0};
+	struct dstr       text   = {0};
+	size_t            i;
+
+	/* enough tokens for the array to outgrow several arena chunks */
+	for (i = 0; i < 5000; i++)
+		dstr_catf(&text, "call(x%zu) ", i);
+
+	barena_init(&arena, 4096);
+	parser.arena = &arena;
+
+	cel_parser_build_tree(&parser, bstrdup(text.array), text.size, "test");
+
+	assert_int_equal(parser.tokens.size, 5000 * 3);
+	for (i = 0; i < 5000; i++) {
+		check_token(&parser, i * 3, CEL_TOKEN_IDENT, "call", 0);
+		assert_int_equal(cel_token_subtree_size(&parser, &parser.tokens.array[i * 3 + 1]), 1);
+	}
+
+	cel_parser_free(&parser);
+	barena_free(&arena);
+	dstr_free(&text);
+
+	UNUSED_PARAMETER(state);
+}
+
+void parser_test_intern_idents(void **state)
+{
+	struct atom_table atoms;
+	struct cel_parser parser = {0};
+	const char       *text   = "foo bar(foo, _baz, 12) { bar }";
+
+	atom_table_init(&atoms);
+	parser.atoms = &atoms;
+
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+
+	assert_int_equal(parser.tokens.size, 10);
+	check_token(&parser, 0, CEL_TOKEN_IDENT, "foo", 0);
+	check_token(&parser, 1, CEL_TOKEN_IDENT, "bar", 0);
+	check_token(&parser, 3, CEL_TOKEN_IDENT, "foo", 0);
+	check_token(&parser, 5, CEL_TOKEN_IDENT, "_baz", 0);
+	check_token(&parser, 7, CEL_TOKEN_NUMBER, "12", 0);
+	check_token(&parser, 9, CEL_TOKEN_IDENT, "bar", 0);
+
+	assert_int_equal(cel_token_atom(&parser, 0), atom_find(&atoms, "foo"));
+	assert_int_equal(cel_token_atom(&parser, 3), cel_token_atom(&parser, 0));
+	assert_int_equal(cel_token_atom(&parser, 9), cel_token_atom(&parser, 1));
+	assert_int_not_equal(cel_token_atom(&parser, 0), cel_token_atom(&parser, 1));
+	assert_int_equal(cel_token_atom(&parser, 5), atom_find(&atoms, "_baz"));
+	assert_int_equal(cel_token_atom(&parser, 7), ATOM_NONE);
+	assert_int_equal(cel_token_atom(&parser, 2), ATOM_NONE);
+
+	/* edits keep the atoms in step with the tokens */
+	assert_true(cel_parser_edit(&parser, 8, 3, "qux, (foo", 9, "test"));
+	assert_int_equal(parser.token_atoms.size, parser.tokens.size);
+	check_token(&parser, 3, CEL_TOKEN_IDENT, "qux", 0);
+	check_token(&parser, 5, CEL_TOKEN_BLOCK, "(foo, _baz, 12)", 5);
+	assert_int_equal(cel_token_atom(&parser, 3), atom_find(&atoms, "qux"));
+	assert_int_equal(cel_token_atom(&parser, 6), cel_token_atom(&parser, 0));
+	assert_int_equal(cel_token_atom(&parser, 8), atom_find(&atoms, "_baz"));
+	assert_int_equal(cel_token_atom(&parser, 12), cel_token_atom(&parser, 1));
+
+	/* freeing the parser leaves the atoms alone */
+	cel_parser_free(&parser);
+	assert_string_equal(atom_get_string(&atoms, atom_find(&atoms, "bar"))->array, "bar");
+	atom_table_free(&atoms);
+
+	UNUSED_PARAMETER(state);
+}
+
+void parser_test_limits(void **state)
+{
+	struct cel_parser parser = {0};
+	struct strref     ref;
+	size_t            size = CEL_TOKEN_MAX_SIZE + 10;
+	char             *text;
+
+	/* a token is 8 bytes, which is what the side tables are for */
+	assert_int_equal(sizeof(struct cel_token), 8);
+
+	/* a string too long to store is cut short, and is an error */
+	text = bmalloc(size + 1);
+	memset(text, 'a', size);
+	text[0]    = '\'';
+	text[size] = 0;
+
+	cel_parser_build_tree(&parser, text, size, "test");
+	assert_int_equal(parser.tokens.size, 1);
+	assert_int_equal(parser.error_list.errors.size, 1);
+	assert_string_equal(parser.error_list.errors.array[0].error, "Token is too long");
+	cel_token_get_text(&parser, parser.tokens.array, &ref);
+	assert_int_equal(ref.size, CEL_TOKEN_MAX_SIZE);
+	text = bstrdup_n(parser.lexx.text, size);
+	cel_parser_free(&parser);
+
+	/* blocks have no limit on their size, just on their number */
+	text[0]        = '(';
+	text[size - 1] = ')';
+	cel_parser_build_tree(&parser, bstrdup_n(text, size), size, "test");
+	assert_int_equal(parser.error_list.errors.size, 1);
+	cel_parser_free(&parser);
+
+	memset(text, ' ', size);
+	text[0]        = '(';
+	text[size - 1] = ')';
+	cel_parser_build_tree(&parser, bstrdup_n(text, size), size, "test");
+	assert_int_equal(parser.error_list.errors.size, 0);
+	check_token(&parser, 0, CEL_TOKEN_BLOCK, text, 0);
+	assert_int_equal(cel_token_size(&parser, parser.tokens.array), size);
+	cel_parser_free(&parser);
+	bfree(text);
+
+	/* offsets wouldn't fit in a token.  the size is all that's checked,
+	 * so the text doesn't have to be there */
+	if (SIZE_MAX > UINT32_MAX) {
+		lexer_start_static(&parser.lexx, "x", (size_t)UINT32_MAX + 1);
+		assert_false(build_tree(&parser, "test"));
+		assert_int_equal(parser.tokens.size, 0);
+		assert_int_equal(parser.error_list.errors.size, 1);
+		assert_string_equal(parser.error_list.errors.array[0].error, "File is too large");
+		cel_parser_free(&parser);
+	}
+
+	UNUSED_PARAMETER(state);
+}
+
+static void check_same_tree(struct cel_parser *parser)
+{
+	struct cel_parser fresh = {0};
+	size_t            i;
+
+	cel_parser_build_tree(&fresh, bstrdup_n(parser->lexx.text, parser->lexx.size), parser->lexx.size, "test");
+
+	assert_int_equal(parser->error_list.errors.size, fresh.error_list.errors.size);
+	assert_int_equal(parser->tokens.size, fresh.tokens.size);
+	for (i = 0; i < fresh.tokens.size; i++) {
+		const struct cel_token *a = parser->tokens.array + i;
+		const struct cel_token *b = fresh.tokens.array + i;
+
+		assert_int_equal(a->type, b->type);
+		assert_int_equal(a->offset, b->offset);
+		assert_int_equal(cel_token_size(parser, a), cel_token_size(&fresh, b));
+		assert_int_equal(cel_token_subtree_size(parser, a), cel_token_subtree_size(&fresh, b));
+		assert_int_equal(a->data, b->data);
+		assert_int_equal(a->passed_whitespace, b->passed_whitespace);
+	}
+
+	cel_parser_free(&fresh);
+}
+
+void parser_test_edit(void **state)
+{
+	static const char *const snippets[] = {
+	        "x", " ", "1.5", "_y", "{", "}", "(", ")", "[", "]", "'", "\"", "\\", "//", "/*", "*/", "\n", ",",
+	};
+
+	struct cel_parser parser = {0};
+	const char       *text   = "a { b(c, 1.5) // comment\n [x] } /* x /* y */ */ 'st\\'r' d";
+	uint32_t          seed   = 12345;
+	size_t            i;
+
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+
+	/* inside a block: (c, 1.5) becomes (c, 2.5, q) */
+	assert_true(cel_parser_edit(&parser, 9, 3, "2.5, q", 6, "test"));
+	check_same_tree(&parser);
+	check_token(&parser, 3, CEL_TOKEN_BLOCK, "(c, 2.5, q)", 5);
+	check_token(&parser, 11, CEL_TOKEN_STRING, "'st\\'r'", 0);
+
+	/* a string that swallows the rest of the block, then the file */
+	assert_true(cel_parser_edit(&parser, 5, 0, "'", 1, "test"));
+	check_same_tree(&parser);
+	assert_true(cel_parser_edit(&parser, 5, 1, "", 0, "test"));
+	check_same_tree(&parser);
+
+	/* invalid UTF-8 has to be reported, and then everything is rebuilt
+	 * until it's gone */
+	assert_false(cel_parser_edit(&parser, 0, 0, "\xff", 1, "test"));
+	assert_int_equal(parser.error_list.errors.size, 1);
+	assert_false(cel_parser_edit(&parser, 0, 1, "", 0, "test"));
+	check_same_tree(&parser);
+	assert_int_equal(parser.error_list.errors.size, 0);
+
+	/* cutting a character in half is invalid too */
+	assert_true(cel_parser_edit(&parser, 0, 0, "\xc3\xbc", 2, "test"));
+	assert_false(cel_parser_edit(&parser, 1, 1, "", 0, "test"));
+	assert_int_equal(parser.error_list.errors.size, 1);
+	assert_false(cel_parser_edit(&parser, 0, 1, "", 0, "test"));
+	assert_int_equal(parser.error_list.errors.size, 0);
+
+	/* random edits built from the pieces that change how things nest.  the
+	 * text stays ASCII, so every one of them is done in place */
+	for (i = 0; i < 2000; i++) {
+		const char *snippet;
+		size_t      offset;
+		size_t      remove;
+
+		seed    = seed * 1103515245 + 12345;
+		snippet = snippets[(seed >> 16) % (sizeof(snippets) / sizeof(snippets[0]))];
+		seed    = seed * 1103515245 + 12345;
+		offset  = (seed >> 16) % (parser.lexx.size + 1);
+		seed    = seed * 1103515245 + 12345;
+		remove  = parser.lexx.size > 64 ? (seed >> 16) % 4 : 0;
+
+		assert_true(cel_parser_edit(&parser, offset, remove, snippet, strlen(snippet), "test"));
+		check_same_tree(&parser);
+	}
+
+	cel_parser_free(&parser);
+
+	UNUSED_PARAMETER(state);
+}
+
+/* nothing allocated yet, and a tree of tokens without any blocks */
+void parser_test_edit_empty(void **state)
+{
+	struct cel_parser parser = {0};
+
+	cel_parser_build_tree(&parser, bstrdup(""), 0, "test");
+	assert_true(cel_parser_edit(&parser, 0, 0, "", 0, "test"));
+	assert_int_equal(parser.tokens.size, 0);
+
+	assert_true(cel_parser_edit(&parser, 0, 0, "a b", 3, "test"));
+	check_same_tree(&parser);
+	assert_int_equal(parser.tokens.size, 2);
+	assert_int_equal(parser.blocks.size, 0);
+
+	assert_true(cel_parser_edit(&parser, 1, 0, "", 0, "test"));
+	assert_true(cel_parser_edit(&parser, 2, 1, "c 1", 3, "test"));
+	check_same_tree(&parser);
+	check_token(&parser, 2, CEL_TOKEN_NUMBER, "1", 0);
+
+	assert_true(cel_parser_edit(&parser, 0, parser.lexx.size, "", 0, "test"));
+	check_same_tree(&parser);
+	assert_int_equal(parser.tokens.size, 0);
+	cel_parser_free(&parser);
+
+	UNUSED_PARAMETER(state);
+}
+
+void parser_test_nesting(void **state)
+{
+	struct cel_parser parser = {0};
+	struct dstr       text   = {0};
+	size_t            depth  = 100000;
+	size_t            i;
+
+	/* far deeper than would fit on the C stack, with the limit raised */
+	for (i = 0; i < depth; i++)
+		dstr_cat_ch(&text, "{(["[i % 3]);
+	dstr_cat_ch(&text, 'x');
+	for (i = depth; i > 0; i--)
+		dstr_cat_ch(&text, "})]"[(i - 1) % 3]);
+
+	parser.max_depth = (uint32_t)depth;
+	cel_parser_build_tree(&parser, bstrdup_n(text.array, text.size), text.size, "test");
+	assert_int_equal(parser.error_list.errors.size, 0);
+	assert_int_equal(parser.tokens.size, depth + 1);
+	for (i = 0; i < depth; i++) {
+		assert_int_equal(cel_token_size(&parser, parser.tokens.array + i), text.size - 2 * i);
+		assert_int_equal(cel_token_subtree_size(&parser, parser.tokens.array + i), depth - i);
+	}
+	check_token(&parser, depth, CEL_TOKEN_IDENT, "x", 0);
+	cel_parser_free(&parser);
+
+	/* by default the block that's one too deep is an error, and the tree
+	 * ends there */
+	cel_parser_build_tree(&parser, bstrdup_n(text.array, text.size), text.size, "test");
+	assert_int_equal(parser.error_list.errors.size, 1);
+	assert_string_equal(parser.error_list.errors.array[0].error, "Blocks are nested too deeply");
+	assert_int_equal(parser.error_list.errors.array[0].col, CEL_DEFAULT_MAX_DEPTH + 1);
+	assert_int_equal(parser.tokens.size, CEL_DEFAULT_MAX_DEPTH);
+	assert_int_equal(cel_token_subtree_size(&parser, parser.tokens.array), CEL_DEFAULT_MAX_DEPTH - 1);
+	cel_parser_free(&parser);
+
+	/* edits count the blocks around the one they lex again.  one more
+	 * block inside the innermost is too deep, so the tree is built again
+	 * with the error, and once more when it's gone */
+	dstr_free(&text);
+	for (i = 0; i < CEL_DEFAULT_MAX_DEPTH; i++)
+		dstr_cat_ch(&text, '(');
+	dstr_cat_ch(&text, 'x');
+	for (i = 0; i < CEL_DEFAULT_MAX_DEPTH; i++)
+		dstr_cat_ch(&text, ')');
+
+	cel_parser_build_tree(&parser, bstrdup_n(text.array, text.size), text.size, "test");
+	assert_int_equal(parser.error_list.errors.size, 0);
+	assert_true(cel_parser_edit(&parser, CEL_DEFAULT_MAX_DEPTH, 1, "y z", 3, "test"));
+	check_same_tree(&parser);
+	assert_false(cel_parser_edit(&parser, CEL_DEFAULT_MAX_DEPTH + 1, 1, "(w)", 3, "test"));
+	check_same_tree(&parser);
+	assert_int_equal(parser.error_list.errors.size, 1);
+	assert_false(cel_parser_edit(&parser, CEL_DEFAULT_MAX_DEPTH + 1, 3, " ", 1, "test"));
+	check_same_tree(&parser);
+	assert_int_equal(parser.error_list.errors.size, 0);
+	cel_parser_free(&parser);
+
+	/* comments only need their depth counted, and don't nest with any of
+	 * the comments after them */
+	dstr_free(&text);
+	for (i = 0; i < depth; i++)
+		dstr_cat(&text, "/* ");
+	for (i = 0; i < depth; i++)
+		dstr_cat(&text, "*/ ");
+	for (i = 0; i < depth; i++)
+		dstr_cat(&text, "// line\n/**/");
+	dstr_cat(&text, "x");
+
+	cel_parser_build_tree(&parser, bstrdup_n(text.array, text.size), text.size, "test");
+	assert_int_equal(parser.error_list.errors.size, 0);
+	assert_int_equal(parser.tokens.size, 1);
+	check_token(&parser, 0, CEL_TOKEN_IDENT, "x", 0);
+	cel_parser_free(&parser);
+
+	dstr_free(&text);
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -2,6 +2,7 @@
 
 #include "util/lexer.h"
 #include "util/darray.h"
+#include "util/atom.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -16,14 +17,38 @@ enum cel_token_type {
 	CEL_TOKEN_OTHER
 };
 
+/*
+ * Tokens are stored in one flat array in depth-first order. A block token is
+ * followed directly by the tokens nested within it, the number of which is
+ * its subtree_size, so the first child of the token at index i is at i + 1
+ * and its next sibling is at i + 1 + subtree_size.
+ *
+ * A token is 8 bytes.  Most tokens are short, so their size fits next to the
+ * type, and the few things only some tokens need live in side tables: blocks
+ * keep their size and subtree_size in parser->blocks, and interned atoms are
+ * in parser->token_atoms.  Use the cel_token_* functions below rather than the
+ * fields to get at them.
+ */
+
+#define CEL_TOKEN_DATA_BITS 24
+#define CEL_TOKEN_MAX_SIZE ((1U << CEL_TOKEN_DATA_BITS) - 1) /* longer tokens are an error */
+#define CEL_MAX_BLOCKS (1U << CEL_TOKEN_DATA_BITS)
+
+/* how many blocks a token can be inside of, unless the parser sets another
+ * limit */
+#define CEL_DEFAULT_MAX_DEPTH 1024
+
 struct cel_token {
-	enum cel_token_type type;
-	struct strref       text;
-	uint32_t            row;
-	uint32_t            col;
-	bool                passed_whitespace;
+	uint32_t offset;                     /* byte offset of the token text within the source */
+	uint32_t data : CEL_TOKEN_DATA_BITS; /* size of the text, or for blocks the index in parser->blocks */
+	uint32_t type : 7;                   /* enum cel_token_type */
+	uint32_t passed_whitespace : 1;
+};
 
-	DARRAY(struct cel_token) tokens;
+/* in the same order as their block tokens */
+struct cel_block {
+	uint32_t size; /* including the delimiters */
+	uint32_t subtree_size;
 };
 
 struct cel_parser {
@@ -31,11 +56,101 @@ struct cel_parser {
 	struct error_data error_list;
 
 	DARRAY(struct cel_token) tokens;
+	DARRAY(struct cel_block) blocks;
+
+	/* the atom of each token, ATOM_NONE if it isn't an identifier.  either
+	 * empty, or as long as tokens */
+	DARRAY(atom_t) token_atoms;
+
+	/* optional, not owned.  if set before building the tree, identifiers
+	 * are interned here and token_atoms is filled in */
+	struct atom_table *atoms;
+
+	/* optional, not owned.  if set before building the tree, the token
+	 * arrays are allocated from it instead of the heap, and are released by
+	 * resetting or freeing the arena rather than by cel_parser_free */
+	struct barena *arena;
+
+	/* what errors are reported under while building the tree, not owned */
+	const char *file_name;
+
+	/* how deeply blocks can be nested, or 0 for CEL_DEFAULT_MAX_DEPTH.  a
+	 * block any deeper is an error, and the tree ends there */
+	uint32_t max_depth;
+
+	/* the blocks that are open while reading a token, innermost last.  kept
+	 * here rather than on the C stack, and only grows */
+	DARRAY(size_t) open_blocks;
 };
 
+static inline uint32_t cel_token_size(const struct cel_parser *parser, const struct cel_token *token)
+{
+	return token->type == CEL_TOKEN_BLOCK ? parser->blocks.array[token->data].size : token->data;
+}
+
+static inline uint32_t cel_token_subtree_size(const struct cel_parser *parser, const struct cel_token *token)
+{
+	return token->type == CEL_TOKEN_BLOCK ? parser->blocks.array[token->data].subtree_size : 0;
+}
+
+static inline atom_t cel_token_atom(const struct cel_parser *parser, size_t idx)
+{
+	return parser->token_atoms.size ? parser->token_atoms.array[idx] : ATOM_NONE;
+}
+
+static inline size_t cel_token_first_child(size_t idx)
+{
+	return idx + 1;
+}
+
+static inline size_t cel_token_next_sibling(const struct cel_parser *parser, size_t idx)
+{
+	return idx + 1 + cel_token_subtree_size(parser, parser->tokens.array + idx);
+}
+
+static inline void cel_token_get_text(const struct cel_parser *parser,
+                                      const struct cel_token  *token,
+                                      struct strref           *text)
+{
+	strref_set(text, parser->lexx.text + token->offset, cel_token_size(parser, token));
+}
+
+/* tokens don't store their row and column, they're looked up when needed */
+static inline void cel_token_get_position(struct cel_parser      *parser,
+                                          const struct cel_token *token,
+                                          uint32_t               *row,
+                                          uint32_t               *col)
+{
+	lexer_get_position(&parser->lexx, parser->lexx.text + token->offset, row, col);
+}
+
 EXPORT void cel_parser_free(struct cel_parser *parser);
+/* a file of 4 GiB or more is an error, and gets no tokens */
 EXPORT void cel_parser_build_tree(struct cel_parser *parser, char *file_string, size_t size, const char *file_name);
 
+/* takes ownership of the mapping, which lives until cel_parser_free */
+EXPORT void cel_parser_build_tree_mapped(struct cel_parser *parser, struct os_mapped_file *file, const char *file_name);
+
+/*
+ * Replaces remove bytes at offset with the given text, and updates the tree
+ * to match without lexing the whole text again.  Tokens are only lexed again
+ * within the smallest closed block around the edit, from the last one that
+ * starts before it until they line up with the old ones again, and the rest
+ * are kept.  If the edit changes where the block ends, e.g. by opening a
+ * string, the enclosing block is tried next, up to the top level.
+ *
+ * The text is changed with lexer_replace, so a mapping is swapped for a copy
+ * on the first edit.  Returns false if the tree had to be built from scratch,
+ * which happens if the text wasn't valid UTF-8 before or after, or if the
+ * tree has errors, such as blocks nested too deeply.
+ */
+EXPORT bool cel_parser_edit(struct cel_parser *parser,
+                            size_t             offset,
+                            size_t             remove,
+                            const char        *text,
+                            size_t             size,
+                            const char        *file_name);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,341 @@
+#include "celes-tree-file.h"
+#include "util/hash-map.h"
+#include "util/bmem.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+#define CHECK_SIZE(type, size) typedef char type##_size_check[(sizeof(struct type) == (size)) ? 1 : -1]
+
+/* the layout is the file format, so it must not depend on the compiler */
+CHECK_SIZE(cel_tree_header, 48);
+CHECK_SIZE(cel_tree_token, 20);
+
+static uint32_t add_string(struct dstr *strings, hash_map_t *offsets, const char *str, size_t len)
+{
+	uint32_t *existing = hash_map_get_n(offsets, str, len);
+	uint32_t  offset;
+
+	if (existing)
+		return *existing;
+
+	offset = (uint32_t)strings->size;
+	dstr_ncat(strings, str, len);
+	dstr_cat_ch(strings, 0);
+
+	/* the keys are the token text, which outlives the map */
+	hash_map_set_borrowed(offsets, hash_key_n(str, len), &offset);
+	return offset;
+}
+
+uint8_t *cel_tree_serialize(const struct cel_parser *parser, const char *file_name, size_t *p_size)
+{
+	struct cel_tree_header header  = {0};
+	struct dstr            strings = {0};
+	hash_map_t             offsets;
+	struct cel_tree_token *tokens;
+	size_t                 count = parser->tokens.size;
+	size_t                 size;
+	uint8_t               *data;
+	size_t                 i;
+
+	if (!file_name)
+		file_name = "";
+
+	hash_map_init(&offsets, sizeof(uint32_t), NULL);
+	tokens = bzalloc(count * sizeof(struct cel_tree_token) + 1);
+
+	header.name = add_string(&strings, &offsets, file_name, strlen(file_name));
+
+	for (i = 0; i < count; i++) {
+		const struct cel_token *token = parser->tokens.array + i;
+		struct cel_tree_token  *out   = tokens + i;
+		const char             *text  = parser->lexx.text + token->offset;
+		size_t                  len   = token->type == CEL_TOKEN_BLOCK ? 1 : token->data;
+
+		out->type         = (uint8_t)token->type;
+		out->flags        = token->passed_whitespace ? CEL_TREE_PASSED_WHITESPACE : 0;
+		out->offset       = token->offset;
+		out->size         = cel_token_size(parser, token);
+		out->subtree_size = cel_token_subtree_size(parser, token);
+		out->text         = add_string(&strings, &offsets, text, len);
+	}
+
+	memcpy(header.magic, CEL_TREE_MAGIC, 4);
+	header.version_major  = CEL_TREE_VERSION_MAJOR;
+	header.version_minor  = CEL_TREE_VERSION_MINOR;
+	header.byte_order     = CEL_TREE_BYTE_ORDER;
+	header.header_size    = sizeof(header);
+	header.token_count    = (uint32_t)count;
+	header.token_size     = sizeof(struct cel_tree_token);
+	header.tokens_offset  = sizeof(header);
+	header.strings_offset = (uint32_t)(sizeof(header) + count * sizeof(struct cel_tree_token));
+	header.strings_size   = (uint32_t)strings.size;
+	header.source_size    = (uint32_t)parser->lexx.size;
+
+	size = header.strings_offset + strings.size;
+	data = bmalloc(size);
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + header.tokens_offset, tokens, count * sizeof(struct cel_tree_token));
+	memcpy(data + header.strings_offset, strings.array, strings.size);
+
+	hash_map_free(&offsets);
+	dstr_free(&strings);
+	bfree(tokens);
+
+	*p_size = size;
+	return data;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static inline bool range_valid(uint64_t offset, uint64_t size, uint64_t total)
+{
+	return offset <= total && size <= total - offset;
+}
+
+bool cel_tree_view_init(struct cel_tree_view *view, const void *data, size_t size)
+{
+	const struct cel_tree_header *header = data;
+	const char                   *strings;
+	size_t                        blocks = 0;
+	bool                          valid  = true;
+	size_t                        i;
+
+	DARRAY_INLINE(size_t, 16) ends;
+
+	memset(view, 0, sizeof(*view));
+
+	/* records are read in place, which needs them aligned */
+	if (!data || ((uintptr_t)data & 3) || size < sizeof(*header))
+		return false;
+
+	if (memcmp(header->magic, CEL_TREE_MAGIC, 4) != 0 || header->version_major != CEL_TREE_VERSION_MAJOR ||
+	    header->byte_order != CEL_TREE_BYTE_ORDER)
+		return false;
+
+	if (header->header_size < sizeof(*header) || header->token_size < sizeof(struct cel_tree_token) ||
+	    (header->token_size & 3) || (header->tokens_offset & 3) || header->tokens_offset < header->header_size)
+		return false;
+
+	if (!range_valid(header->tokens_offset, (uint64_t)header->token_count * header->token_size, size) ||
+	    !range_valid(header->strings_offset, header->strings_size, size))
+		return false;
+
+	/* every string ends at a NUL, so ending the table with one keeps any
+	 * string offset inside it */
+	strings = (const char *)data + header->strings_offset;
+	if (!header->strings_size || strings[header->strings_size - 1] != 0 || header->name >= header->strings_size)
+		return false;
+
+	view->data    = data;
+	view->size    = size;
+	view->header  = header;
+	view->strings = strings;
+
+	/* tokens have to nest, and fit in a parser's, so any view can be loaded.
+	 * ends has where each block around the current token ends, innermost
+	 * last, and every subtree has to end by the time the one around it does */
+	da_init(ends);
+	for (i = 0; i < header->token_count; i++) {
+		const struct cel_tree_token *token = cel_tree_view_token(view, i);
+		bool                         block = token->type == CEL_TOKEN_BLOCK;
+		size_t                       end   = i + 1 + token->subtree_size;
+
+		while (ends.size && ends.array[ends.size - 1] <= i)
+			da_pop_back(ends);
+
+		if (block)
+			blocks++;
+
+		if (token->type > CEL_TOKEN_OTHER || token->text >= header->strings_size ||
+		    token->subtree_size >= header->token_count - i || (!block && token->subtree_size) ||
+		    (!block && token->size > CEL_TOKEN_MAX_SIZE) || blocks > CEL_MAX_BLOCKS ||
+		    (ends.size && end > ends.array[ends.size - 1])) {
+			valid = false;
+			break;
+		}
+
+		if (token->subtree_size)
+			da_push_back(ends, &end);
+	}
+	da_free(ends);
+
+	if (!valid)
+		memset(view, 0, sizeof(*view));
+	return valid;
+}
+
+bool cel_tree_view_open(struct cel_tree_view *view, const char *path)
+{
+	struct os_mapped_file mapping;
+
+	if (!os_mmap_file(path, &mapping)) {
+		memset(view, 0, sizeof(*view));
+		return false;
+	}
+
+	if (!cel_tree_view_init(view, mapping.data, mapping.size)) {
+		os_munmap_file(&mapping);
+		return false;
+	}
+
+	view->mapping = mapping;
+	return true;
+}
+
+void cel_tree_view_free(struct cel_tree_view *view)
+{
+	os_munmap_file(&view->mapping);
+	memset(view, 0, sizeof(*view));
+}
+
+void cel_tree_view_load(const struct cel_tree_view *view, struct cel_parser *parser)
+{
+	size_t count  = cel_tree_view_count(view);
+	size_t blocks = 0;
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (cel_tree_view_token(view, i)->type == CEL_TOKEN_BLOCK)
+			blocks++;
+	}
+
+	if (parser->arena) {
+		parser->tokens.array    = barena_alloc(parser->arena, count * sizeof(struct cel_token));
+		parser->tokens.capacity = count;
+		parser->blocks.array    = barena_alloc(parser->arena, blocks * sizeof(struct cel_block));
+		parser->blocks.capacity = blocks;
+	} else {
+		da_free(parser->tokens);
+		da_free(parser->blocks);
+		da_free(parser->token_atoms);
+		da_reserve(parser->tokens, count);
+		da_reserve(parser->blocks, blocks);
+	}
+	parser->tokens.size      = count;
+	parser->blocks.size      = blocks;
+	parser->token_atoms.size = 0;
+
+	blocks = 0;
+	for (i = 0; i < count; i++) {
+		const struct cel_tree_token *token = cel_tree_view_token(view, i);
+		struct cel_token            *out   = parser->tokens.array + i;
+
+		out->type              = token->type;
+		out->offset            = token->offset;
+		out->passed_whitespace = (token->flags & CEL_TREE_PASSED_WHITESPACE) != 0;
+
+		if (token->type == CEL_TOKEN_BLOCK) {
+			struct cel_block *block = parser->blocks.array + blocks;
+
+			block->size         = token->size;
+			block->subtree_size = token->subtree_size;
+			out->data           = (uint32_t)blocks++;
+		} else {
+			out->data = token->size;
+		}
+	}
+}
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+void tree_file_test_view(void **state)
+{
+	struct cel_parser      parser = {0};
+	struct cel_parser      loaded = {0};
+	struct cel_tree_view   view;
+	const char            *text = "a { b(c, a) } 'str' a";
+	const char            *path = "test-tree-file.celt";
+	struct cel_tree_token *child;
+	uint32_t               subtree_size;
+	uint8_t               *data;
+	size_t                 size;
+	size_t                 idx;
+	size_t                 i;
+
+	cel_parser_build_tree(&parser, bstrdup(text), strlen(text), "test");
+	data = cel_tree_serialize(&parser, "test.celes", &size);
+
+	assert_true(cel_tree_view_init(&view, data, size));
+	assert_int_equal(cel_tree_view_count(&view), parser.tokens.size);
+	assert_string_equal(cel_tree_view_name(&view), "test.celes");
+	assert_int_equal(view.header->source_size, strlen(text));
+
+	for (i = 0; i < parser.tokens.size; i++) {
+		const struct cel_token      *a = parser.tokens.array + i;
+		const struct cel_tree_token *b = cel_tree_view_token(&view, i);
+
+		assert_int_equal(a->type, b->type);
+		assert_int_equal(a->offset, b->offset);
+		assert_int_equal(cel_token_size(&parser, a), b->size);
+		assert_int_equal(cel_token_subtree_size(&parser, a), b->subtree_size);
+	}
+
+	/* walk the top level: a, {...}, 'str', a */
+	idx = 0;
+	assert_string_equal(cel_tree_view_text(&view, cel_tree_view_token(&view, idx)), "a");
+	idx = cel_tree_view_next_sibling(&view, idx);
+	assert_string_equal(cel_tree_view_text(&view, cel_tree_view_token(&view, idx)), "{");
+	idx = cel_tree_view_next_sibling(&view, idx);
+	assert_string_equal(cel_tree_view_text(&view, cel_tree_view_token(&view, idx)), "'str'");
+	idx = cel_tree_view_next_sibling(&view, idx);
+	assert_string_equal(cel_tree_view_text(&view, cel_tree_view_token(&view, idx)), "a");
+	assert_int_equal(cel_tree_view_next_sibling(&view, idx), cel_tree_view_count(&view));
+
+	/* identical text shares one string */
+	assert_int_equal(cel_tree_view_token(&view, 0)->text, cel_tree_view_token(&view, idx)->text);
+
+	cel_tree_view_load(&view, &loaded);
+	assert_int_equal(loaded.tokens.size, parser.tokens.size);
+	assert_int_equal(loaded.blocks.size, parser.blocks.size);
+	for (i = 0; i < parser.tokens.size; i++) {
+		const struct cel_token *a = parser.tokens.array + i;
+		const struct cel_token *b = loaded.tokens.array + i;
+
+		assert_int_equal(a->data, b->data);
+		assert_int_equal(cel_token_size(&loaded, b), cel_token_size(&parser, a));
+		assert_int_equal(cel_token_subtree_size(&loaded, b), cel_token_subtree_size(&parser, a));
+		assert_int_equal(b->passed_whitespace, a->passed_whitespace);
+	}
+
+	/* through a mapped file */
+	assert_true(os_quick_write_utf8_file(path, (const char *)data, size, false));
+	assert_true(cel_tree_view_open(&view, path));
+	assert_int_equal(cel_tree_view_count(&view), parser.tokens.size);
+	cel_tree_view_free(&view);
+	assert_true(os_unlink(path));
+
+	/* so is a child that runs past the end of its block */
+	for (i = 0; i < parser.tokens.size; i++) {
+		if (parser.tokens.array[i].type == CEL_TOKEN_BLOCK && text[parser.tokens.array[i].offset] == '(')
+			break;
+	}
+	assert_true(cel_tree_view_init(&view, data, size));
+	child               = (struct cel_tree_token *)cel_tree_view_token(&view, i);
+	subtree_size        = child->subtree_size;
+	child->subtree_size = (uint32_t)(parser.tokens.size - i - 1);
+	assert_false(cel_tree_view_init(&view, data, size));
+	child->subtree_size = subtree_size;
+	assert_true(cel_tree_view_init(&view, data, size));
+
+	/* anything that would lead outside the file is rejected */
+	assert_false(cel_tree_view_init(&view, data, size - 1));
+	((struct cel_tree_token *)(data + sizeof(struct cel_tree_header)))->subtree_size = 100;
+	assert_false(cel_tree_view_init(&view, data, size));
+	((struct cel_tree_header *)data)->version_major++;
+	assert_false(cel_tree_view_init(&view, data, size));
+
+	bfree(data);
+	cel_parser_free(&loaded);
+	cel_parser_free(&parser);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
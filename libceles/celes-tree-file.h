@@ -0,0 +1,117 @@
+#pragma once
+
+#include "celes-parser.h"
+#include "util/platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Binary token tree files.  The layout is meant to be mapped and used in
+ * place: every reference is an offset from the start of the file, so nothing
+ * needs fixing up after loading, and all integers are stored in host order
+ * (little endian on everything we target, which byte_order records).
+ *
+ *   struct cel_tree_header
+ *   struct cel_tree_token  tokens[token_count]  (token_size bytes apart)
+ *   char                   strings[strings_size]
+ *
+ * Tokens are in the same depth-first order as cel_parser.tokens, with the
+ * same subtree_size nesting.  The string table holds the text of every token
+ * NUL terminated and deduplicated, except for blocks, which only get their
+ * opening delimiter, so tools can walk a tree without the source file.
+ * Like cel_token, tokens have no row and column, those are worked out from
+ * the offset and the source when needed.
+ *
+ * Readers accept any minor version of the major version they know.  Minor
+ * versions may only grow the header and token records, and header_size and
+ * token_size say by how much.
+ */
+
+#define CEL_TREE_MAGIC "CELT"
+#define CEL_TREE_VERSION_MAJOR 2
+#define CEL_TREE_VERSION_MINOR 0
+#define CEL_TREE_BYTE_ORDER 0x01020304
+
+#define CEL_TREE_PASSED_WHITESPACE (1 << 0)
+
+struct cel_tree_header {
+	char     magic[4];
+	uint16_t version_major;
+	uint16_t version_minor;
+	uint32_t byte_order;
+	uint32_t header_size;
+	uint32_t token_count;
+	uint32_t token_size;
+	uint32_t tokens_offset;
+	uint32_t strings_offset;
+	uint32_t strings_size;
+	uint32_t name;        /* source file name, in the string table */
+	uint32_t source_size; /* token offsets and sizes refer to the source */
+	uint32_t reserved;
+};
+
+struct cel_tree_token {
+	uint8_t  type; /* enum cel_token_type */
+	uint8_t  flags;
+	uint16_t reserved;
+	uint32_t offset;
+	uint32_t size;
+	uint32_t subtree_size;
+	uint32_t text; /* in the string table */
+};
+
+/* returns a bmalloc'd buffer holding the tree file for the parser's tokens */
+EXPORT uint8_t *cel_tree_serialize(const struct cel_parser *parser, const char *file_name, size_t *size);
+
+/* -------------------------------------------------------------------------
+ * Views over tree files.  A view validates the file once when it's created,
+ * after which every offset in it can be followed without further checks. */
+
+struct cel_tree_view {
+	const uint8_t                *data;
+	size_t                        size;
+	const struct cel_tree_header *header;
+	const char                   *strings;
+
+	struct os_mapped_file mapping;
+};
+
+/* uses data in place, which has to stay valid for as long as the view */
+EXPORT bool cel_tree_view_init(struct cel_tree_view *view, const void *data, size_t size);
+EXPORT bool cel_tree_view_open(struct cel_tree_view *view, const char *path);
+EXPORT void cel_tree_view_free(struct cel_tree_view *view);
+
+static inline size_t cel_tree_view_count(const struct cel_tree_view *view)
+{
+	return view->header->token_count;
+}
+
+static inline const struct cel_tree_token *cel_tree_view_token(const struct cel_tree_view *view, size_t idx)
+{
+	const uint8_t *tokens = view->data + view->header->tokens_offset;
+	return (const struct cel_tree_token *)(tokens + idx * view->header->token_size);
+}
+
+static inline const char *cel_tree_view_text(const struct cel_tree_view *view, const struct cel_tree_token *token)
+{
+	return view->strings + token->text;
+}
+
+static inline const char *cel_tree_view_name(const struct cel_tree_view *view)
+{
+	return view->strings + view->header->name;
+}
+
+static inline size_t cel_tree_view_next_sibling(const struct cel_tree_view *view, size_t idx)
+{
+	return idx + 1 + cel_tree_view_token(view, idx)->subtree_size;
+}
+
+/* copies the tokens back into a parser, replacing any it had */
+EXPORT void cel_tree_view_load(const struct cel_tree_view *view, struct cel_parser *parser);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,170 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "atom.h"
+
+#ifdef ENABLE_TESTS
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+#define ATOM_CHUNK_SIZE 4096
+
+struct atom_chunk {
+	struct atom_chunk *next;
+	size_t             used;
+	size_t             capacity;
+	char               data[];
+};
+
+void atom_table_init(struct atom_table *atoms)
+{
+	hash_table_init(&atoms->lookup, sizeof(atom_t), NULL);
+	da_init(atoms->strings);
+	atoms->chunks = NULL;
+}
+
+void atom_table_free(struct atom_table *atoms)
+{
+	struct atom_chunk *chunk = atoms->chunks;
+
+	while (chunk) {
+		struct atom_chunk *next = chunk->next;
+		bfree(chunk);
+		chunk = next;
+	}
+
+	hash_table_free(&atoms->lookup);
+	da_free(atoms->strings);
+	atoms->chunks = NULL;
+}
+
+/* copies the string into the current chunk, starting a new one if it's full.
+ * strings larger than a chunk get a chunk of their own. */
+static const char *atom_store_string(struct atom_table *atoms, const char *str, size_t len)
+{
+	struct atom_chunk *chunk = atoms->chunks;
+	char              *dst;
+
+	if (!chunk || chunk->capacity - chunk->used < len + 1) {
+		size_t capacity = len + 1 > ATOM_CHUNK_SIZE ? len + 1 : ATOM_CHUNK_SIZE;
+
+		chunk           = bmalloc(sizeof(struct atom_chunk) + capacity);
+		chunk->used     = 0;
+		chunk->capacity = capacity;
+		chunk->next     = atoms->chunks;
+		atoms->chunks   = chunk;
+	}
+
+	dst = chunk->data + chunk->used;
+	memcpy(dst, str, len);
+	dst[len] = 0;
+
+	chunk->used += len + 1;
+	return dst;
+}
+
+atom_t atom_intern_n(struct atom_table *atoms, const char *str, size_t len)
+{
+	hash_key_t     key = hash_key_n(str, len);
+	atom_t        *existing;
+	struct strref *ref;
+	atom_t         atom;
+
+	existing = hash_table_get_prehashed(&atoms->lookup, key);
+	if (existing) {
+		return *existing;
+	}
+
+	if (!atoms->strings.size) {
+		strref_clear(da_push_back_new(atoms->strings));
+	}
+
+	atom       = (atom_t)atoms->strings.size;
+	key.str    = atom_store_string(atoms, str, len);
+	ref        = da_push_back_new(atoms->strings);
+	ref->array = key.str;
+	ref->size  = len;
+
+	hash_table_set_borrowed(&atoms->lookup, key, &atom);
+	return atom;
+}
+
+atom_t atom_find_n(struct atom_table *atoms, const char *str, size_t len)
+{
+	atom_t *existing = hash_table_get_n(&atoms->lookup, str, len);
+	return existing ? *existing : ATOM_NONE;
+}
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+void atom_test_intern(void **state)
+{
+	struct atom_table atoms;
+	char              name[32];
+	char              long_name[ATOM_CHUNK_SIZE * 2];
+	atom_t            first;
+	atom_t            atom;
+	size_t            i;
+
+	atom_table_init(&atoms);
+	assert_int_equal(atom_table_size(&atoms), 1);
+	assert_int_equal(atom_find(&atoms, "a"), ATOM_NONE);
+	assert_null(atom_get_string(&atoms, ATOM_NONE));
+
+	first = atom_intern(&atoms, "value");
+	assert_int_equal(first, 1);
+	assert_int_equal(atom_intern(&atoms, "value"), first);
+	assert_int_equal(atom_intern_n(&atoms, "values", 5), first);
+	assert_int_equal(atom_find(&atoms, "value"), first);
+	assert_int_equal(atom_intern(&atoms, "values"), 2);
+
+	/* enough strings to fill several chunks and grow the hash table */
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "identifier_%zu", i);
+		atom = atom_intern(&atoms, name);
+		assert_int_equal(atom, i + 3);
+	}
+
+	memset(long_name, 'x', sizeof(long_name) - 1);
+	long_name[sizeof(long_name) - 1] = 0;
+	atom = atom_intern(&atoms, long_name);
+	assert_int_equal(atom, 2003);
+	assert_int_equal(atom_get_string(&atoms, atom)->size, sizeof(long_name) - 1);
+
+	/* strings stay where they are while the table grows */
+	assert_string_equal(atom_get_string(&atoms, first)->array, "value");
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "identifier_%zu", i);
+		atom = atom_find(&atoms, name);
+		assert_int_equal(atom, i + 3);
+		assert_string_equal(atom_get_string(&atoms, atom)->array, name);
+	}
+
+	assert_int_equal(atom_table_size(&atoms), 2004);
+	assert_int_equal(atom_intern(&atoms, ""), 2004);
+	assert_int_equal(atom_intern(&atoms, ""), 2004);
+
+	atom_table_free(&atoms);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
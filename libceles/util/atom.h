@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "util-defs.h"
+#include "darray.h"
+#include "hash.h"
+#include "lexer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * String interning.  Every distinct string added to an atom table gets a
+ * stable 32-bit ID, so interned strings can be compared by ID and the IDs can
+ * be used as indices into dense arrays.  IDs start at 1 and are handed out in
+ * order; ATOM_NONE (0) is never a valid atom.
+ *
+ * The strings are copied into append-only chunks that are only freed along
+ * with the table, so the pointers returned by atom_get_string stay valid.
+ */
+
+typedef uint32_t atom_t;
+
+#define ATOM_NONE ((atom_t)0)
+
+struct atom_chunk;
+
+struct atom_table {
+	hash_table_t lookup;
+
+	/* indexed by atom, entry 0 is ATOM_NONE */
+	DARRAY(struct strref) strings;
+
+	struct atom_chunk *chunks;
+};
+
+EXPORT void atom_table_init(struct atom_table *atoms);
+EXPORT void atom_table_free(struct atom_table *atoms);
+
+/* returns the atom for the string, adding it if it isn't in the table yet */
+EXPORT atom_t atom_intern_n(struct atom_table *atoms, const char *str, size_t len);
+
+/* returns the atom for the string, or ATOM_NONE if it was never interned */
+EXPORT atom_t atom_find_n(struct atom_table *atoms, const char *str, size_t len);
+
+static inline atom_t atom_intern(struct atom_table *atoms, const char *str)
+{
+	return atom_intern_n(atoms, str, strlen(str));
+}
+
+static inline atom_t atom_find(struct atom_table *atoms, const char *str)
+{
+	return atom_find_n(atoms, str, strlen(str));
+}
+
+/* number of atoms, plus one for ATOM_NONE: the size of an array indexed by
+ * atom */
+static inline size_t atom_table_size(const struct atom_table *atoms)
+{
+	return atoms->strings.size ? atoms->strings.size : 1;
+}
+
+static inline const struct strref *atom_get_string(const struct atom_table *atoms, atom_t atom)
+{
+	return (atom && atom < atoms->strings.size) ? &atoms->strings.array[atom] : NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,593 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "bmem.h"
+#include "threading.h"
+
+#ifdef ENABLE_TESTS
+#include "darray.h"
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+void barena_free(struct barena *arena)
+{
+	struct barena_chunk *chunk = arena->chunk;
+
+	while (chunk) {
+		struct barena_chunk *prev = chunk->prev;
+		bfree(chunk);
+		chunk = prev;
+	}
+
+	arena->chunk = NULL;
+}
+
+/* called when the current chunk is full.  allocations larger than a chunk
+ * get a chunk of their own. */
+void *barena_alloc_slow(struct barena *arena, size_t size)
+{
+	size_t               capacity = arena->chunk_size - sizeof(struct barena_chunk);
+	struct barena_chunk *chunk;
+
+	size = barena_align_size(size);
+	if (size > capacity)
+		capacity = size;
+
+	chunk           = bmalloc(sizeof(struct barena_chunk) + capacity);
+	chunk->prev     = arena->chunk;
+	chunk->used     = size;
+	chunk->capacity = capacity;
+	chunk->last     = 0;
+	arena->chunk    = chunk;
+
+	return barena_chunk_data(chunk);
+}
+
+void *barena_realloc(struct barena *arena, void *ptr, size_t old_size, size_t new_size)
+{
+	struct barena_chunk *chunk = arena->chunk;
+	void                *mem;
+
+	if (!ptr)
+		return barena_alloc(arena, new_size);
+
+	/* the last allocation can grow or shrink in place */
+	if (chunk && (char *)ptr == barena_chunk_data(chunk) + chunk->last) {
+		size_t new_used = chunk->last + barena_align_size(new_size);
+		if (new_used <= chunk->capacity) {
+			chunk->used = new_used;
+			return ptr;
+		}
+	}
+
+	mem = barena_alloc(arena, new_size);
+	memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+	return mem;
+}
+
+void barena_reset(struct barena *arena, struct barena_mark mark)
+{
+	struct barena_chunk *chunk = arena->chunk;
+
+	while (chunk && chunk != mark.chunk) {
+		struct barena_chunk *prev = chunk->prev;
+
+		/* when resetting everything, keep one regular chunk around so
+		 * the next round of allocations doesn't have to malloc again */
+		if (!mark.chunk && !prev && chunk->capacity == arena->chunk_size - sizeof(struct barena_chunk)) {
+			chunk->used  = 0;
+			chunk->last  = 0;
+			arena->chunk = chunk;
+			return;
+		}
+
+		bfree(chunk);
+		chunk = prev;
+	}
+
+	arena->chunk = chunk;
+	if (chunk) {
+		chunk->used = mark.used;
+		chunk->last = mark.used;
+	}
+}
+
+/* ========================================================================= */
+
+/* ------------------------------------------------------------------------- */
+/* Allocation tracking                                                       */
+
+#ifdef ENABLE_BMEM_TRACKING
+
+#define BMEM_MAGIC 0x626d656dU
+#define BMEM_MAX_SITES 4096 /* power of two, sites past it are counted as one */
+#define BMEM_LEAK_SITES 20
+
+/* the long double keeps what comes after it aligned the way malloc would */
+union bmem_header {
+	struct {
+		size_t   size;
+		uint32_t site;
+		uint32_t magic;
+	} info;
+
+	long double align;
+};
+
+/* the last one counts everything that didn't fit in the table */
+static struct bmem_site  sites[BMEM_MAX_SITES + 1];
+static struct bmem_stats totals;
+static volatile long     lock = 0;
+static bool              report_registered = false;
+
+static void report_leaks(void);
+
+/* allocations are short, and nothing in here allocates, so a spin lock is
+ * enough and keeps the tracking independent of os_mutex_t */
+static inline void lock_tracking(void)
+{
+	while (!os_atomic_compare_swap_long(&lock, 0, 1))
+		os_cpu_relax();
+}
+
+static inline void unlock_tracking(void)
+{
+	os_atomic_store_long(&lock, 0);
+}
+
+/* the same header can come with a different __FILE__ pointer in each file
+ * that includes it, so sites are compared by name */
+static uint32_t find_site(const char *file, int line)
+{
+	uint32_t hash = 2166136261U ^ (uint32_t)line;
+	uint32_t idx;
+	size_t   i;
+
+	for (i = 0; file[i]; i++)
+		hash = (hash ^ (uint8_t)file[i]) * 16777619U;
+
+	idx = hash & (BMEM_MAX_SITES - 1);
+	for (i = 0; i < BMEM_MAX_SITES; i++) {
+		struct bmem_site *site = &sites[idx];
+
+		if (!site->file) {
+			site->file = file;
+			site->line = line;
+			return idx;
+		}
+		if (site->line == line && (site->file == file || strcmp(site->file, file) == 0))
+			return idx;
+
+		idx = (idx + 1) & (BMEM_MAX_SITES - 1);
+	}
+
+	return BMEM_MAX_SITES;
+}
+
+static void count_alloc(uint32_t idx, size_t size)
+{
+	struct bmem_site *site = &sites[idx];
+
+	site->allocs++;
+	site->bytes += size;
+	site->live_allocs++;
+	site->live_bytes += size;
+	if (site->live_bytes > site->peak_bytes)
+		site->peak_bytes = site->live_bytes;
+
+	totals.allocs++;
+	totals.live_allocs++;
+	totals.live_bytes += size;
+	if (totals.live_bytes > totals.peak_bytes)
+		totals.peak_bytes = totals.live_bytes;
+}
+
+static void count_free(uint32_t idx, size_t size)
+{
+	struct bmem_site *site = &sites[idx];
+
+	site->live_allocs--;
+	site->live_bytes -= size;
+	totals.live_allocs--;
+	totals.live_bytes -= size;
+}
+
+static union bmem_header *get_header(void *ptr)
+{
+	union bmem_header *header = (union bmem_header *)ptr - 1;
+
+	if (header->info.magic != BMEM_MAGIC) {
+		os_breakpoint();
+		fprintf(stderr, "%p was not allocated with bmalloc, or was freed already\n", ptr);
+		abort();
+	}
+
+	return header;
+}
+
+void *bmem_track_malloc(size_t size, const char *file, int line)
+{
+	union bmem_header *header = malloc(sizeof(*header) + size);
+
+	if (!header)
+		return NULL;
+
+	lock_tracking();
+	if (!report_registered) {
+		atexit(report_leaks);
+		report_registered = true;
+	}
+
+	header->info.size  = size;
+	header->info.site  = find_site(file, line);
+	header->info.magic = BMEM_MAGIC;
+	count_alloc(header->info.site, size);
+	unlock_tracking();
+
+	return header + 1;
+}
+
+/* the memory moves to the new call site, since that's where its size was
+ * decided */
+void *bmem_track_realloc(void *ptr, size_t size, const char *file, int line)
+{
+	union bmem_header *header;
+	size_t             old_size;
+	uint32_t           old_site;
+
+	if (!ptr)
+		return bmem_track_malloc(size, file, line);
+
+	header   = get_header(ptr);
+	old_size = header->info.size;
+	old_site = header->info.site;
+
+	header = realloc(header, sizeof(*header) + size);
+	if (!header)
+		return NULL;
+
+	lock_tracking();
+	count_free(old_site, old_size);
+	header->info.size = size;
+	header->info.site = find_site(file, line);
+	count_alloc(header->info.site, size);
+	unlock_tracking();
+
+	return header + 1;
+}
+
+void bmem_track_free(void *ptr)
+{
+	union bmem_header *header;
+
+	if (!ptr)
+		return;
+
+	header = get_header(ptr);
+
+	lock_tracking();
+	count_free(header->info.site, header->info.size);
+	totals.frees++;
+	unlock_tracking();
+
+	header->info.magic = 0;
+	free(header);
+}
+
+void bmem_get_stats(struct bmem_stats *stats)
+{
+	lock_tracking();
+	*stats = totals;
+	unlock_tracking();
+}
+
+static int compare_peak(const void *a, const void *b)
+{
+	const struct bmem_site *site_a = a;
+	const struct bmem_site *site_b = b;
+
+	if (site_a->peak_bytes != site_b->peak_bytes)
+		return site_a->peak_bytes < site_b->peak_bytes ? 1 : -1;
+	return site_a->line - site_b->line;
+}
+
+static int compare_live(const void *a, const void *b)
+{
+	const struct bmem_site *site_a = a;
+	const struct bmem_site *site_b = b;
+
+	if (site_a->live_bytes != site_b->live_bytes)
+		return site_a->live_bytes < site_b->live_bytes ? 1 : -1;
+	return compare_peak(a, b);
+}
+
+/* sorting happens on a copy, outside of the lock */
+static size_t copy_sites(struct bmem_site *out, size_t count, bool live_only, int (*compare)(const void *, const void *))
+{
+	struct bmem_site *used = malloc(sizeof(sites));
+	size_t            num  = 0;
+	size_t            i;
+
+	if (!used)
+		return 0;
+
+	lock_tracking();
+	for (i = 0; i <= BMEM_MAX_SITES; i++) {
+		if (sites[i].allocs && (!live_only || sites[i].live_allocs))
+			used[num++] = sites[i];
+	}
+	unlock_tracking();
+
+	for (i = 0; i < num; i++) {
+		if (!used[i].file)
+			used[i].file = "(other)";
+	}
+
+	qsort(used, num, sizeof(*used), compare);
+	if (count > num)
+		count = num;
+	memcpy(out, used, count * sizeof(*out));
+
+	free(used);
+	return count;
+}
+
+size_t bmem_get_sites(struct bmem_site *out, size_t count)
+{
+	return copy_sites(out, count, false, compare_peak);
+}
+
+static void report_leaks(void)
+{
+	struct bmem_site  leaks[BMEM_LEAK_SITES];
+	struct bmem_stats stats;
+	size_t            count;
+	size_t            i;
+
+	bmem_get_stats(&stats);
+	if (!stats.live_allocs)
+		return;
+
+	fprintf(stderr,
+	        "%llu allocations (%llu bytes) were never freed:\n",
+	        (unsigned long long)stats.live_allocs,
+	        (unsigned long long)stats.live_bytes);
+
+	count = copy_sites(leaks, BMEM_LEAK_SITES, true, compare_live);
+	for (i = 0; i < count; i++) {
+		fprintf(stderr,
+		        "  %s:%d: %llu allocations, %llu bytes\n",
+		        leaks[i].file,
+		        leaks[i].line,
+		        (unsigned long long)leaks[i].live_allocs,
+		        (unsigned long long)leaks[i].live_bytes);
+	}
+}
+
+#else
+
+void bmem_get_stats(struct bmem_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+size_t bmem_get_sites(struct bmem_site *sites, size_t count)
+{
+	return 0;
+}
+
+#endif
+
+#ifdef ENABLE_TESTS
+
+static size_t count_chunks(const struct barena *arena)
+{
+	struct barena_chunk *chunk = arena->chunk;
+	size_t               count = 0;
+
+	for (; chunk; chunk = chunk->prev)
+		count++;
+	return count;
+}
+
+void bmem_test_arena(void **state)
+{
+	struct barena      arena;
+	struct barena_mark mark;
+	char              *a;
+	char              *b;
+	char              *big;
+	int               *array;
+	int                i;
+
+	barena_init(&arena, 1024);
+
+	a = barena_alloc(&arena, 3);
+	b = barena_alloc(&arena, 5);
+	assert_int_equal(b - a, BARENA_ALIGNMENT);
+	assert_int_equal((uintptr_t)a % BARENA_ALIGNMENT, 0);
+	assert_int_equal(count_chunks(&arena), 1);
+
+	/* the last allocation grows in place, earlier ones get copied */
+	memcpy(b, "abcd", 5);
+	assert_ptr_equal(barena_realloc(&arena, b, 5, 100), b);
+	a = barena_realloc(&arena, a, 3, 8);
+	assert_true(a != b);
+	assert_string_equal(b, "abcd");
+
+	/* build an array one item at a time */
+	array = NULL;
+	for (i = 0; i < 200; i++) {
+		array    = barena_realloc(&arena, array, i * sizeof(int), (i + 1) * sizeof(int));
+		array[i] = i;
+	}
+	for (i = 0; i < 200; i++)
+		assert_int_equal(array[i], i);
+
+	mark = barena_get_mark(&arena);
+
+	/* allocations larger than a chunk get their own */
+	big = barena_zalloc(&arena, 5000);
+	assert_int_equal(big[4999], 0);
+	assert_string_equal(barena_strdup(&arena, "text"), "text");
+	assert_true(count_chunks(&arena) >= 3);
+
+	barena_reset(&arena, mark);
+	assert_ptr_equal(arena.chunk, mark.chunk);
+	assert_int_equal(arena.chunk->used, mark.used);
+	for (i = 0; i < 200; i++)
+		assert_int_equal(array[i], i);
+
+	barena_clear(&arena);
+	assert_true(count_chunks(&arena) <= 1);
+	a = barena_alloc(&arena, 16);
+	assert_non_null(a);
+
+	barena_free(&arena);
+	assert_null(arena.chunk);
+
+	UNUSED_PARAMETER(state);
+}
+
+/* inline arrays live here with the rest of the memory tests, as darray is
+ * header only */
+void bmem_test_darray_inline(void **state)
+{
+	DARRAY_INLINE(int, 4) small;
+	DARRAY(int) plain = {0};
+	int *items;
+	int  i;
+
+	da_init(small);
+	assert_int_equal(da_inline_capacity(small), 4);
+	assert_int_equal(da_inline_capacity(plain), 0);
+	assert_ptr_equal(small.array, small.inline_array);
+
+	for (i = 0; i < 4; i++)
+		da_push_back(small, &i);
+	assert_ptr_equal(small.array, small.inline_array);
+
+	/* spills to the heap, and goes back to inline when freed */
+	da_push_back(small, &i);
+	assert_true(small.array != small.inline_array);
+	for (i = 0; i < 5; i++)
+		assert_int_equal(small.array[i], i);
+
+	da_free(small);
+	assert_ptr_equal(small.array, small.inline_array);
+	assert_int_equal(small.size, 0);
+	assert_int_equal(small.capacity, 4);
+
+	/* items in inline storage are copied when moved, heap ones handed over */
+	i = 7;
+	da_push_back(small, &i);
+	da_move(plain, small);
+	assert_int_equal(plain.size, 1);
+	assert_int_equal(plain.array[0], 7);
+	assert_ptr_equal(small.array, small.inline_array);
+	assert_int_equal(small.size, 0);
+
+	da_resize(small, 10);
+	items = small.array;
+	da_move(plain, small);
+	assert_ptr_equal(plain.array, items);
+	assert_ptr_equal(small.array, small.inline_array);
+	da_free(plain);
+
+	/* exact reserve, then filling in bulk */
+	da_reserve(plain, 100);
+	assert_int_equal(plain.capacity, 100);
+	items = da_push_back_n(plain, 100);
+	for (i = 0; i < 100; i++)
+		items[i] = i;
+	assert_int_equal(plain.size, 100);
+	assert_int_equal(plain.capacity, 100);
+	assert_int_equal(plain.array[99], 99);
+
+	da_free(plain);
+	da_free(small);
+
+	UNUSED_PARAMETER(state);
+}
+
+void bmem_test_tracking(void **state)
+{
+	struct bmem_stats before;
+	struct bmem_stats stats;
+	struct bmem_site  found[4096];
+	size_t            count;
+	size_t            i;
+	char             *mem;
+	int               line;
+
+	bmem_get_stats(&before);
+
+	line = __LINE__ + 1;
+	mem  = bmalloc(100);
+	memset(mem, 1, 100);
+
+	bmem_get_stats(&stats);
+	if (!BMEM_TRACKING_ENABLED) {
+		assert_int_equal(stats.allocs, 0);
+		assert_int_equal(stats.peak_bytes, 0);
+		assert_int_equal(bmem_get_sites(found, 4096), 0);
+		bfree(mem);
+		return;
+	}
+
+	assert_int_equal(stats.allocs, before.allocs + 1);
+	assert_int_equal(stats.live_allocs, before.live_allocs + 1);
+	assert_int_equal(stats.live_bytes, before.live_bytes + 100);
+	assert_true(stats.peak_bytes >= stats.live_bytes);
+
+	/* growing moves the bytes, it doesn't add an allocation */
+	mem = brealloc(mem, 300);
+	bmem_get_stats(&stats);
+	assert_int_equal(stats.allocs, before.allocs + 2);
+	assert_int_equal(stats.live_allocs, before.live_allocs + 1);
+	assert_int_equal(stats.live_bytes, before.live_bytes + 300);
+	assert_int_equal(mem[99], 1);
+
+	bfree(mem);
+	mem = bstrdup("abc");
+
+	/* sites are where the inline allocators were called from */
+	count = bmem_get_sites(found, 4096);
+	for (i = 0; i < count; i++) {
+		if (found[i].line == line && strcmp(found[i].file, __FILE__) == 0)
+			break;
+	}
+	assert_true(i < count);
+	assert_int_equal(found[i].allocs, 1);
+	assert_int_equal(found[i].bytes, 100);
+	assert_int_equal(found[i].live_allocs, 0);
+	assert_int_equal(found[i].peak_bytes, 100);
+
+	for (i = 1; i < count; i++)
+		assert_true(found[i - 1].peak_bytes >= found[i].peak_bytes);
+
+	bfree(mem);
+	bmem_get_stats(&stats);
+	assert_int_equal(stats.frees, before.frees + 2);
+	assert_int_equal(stats.live_allocs, before.live_allocs);
+	assert_int_equal(stats.live_bytes, before.live_bytes);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -21,14 +21,82 @@
 #include <string.h>
 
 #include "platform.h"
+#include "stats.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-static inline void *bmalloc(size_t size)
+/*
+ * Allocation tracking, for finding out where memory goes.
+ *
+ * Only compiled in with ENABLE_BMEM_TRACKING.  Each allocation then carries a
+ * small header with its size and the file and line that made it, which are
+ * counted per call site.  Whatever is still allocated at exit is reported on
+ * stderr.  Without it the allocators below are plain malloc/realloc/free,
+ * and bmem_get_stats() reports zeros.
+ *
+ * Every bmalloc/brealloc'd pointer has to go back through bfree, and memory
+ * from anywhere else must never be passed to it.
+ */
+
+struct bmem_stats {
+	size_t allocs; /* bmalloc/brealloc calls */
+	size_t frees;
+	size_t live_allocs;
+	size_t live_bytes;
+	size_t peak_bytes; /* highest live_bytes so far */
+};
+
+struct bmem_site {
+	const char *file;
+	int         line;
+	size_t      allocs;
+	size_t      bytes; /* all bytes requested, freed or not */
+	size_t      live_allocs;
+	size_t      live_bytes;
+	size_t      peak_bytes;
+};
+
+EXPORT void bmem_get_stats(struct bmem_stats *stats);
+
+/* copies up to count call sites, those with the highest peak_bytes first,
+ * and returns how many were copied */
+EXPORT size_t bmem_get_sites(struct bmem_site *sites, size_t count);
+
+#ifdef ENABLE_BMEM_TRACKING
+
+EXPORT void *bmem_track_malloc(size_t size, const char *file, int line);
+EXPORT void *bmem_track_realloc(void *ptr, size_t size, const char *file, int line);
+EXPORT void  bmem_track_free(void *ptr);
+
+/* the inline allocators take the call site along, so that what's counted is
+ * where they were called from rather than this file */
+#define BMEM_TRACKING_ENABLED true
+#define BMEM_SITE_PARAMS , const char *file, int line
+#define BMEM_SITE_ARGS , file, line
+#define BMEM_SITE_HERE , __FILE__, __LINE__
+#define BMEM_MALLOC(size) bmem_track_malloc(size, file, line)
+#define BMEM_REALLOC(ptr, size) bmem_track_realloc(ptr, size, file, line)
+#define bfree bmem_track_free
+
+#else
+
+#define BMEM_TRACKING_ENABLED false
+#define BMEM_SITE_PARAMS
+#define BMEM_SITE_ARGS
+#define BMEM_SITE_HERE
+#define BMEM_MALLOC(size) malloc(size)
+#define BMEM_REALLOC(ptr, size) realloc(ptr, size)
+#define bfree free
+
+#endif
+
+static inline void *bmalloc_at(size_t size BMEM_SITE_PARAMS)
 {
-	void *mem = malloc(size);
+	void *mem = BMEM_MALLOC(size);
+	STATS_ADD(STATS_ALLOCS, 1);
+	STATS_ADD(STATS_ALLOC_BYTES, size);
 	if (!mem) {
 		os_breakpoint();
 		printf("Out of memory while trying to allocate %lu bytes", (unsigned long)size);
@@ -36,9 +104,11 @@ static inline void *bmalloc(size_t size)
 	return mem;
 }
 
-static inline void *brealloc(void *ptr, size_t size)
+static inline void *brealloc_at(void *ptr, size_t size BMEM_SITE_PARAMS)
 {
-	void *mem = realloc(ptr, size);
+	void *mem = BMEM_REALLOC(ptr, size);
+	STATS_ADD(STATS_ALLOCS, 1);
+	STATS_ADD(STATS_ALLOC_BYTES, size);
 	if (!mem) {
 		os_breakpoint();
 		printf("Out of memory while trying to allocate %lu bytes", (unsigned long)size);
@@ -46,42 +116,164 @@ static inline void *brealloc(void *ptr, size_t size)
 	return mem;
 }
 
-#define bfree free
-
-static inline void *bmemdup(const void *ptr, size_t size)
+static inline void *bmemdup_at(const void *ptr, size_t size BMEM_SITE_PARAMS)
 {
-	void *mem = bmalloc(size);
+	void *mem = bmalloc_at(size BMEM_SITE_ARGS);
 	if (size)
 		memcpy(mem, ptr, size);
 
 	return mem;
 }
 
-static inline void *bzalloc(size_t size)
+static inline void *bzalloc_at(size_t size BMEM_SITE_PARAMS)
+{
+	void *mem = bmalloc_at(size BMEM_SITE_ARGS);
+	memset(mem, 0, size);
+	return mem;
+}
+
+static inline char *bstrdup_n_at(const char *str, size_t n BMEM_SITE_PARAMS)
+{
+	char *dup;
+	if (!str)
+		return NULL;
+
+	dup    = (char *)bmemdup_at(str, n + 1 BMEM_SITE_ARGS);
+	dup[n] = 0;
+
+	return dup;
+}
+
+static inline char *bstrdup_at(const char *str BMEM_SITE_PARAMS)
+{
+	if (!str)
+		return NULL;
+
+	return bstrdup_n_at(str, strlen(str) BMEM_SITE_ARGS);
+}
+
+#define bmalloc(size) bmalloc_at(size BMEM_SITE_HERE)
+#define brealloc(ptr, size) brealloc_at(ptr, size BMEM_SITE_HERE)
+#define bmemdup(ptr, size) bmemdup_at(ptr, size BMEM_SITE_HERE)
+#define bzalloc(size) bzalloc_at(size BMEM_SITE_HERE)
+#define bstrdup_n(str, n) bstrdup_n_at(str, n BMEM_SITE_HERE)
+#define bstrdup(str) bstrdup_at(str BMEM_SITE_HERE)
+
+/* ------------------------------------------------------------------------- */
+/* Arena allocator                                                           */
+
+/*
+ * Bump allocator for data that is freed all at once, such as everything
+ * produced while parsing a file.  Memory comes from large chunks, so the
+ * number of mallocs is the number of chunks rather than the number of
+ * allocations.  Individual allocations are never freed; instead the whole
+ * arena is freed, or reset back to a mark taken earlier.
+ *
+ * The most recent allocation can be grown or shrunk in place with
+ * barena_realloc as long as it still fits in its chunk, which makes arrays
+ * that are built up one item at a time cheap.
+ */
+
+#define BARENA_ALIGNMENT 16
+#define BARENA_DEFAULT_CHUNK_SIZE (64 * 1024)
+
+/* four pointer-sized members keep the data after the header aligned */
+struct barena_chunk {
+	struct barena_chunk *prev;
+	size_t               used;
+	size_t               capacity;
+	size_t               last; /* offset of the last allocation */
+};
+
+struct barena {
+	struct barena_chunk *chunk;
+	size_t               chunk_size;
+};
+
+struct barena_mark {
+	struct barena_chunk *chunk;
+	size_t               used;
+};
+
+static inline size_t barena_align_size(size_t size)
+{
+	return (size + (BARENA_ALIGNMENT - 1)) & ~(size_t)(BARENA_ALIGNMENT - 1);
+}
+
+static inline char *barena_chunk_data(struct barena_chunk *chunk)
+{
+	return (char *)(chunk + 1);
+}
+
+/* chunk_size of 0 uses BARENA_DEFAULT_CHUNK_SIZE */
+static inline void barena_init(struct barena *arena, size_t chunk_size)
+{
+	arena->chunk      = NULL;
+	arena->chunk_size = chunk_size ? chunk_size : BARENA_DEFAULT_CHUNK_SIZE;
+}
+
+EXPORT void  barena_free(struct barena *arena);
+EXPORT void *barena_alloc_slow(struct barena *arena, size_t size);
+EXPORT void *barena_realloc(struct barena *arena, void *ptr, size_t old_size, size_t new_size);
+EXPORT void  barena_reset(struct barena *arena, struct barena_mark mark);
+
+static inline void *barena_alloc(struct barena *arena, size_t size)
+{
+	struct barena_chunk *chunk = arena->chunk;
+
+	size = barena_align_size(size);
+	if (chunk && chunk->capacity - chunk->used >= size) {
+		chunk->last = chunk->used;
+		chunk->used += size;
+		return barena_chunk_data(chunk) + chunk->last;
+	}
+
+	return barena_alloc_slow(arena, size);
+}
+
+static inline void *barena_zalloc(struct barena *arena, size_t size)
 {
-	void *mem = bmalloc(size);
+	void *mem = barena_alloc(arena, size);
 	memset(mem, 0, size);
 	return mem;
 }
 
-static inline char *bstrdup_n(const char *str, size_t n)
+static inline char *barena_strdup_n(struct barena *arena, const char *str, size_t n)
 {
 	char *dup;
 	if (!str)
 		return NULL;
 
-	dup    = (char *)bmemdup(str, n + 1);
+	dup = (char *)barena_alloc(arena, n + 1);
+	if (n)
+		memcpy(dup, str, n);
 	dup[n] = 0;
 
 	return dup;
 }
 
-static inline char *bstrdup(const char *str)
+static inline char *barena_strdup(struct barena *arena, const char *str)
 {
 	if (!str)
 		return NULL;
 
-	return bstrdup_n(str, strlen(str));
+	return barena_strdup_n(arena, str, strlen(str));
+}
+
+static inline struct barena_mark barena_get_mark(const struct barena *arena)
+{
+	struct barena_mark mark;
+	mark.chunk = arena->chunk;
+	mark.used  = arena->chunk ? arena->chunk->used : 0;
+	return mark;
+}
+
+/* frees everything.  the oldest chunk is kept (emptied) for reuse if it's a
+ * regular-sized one, an oversized first chunk is freed along with the rest */
+static inline void barena_clear(struct barena *arena)
+{
+	struct barena_mark mark = {NULL, 0};
+	barena_reset(arena, mark);
 }
 
 #ifdef __cplusplus
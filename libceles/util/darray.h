@@ -35,6 +35,12 @@ extern "C" {
  *       Specifying size per call with inline maximizes compiler optimizations
  *
  *       See DARRAY macro at the bottom of the file for slightly safer usage.
+ *
+ * Arrays declared with DARRAY_INLINE keep their first few items in storage
+ * that directly follows the header, and only go to the heap once they
+ * outgrow it.  Such an array is recognized by its array pointer pointing at
+ * its own end, which a heap buffer never does, so the functions here work the
+ * same on both.
  */
 
 #define DARRAY_INVALID ((size_t)-1)
@@ -52,14 +58,41 @@ static inline void darray_init(struct darray *dst)
 	dst->capacity = 0;
 }
 
+static inline bool darray_is_inline(const struct darray *da)
+{
+	return da->array && da->array == (const void *)(da + 1);
+}
+
+/* points an array at its inline storage, if it has any */
+static inline void darray_init_inline(struct darray *dst, const size_t inline_capacity)
+{
+	dst->array    = inline_capacity ? (void *)(dst + 1) : NULL;
+	dst->size     = 0;
+	dst->capacity = inline_capacity;
+}
+
+/* arrays still in their inline storage just become empty */
 static inline void darray_free(struct darray *dst)
 {
+	if (darray_is_inline(dst)) {
+		dst->size = 0;
+		return;
+	}
+
 	bfree(dst->array);
 	dst->array    = NULL;
 	dst->size     = 0;
 	dst->capacity = 0;
 }
 
+/* frees the array and goes back to its inline storage, if it has any */
+static inline void darray_free_inline(struct darray *dst, const size_t inline_capacity)
+{
+	if (!darray_is_inline(dst))
+		bfree(dst->array);
+	darray_init_inline(dst, inline_capacity);
+}
+
 static inline size_t darray_alloc_size(const size_t element_size, const struct darray *da)
 {
 	return element_size * da->size;
@@ -78,6 +111,7 @@ static inline void *darray_end(const size_t element_size, const struct darray *d
 	return darray_item(element_size, da, da->size - 1);
 }
 
+/* grows to exactly the given capacity, where darray_ensure_capacity doubles */
 static inline void darray_reserve(const size_t element_size, struct darray *dst, const size_t capacity)
 {
 	void *ptr;
@@ -89,7 +123,8 @@ static inline void darray_reserve(const size_t element_size, struct darray *dst,
 		if (dst->size)
 			memcpy(ptr, dst->array, element_size * dst->size);
 
-		bfree(dst->array);
+		if (!darray_is_inline(dst))
+			bfree(dst->array);
 	}
 	dst->array    = ptr;
 	dst->capacity = capacity;
@@ -110,7 +145,8 @@ static inline void darray_ensure_capacity(const size_t element_size, struct darr
 		if (dst->capacity)
 			memcpy(ptr, dst->array, element_size * dst->capacity);
 
-		bfree(dst->array);
+		if (!darray_is_inline(dst))
+			bfree(dst->array);
 	}
 	dst->array    = ptr;
 	dst->capacity = new_cap;
@@ -171,6 +207,27 @@ static inline void darray_move(struct darray *dst, struct darray *src)
 	src->size     = 0;
 }
 
+/* a source in its inline storage can't be handed over, so its items are
+ * copied instead */
+static inline void darray_move_inline(const size_t   element_size,
+                                      struct darray *dst,
+                                      struct darray *src,
+                                      const size_t   src_inline_capacity)
+{
+	if (darray_is_inline(src)) {
+		darray_resize(element_size, dst, src->size);
+		if (src->size)
+			memcpy(dst->array, src->array, element_size * src->size);
+		src->size = 0;
+		return;
+	}
+
+	/* only the header moves, any inline storage dst has goes unused */
+	darray_free(dst);
+	memcpy(dst, src, sizeof(struct darray));
+	darray_init_inline(src, src_inline_capacity);
+}
+
 static inline size_t darray_find(const size_t element_size, const struct darray *da, const void *item, const size_t idx)
 {
 	size_t i;
@@ -205,6 +262,19 @@ static inline void *darray_push_back_new(const size_t element_size, struct darra
 	return last;
 }
 
+/* adds num items to the end without initializing them, and returns the first
+ * of them.  callers that know the final size can darray_reserve() it first,
+ * which allocates exactly that much */
+static inline void *darray_push_back_n(const size_t element_size, struct darray *dst, const size_t num)
+{
+	size_t old_size = dst->size;
+
+	darray_ensure_capacity(element_size, dst, old_size + num);
+	dst->size += num;
+
+	return darray_item(element_size, dst, old_size);
+}
+
 static inline size_t darray_push_back_array(const size_t   element_size,
                                             struct darray *dst,
                                             const void    *array,
@@ -453,9 +523,28 @@ static inline void darray_swap(const size_t element_size, struct darray *dst, co
 		size_t capacity;                                                                                       \
 	}
 
-#define da_init(v) darray_init((struct darray *)&(v))
+/*
+ * Keeps the first n items inline, for arrays that are usually small.  Works
+ * with all of the da_* macros, but has to be set up with da_init to use the
+ * inline storage (a zeroed one just starts on the heap), and must only be
+ * moved with da_move, as a copy of the header would point at the original's
+ * storage.  The items must not need more than pointer alignment, so that the
+ * storage directly follows the header.
+ */
+#define DARRAY_INLINE(type, n)                                                                                         \
+	struct {                                                                                                       \
+		type  *array;                                                                                          \
+		size_t size;                                                                                           \
+		size_t capacity;                                                                                       \
+		type   inline_array[n];                                                                                \
+	}
+
+/* number of items kept inline, 0 for a plain DARRAY */
+#define da_inline_capacity(v) ((sizeof(v) - sizeof(struct darray)) / sizeof(*(v).array))
 
-#define da_free(v) darray_free((struct darray *)&(v))
+#define da_init(v) darray_init_inline((struct darray *)&(v), da_inline_capacity(v))
+
+#define da_free(v) darray_free_inline((struct darray *)&(v), da_inline_capacity(v))
 
 #define da_alloc_size(v) (sizeof(*(v).array) * (v).size)
 
@@ -471,7 +560,8 @@ static inline void darray_swap(const size_t element_size, struct darray *dst, co
 
 #define da_copy_array(dst, src_array, n) darray_copy_array(sizeof(*(dst).array), (struct darray *)&(dst), src_array, n)
 
-#define da_move(dst, src) darray_move((struct darray *)&(dst), (struct darray *)&(src))
+#define da_move(dst, src)                                                                                              \
+	darray_move_inline(sizeof(*(dst).array), (struct darray *)&(dst), (struct darray *)&(src), da_inline_capacity(src))
 
 #ifdef ENABLE_DARRAY_TYPE_TEST
 #ifdef __cplusplus
@@ -543,6 +633,8 @@ static inline void darray_swap(const size_t element_size, struct darray *dst, co
 	darray_push_back_array(sizeof(*(dst).array), (struct darray *)&(dst), src_array, n)
 #endif
 
+#define da_push_back_n(v, n) darray_push_back_n(sizeof(*(v).array), (struct darray *)&(v), n)
+
 #ifdef ENABLE_DARRAY_TYPE_TEST
 #define da_push_back_da(dst, src)                                                                                      \
 	({                                                                                                             \
@@ -25,6 +25,12 @@
 #include <limits.h>
 
 #include "dstr.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
 #include "darray.h"
 #include "bmem.h"
 #include "utf8.h"
@@ -358,9 +364,6 @@ void dstr_copy(struct dstr *dst, const char *array)
 
 void dstr_copy_strref(struct dstr *dst, const struct strref *src)
 {
-	if (dst->array)
-		dstr_free(dst);
-
 	dstr_ncopy(dst, src->array, src->size);
 }
 
@@ -369,17 +372,17 @@ static inline size_t size_min(size_t a, size_t b)
 	return (a < b) ? a : b;
 }
 
+/* copies reuse the buffer the string already has */
 void dstr_ncopy(struct dstr *dst, const char *array, const size_t size)
 {
-	if (dst->array)
+	if (!size) {
 		dstr_free(dst);
-
-	if (!size)
 		return;
+	}
 
-	dst->array    = bmemdup(array, size + 1);
-	dst->size     = size;
-	dst->capacity = size + 1;
+	dstr_ensure_capacity(dst, size + 1);
+	memmove(dst->array, array, size);
+	dst->size = size;
 
 	dst->array[size] = 0;
 }
@@ -388,16 +391,15 @@ void dstr_ncopy_dstr(struct dstr *dst, const struct dstr *str, const size_t size
 {
 	size_t new_size;
 
-	if (dst->array)
+	new_size = size_min(size, str->size);
+	if (!new_size) {
 		dstr_free(dst);
-
-	if (!size)
 		return;
+	}
 
-	new_size      = size_min(size, str->size);
-	dst->array    = bmemdup(str->array, new_size + 1);
-	dst->size     = new_size;
-	dst->capacity = new_size + 1;
+	dstr_ensure_capacity(dst, new_size + 1);
+	memmove(dst->array, str->array, new_size);
+	dst->size = new_size;
 
 	dst->array[new_size] = 0;
 }
@@ -539,48 +541,56 @@ void dstr_catf(struct dstr *dst, const char *format, ...)
 	va_end(args);
 }
 
-void dstr_vprintf(struct dstr *dst, const char *format, va_list args)
+/* room that is reserved for formatting into a string with no spare capacity,
+ * so that short results only take one vsnprintf call */
+#define DSTR_FORMAT_RESERVE 64
+
+/*
+ * Formats to the end of the string.  Formatting goes straight into the
+ * string's spare capacity, and only if the result didn't fit is the buffer
+ * grown to the size vsnprintf reported and the text formatted again.
+ */
+static void dstr_format_at(struct dstr *dst, size_t offset, const char *format, va_list args)
 {
 	va_list args_cp;
-	va_copy(args_cp, args);
+	size_t  avail;
+	int     size;
 
-	int size = vsnprintf(NULL, 0, format, args_cp);
-	va_end(args_cp);
+	if (dst->capacity < offset + DSTR_FORMAT_RESERVE)
+		dstr_ensure_capacity(dst, offset + DSTR_FORMAT_RESERVE);
 
-	if (size < 0)
+	va_copy(args_cp, args);
+	avail = dst->capacity - offset;
+	size  = vsnprintf(dst->array + offset, avail, format, args);
+
+	if (size < 0) {
+		/* some C libraries report truncation this way */
 		size = 4095;
+		dstr_ensure_capacity(dst, offset + (size_t)size + 1);
+		size = vsnprintf(dst->array + offset, (size_t)size + 1, format, args_cp);
 
-	dstr_ensure_capacity(dst, ((size_t)size) + 1);
-	size = vsnprintf(dst->array, ((size_t)size) + 1, format, args);
+	} else if ((size_t)size >= avail) {
+		dstr_ensure_capacity(dst, offset + (size_t)size + 1);
+		size = vsnprintf(dst->array + offset, (size_t)size + 1, format, args_cp);
+	}
+	va_end(args_cp);
 
 	if (!*dst->array) {
 		dstr_free(dst);
 		return;
 	}
 
-	dst->size = size < 0 ? strlen(dst->array) : (size_t)size;
+	dst->size = offset + (size < 0 ? strlen(dst->array + offset) : (size_t)size);
 }
 
-void dstr_vcatf(struct dstr *dst, const char *format, va_list args)
+void dstr_vprintf(struct dstr *dst, const char *format, va_list args)
 {
-	va_list args_cp;
-	va_copy(args_cp, args);
-
-	int size = vsnprintf(NULL, 0, format, args_cp);
-	va_end(args_cp);
-
-	if (size < 0)
-		size = 4095;
-
-	dstr_ensure_capacity(dst, dst->size + ((size_t)size) + 1);
-	size = vsnprintf(dst->array + dst->size, ((size_t)size) + 1, format, args);
-
-	if (!*dst->array) {
-		dstr_free(dst);
-		return;
-	}
+	dstr_format_at(dst, 0, format, args);
+}
 
-	dst->size += size < 0 ? strlen(dst->array + dst->size) : (size_t)size;
+void dstr_vcatf(struct dstr *dst, const char *format, va_list args)
+{
+	dstr_format_at(dst, dst->size, format, args);
 }
 
 void dstr_safe_printf(struct dstr *dst,
@@ -775,3 +785,102 @@ void dstr_to_lower(struct dstr *str)
 	dstr_from_wcs(str, wstr);
 	bfree(wstr);
 }
+
+#ifdef ENABLE_TESTS
+
+void dstr_test_reuse(void **state)
+{
+	struct dstr str = {0};
+	char       *array;
+
+	dstr_copy(&str, "a string long enough to need its own buffer");
+	array = str.array;
+
+	/* clearing and copying keep the buffer */
+	dstr_clear(&str);
+	assert_int_equal(str.size, 0);
+	assert_string_equal(str.array, "");
+	assert_true(dstr_is_empty(&str));
+
+	dstr_copy(&str, "shorter");
+	assert_ptr_equal(str.array, array);
+	dstr_ncopy(&str, "abcdef", 3);
+	assert_ptr_equal(str.array, array);
+	assert_string_equal(str.array, "abc");
+
+	/* reserving never shrinks */
+	dstr_reserve(&str, 4);
+	assert_ptr_equal(str.array, array);
+	assert_true(str.capacity > 4);
+
+	dstr_reserve(&str, 256);
+	assert_int_equal(str.capacity, 256);
+	assert_string_equal(str.array, "abc");
+
+	dstr_free(&str);
+	UNUSED_PARAMETER(state);
+}
+
+void dstr_test_printf(void **state)
+{
+	struct dstr str = {0};
+	char        long_text[300];
+
+	dstr_printf(&str, "%d-%s", 42, "x");
+	assert_string_equal(str.array, "42-x");
+	assert_int_equal(str.size, 4);
+
+	dstr_catf(&str, " %u", 7u);
+	assert_string_equal(str.array, "42-x 7");
+
+	/* more than fits in the spare capacity */
+	memset(long_text, 'y', sizeof(long_text) - 1);
+	long_text[sizeof(long_text) - 1] = 0;
+	dstr_catf(&str, "[%s]", long_text);
+	assert_int_equal(str.size, 6 + 2 + strlen(long_text));
+	assert_int_equal(str.array[6], '[');
+	assert_int_equal(str.array[str.size - 1], ']');
+	assert_int_equal(str.array[str.size], 0);
+
+	/* an empty result frees the string, as before */
+	dstr_printf(&str, "%s", "");
+	assert_null(str.array);
+
+	dstr_free(&str);
+	UNUSED_PARAMETER(state);
+}
+
+void dstr_test_arena(void **state)
+{
+	struct barena arena;
+	struct dstr   a;
+	struct dstr   b;
+	const char   *first;
+
+	barena_init(&arena, 0);
+	dstr_init_arena(&a, &arena);
+	dstr_init_arena(&b, &arena);
+
+	dstr_copy(&a, "first");
+	first = a.array;
+	dstr_copy(&b, "second");
+	dstr_cat(&b, " string, grown in place");
+	dstr_catf(&b, " %d", 2);
+	assert_string_equal(a.array, "first");
+	assert_string_equal(b.array, "second string, grown in place 2");
+
+	/* freeing an arena string leaves its memory to the arena, and it is
+	 * still an arena string afterward */
+	dstr_free(&a);
+	assert_null(a.array);
+	assert_ptr_equal(a.arena, &arena);
+	assert_string_equal(first, "first");
+
+	dstr_cat(&a, "again");
+	assert_string_equal(a.array, "again");
+
+	barena_free(&arena);
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -34,10 +34,23 @@ extern "C" {
 
 struct strref;
 
+/*
+ * A string normally owns a heap buffer.  Strings initialized with
+ * dstr_init_arena() take their memory from an arena instead, which suits the
+ * many short strings built while parsing that all go away together: growing
+ * the most recent one extends it in place, and freeing one is a no-op, the
+ * memory is released with the arena.  Either way, clearing a string keeps
+ * its buffer, so a scratch string that is cleared and refilled for every
+ * token only allocates until it reaches its largest size.
+ *
+ * (Strings aren't stored inline, as they're routinely copied by value, and a
+ * copy would keep pointing at the inline buffer of the original.)
+ */
 struct dstr {
-	char  *array;
-	size_t size; /* number of characters, excluding null terminator */
-	size_t capacity;
+	char          *array;
+	size_t         size; /* number of characters, excluding null terminator */
+	size_t         capacity;
+	struct barena *arena; /* not owned, NULL for heap strings */
 };
 
 #ifndef _MSC_VER
@@ -63,6 +76,7 @@ EXPORT char **strlist_split(const char *str, char split_ch, bool include_empty);
 EXPORT void   strlist_free(char **strlist);
 
 static inline void dstr_init(struct dstr *dst);
+static inline void dstr_init_arena(struct dstr *dst, struct barena *arena);
 static inline void dstr_init_move(struct dstr *dst, struct dstr *src);
 static inline void dstr_init_move_array(struct dstr *dst, char *str);
 static inline void dstr_init_copy(struct dstr *dst, const char *src);
@@ -154,6 +168,27 @@ static inline void dstr_init(struct dstr *dst)
 	dst->array    = NULL;
 	dst->size     = 0;
 	dst->capacity = 0;
+	dst->arena    = NULL;
+}
+
+static inline void dstr_init_arena(struct dstr *dst, struct barena *arena)
+{
+	dstr_init(dst);
+	dst->arena = arena;
+}
+
+/* the string's own memory functions, for the arena or the heap */
+static inline char *dstr_realloc_array(struct dstr *dst, size_t new_cap)
+{
+	if (dst->arena)
+		return (char *)barena_realloc(dst->arena, dst->array, dst->capacity, new_cap);
+	return (char *)brealloc(dst->array, new_cap);
+}
+
+static inline void dstr_free_array(struct dstr *dst)
+{
+	if (!dst->arena)
+		bfree(dst->array);
 }
 
 static inline void dstr_init_move_array(struct dstr *dst, char *str)
@@ -161,6 +196,7 @@ static inline void dstr_init_move_array(struct dstr *dst, char *str)
 	dst->array    = str;
 	dst->size     = (!str) ? 0 : strlen(str);
 	dst->capacity = dst->size + 1;
+	dst->arena    = NULL;
 }
 
 static inline void dstr_init_move(struct dstr *dst, struct dstr *src)
@@ -181,9 +217,10 @@ static inline void dstr_init_copy_dstr(struct dstr *dst, const struct dstr *src)
 	dstr_copy_dstr(dst, src);
 }
 
+/* arena strings stay arena strings, for reuse */
 static inline void dstr_free(struct dstr *dst)
 {
-	bfree(dst->array);
+	dstr_free_array(dst);
 	dst->array    = NULL;
 	dst->size     = 0;
 	dst->capacity = 0;
@@ -199,14 +236,18 @@ static inline void dstr_array_free(struct dstr *array, const size_t count)
 static inline void dstr_move_array(struct dstr *dst, char *str)
 {
 	dstr_free(dst);
+	dst->arena    = NULL;
 	dst->array    = str;
 	dst->size     = (!str) ? 0 : strlen(str);
 	dst->capacity = dst->size + 1;
 }
 
+/* empties the string but keeps its buffer, unlike dstr_free */
 static inline void dstr_clear(struct dstr *dst)
 {
 	dst->size = 0;
+	if (dst->array)
+		*dst->array = 0;
 }
 
 static inline void dstr_move(struct dstr *dst, struct dstr *src)
@@ -224,27 +265,30 @@ static inline void dstr_ensure_capacity(struct dstr *dst, const size_t new_size)
 	new_cap = (!dst->capacity) ? new_size : dst->capacity * 2;
 	if (new_size > new_cap)
 		new_cap = new_size;
-	dst->array    = (char *)brealloc(dst->array, new_cap);
+	dst->array    = dstr_realloc_array(dst, new_cap);
 	dst->capacity = new_cap;
 }
 
 static inline void dstr_copy_dstr(struct dstr *dst, const struct dstr *src)
 {
-	dstr_free(dst);
-
-	if (src->size) {
-		dstr_ensure_capacity(dst, src->size + 1);
-		memcpy(dst->array, src->array, src->size + 1);
-		dst->size = src->size;
+	if (!src->size) {
+		dstr_free(dst);
+		return;
 	}
+
+	dstr_ensure_capacity(dst, src->size + 1);
+	memcpy(dst->array, src->array, src->size + 1);
+	dst->size = src->size;
 }
 
+/* makes room for a string of at least this size (including the null
+ * terminator) up front.  never shrinks the buffer */
 static inline void dstr_reserve(struct dstr *dst, const size_t capacity)
 {
-	if (capacity == 0 || capacity <= dst->size)
+	if (capacity <= dst->capacity)
 		return;
 
-	dst->array    = (char *)brealloc(dst->array, capacity);
+	dst->array    = dstr_realloc_array(dst, capacity);
 	dst->capacity = capacity;
 }
 
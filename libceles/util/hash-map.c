@@ -0,0 +1,522 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "hash-map.h"
+#include "stats.h"
+
+#ifdef ENABLE_TESTS
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+#define GROUP_WIDTH 16
+#define MIN_CAPACITY 16
+#define MAX_LOAD(cap) ((cap) - ((cap) >> 3))
+#define NOT_FOUND ((size_t)-1)
+
+#define CTRL_EMPTY ((uint8_t)0x80)
+#define CTRL_DELETED ((uint8_t)0xFE)
+
+struct entry_header {
+	uint64_t    hash;
+	struct dstr key;
+};
+
+static inline size_t entry_stride(const hash_map_t *map)
+{
+	return (sizeof(struct entry_header) + map->type_size + 7) & ~(size_t)7;
+}
+
+static inline struct entry_header *get_entry(const hash_map_t *map, size_t idx)
+{
+	return (struct entry_header *)(map->entries + idx * entry_stride(map));
+}
+
+/* the low 7 bits go in the control byte, the rest pick the first group */
+static inline uint8_t hash_h2(uint64_t hash)
+{
+	return (uint8_t)(hash & 0x7F);
+}
+
+static inline size_t hash_h1(uint64_t hash)
+{
+	return (size_t)(hash >> 7);
+}
+
+/* ------------------------------------------------------------------------- */
+/* group matching, each returns one bit per matching control byte            */
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t h2)
+{
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)h2)));
+}
+
+static inline uint32_t group_match_empty(const uint8_t *ctrl)
+{
+	return group_match(ctrl, CTRL_EMPTY);
+}
+
+/* empty and deleted are the only control bytes with the high bit set */
+static inline uint32_t group_match_free(const uint8_t *ctrl)
+{
+	return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)ctrl));
+}
+
+#else
+
+static inline uint32_t group_match(const uint8_t *ctrl, uint8_t h2)
+{
+	uint32_t mask = 0;
+	int      i;
+
+	for (i = 0; i < GROUP_WIDTH; i++) {
+		if (ctrl[i] == h2)
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+static inline uint32_t group_match_empty(const uint8_t *ctrl)
+{
+	return group_match(ctrl, CTRL_EMPTY);
+}
+
+static inline uint32_t group_match_free(const uint8_t *ctrl)
+{
+	uint32_t mask = 0;
+	int      i;
+
+	for (i = 0; i < GROUP_WIDTH; i++) {
+		if (ctrl[i] & 0x80)
+			mask |= 1u << i;
+	}
+	return mask;
+}
+
+#endif
+
+static inline unsigned lowest_bit(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (unsigned)idx;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Groups are probed triangularly (1, 2, 3, ... groups apart), which visits
+ * every group once when the group count is a power of two.  The load limit
+ * guarantees that there is always an empty slot to stop at.
+ */
+struct probe {
+	size_t mask;
+	size_t group;
+	size_t step;
+};
+
+static inline void probe_start(struct probe *probe, const hash_map_t *map, uint64_t hash)
+{
+	probe->mask  = (map->capacity / GROUP_WIDTH) - 1;
+	probe->group = hash_h1(hash) & probe->mask;
+	probe->step  = 0;
+	STATS_ADD(STATS_HASH_PROBES, 1);
+}
+
+static inline size_t probe_offset(const struct probe *probe)
+{
+	return probe->group * GROUP_WIDTH;
+}
+
+static inline void probe_next(struct probe *probe)
+{
+	probe->group = (probe->group + ++probe->step) & probe->mask;
+	STATS_ADD(STATS_HASH_PROBES, 1);
+}
+
+static size_t find_slot(const hash_map_t *map, uint64_t hash, const char *key, size_t len)
+{
+	struct probe probe;
+
+	if (!map->capacity)
+		return NOT_FOUND;
+
+	for (probe_start(&probe, map, hash);; probe_next(&probe)) {
+		const uint8_t *ctrl = map->ctrl + probe_offset(&probe);
+		uint32_t       mask = group_match(ctrl, hash_h2(hash));
+
+		while (mask) {
+			size_t               slot  = probe_offset(&probe) + lowest_bit(mask);
+			struct entry_header *entry = get_entry(map, map->slots[slot]);
+
+			if (entry->hash == hash && entry->key.size == len && memcmp(entry->key.array, key, len) == 0)
+				return slot;
+
+			mask &= mask - 1;
+		}
+
+		if (group_match_empty(ctrl))
+			return NOT_FOUND;
+	}
+}
+
+/* finds the slot that points to a specific entry */
+static size_t find_slot_of_entry(const hash_map_t *map, uint64_t hash, size_t idx)
+{
+	struct probe probe;
+
+	for (probe_start(&probe, map, hash);; probe_next(&probe)) {
+		uint32_t mask = group_match(map->ctrl + probe_offset(&probe), hash_h2(hash));
+
+		while (mask) {
+			size_t slot = probe_offset(&probe) + lowest_bit(mask);
+			if (map->slots[slot] == idx)
+				return slot;
+
+			mask &= mask - 1;
+		}
+	}
+}
+
+static size_t find_free_slot(const hash_map_t *map, uint64_t hash)
+{
+	struct probe probe;
+
+	for (probe_start(&probe, map, hash);; probe_next(&probe)) {
+		uint32_t mask = group_match_free(map->ctrl + probe_offset(&probe));
+		if (mask)
+			return probe_offset(&probe) + lowest_bit(mask);
+	}
+}
+
+/* rebuilds the slots for the existing entries, which also drops tombstones */
+static void hash_map_rehash(hash_map_t *map, size_t new_capacity)
+{
+	size_t i;
+
+	bfree(map->ctrl);
+	bfree(map->slots);
+
+	map->ctrl       = bmalloc(new_capacity);
+	map->slots      = bmalloc(new_capacity * sizeof(uint32_t));
+	map->capacity   = new_capacity;
+	map->tombstones = 0;
+	memset(map->ctrl, CTRL_EMPTY, new_capacity);
+
+	for (i = 0; i < map->count; i++) {
+		uint64_t hash = get_entry(map, i)->hash;
+		size_t   slot = find_free_slot(map, hash);
+
+		map->ctrl[slot]  = hash_h2(hash);
+		map->slots[slot] = (uint32_t)i;
+	}
+}
+
+static void free_entries(hash_map_t *map)
+{
+	size_t i;
+
+	for (i = 0; i < map->count; i++) {
+		struct entry_header *entry = get_entry(map, i);
+		if (map->type_size && map->on_free)
+			map->on_free(entry + 1);
+		if (entry->key.capacity)
+			dstr_free(&entry->key);
+	}
+}
+
+void hash_map_clear(hash_map_t *map)
+{
+	free_entries(map);
+
+	if (map->ctrl)
+		memset(map->ctrl, CTRL_EMPTY, map->capacity);
+	map->count      = 0;
+	map->tombstones = 0;
+}
+
+void hash_map_free(hash_map_t *map)
+{
+	free_entries(map);
+
+	bfree(map->ctrl);
+	bfree(map->slots);
+	bfree(map->entries);
+	hash_map_init(map, map->type_size, map->on_free);
+}
+
+static void *hash_map_set_internal(hash_map_t *map, hash_key_t key, bool copy, void *val)
+{
+	size_t               slot = find_slot(map, key.hash, key.str, key.len);
+	struct entry_header *entry;
+
+	/* set */
+	if (slot != NOT_FOUND) {
+		entry = get_entry(map, map->slots[slot]);
+		if (!map->type_size)
+			return NULL;
+
+		if (map->on_free)
+			map->on_free(entry + 1);
+		memcpy(entry + 1, val, map->type_size);
+		return entry + 1;
+	}
+
+	/* insert */
+	if (!map->capacity) {
+		hash_map_rehash(map, MIN_CAPACITY);
+
+	} else if (map->count + map->tombstones >= MAX_LOAD(map->capacity)) {
+		/* if tombstones take up most of the load, clean them out instead
+		 * of growing */
+		bool grow = map->count >= MAX_LOAD(map->capacity) / 2;
+		hash_map_rehash(map, grow ? map->capacity << 1 : map->capacity);
+	}
+
+	if (map->count == map->entry_capacity) {
+		map->entry_capacity = map->entry_capacity ? map->entry_capacity << 1 : MIN_CAPACITY;
+		map->entries        = brealloc(map->entries, map->entry_capacity * entry_stride(map));
+	}
+
+	slot = find_free_slot(map, key.hash);
+	if (map->ctrl[slot] == CTRL_DELETED)
+		map->tombstones--;
+
+	map->ctrl[slot]  = hash_h2(key.hash);
+	map->slots[slot] = (uint32_t)map->count;
+
+	entry       = get_entry(map, map->count++);
+	entry->hash = key.hash;
+	if (copy) {
+		entry->key.array    = bstrdup_n(key.str ? key.str : "", key.len);
+		entry->key.capacity = key.len + 1;
+	} else {
+		entry->key.array    = (char *)key.str;
+		entry->key.capacity = 0;
+	}
+	entry->key.size  = key.len;
+	entry->key.arena = NULL;
+
+	if (!map->type_size)
+		return NULL;
+
+	memcpy(entry + 1, val, map->type_size);
+	return entry + 1;
+}
+
+void *hash_map_set(hash_map_t *map, const char *key, void *val)
+{
+	return hash_map_set_n(map, key, strlen(key), val);
+}
+
+void *hash_map_set_n(hash_map_t *map, const char *key, size_t len, void *val)
+{
+	return hash_map_set_internal(map, hash_key_n(key, len), true, val);
+}
+
+void *hash_map_set_borrowed(hash_map_t *map, hash_key_t key, void *val)
+{
+	return hash_map_set_internal(map, key, false, val);
+}
+
+void *hash_map_get(hash_map_t *map, const char *key)
+{
+	return hash_map_get_n(map, key, strlen(key));
+}
+
+void *hash_map_get_n(hash_map_t *map, const char *key, size_t len)
+{
+	return hash_map_get_prehashed(map, hash_key_n(key, len));
+}
+
+void *hash_map_get_prehashed(hash_map_t *map, hash_key_t key)
+{
+	size_t slot = find_slot(map, key.hash, key.str, key.len);
+	if (slot == NOT_FOUND)
+		return NULL;
+
+	return get_entry(map, map->slots[slot]) + 1;
+}
+
+bool hash_map_remove(hash_map_t *map, const char *key)
+{
+	return hash_map_remove_n(map, key, strlen(key));
+}
+
+bool hash_map_remove_n(hash_map_t *map, const char *key, size_t len)
+{
+	size_t               slot = find_slot(map, hash_string_n(key, len), key, len);
+	size_t               idx;
+	size_t               last;
+	struct entry_header *entry;
+
+	if (slot == NOT_FOUND)
+		return false;
+
+	/* a group that still has an empty slot has never been full, so no probe
+	 * has ever gone past it and the slot can simply be emptied */
+	if (group_match_empty(map->ctrl + (slot & ~(size_t)(GROUP_WIDTH - 1)))) {
+		map->ctrl[slot] = CTRL_EMPTY;
+	} else {
+		map->ctrl[slot] = CTRL_DELETED;
+		map->tombstones++;
+	}
+
+	idx   = map->slots[slot];
+	last  = map->count - 1;
+	entry = get_entry(map, idx);
+
+	if (map->type_size && map->on_free)
+		map->on_free(entry + 1);
+	if (entry->key.capacity)
+		dstr_free(&entry->key);
+
+	/* keep the entries dense by moving the last one into the hole */
+	if (idx != last) {
+		struct entry_header *last_entry = get_entry(map, last);
+
+		map->slots[find_slot_of_entry(map, last_entry->hash, last)] = (uint32_t)idx;
+		memcpy(entry, last_entry, entry_stride(map));
+	}
+
+	map->count--;
+	return true;
+}
+
+void *hash_map_get_idx(hash_map_t *map, size_t idx, const char **key)
+{
+	struct entry_header *entry;
+
+	if (idx >= map->count) {
+		if (key)
+			*key = NULL;
+		return NULL;
+	}
+
+	entry = get_entry(map, idx);
+	if (key)
+		*key = entry->key.array;
+
+	return entry + 1;
+}
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+void hash_map_test_map(void **state)
+{
+	hash_map_t map;
+	char       key[32];
+	uint64_t   val;
+	uint64_t  *found;
+	uint64_t   i;
+
+	hash_map_init(&map, sizeof(uint64_t), NULL);
+
+	for (i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "key%llu", (unsigned long long)i);
+		val = i;
+		hash_map_set(&map, key, &val);
+	}
+	assert_int_equal(hash_map_count(&map), 5000);
+
+	for (i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "key%llu", (unsigned long long)i);
+		found = hash_map_get(&map, key);
+		assert_non_null(found);
+		assert_int_equal(*found, i);
+	}
+
+	assert_null(hash_map_get(&map, "key"));
+	assert_null(hash_map_get(&map, "key5000"));
+	assert_non_null(hash_map_get_n(&map, "key49999", 7));
+	assert_null(hash_map_get_n(&map, "key49999", 8));
+
+	val = 1234;
+	hash_map_set(&map, "key7", &val);
+	assert_int_equal(hash_map_count(&map), 5000);
+	assert_int_equal(*(uint64_t *)hash_map_get(&map, "key7"), 1234);
+
+	/* remove every even key, the odd ones must survive being moved */
+	for (i = 0; i < 5000; i += 2) {
+		snprintf(key, sizeof(key), "key%llu", (unsigned long long)i);
+		assert_true(hash_map_remove(&map, key));
+		assert_false(hash_map_remove(&map, key));
+	}
+	assert_int_equal(hash_map_count(&map), 2500);
+
+	for (i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "key%llu", (unsigned long long)i);
+		found = hash_map_get(&map, key);
+		if (i & 1) {
+			assert_non_null(found);
+			assert_int_equal(*found, i == 7 ? 1234 : i);
+		} else {
+			assert_null(found);
+		}
+	}
+
+	/* iteration only visits live entries */
+	for (i = 0; i < hash_map_count(&map); i++) {
+		const char *entry_key;
+		found = hash_map_get_idx(&map, (size_t)i, &entry_key);
+		assert_non_null(entry_key);
+		assert_ptr_equal(hash_map_get(&map, entry_key), found);
+	}
+	assert_null(hash_map_get_idx(&map, hash_map_count(&map), NULL));
+
+	/* churn: tombstones get cleaned out instead of growing forever */
+	for (i = 0; i < 100000; i++) {
+		snprintf(key, sizeof(key), "churn%llu", (unsigned long long)i);
+		val = i;
+		hash_map_set(&map, key, &val);
+		assert_true(hash_map_remove(&map, key));
+	}
+	assert_int_equal(hash_map_count(&map), 2500);
+	assert_true(map.capacity <= 8192);
+
+	assert_ptr_equal(hash_map_get_prehashed(&map, HASH_KEY("key7")), hash_map_get(&map, "key7"));
+	assert_null(hash_map_get_prehashed(&map, HASH_KEY("key8")));
+
+	val = 42;
+	hash_map_set(&map, "", &val);
+	assert_int_equal(*(uint64_t *)hash_map_get(&map, ""), 42);
+
+	/* clearing keeps the memory and the map usable */
+	hash_map_clear(&map);
+	assert_int_equal(hash_map_count(&map), 0);
+	assert_null(hash_map_get(&map, "key7"));
+	assert_non_null(map.ctrl);
+	hash_map_set(&map, "key7", &val);
+	assert_int_equal(*(uint64_t *)hash_map_get(&map, "key7"), 42);
+
+	hash_map_free(&map);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
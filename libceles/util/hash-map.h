@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "util-defs.h"
+#include "hash.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Open addressing hash map in the style of SwissTable.
+ *
+ * Each slot has one control byte holding either the low 7 bits of the key's
+ * hash, or a marker for an empty or deleted slot.  Lookups compare a group of
+ * 16 control bytes at a time and only look at an entry when its control byte
+ * matches.  Slots store an index into a dense array of entries, so iterating
+ * with hash_map_get_idx only visits live entries, in insertion order until
+ * something is removed.
+ *
+ * Pointers to values are invalidated by any insertion or removal.
+ */
+
+typedef struct {
+	uint8_t               *ctrl;
+	uint32_t              *slots;
+	uint8_t               *entries;
+	size_t                 capacity;
+	size_t                 count;
+	size_t                 tombstones;
+	size_t                 entry_capacity;
+	size_t                 type_size;
+	hash_table_val_free_cb on_free;
+} hash_map_t;
+
+static inline void hash_map_init(hash_map_t *map, size_t type_size, hash_table_val_free_cb on_free)
+{
+	map->ctrl           = NULL;
+	map->slots          = NULL;
+	map->entries        = NULL;
+	map->capacity       = 0;
+	map->count          = 0;
+	map->tombstones     = 0;
+	map->entry_capacity = 0;
+	map->type_size      = type_size;
+	map->on_free        = on_free;
+}
+
+static inline size_t hash_map_count(const hash_map_t *map)
+{
+	return map->count;
+}
+
+EXPORT void  hash_map_free(hash_map_t *map);
+EXPORT void  hash_map_clear(hash_map_t *map); /* keeps the memory, for maps that get refilled */
+EXPORT void *hash_map_set(hash_map_t *map, const char *key, void *val);
+EXPORT void *hash_map_set_n(hash_map_t *map, const char *key, size_t len, void *val);
+/* borrowed keys are not copied, so they must outlive the map */
+EXPORT void *hash_map_set_borrowed(hash_map_t *map, hash_key_t key, void *val);
+EXPORT void *hash_map_get(hash_map_t *map, const char *key);
+EXPORT void *hash_map_get_n(hash_map_t *map, const char *key, size_t len);
+EXPORT void *hash_map_get_prehashed(hash_map_t *map, hash_key_t key);
+EXPORT bool  hash_map_remove(hash_map_t *map, const char *key);
+EXPORT bool  hash_map_remove_n(hash_map_t *map, const char *key, size_t len);
+EXPORT void *hash_map_get_idx(hash_map_t *map, size_t idx, const char **key);
+
+#ifdef __cplusplus
+}
+#endif
@@ -2,37 +2,46 @@
 
 #include "hash.h"
 
+#ifdef ENABLE_TESTS
+#include <stdio.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
 struct bucket_header {
 	uint64_t    hash;
 	struct dstr key;
 };
 
-static uint64_t get_hash(const char *key, const size_t len)
+/* rounded up so the headers stay aligned after values like atom_t */
+static inline size_t bucket_size(const hash_table_t *ht)
 {
-	const uint64_t polynomial     = 29791;      /* ? */
-	const uint64_t prime          = 1000000007; /* large prime */
-	uint64_t       polynomial_pow = 1;
-	uint64_t       hash           = 0;
-	size_t         i;
-
-	for (i = 0; i < len; i++) {
-		const char ch     = key[i];
-		uint64_t   ch_val = ch;
+	const size_t align = sizeof(uint64_t);
+	return (sizeof(struct bucket_header) + ht->type_size + align - 1) & ~(align - 1);
+}
 
-		if (i != 0)
-			polynomial_pow *= polynomial;
+static inline struct bucket_header *get_bucket(hash_table_t *ht, size_t idx)
+{
+	void *ptr = ht->buckets + (idx * bucket_size(ht));
+	return ptr;
+}
 
-		ch_val *= polynomial_pow;
-		hash += ch_val;
-	}
+/* empty keys are valid, so a bucket is in use if its key has an array */
+static inline bool bucket_used(const struct bucket_header *bucket)
+{
+	return bucket->key.array != NULL;
+}
 
-	return hash % prime;
+/* borrowed keys are stored with a capacity of 0 */
+static inline bool bucket_owns_key(const struct bucket_header *bucket)
+{
+	return bucket->key.capacity != 0;
 }
 
-static inline struct bucket_header *get_bucket(hash_table_t *ht, size_t idx)
+static inline bool bucket_matches(const struct bucket_header *bucket, uint64_t hash, const char *key, size_t len)
 {
-	void *ptr = ht->buckets + (idx * (ht->type_size + sizeof(struct bucket_header)));
-	return ptr;
+	return bucket->hash == hash && bucket->key.size == len && memcmp(bucket->key.array, key, len) == 0;
 }
 
 void hash_table_free(hash_table_t *ht)
@@ -40,8 +49,13 @@ void hash_table_free(hash_table_t *ht)
 	size_t i;
 	for (i = 0; i < ht->size; i++) {
 		struct bucket_header *bucket = get_bucket(ht, i);
-		if (!dstr_is_empty(&bucket->key) && ht->type_size && ht->on_free) {
-			ht->on_free(++bucket);
+		if (bucket_used(bucket)) {
+			if (ht->type_size && ht->on_free) {
+				ht->on_free(bucket + 1);
+			}
+			if (bucket_owns_key(bucket)) {
+				dstr_free(&bucket->key);
+			}
 		}
 	}
 
@@ -54,29 +68,29 @@ static void hash_table_upsize(hash_table_t *ht);
 #define BUCKET_LIMIT(size) (size >> 1 | size >> 2)
 #define STARTING_CAPACITY 16
 
-static void *hash_table_set_internal(hash_table_t *ht, char *key, size_t len, bool copy, void *val)
+static void *hash_table_set_internal(hash_table_t *ht, struct dstr *key, bool copy, uint64_t hash, void *val)
 {
 	if (!ht->size) {
-		ht->buckets      = bzalloc((ht->type_size + sizeof(struct bucket_header)) * STARTING_CAPACITY);
+		ht->buckets      = bzalloc(bucket_size(ht) * STARTING_CAPACITY);
 		ht->size         = STARTING_CAPACITY;
 		ht->bucket_limit = BUCKET_LIMIT(STARTING_CAPACITY);
 	}
 
-	uint64_t hash = get_hash(key, len);
-	size_t   idx  = (size_t)(hash % (uint64_t)ht->size);
+	size_t mask = ht->size - 1;
+	size_t idx  = (size_t)hash & mask;
 
 	for (;;) {
 		struct bucket_header *bucket = get_bucket(ht, idx);
 
 		/* insert */
-		if (dstr_is_empty(&bucket->key)) {
+		if (!bucket_used(bucket)) {
 			bucket->hash = hash;
 			if (copy) {
-				dstr_ncopy(&bucket->key, key, len);
+				bucket->key.array    = bstrdup_n(key->array ? key->array : "", key->size);
+				bucket->key.size     = key->size;
+				bucket->key.capacity = key->size + 1;
 			} else {
-				bucket->key.array    = key;
-				bucket->key.size     = len;
-				bucket->key.capacity = len + 1;
+				bucket->key = *key;
 			}
 
 			if (ht->type_size) {
@@ -85,12 +99,15 @@ static void *hash_table_set_internal(hash_table_t *ht, char *key, size_t len, bo
 
 			if (++ht->bucket_count == ht->bucket_limit) {
 				hash_table_upsize(ht);
+
+				/* the bucket moved, so look it up again */
+				return ht->type_size ? hash_table_get_n(ht, key->array, key->size) : NULL;
 			}
 			return ht->type_size ? bucket : NULL;
 		}
 
 		/* set */
-		if (bucket->hash == hash) {
+		if (bucket_matches(bucket, hash, key->array, key->size)) {
 			if (ht->type_size) {
 				bucket++;
 				if (ht->on_free) {
@@ -102,8 +119,7 @@ static void *hash_table_set_internal(hash_table_t *ht, char *key, size_t len, bo
 			break;
 		}
 
-		idx++;
-		idx &= ht->size - 1;
+		idx = (idx + 1) & mask;
 	}
 
 	return NULL;
@@ -114,18 +130,20 @@ static void hash_table_upsize(hash_table_t *ht)
 	size_t       i;
 	const size_t new_size  = (ht->size << 1);
 	hash_table_t new_table = {
-	        bzalloc((ht->type_size + sizeof(struct bucket_header)) * new_size),
+	        bzalloc(bucket_size(ht) * new_size),
 	        new_size,
 	        BUCKET_LIMIT(new_size),
-	        ht->bucket_count,
+	        0,
 	        ht->type_size,
 	        ht->on_free,
 	};
 
+	/* moves the existing keys and values over without copying them, and
+	 * reuses the stored hashes */
 	for (i = 0; i < ht->size; i++) {
 		struct bucket_header *bucket = get_bucket(ht, i);
-		if (!dstr_is_empty(&bucket->key)) {
-			hash_table_set_internal(&new_table, bucket->key.array, bucket->key.size, false, bucket + 1);
+		if (bucket_used(bucket)) {
+			hash_table_set_internal(&new_table, &bucket->key, false, bucket->hash, bucket + 1);
 		}
 	}
 
@@ -135,37 +153,52 @@ static void hash_table_upsize(hash_table_t *ht)
 
 void *hash_table_set(hash_table_t *ht, const char *key, void *val)
 {
-	return hash_table_set_internal(ht, (char *)key, strlen(key), true, val);
+	return hash_table_set_n(ht, key, strlen(key), val);
 }
 
 void *hash_table_set_n(hash_table_t *ht, const char *key, size_t len, void *val)
 {
-	return hash_table_set_internal(ht, (char *)key, len, true, val);
+	struct dstr key_ref = {(char *)key, len, 0, NULL};
+	return hash_table_set_internal(ht, &key_ref, true, hash_string_n(key, len), val);
+}
+
+void *hash_table_set_borrowed(hash_table_t *ht, hash_key_t key, void *val)
+{
+	struct dstr key_ref = {(char *)key.str, key.len, 0, NULL};
+	return hash_table_set_internal(ht, &key_ref, false, key.hash, val);
 }
 
 void *hash_table_get(hash_table_t *ht, const char *key)
+{
+	return hash_table_get_n(ht, key, strlen(key));
+}
+
+void *hash_table_get_n(hash_table_t *ht, const char *key, size_t len)
+{
+	return hash_table_get_prehashed(ht, hash_key_n(key, len));
+}
+
+void *hash_table_get_prehashed(hash_table_t *ht, hash_key_t key)
 {
 	if (!ht->size) {
 		return NULL;
 	}
 
-	size_t   len  = strlen(key);
-	uint64_t hash = get_hash(key, len);
-	size_t   idx  = (size_t)(hash % (uint64_t)ht->size);
+	size_t mask = ht->size - 1;
+	size_t idx  = (size_t)key.hash & mask;
 
 	for (;;) {
 		struct bucket_header *bucket = get_bucket(ht, idx);
 
-		if (dstr_is_empty(&bucket->key)) {
+		if (!bucket_used(bucket)) {
 			break;
 		}
 
-		if (bucket->hash == hash) {
+		if (bucket_matches(bucket, key.hash, key.str, key.len)) {
 			return ++bucket;
 		}
 
-		idx++;
-		idx &= ~(ht->size - 1);
+		idx = (idx + 1) & mask;
 	}
 
 	return NULL;
@@ -187,3 +220,79 @@ void *hash_table_get_idx(hash_table_t *ht, size_t idx, const char **key)
 
 	return ++bucket;
 }
+
+#ifdef ENABLE_TESTS
+
+void hash_test_table(void **state)
+{
+	hash_table_t ht;
+	char         key[32];
+	uint64_t     val;
+	uint64_t    *found;
+	uint64_t     i;
+
+	hash_table_init(&ht, sizeof(uint64_t), NULL);
+
+	/* enough keys to grow the table several times */
+	for (i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "key%llu", (unsigned long long)i);
+		val = i;
+		hash_table_set(&ht, key, &val);
+	}
+	assert_int_equal(ht.bucket_count, 5000);
+
+	for (i = 0; i < 5000; i++) {
+		snprintf(key, sizeof(key), "key%llu", (unsigned long long)i);
+		found = hash_table_get(&ht, key);
+		assert_non_null(found);
+		assert_int_equal(*found, i);
+	}
+
+	/* lookups compare the whole key, not just a prefix or the hash */
+	assert_null(hash_table_get(&ht, "key"));
+	assert_null(hash_table_get(&ht, "key5000"));
+	assert_non_null(hash_table_get_n(&ht, "key49999", 7));
+	assert_non_null(hash_table_get_n(&ht, "key49999", 6));
+	assert_null(hash_table_get_n(&ht, "key49999", 8));
+
+	/* overwriting a key replaces its value in place */
+	val = 1234;
+	hash_table_set(&ht, "key7", &val);
+	assert_int_equal(ht.bucket_count, 5000);
+	assert_int_equal(*(uint64_t *)hash_table_get(&ht, "key7"), 1234);
+
+	/* empty keys are valid keys */
+	assert_null(hash_table_get(&ht, ""));
+	val = 42;
+	hash_table_set(&ht, "", &val);
+	assert_int_equal(*(uint64_t *)hash_table_get(&ht, ""), 42);
+
+	assert_ptr_equal(hash_table_get_prehashed(&ht, HASH_KEY("key12")), hash_table_get(&ht, "key12"));
+	assert_ptr_equal(hash_table_get_prehashed(&ht, hash_key("key99")), hash_table_get(&ht, "key99"));
+	assert_null(hash_table_get_prehashed(&ht, HASH_KEY("key5000")));
+
+	hash_table_free(&ht);
+
+	UNUSED_PARAMETER(state);
+}
+
+void hash_test_literal_keys(void **state)
+{
+	assert_int_equal(HASH_KEY("").hash, hash_key("").hash);
+	assert_int_equal(HASH_KEY("").len, 0);
+	assert_int_equal(HASH_KEY("Name").hash, hash_key("Name").hash);
+	assert_int_equal(HASH_KEY("Name").len, 4);
+	assert_string_equal(HASH_KEY("Name").str, "Name");
+
+	/* the longest literal the macro supports */
+	assert_int_equal(HASH_KEY("abcdefghijklmnopqrstuvwxyz012345").hash,
+	                 hash_key("abcdefghijklmnopqrstuvwxyz012345").hash);
+	assert_int_equal(HASH_KEY("abcdefghijklmnopqrstuvwxyz012345").len, HASH_KEY_MAX_LITERAL);
+
+	/* high bytes are hashed as unsigned */
+	assert_int_equal(HASH_KEY("\xc3\xa9t\xc3\xa9").hash, hash_key("\xc3\xa9t\xc3\xa9").hash);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -8,6 +8,94 @@
 extern "C" {
 #endif
 
+/*
+ * 64-bit FNV-1a over the key, followed by a final avalanche mix (the
+ * MurmurHash3 finalizer) so that the low bits, which pick the bucket, depend
+ * on every byte of the key.
+ */
+
+#define HASH_FNV_OFFSET 0xcbf29ce484222325ULL
+#define HASH_FNV_PRIME 0x100000001b3ULL
+
+static inline uint64_t hash_fnv1a(const char *key, size_t len)
+{
+	uint64_t hash = HASH_FNV_OFFSET;
+	size_t   i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t)key[i];
+		hash *= HASH_FNV_PRIME;
+	}
+
+	return hash;
+}
+
+static inline uint64_t hash_finalize(uint64_t hash)
+{
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static inline uint64_t hash_string_n(const char *key, size_t len)
+{
+	return hash_finalize(hash_fnv1a(key, len));
+}
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * A key with its hash already computed, for lookups that are repeated often
+ * enough that hashing and strlen start to matter.  Use hash_key() for
+ * strings known at runtime, or HASH_KEY() for string literals, which the
+ * compiler folds to a constant when optimizing.
+ */
+typedef struct {
+	uint64_t    hash;
+	const char *str;
+	size_t      len;
+} hash_key_t;
+
+static inline hash_key_t hash_key_n(const char *str, size_t len)
+{
+	hash_key_t key;
+	key.hash = hash_string_n(str, len);
+	key.str  = str;
+	key.len  = len;
+	return key;
+}
+
+static inline hash_key_t hash_key(const char *str)
+{
+	return hash_key_n(str, strlen(str));
+}
+
+/* one FNV-1a step per character; past the end of the literal a step xors 0
+ * and multiplies by 1, which leaves the hash unchanged */
+#define HASH_LIT_IN_RANGE(lit, i) ((i) < sizeof(lit) - 1)
+#define HASH_LIT_CHAR(lit, i) (HASH_LIT_IN_RANGE(lit, i) ? (uint8_t)(lit)[HASH_LIT_IN_RANGE(lit, i) ? (i) : 0] : 0)
+#define HASH_LIT_STEP(h, lit, i) (((h) ^ HASH_LIT_CHAR(lit, i)) * (HASH_LIT_IN_RANGE(lit, i) ? HASH_FNV_PRIME : 1))
+
+#define HASH_LIT_STEP2(h, lit, i) HASH_LIT_STEP(HASH_LIT_STEP(h, lit, i), lit, (i) + 1)
+#define HASH_LIT_STEP4(h, lit, i) HASH_LIT_STEP2(HASH_LIT_STEP2(h, lit, i), lit, (i) + 2)
+#define HASH_LIT_STEP8(h, lit, i) HASH_LIT_STEP4(HASH_LIT_STEP4(h, lit, i), lit, (i) + 4)
+#define HASH_LIT_STEP16(h, lit, i) HASH_LIT_STEP8(HASH_LIT_STEP8(h, lit, i), lit, (i) + 8)
+#define HASH_LIT_STEP32(h, lit, i) HASH_LIT_STEP16(HASH_LIT_STEP16(h, lit, i), lit, (i) + 16)
+
+/* literals longer than this fail to compile */
+#define HASH_KEY_MAX_LITERAL 32
+#define HASH_LIT_CHECK_SIZE(lit) (0 * sizeof(char[sizeof(lit) <= HASH_KEY_MAX_LITERAL + 1 ? 1 : -1]))
+
+#define HASH_KEY(lit)                                                          \
+	((hash_key_t){hash_finalize(HASH_LIT_STEP32(HASH_FNV_OFFSET, lit, 0)), \
+	              (lit),                                                   \
+	              sizeof(lit) - 1 + HASH_LIT_CHECK_SIZE(lit)})
+
+/* ------------------------------------------------------------------------- */
+
 typedef void (*hash_table_val_free_cb)(void *val);
 
 typedef struct {
@@ -32,7 +120,11 @@ static inline void hash_table_init(hash_table_t *ht, size_t type_size, hash_tabl
 EXPORT void  hash_table_free(hash_table_t *ht);
 EXPORT void *hash_table_set(hash_table_t *ht, const char *key, void *val);
 EXPORT void *hash_table_set_n(hash_table_t *ht, const char *key, size_t len, void *val);
+/* stores the key without copying it, so it must outlive the table */
+EXPORT void *hash_table_set_borrowed(hash_table_t *ht, hash_key_t key, void *val);
 EXPORT void *hash_table_get(hash_table_t *ht, const char *key);
+EXPORT void *hash_table_get_n(hash_table_t *ht, const char *key, size_t len);
+EXPORT void *hash_table_get_prehashed(hash_table_t *ht, hash_key_t key);
 EXPORT void *hash_table_get_idx(hash_table_t *ht, size_t idx, const char **key);
 
 #ifdef __cplusplus
@@ -0,0 +1,332 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "job-pool.h"
+#include "threading.h"
+#include "ring-queue.h"
+#include "darray.h"
+#include "bmem.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+struct job {
+	job_func_t func;
+	void      *param;
+};
+
+struct job_queue {
+	os_mutex_t *mutex;
+	DARRAY(struct job) jobs;
+	size_t head; /* thieves take from here, the owner from the back */
+};
+
+struct job_worker {
+	struct job_pool *pool;
+	struct job_queue queue;
+	os_thread_t     *thread;
+	size_t           idx;
+};
+
+/* jobs go into the shared ring while there's room, which no push or take
+ * has to lock for, and are spread over the worker queues when it's full */
+#define JOB_RING_CAPACITY 1024
+
+struct job_pool {
+	struct job_worker *workers;
+	size_t             num_workers;
+	struct mpmc_ring   shared;
+
+	/* one count per queued job, and one per worker on shutdown */
+	os_sem_t *available;
+
+	/* signalled whenever the last pending job finishes */
+	os_event_t *idle;
+
+	volatile long pending;
+	volatile long next_queue;
+	volatile bool stop;
+};
+
+static inline void job_queue_reset_if_empty(struct job_queue *queue)
+{
+	if (queue->head == queue->jobs.size) {
+		queue->head = 0;
+		da_clear(queue->jobs);
+	}
+}
+
+static bool job_queue_pop_back(struct job_queue *queue, struct job *job)
+{
+	bool found = false;
+
+	os_mutex_lock(queue->mutex);
+	if (queue->head < queue->jobs.size) {
+		*job  = queue->jobs.array[--queue->jobs.size];
+		found = true;
+		job_queue_reset_if_empty(queue);
+	}
+	os_mutex_unlock(queue->mutex);
+
+	return found;
+}
+
+static bool job_queue_pop_front(struct job_queue *queue, struct job *job)
+{
+	bool found = false;
+
+	os_mutex_lock(queue->mutex);
+	if (queue->head < queue->jobs.size) {
+		*job  = queue->jobs.array[queue->head++];
+		found = true;
+		job_queue_reset_if_empty(queue);
+	}
+	os_mutex_unlock(queue->mutex);
+
+	return found;
+}
+
+static bool job_worker_take(struct job_worker *worker, struct job *job)
+{
+	struct job_pool *pool = worker->pool;
+	size_t           i;
+
+	if (mpmc_ring_pop(&pool->shared, job))
+		return true;
+	if (job_queue_pop_back(&worker->queue, job))
+		return true;
+
+	for (i = 1; i < pool->num_workers; i++) {
+		struct job_worker *victim = &pool->workers[(worker->idx + i) % pool->num_workers];
+		if (job_queue_pop_front(&victim->queue, job))
+			return true;
+	}
+
+	return false;
+}
+
+static void *job_worker_thread(void *param)
+{
+	struct job_worker *worker = param;
+	struct job_pool   *pool   = worker->pool;
+	struct job         job;
+
+	for (;;) {
+		os_sem_wait(pool->available);
+		if (os_atomic_load_bool(&pool->stop))
+			break;
+
+		/* every count on the semaphore is backed by a queued job that no
+		 * other worker can claim without taking a count of its own, so
+		 * this only loops if the job is stolen from a queue that was
+		 * already checked and retried in another */
+		while (!job_worker_take(worker, &job))
+			;
+
+		job.func(job.param, worker->idx);
+
+		if (os_atomic_dec_long(&pool->pending) == 0)
+			os_event_signal(pool->idle);
+	}
+
+	return NULL;
+}
+
+struct job_pool *job_pool_create(size_t num_threads)
+{
+	struct job_pool *pool = bzalloc(sizeof(*pool));
+	size_t           i;
+
+	if (!num_threads)
+		num_threads = os_get_logical_cores();
+
+	pool->num_workers = num_threads;
+	pool->workers     = bzalloc(sizeof(struct job_worker) * num_threads);
+	pool->available   = os_sem_create(0);
+	pool->idle        = os_event_create(OS_EVENT_TYPE_AUTO);
+	mpmc_ring_init(&pool->shared, sizeof(struct job), JOB_RING_CAPACITY);
+
+	for (i = 0; i < num_threads; i++) {
+		struct job_worker *worker = &pool->workers[i];
+		worker->pool              = pool;
+		worker->idx               = i;
+		worker->queue.mutex       = os_mutex_create();
+	}
+
+	/* start the threads once every queue exists, since they steal */
+	for (i = 0; i < num_threads; i++) {
+		struct job_worker *worker = &pool->workers[i];
+		worker->thread            = os_thread_create(job_worker_thread, worker);
+	}
+
+	return pool;
+}
+
+void job_pool_destroy(struct job_pool *pool)
+{
+	size_t i;
+
+	if (!pool)
+		return;
+
+	job_pool_wait(pool);
+
+	os_atomic_store_bool(&pool->stop, true);
+	for (i = 0; i < pool->num_workers; i++)
+		os_sem_post(pool->available);
+
+	for (i = 0; i < pool->num_workers; i++) {
+		struct job_worker *worker = &pool->workers[i];
+		os_thread_join(worker->thread);
+		os_mutex_destroy(worker->queue.mutex);
+		da_free(worker->queue.jobs);
+	}
+
+	mpmc_ring_free(&pool->shared);
+	os_event_destroy(pool->idle);
+	os_sem_destroy(pool->available);
+	bfree(pool->workers);
+	bfree(pool);
+}
+
+void job_pool_push(struct job_pool *pool, job_func_t func, void *param)
+{
+	struct job         job = {func, param};
+	struct job_worker *worker;
+	size_t             idx;
+
+	os_atomic_inc_long(&pool->pending);
+
+	if (!mpmc_ring_push(&pool->shared, &job)) {
+		idx    = (size_t)(unsigned long)os_atomic_inc_long(&pool->next_queue) % pool->num_workers;
+		worker = &pool->workers[idx];
+
+		os_mutex_lock(worker->queue.mutex);
+		da_push_back(worker->queue.jobs, &job);
+		os_mutex_unlock(worker->queue.mutex);
+	}
+
+	os_sem_post(pool->available);
+}
+
+void job_pool_wait(struct job_pool *pool)
+{
+	/* the event can be left signalled by an earlier batch, so it only
+	 * means "check again" */
+	while (os_atomic_load_long(&pool->pending))
+		os_event_wait(pool->idle);
+}
+
+size_t job_pool_thread_count(const struct job_pool *pool)
+{
+	return pool->num_workers;
+}
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+/* more than fit in the shared ring, so the worker queues get used too */
+#define TEST_JOBS 5000
+#define TEST_THREADS 4
+
+struct test_jobs {
+	struct job_pool *pool;
+	volatile long    count;
+	volatile long    spawned;
+	volatile long    per_worker[TEST_THREADS];
+	volatile long    done[TEST_JOBS];
+	volatile long    bad_workers; /* checked after the run, cmocka can't fail in a job */
+};
+
+struct test_job {
+	struct test_jobs *jobs;
+	size_t            idx;
+};
+
+static void test_count_job(void *param, size_t worker)
+{
+	struct test_job *job = param;
+
+	if (worker >= TEST_THREADS) {
+		os_atomic_inc_long(&job->jobs->bad_workers);
+		return;
+	}
+	os_atomic_inc_long(&job->jobs->count);
+	os_atomic_inc_long(&job->jobs->per_worker[worker]);
+	os_atomic_inc_long(&job->jobs->done[job->idx]);
+}
+
+static void test_spawn_job(void *param, size_t worker)
+{
+	struct test_jobs *jobs = param;
+
+	os_atomic_inc_long(&jobs->spawned);
+	if (os_atomic_load_long(&jobs->spawned) < 100)
+		job_pool_push(jobs->pool, test_spawn_job, jobs);
+
+	UNUSED_PARAMETER(worker);
+}
+
+void job_pool_test_run(void **state)
+{
+	struct test_jobs jobs = {0};
+	struct test_job  job_params[TEST_JOBS];
+	long             total = 0;
+	size_t           i;
+
+	jobs.pool = job_pool_create(TEST_THREADS);
+	assert_int_equal(job_pool_thread_count(jobs.pool), TEST_THREADS);
+
+	/* waiting with nothing queued returns right away */
+	job_pool_wait(jobs.pool);
+
+	for (i = 0; i < TEST_JOBS; i++) {
+		job_params[i].jobs = &jobs;
+		job_params[i].idx  = i;
+		job_pool_push(jobs.pool, test_count_job, &job_params[i]);
+	}
+	job_pool_wait(jobs.pool);
+
+	assert_int_equal(jobs.bad_workers, 0);
+	assert_int_equal(jobs.count, TEST_JOBS);
+	for (i = 0; i < TEST_JOBS; i++)
+		assert_int_equal(jobs.done[i], 1);
+	for (i = 0; i < TEST_THREADS; i++)
+		total += jobs.per_worker[i];
+	assert_int_equal(total, TEST_JOBS);
+
+	/* jobs pushed by jobs are waited on too */
+	job_pool_push(jobs.pool, test_spawn_job, &jobs);
+	job_pool_wait(jobs.pool);
+	assert_int_equal(jobs.spawned, 100);
+
+	/* and the pool can be reused after waiting */
+	jobs.count = 0;
+	for (i = 0; i < TEST_JOBS; i++) {
+		jobs.done[i] = 0;
+		job_pool_push(jobs.pool, test_count_job, &job_params[i]);
+	}
+	job_pool_destroy(jobs.pool);
+	assert_int_equal(jobs.count, TEST_JOBS);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
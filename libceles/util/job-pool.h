@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "util-defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Work-stealing job pool.  Jobs go into a shared lock-free ring first, and
+ * once that's full they're dealt out to per-worker queues in turn.  Workers
+ * take from the ring, then from the back of their own queue, and once that
+ * runs dry they steal from the front of the others, so a few slow jobs don't
+ * leave the rest of their queue waiting.
+ *
+ * Jobs receive the index of the worker running them, which is always less
+ * than job_pool_thread_count(), so callers can keep per-thread state in a
+ * plain array.  Jobs may push more jobs.
+ */
+
+typedef void (*job_func_t)(void *param, size_t worker);
+
+struct job_pool;
+
+/* num_threads of 0 creates one worker per logical core */
+EXPORT struct job_pool *job_pool_create(size_t num_threads);
+EXPORT void             job_pool_destroy(struct job_pool *pool);
+
+EXPORT void job_pool_push(struct job_pool *pool, job_func_t func, void *param);
+
+/* blocks until every job pushed so far, and every job they pushed, is done */
+EXPORT void job_pool_wait(struct job_pool *pool);
+
+EXPORT size_t job_pool_thread_count(const struct job_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
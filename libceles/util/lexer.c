@@ -16,6 +16,13 @@
 
 #include <ctype.h>
 #include "lexer.h"
+#include "utf8.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
 
 static const char *astrblank = "";
 
@@ -291,6 +298,9 @@ static bool next_utf32(const char **text, wint_t *ch)
 			return false;                                                                                  \
 	} while (false)
 
+	/* sequences that encode a character in more bytes than it needs,
+	 * surrogates and anything past U+10FFFF are all invalid (RFC 3629) */
+
 	if ((*ch & 0x80) == 0) {
 		if (*ch == 0)
 			return false;
@@ -303,7 +313,7 @@ static bool next_utf32(const char **text, wint_t *ch)
 		out |= *ch & 0x3F;
 		++*text;
 		*ch = out;
-		return !!out;
+		return out >= 0x80;
 
 	} else if ((*ch & 0xF0) == 0xE0) {
 		out = (*ch & 0x0F) << 12;
@@ -313,7 +323,7 @@ static bool next_utf32(const char **text, wint_t *ch)
 		out |= *ch & 0x3F;
 		++*text;
 		*ch = out;
-		return !!out;
+		return out >= 0x800 && (out < 0xD800 || out > 0xDFFF);
 
 	} else if ((*ch & 0xF8) == 0xF0) {
 		out = (*ch & 0x07) << 18;
@@ -325,21 +335,7 @@ static bool next_utf32(const char **text, wint_t *ch)
 		out |= *ch & 0x3F;
 		++*text;
 		*ch = out;
-		return !!out;
-
-	} else if ((*ch & 0xFC) == 0xF8) {
-		out = (*ch & 0x03) << 24;
-		get_next_ch();
-		out = (*ch & 0x3F) << 18;
-		get_next_ch();
-		out |= (*ch & 0x3F) << 12;
-		get_next_ch();
-		out |= (*ch & 0x3F) << 6;
-		get_next_ch();
-		out |= *ch & 0x3F;
-		++*text;
-		*ch = out;
-		return !!out;
+		return out >= 0x10000 && out <= 0x10FFFF;
 	}
 
 #undef get_next_ch
@@ -347,6 +343,36 @@ static bool next_utf32(const char **text, wint_t *ch)
 	return false;
 }
 
+/* for text that lexer_validate_utf8() has passed, where the lead byte is all
+ * that has to be looked at */
+static inline void next_utf32_unchecked(const char **text, wint_t *ch)
+{
+	const uint8_t *p = (const uint8_t *)*text;
+
+	if (p[0] < 0xE0) {
+		*ch = ((wint_t)(p[0] & 0x1F) << 6) | (p[1] & 0x3F);
+		*text += 2;
+	} else if (p[0] < 0xF0) {
+		*ch = ((wint_t)(p[0] & 0x0F) << 12) | ((wint_t)(p[1] & 0x3F) << 6) | (p[2] & 0x3F);
+		*text += 3;
+	} else {
+		*ch = ((wint_t)(p[0] & 0x07) << 18) | ((wint_t)(p[1] & 0x3F) << 12) | ((wint_t)(p[2] & 0x3F) << 6) |
+		      (p[3] & 0x3F);
+		*text += 4;
+	}
+}
+
+/* decodes a non-ASCII character at the lexer's text, returns false for
+ * invalid sequences */
+static inline bool lexer_next_utf32(const struct lexer *lex, const char **text, wint_t *ch)
+{
+	if (lex->utf8_valid && *text < lex->text + lex->size) {
+		next_utf32_unchecked(text, ch);
+		return true;
+	}
+	return next_utf32(text, ch);
+}
+
 static inline enum base_token_type get_char_token_type(const wint_t ch)
 {
 	if (iswspace(ch))
@@ -359,17 +385,165 @@ static inline enum base_token_type get_char_token_type(const wint_t ch)
 	return BASE_TOKEN_OTHER;
 }
 
-static bool lexer_get_token_internal(struct lexer *lex, struct base_token *token, enum ignore_whitespace iws, bool pop)
+/* ------------------------------------------------------------------------- */
+/* ASCII fast path                                                           */
+
+/* Token type of every ASCII byte, matching get_char_token_type() for the C
+ * locale. NUL maps to BASE_TOKEN_NONE, and bytes with the high bit set map to
+ * CHAR_MULTIBYTE so they go through the full UTF-8 decoder. */
+
+#define CHAR_MULTIBYTE 0xFF
+
+#define N BASE_TOKEN_NONE
+#define A BASE_TOKEN_ALPHA
+#define D BASE_TOKEN_DIGIT
+#define W BASE_TOKEN_WHITESPACE
+#define O BASE_TOKEN_OTHER
+#define U CHAR_MULTIBYTE
+
+static const uint8_t ascii_token_types[256] = {
+        N, O, O, O, O, O, O, O, O, W, W, W, W, W, O, O, /* 0x00 */
+        O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 0x10 */
+        W, O, O, O, O, O, O, O, O, O, O, O, O, O, O, O, /* 0x20 */
+        D, D, D, D, D, D, D, D, D, D, O, O, O, O, O, O, /* 0x30 */
+        O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, /* 0x40 */
+        A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O, /* 0x50 */
+        O, A, A, A, A, A, A, A, A, A, A, A, A, A, A, A, /* 0x60 */
+        A, A, A, A, A, A, A, A, A, A, A, O, O, O, O, O, /* 0x70 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0x80 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0x90 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0xA0 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0xB0 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0xC0 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0xD0 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0xE0 */
+        U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, U, /* 0xF0 */
+};
+
+#undef N
+#undef A
+#undef D
+#undef W
+#undef O
+#undef U
+
+/* Spaces and tabs, the only whitespace that is skipped in bulk.  newlines
+ * have to go through the main loop, as they set passed_newline */
+static inline bool is_blank_byte(uint8_t byte)
+{
+	return byte == ' ' || byte == '\t';
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LEXER_SSE2
+
+static inline unsigned ctz32(uint32_t mask)
+{
+#ifdef _MSC_VER
+	unsigned long idx;
+	_BitScanForward(&idx, mask);
+	return (unsigned)idx;
+#else
+	return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+/* returns a mask with one bit set for every byte of the block that matches
+ * the requested class */
+static inline uint32_t match_block(const char *p, enum base_token_type type)
+{
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+	__m128i match;
+
+	if (type == BASE_TOKEN_ALPHA) {
+		__m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+		match         = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                      _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+	} else if (type == BASE_TOKEN_DIGIT) {
+		match = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+		                      _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+	} else {
+		match = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+	}
+
+	return (uint32_t)_mm_movemask_epi8(match);
+}
+
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define LEXER_NEON
+
+/* returns a mask with four bits set for every byte of the block that matches
+ * the requested class */
+static inline uint64_t match_block(const char *p, enum base_token_type type)
+{
+	uint8x16_t v = vld1q_u8((const uint8_t *)p);
+	uint8x16_t match;
+
+	if (type == BASE_TOKEN_ALPHA) {
+		uint8x16_t lower = vorrq_u8(v, vdupq_n_u8(0x20));
+		match            = vandq_u8(vcgeq_u8(lower, vdupq_n_u8('a')), vcleq_u8(lower, vdupq_n_u8('z')));
+	} else if (type == BASE_TOKEN_DIGIT) {
+		match = vandq_u8(vcgeq_u8(v, vdupq_n_u8('0')), vcleq_u8(v, vdupq_n_u8('9')));
+	} else {
+		match = vorrq_u8(vceqq_u8(v, vdupq_n_u8(' ')), vceqq_u8(v, vdupq_n_u8('\t')));
+	}
+
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+}
+#endif
+
+/*
+ * Returns the end of the run of ASCII bytes starting at p that are of the
+ * given class (alpha, digit, or blank whitespace). Runs never contain NUL or
+ * multibyte characters, so the caller falls back to the UTF-8 decoder at
+ * wherever a run ends. Blocks are only loaded if they are fully within the
+ * lexer's buffer; the remainder is scanned a byte at a time.
+ */
+static const char *scan_ascii_run(const char *p, const char *end, enum base_token_type type)
+{
+#if defined(LEXER_SSE2)
+	while (p + 16 <= end) {
+		uint32_t mask = match_block(p, type);
+		if (mask != 0xFFFF)
+			return p + ctz32(~mask);
+		p += 16;
+	}
+#elif defined(LEXER_NEON)
+	while (p + 16 <= end) {
+		uint64_t mask = match_block(p, type);
+		if (mask != UINT64_MAX)
+			return p + (__builtin_ctzll(~mask) >> 2);
+		p += 16;
+	}
+#endif
+
+	if (type == BASE_TOKEN_WHITESPACE) {
+		while (is_blank_byte((uint8_t)*p))
+			p++;
+	} else {
+		while (ascii_token_types[(uint8_t)*p] == type)
+			p++;
+	}
+	return p;
+}
+
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Scans the next token from the lexer's current position without moving the
+ * lexer. The next_* members of the token are always set, even if no token was
+ * found, as ignored whitespace is still consumed by lexer_get_token().
+ */
+static bool lexer_scan_token(const struct lexer *lex, struct base_token *token, enum ignore_whitespace iws)
 {
 	const char          *offset            = lex->offset;
+	const char          *end               = lex->text + lex->size;
 	const char          *prev              = offset;
 	const char          *token_start       = NULL;
 	wint_t               ch                = 0;
 	wint_t               out_ch            = 0;
-	uint32_t             row               = lex->row;
-	uint32_t             col               = lex->col;
-	uint32_t             start_row         = row;
-	uint32_t             start_col         = col;
 	enum base_token_type type              = BASE_TOKEN_NONE;
 	enum whitespace_type ws_type           = WHITESPACE_TYPE_UNKNOWN;
 	bool                 passed_whitespace = false;
@@ -378,12 +552,30 @@ static bool lexer_get_token_internal(struct lexer *lex, struct base_token *token
 	bool                 stop_parsing      = false;
 	size_t               count             = 0;
 
+	token->next_offset = offset;
+
 	if (!offset) {
 		return false;
 	}
 
-	while (!stop_parsing && next_utf32(&offset, &ch)) {
-		enum base_token_type new_type = get_char_token_type(ch);
+	while (!stop_parsing) {
+		enum base_token_type new_type;
+		uint8_t              byte = (uint8_t)*offset;
+
+		if (byte < 0x80) {
+			if (!byte)
+				break;
+
+			ch       = byte;
+			new_type = (enum base_token_type)ascii_token_types[byte];
+			offset++;
+
+		} else {
+			if (!lexer_next_utf32(lex, &offset, &ch))
+				break;
+
+			new_type = get_char_token_type(ch);
+		}
 
 		if (type == BASE_TOKEN_NONE) {
 			bool ignore = false;
@@ -411,8 +603,6 @@ static bool lexer_get_token_internal(struct lexer *lex, struct base_token *token
 				out_ch      = ch;
 				token_start = prev;
 				type        = new_type;
-				start_row   = row;
-				start_col   = col;
 
 				if (type != BASE_TOKEN_DIGIT && type != BASE_TOKEN_ALPHA) {
 					stop_parsing = true;
@@ -426,54 +616,80 @@ static bool lexer_get_token_internal(struct lexer *lex, struct base_token *token
 			count++;
 		}
 
-		if (is_newline(ch)) {
-			if (is_newline_pair(ch, *offset)) {
-				offset++;
-			}
+		if (is_newline(ch) && is_newline_pair(ch, *offset)) {
+			offset++;
+		}
 
-			row++;
-			col = 1;
-		} else {
-			col++;
+		/* consume the rest of an ASCII alpha/digit run, or a run of ignored
+		 * spaces/tabs, in bulk */
+		if (type == BASE_TOKEN_ALPHA || type == BASE_TOKEN_DIGIT) {
+			const char *run_end = scan_ascii_run(offset, end, type);
+			count += (size_t)(run_end - offset);
+			offset = run_end;
+
+		} else if (type == BASE_TOKEN_NONE && (ch == ' ' || ch == '\t')) {
+			offset = scan_ascii_run(offset, end, BASE_TOKEN_WHITESPACE);
 		}
 
 		prev = offset;
 	}
 
-	if (pop) {
-		lex->offset = offset;
-		lex->row    = row;
-		lex->col    = col;
-	}
+	token->next_offset = offset;
 
 	if (token_start && offset > token_start) {
-		if (token) {
-			strref_set(&token->text, token_start, offset - token_start);
-			token->ch                = count == 1 ? out_ch : 0;
-			token->type              = type;
-			token->ws_type           = ws_type;
-			token->passed_whitespace = passed_whitespace;
-			token->passed_newline    = passed_newline;
-			token->row               = start_row;
-			token->col               = start_col;
-			token->next_offset       = offset;
-			token->next_row          = row;
-			token->next_col          = col;
-		}
+		strref_set(&token->text, token_start, offset - token_start);
+		token->ch                = count == 1 ? out_ch : 0;
+		token->type              = type;
+		token->ws_type           = ws_type;
+		token->passed_whitespace = passed_whitespace;
+		token->passed_newline    = passed_newline;
 		return true;
 	}
 
 	return false;
 }
 
+static inline bool lexer_peek_cached(const struct lexer *lex, enum ignore_whitespace iws)
+{
+	return lex->peek_offset && lex->peek_offset == lex->offset && lex->peek_iws == iws;
+}
+
 bool lexer_peek_token(struct lexer *lex, struct base_token *t, enum ignore_whitespace iws)
 {
-	return lexer_get_token_internal(lex, t, iws, false);
+	if (!lexer_peek_cached(lex, iws)) {
+		lex->peek_result = lexer_scan_token(lex, &lex->peek_token, iws);
+		lex->peek_offset = lex->offset;
+		lex->peek_iws    = iws;
+	}
+
+	if (lex->peek_result && t) {
+		base_token_copy(t, &lex->peek_token);
+	}
+	return lex->peek_result;
 }
 
 bool lexer_get_token(struct lexer *lex, struct base_token *t, enum ignore_whitespace iws)
 {
-	return lexer_get_token_internal(lex, t, iws, true);
+	struct base_token        scanned;
+	const struct base_token *token;
+	bool                     success;
+
+	if (lexer_peek_cached(lex, iws)) {
+		token   = &lex->peek_token;
+		success = lex->peek_result;
+	} else {
+		token   = &scanned;
+		success = lexer_scan_token(lex, &scanned, iws);
+	}
+
+	if (token->next_offset) {
+		lex->offset = token->next_offset;
+	}
+
+	if (success && t) {
+		base_token_copy(t, token);
+	}
+	return success;
 }
 
 static bool lexer_get_char_internal(struct lexer *lex, struct base_token *token, bool pop)
@@ -482,19 +698,16 @@ static bool lexer_get_char_internal(struct lexer *lex, struct base_token *token,
 	const char          *prev        = offset;
 	const char          *token_start = offset;
 	wint_t               ch          = 0;
-	uint32_t             row         = lex->row;
-	uint32_t             col         = lex->col;
-	uint32_t             start_row   = row;
-	uint32_t             start_col   = col;
 	enum base_token_type type        = BASE_TOKEN_NONE;
 	enum whitespace_type ws_type     = WHITESPACE_TYPE_UNKNOWN;
 
-	if (!next_utf32(&offset, &ch)) {
+	if ((uint8_t)*offset < 0x80) {
+		if (!next_utf32(&offset, &ch))
+			return false;
+	} else if (!lexer_next_utf32(lex, &offset, &ch)) {
 		return false;
 	}
 
-	col++;
-
 	type = get_char_token_type(ch);
 	if (type == BASE_TOKEN_WHITESPACE) {
 		if (is_newline(ch)) {
@@ -503,8 +716,6 @@ static bool lexer_get_char_internal(struct lexer *lex, struct base_token *token,
 			}
 
 			ws_type = WHITESPACE_TYPE_NEWLINE;
-			col     = 1;
-			row++;
 
 		} else if (ch == '\t') {
 			ws_type = WHITESPACE_TYPE_TAB;
@@ -516,8 +727,6 @@ static bool lexer_get_char_internal(struct lexer *lex, struct base_token *token,
 
 	if (pop) {
 		lex->offset = offset;
-		lex->row    = row;
-		lex->col    = col;
 	}
 
 	if (token_start && offset > token_start) {
@@ -528,11 +737,7 @@ static bool lexer_get_char_internal(struct lexer *lex, struct base_token *token,
 			token->ws_type           = ws_type;
 			token->passed_whitespace = false;
 			token->passed_newline    = false;
-			token->row               = start_row;
-			token->col               = start_col;
 			token->next_offset       = offset;
-			token->next_row          = row;
-			token->next_col          = col;
 		}
 		return true;
 	}
@@ -549,3 +754,650 @@ bool lexer_get_char(struct lexer *lex, struct base_token *token)
 {
 	return lexer_get_char_internal(lex, token, true);
 }
+
+/* ------------------------------------------------------------------------- */
+
+#define MAX_SKIP_BYTES 8
+
+/* returns the first byte in [p, end) that is NUL or one of the given bytes,
+ * or end if there is none */
+static const char *find_any(const char *p, const char *end, const char *bytes, size_t count)
+{
+	bool   table[256];
+	size_t i;
+
+#if defined(LEXER_SSE2)
+	while (p + 16 <= end) {
+		__m128i v     = _mm_loadu_si128((const __m128i *)p);
+		__m128i match = _mm_cmpeq_epi8(v, _mm_setzero_si128());
+		uint32_t mask;
+
+		for (i = 0; i < count; i++)
+			match = _mm_or_si128(match, _mm_cmpeq_epi8(v, _mm_set1_epi8(bytes[i])));
+
+		mask = (uint32_t)_mm_movemask_epi8(match);
+		if (mask)
+			return p + ctz32(mask);
+		p += 16;
+	}
+#elif defined(LEXER_NEON)
+	while (p + 16 <= end) {
+		uint8x16_t v     = vld1q_u8((const uint8_t *)p);
+		uint8x16_t match = vceqq_u8(v, vdupq_n_u8(0));
+		uint64_t   mask;
+
+		for (i = 0; i < count; i++)
+			match = vorrq_u8(match, vceqq_u8(v, vdupq_n_u8((uint8_t)bytes[i])));
+
+		mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+		if (mask)
+			return p + (__builtin_ctzll(mask) >> 2);
+		p += 16;
+	}
+#endif
+
+	memset(table, 0, sizeof(table));
+	table[0] = true;
+	for (i = 0; i < count; i++)
+		table[(uint8_t)bytes[i]] = true;
+
+	while (p < end && !table[(uint8_t)*p])
+		p++;
+	return p;
+}
+
+static inline bool lexer_at_end(const struct lexer *lex)
+{
+	return lex->offset >= lex->text + lex->size || !*lex->offset;
+}
+
+bool lexer_skip_to_any(struct lexer *lex, const char *bytes)
+{
+	size_t count = strlen(bytes);
+
+	if (!lex->offset)
+		return false;
+
+	if (count > MAX_SKIP_BYTES) {
+		os_breakpoint();
+		count = MAX_SKIP_BYTES;
+	}
+
+	lex->offset = find_any(lex->offset, lex->text + lex->size, bytes, count);
+	return !lexer_at_end(lex);
+}
+
+bool lexer_skip_line(struct lexer *lex)
+{
+	if (!lexer_skip_to_any(lex, "\r\n"))
+		return false;
+
+	if (lex->offset + 1 < lex->text + lex->size && is_newline_pair((uint8_t)lex->offset[0], (uint8_t)lex->offset[1]))
+		lex->offset++;
+	lex->offset++;
+	return true;
+}
+
+bool lexer_validate_utf8(struct lexer *lex, size_t *error_offset)
+{
+	lex->utf8_valid = utf8_validate(lex->text, lex->size, error_offset);
+	return lex->utf8_valid;
+}
+
+/* the rest of the text was valid before, so only the new text and the
+ * characters at either end that it might have cut into have to be checked */
+static bool replacement_is_valid_utf8(const char *text, size_t size, size_t start, size_t end)
+{
+	if (start)
+		start--;
+	while (start && ((uint8_t)text[start] & 0xC0) == 0x80)
+		start--;
+	while (end < size && ((uint8_t)text[end] & 0xC0) == 0x80)
+		end++;
+
+	return utf8_validate(text + start, end - start, NULL);
+}
+
+void lexer_replace(struct lexer *lex, size_t offset, size_t remove, const char *text, size_t size)
+{
+	size_t tail;
+	size_t new_size;
+	char  *buf;
+
+	if (offset > lex->size)
+		offset = lex->size;
+	if (remove > lex->size - offset)
+		remove = lex->size - offset;
+
+	tail     = lex->size - offset - remove;
+	new_size = lex->size - remove + size;
+
+	if (lex->owns_memory) {
+		buf = (char *)lex->text;
+		if (size > remove)
+			buf = brealloc(buf, new_size + 1);
+		memmove(buf + offset + size, buf + offset + remove, tail);
+	} else {
+		buf = bmalloc(new_size + 1);
+		if (lex->text) {
+			memcpy(buf, lex->text, offset);
+			memcpy(buf + offset + size, lex->text + offset + remove, tail);
+		}
+		os_munmap_file(&lex->mapping);
+		lex->owns_memory = true;
+	}
+
+	if (size)
+		memcpy(buf + offset, text, size);
+	buf[new_size] = 0;
+
+	lex->text        = buf;
+	lex->size        = new_size;
+	lex->offset      = buf;
+	lex->peek_offset = NULL;
+	da_free(lex->line_starts);
+
+	if (lex->utf8_valid)
+		lex->utf8_valid = replacement_is_valid_utf8(buf, new_size, offset, offset + size);
+}
+
+bool lexer_skip_char(struct lexer *lex)
+{
+	if (!lex->offset || lexer_at_end(lex))
+		return false;
+
+	/* the lead byte, then any continuation bytes */
+	lex->offset++;
+	while (lex->offset < lex->text + lex->size && ((uint8_t)*lex->offset & 0xC0) == 0x80)
+		lex->offset++;
+	return true;
+}
+
+/* returns the first '\r' or '\n' in [p, end), or end if there is none */
+static const char *find_newline(const char *p, const char *end)
+{
+#if defined(LEXER_SSE2)
+	while (p + 16 <= end) {
+		__m128i  v    = _mm_loadu_si128((const __m128i *)p);
+		uint32_t mask = (uint32_t)_mm_movemask_epi8(
+		        _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')), _mm_cmpeq_epi8(v, _mm_set1_epi8('\r'))));
+		if (mask)
+			return p + ctz32(mask);
+		p += 16;
+	}
+#elif defined(LEXER_NEON)
+	while (p + 16 <= end) {
+		uint8x16_t v     = vld1q_u8((const uint8_t *)p);
+		uint8x16_t match = vorrq_u8(vceqq_u8(v, vdupq_n_u8('\n')), vceqq_u8(v, vdupq_n_u8('\r')));
+		uint64_t   mask  = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(match), 4)), 0);
+		if (mask)
+			return p + (__builtin_ctzll(mask) >> 2);
+		p += 16;
+	}
+#endif
+
+	while (p < end && *p != '\n' && *p != '\r')
+		p++;
+	return p;
+}
+
+/* newlines are counted the same way the token scanner consumes them, with
+ * "\r\n" and "\n\r" pairs counting as one */
+static void build_line_starts(struct lexer *lex)
+{
+	const char *text = lex->text;
+	const char *end  = text + lex->size;
+	const char *p    = text;
+	size_t      start = 0;
+
+	da_push_back(lex->line_starts, &start);
+
+	while ((p = find_newline(p, end)) < end) {
+		if (p + 1 < end && is_newline_pair((uint8_t)p[0], (uint8_t)p[1]))
+			p++;
+
+		start = (size_t)(++p - text);
+		da_push_back(lex->line_starts, &start);
+	}
+}
+
+void lexer_get_position(struct lexer *lex, const char *offset, uint32_t *row, uint32_t *col)
+{
+	size_t      pos;
+	size_t      lo = 0;
+	size_t      hi;
+	const char *cur;
+	uint32_t    column = 1;
+
+	if (!lex->text) {
+		*row = 1;
+		*col = 1;
+		return;
+	}
+
+	if ((uintptr_t)offset < (uintptr_t)lex->text || (uintptr_t)offset > (uintptr_t)(lex->text + lex->size))
+		offset = lex->offset;
+
+	if (!lex->line_starts.size)
+		build_line_starts(lex);
+
+	/* last line starting at or before the offset */
+	pos = (size_t)(offset - lex->text);
+	hi  = lex->line_starts.size;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (lex->line_starts.array[mid] <= pos)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	for (cur = lex->text + lex->line_starts.array[lo]; cur < offset; cur++) {
+		if (((uint8_t)*cur & 0xC0) != 0x80)
+			column++;
+	}
+
+	*row = (uint32_t)lo + 1;
+	*col = column;
+}
+
+/* ------------------------------------------------------------------------- */
+
+#define LEXER_PIPE_DEFAULT_CAPACITY 1024
+#define LEXER_PIPE_BATCH 32
+#define LEXER_PIPE_SPINS 64
+
+/* spins for a short while first, since the other side is usually only a few
+ * tokens behind */
+static inline void lexer_pipe_wait(unsigned int *spins)
+{
+	if (++*spins < LEXER_PIPE_SPINS) {
+		os_cpu_relax();
+	} else {
+		os_thread_yield();
+	}
+}
+
+/* tokens are published in batches, which keeps the consumer from pulling the
+ * ring's head over from the lexer's cache for every token */
+static bool lexer_pipe_push(struct lexer_pipe *pipe, const struct base_token *t, size_t count)
+{
+	unsigned int spins = 0;
+
+	while (!spsc_ring_push_deferred(&pipe->tokens, t)) {
+		spsc_ring_publish(&pipe->tokens);
+		if (os_atomic_load_bool(&pipe->stop))
+			return false;
+		lexer_pipe_wait(&spins);
+	}
+
+	if (count % LEXER_PIPE_BATCH == 0)
+		spsc_ring_publish(&pipe->tokens);
+	return true;
+}
+
+static void *lexer_pipe_thread(void *param)
+{
+	struct lexer_pipe *pipe  = param;
+	struct base_token  token;
+	size_t             count = 0;
+
+	while (lexer_get_token(pipe->lex, &token, pipe->iws)) {
+		if (!lexer_pipe_push(pipe, &token, ++count))
+			return NULL;
+	}
+
+	/* a token of type none marks the end */
+	base_token_clear(&token);
+	if (lexer_pipe_push(pipe, &token, ++count))
+		spsc_ring_publish(&pipe->tokens);
+	return NULL;
+}
+
+bool lexer_pipe_start(struct lexer_pipe *pipe, struct lexer *lex, enum ignore_whitespace iws, size_t capacity)
+{
+	memset(pipe, 0, sizeof(*pipe));
+	pipe->lex = lex;
+	pipe->iws = iws;
+
+	spsc_ring_init(&pipe->tokens, sizeof(struct base_token), capacity ? capacity : LEXER_PIPE_DEFAULT_CAPACITY);
+
+	pipe->thread = os_thread_create(lexer_pipe_thread, pipe);
+	if (!pipe->thread) {
+		spsc_ring_free(&pipe->tokens);
+		return false;
+	}
+
+	return true;
+}
+
+bool lexer_pipe_next(struct lexer_pipe *pipe, struct base_token *t)
+{
+	unsigned int spins = 0;
+
+	if (pipe->done)
+		return false;
+
+	while (!spsc_ring_pop(&pipe->tokens, t))
+		lexer_pipe_wait(&spins);
+
+	if (t->type == BASE_TOKEN_NONE) {
+		pipe->done = true;
+		return false;
+	}
+
+	return true;
+}
+
+void lexer_pipe_stop(struct lexer_pipe *pipe)
+{
+	if (!pipe->thread)
+		return;
+
+	os_atomic_store_bool(&pipe->stop, true);
+	os_thread_join(pipe->thread);
+	spsc_ring_free(&pipe->tokens);
+	pipe->thread = NULL;
+}
+
+#ifdef ENABLE_TESTS
+
+static void check_token(struct lexer         *lexx,
+                        enum ignore_whitespace iws,
+                        const char            *text,
+                        enum base_token_type   type,
+                        uint32_t               row,
+                        uint32_t               col)
+{
+	struct base_token token;
+	uint32_t          token_row;
+	uint32_t          token_col;
+
+	assert_true(lexer_get_token(lexx, &token, iws));
+	assert_int_equal(token.text.size, strlen(text));
+	assert_int_equal(strref_cmp(&token.text, text), 0);
+	assert_int_equal(token.type, type);
+
+	lexer_get_position(lexx, token.text.array, &token_row, &token_col);
+	assert_int_equal(token_row, row);
+	assert_int_equal(token_col, col);
+}
+
+void lexer_test_ascii_fast_path(void **state)
+{
+	struct lexer lexx;
+	const char  *text = "abcdefghijklmnopqrstuvwxyz0123456789 \t  \t   0123456789012345678901234567890123456789\n"
+	                    "  x\xC3\xA9y_z\r\n\t{ 42 }";
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, text, strlen(text));
+
+	check_token(&lexx, IGNORE_WHITESPACE, "abcdefghijklmnopqrstuvwxyz", BASE_TOKEN_ALPHA, 1, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, "0123456789", BASE_TOKEN_DIGIT, 1, 27);
+	check_token(&lexx,
+	            IGNORE_WHITESPACE,
+	            "0123456789012345678901234567890123456789",
+	            BASE_TOKEN_DIGIT,
+	            1,
+	            45);
+	check_token(&lexx, PARSE_WHITESPACE, "\n", BASE_TOKEN_WHITESPACE, 1, 85);
+	check_token(&lexx, PARSE_WHITESPACE, " ", BASE_TOKEN_WHITESPACE, 2, 1);
+
+	/* multibyte characters are part of alpha runs and count as one column */
+	check_token(&lexx, IGNORE_WHITESPACE, "x\xC3\xA9y", BASE_TOKEN_ALPHA, 2, 3);
+	check_token(&lexx, IGNORE_WHITESPACE, "_", BASE_TOKEN_OTHER, 2, 6);
+	check_token(&lexx, IGNORE_WHITESPACE, "z", BASE_TOKEN_ALPHA, 2, 7);
+	check_token(&lexx, IGNORE_WHITESPACE, "{", BASE_TOKEN_OTHER, 3, 2);
+	check_token(&lexx, IGNORE_WHITESPACE, "42", BASE_TOKEN_DIGIT, 3, 4);
+	check_token(&lexx, IGNORE_WHITESPACE, "}", BASE_TOKEN_OTHER, 3, 7);
+	assert_false(lexer_get_token(&lexx, NULL, IGNORE_WHITESPACE));
+
+	lexer_free(&lexx);
+
+	UNUSED_PARAMETER(state);
+}
+
+void lexer_test_utf8(void **state)
+{
+	struct lexer lexx;
+	const char  *text    = "x\xC3\xA9y \xE2\x82\xAC \xF0\x9F\x98\x80";
+	const char  *invalid = "ab \xC0\xAF"; /* an overlong '/' */
+	size_t       offset;
+
+	lexer_init(&lexx);
+
+	/* validated text is decoded unchecked */
+	lexer_start_static(&lexx, text, strlen(text));
+	assert_true(lexer_validate_utf8(&lexx, NULL));
+	check_token(&lexx, IGNORE_WHITESPACE, "x\xC3\xA9y", BASE_TOKEN_ALPHA, 1, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, "\xE2\x82\xAC", BASE_TOKEN_ALPHA, 1, 5);
+	check_token(&lexx, IGNORE_WHITESPACE, "\xF0\x9F\x98\x80", BASE_TOKEN_ALPHA, 1, 7);
+	assert_false(lexer_get_token(&lexx, NULL, IGNORE_WHITESPACE));
+
+	/* text that wasn't validated stops at invalid sequences */
+	lexer_start_static(&lexx, invalid, strlen(invalid));
+	check_token(&lexx, IGNORE_WHITESPACE, "ab", BASE_TOKEN_ALPHA, 1, 1);
+	assert_false(lexer_get_token(&lexx, NULL, IGNORE_WHITESPACE));
+	assert_false(lexer_validate_utf8(&lexx, &offset));
+	assert_int_equal(offset, 3);
+
+	lexer_free(&lexx);
+
+	UNUSED_PARAMETER(state);
+}
+
+void lexer_test_mapped(void **state)
+{
+	struct os_mapped_file file;
+	struct lexer          lexx;
+	const char           *path = "test-lexer-mapped.txt";
+	char                  text[4096 - 3 + 1];
+
+	/* with the BOM the file fills a page exactly, so the terminator can't
+	 * come from the tail of the file mapping */
+	memset(text, 'a', sizeof(text) - 1);
+	text[sizeof(text) - 1] = 0;
+	text[8]                = ' ';
+	assert_true(os_quick_write_utf8_file(path, text, sizeof(text) - 1, true));
+
+	assert_true(os_mmap_file(path, &file));
+	assert_int_equal(file.size, sizeof(text) - 1);
+	assert_int_equal(file.data[file.size], 0);
+	assert_memory_equal(file.data, text, file.size);
+
+	lexer_init(&lexx);
+	lexer_start_mapped(&lexx, &file);
+	assert_null(file.data);
+
+	check_token(&lexx, IGNORE_WHITESPACE, "aaaaaaaa", BASE_TOKEN_ALPHA, 1, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, text + 9, BASE_TOKEN_ALPHA, 1, 10);
+	assert_false(lexer_get_token(&lexx, NULL, IGNORE_WHITESPACE));
+	lexer_free(&lexx);
+
+	/* empty files map to an empty string */
+	assert_true(os_quick_write_utf8_file(path, "", 0, false));
+	assert_true(os_mmap_file(path, &file));
+	assert_int_equal(file.size, 0);
+	assert_string_equal(file.data, "");
+	os_munmap_file(&file);
+
+	remove(path);
+	assert_false(os_mmap_file(path, &file));
+
+	UNUSED_PARAMETER(state);
+}
+
+void lexer_test_positions(void **state)
+{
+	struct lexer lexx;
+	struct dstr  text = {0};
+	uint32_t     row;
+	uint32_t     col;
+	size_t       i;
+
+	/* every newline style, and lines long enough for the block scan */
+	dstr_cat(&text, "a\r\nb\n\rc\rd\ne\n\n");
+	for (i = 0; i < 40; i++)
+		dstr_cat_ch(&text, 'x');
+	dstr_cat(&text, "\xC3\xA9\xC3\xA9 y\r\n\r\nz");
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, text.array, text.size);
+
+	check_token(&lexx, IGNORE_WHITESPACE, "a", BASE_TOKEN_ALPHA, 1, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, "b", BASE_TOKEN_ALPHA, 2, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, "c", BASE_TOKEN_ALPHA, 3, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, "d", BASE_TOKEN_ALPHA, 4, 1);
+	check_token(&lexx, IGNORE_WHITESPACE, "e", BASE_TOKEN_ALPHA, 5, 1);
+	assert_true(lexer_get_token(&lexx, NULL, IGNORE_WHITESPACE));
+	check_token(&lexx, IGNORE_WHITESPACE, "y", BASE_TOKEN_ALPHA, 7, 44);
+	check_token(&lexx, IGNORE_WHITESPACE, "z", BASE_TOKEN_ALPHA, 9, 1);
+
+	/* the end of the text is a valid position, anything else isn't */
+	lexer_get_position(&lexx, text.array + text.size, &row, &col);
+	assert_int_equal(row, 9);
+	assert_int_equal(col, 2);
+	lexer_reset(&lexx);
+	lexer_get_position(&lexx, NULL, &row, &col);
+	assert_int_equal(row, 1);
+	assert_int_equal(col, 1);
+
+	lexer_free(&lexx);
+	dstr_free(&text);
+
+	UNUSED_PARAMETER(state);
+}
+
+void lexer_test_replace(void **state)
+{
+	struct lexer lexx;
+	const char  *text = "abc d\xc3\xbc";
+	uint32_t     row;
+	uint32_t     col;
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, text, strlen(text));
+	assert_true(lexer_validate_utf8(&lexx, NULL));
+
+	/* a static text is copied before it's changed */
+	lexer_replace(&lexx, 1, 1, "\nxy", 3);
+	assert_true(lexx.owns_memory);
+	assert_string_equal(lexx.text, "a\nxyc d\xc3\xbc");
+	assert_int_equal(lexx.size, strlen(lexx.text));
+	assert_true(lexx.utf8_valid);
+	assert_string_equal(text, "abc d\xc3\xbc");
+
+	/* lines are found again */
+	lexer_get_position(&lexx, lexx.text + 3, &row, &col);
+	assert_int_equal(row, 2);
+	assert_int_equal(col, 2);
+
+	/* cutting a character in half is caught without checking the rest */
+	lexer_replace(&lexx, lexx.size - 1, 1, "", 0);
+	assert_false(lexx.utf8_valid);
+	assert_string_equal(lexx.text, "a\nxyc d\xc3");
+
+	/* past the end appends */
+	lexer_replace(&lexx, 100, 5, "!", 1);
+	assert_string_equal(lexx.text, "a\nxyc d\xc3!");
+	assert_int_equal(lexx.offset - lexx.text, 0);
+
+	lexer_free(&lexx);
+	UNUSED_PARAMETER(state);
+}
+
+void lexer_test_skip(void **state)
+{
+	struct lexer lexx;
+	const char  *text = "a comment that is longer than a block\r\nnext 'str \\' x' */ y\0z";
+	const char  *quote;
+
+	lexer_init(&lexx);
+	lexer_start_static(&lexx, text, strlen(text) + 2);
+
+	assert_true(lexer_skip_line(&lexx));
+	check_token(&lexx, IGNORE_WHITESPACE, "next", BASE_TOKEN_ALPHA, 2, 1);
+
+	assert_true(lexer_skip_to_any(&lexx, "'"));
+	quote = lexx.offset;
+	assert_true(lexer_skip_char(&lexx));
+	assert_true(lexer_skip_to_any(&lexx, "'\\"));
+	assert_int_equal(*lexx.offset, '\\');
+	assert_true(lexer_skip_char(&lexx));
+	assert_true(lexer_skip_char(&lexx));
+	assert_true(lexer_skip_to_any(&lexx, "'\\"));
+	assert_int_equal(lexx.offset - quote, 9);
+
+	assert_true(lexer_skip_to_any(&lexx, "/*"));
+	assert_int_equal(astrcmp_n(lexx.offset, "*/", 2), 0);
+
+	/* NUL ends the text, like it does for tokens */
+	assert_false(lexer_skip_to_any(&lexx, "z"));
+	assert_int_equal(*lexx.offset, 0);
+	assert_false(lexer_skip_line(&lexx));
+	assert_false(lexer_skip_char(&lexx));
+
+	lexer_free(&lexx);
+
+	UNUSED_PARAMETER(state);
+}
+
+/* the pipe must give the same tokens as lexing directly, and be able to stop
+ * partway through */
+void lexer_test_pipe(void **state)
+{
+	struct dstr            text = {0};
+	struct lexer           direct;
+	struct lexer           piped;
+	struct lexer_pipe      pipe;
+	struct base_token      expected;
+	struct base_token      token;
+	enum ignore_whitespace iws;
+	size_t                 count;
+	size_t                 i;
+
+	for (i = 0; i < 2000; i++)
+		dstr_catf(&text, "value_%zu = call(%zu, 'Grüße');\n", i, i * 3);
+
+	for (iws = PARSE_WHITESPACE; iws <= IGNORE_WHITESPACE; iws++) {
+		lexer_init(&direct);
+		lexer_init(&piped);
+		lexer_start_static(&direct, text.array, text.size);
+		lexer_start_static(&piped, text.array, text.size);
+
+		/* a small ring, so the lexer has to wait on the consumer */
+		assert_true(lexer_pipe_start(&pipe, &piped, iws, 16));
+
+		count = 0;
+		while (lexer_get_token(&direct, &expected, iws)) {
+			assert_true(lexer_pipe_next(&pipe, &token));
+			assert_ptr_equal(token.text.array, expected.text.array);
+			assert_int_equal(token.text.size, expected.text.size);
+			assert_int_equal(token.type, expected.type);
+			assert_int_equal(token.passed_whitespace, expected.passed_whitespace);
+			count++;
+		}
+		assert_true(count > 2000 * 10);
+
+		/* the end stays the end */
+		assert_false(lexer_pipe_next(&pipe, &token));
+		assert_false(lexer_pipe_next(&pipe, &token));
+		lexer_pipe_stop(&pipe);
+
+		lexer_free(&direct);
+		lexer_free(&piped);
+	}
+
+	lexer_init(&piped);
+	lexer_start_static(&piped, text.array, text.size);
+	assert_true(lexer_pipe_start(&pipe, &piped, IGNORE_WHITESPACE, 16));
+	for (i = 0; i < 100; i++)
+		assert_true(lexer_pipe_next(&pipe, &token));
+	lexer_pipe_stop(&pipe);
+	lexer_free(&piped);
+
+	dstr_free(&text);
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -19,6 +19,8 @@
 #include "util-defs.h"
 #include "dstr.h"
 #include "darray.h"
+#include "platform.h"
+#include "ring-queue.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -148,12 +150,7 @@ struct base_token {
 	bool                 passed_whitespace;
 	bool                 passed_newline;
 
-	uint32_t row;
-	uint32_t col;
-
 	const char *next_offset;
-	uint32_t    next_row;
-	uint32_t    next_col;
 };
 
 static inline void base_token_clear(struct base_token *t)
@@ -216,6 +213,13 @@ static inline void error_data_free(struct error_data *data)
 	da_free(data->errors);
 }
 
+/* moves the errors of src to the end of dst, leaving src empty */
+static inline void error_data_append(struct error_data *dst, struct error_data *src)
+{
+	da_push_back_da(dst->errors, src->errors);
+	da_free(src->errors);
+}
+
 static inline const struct error_item *error_data_item(struct error_data *ed, size_t idx)
 {
 	return ed->errors.array + idx;
@@ -253,20 +257,40 @@ static inline bool error_data_has_errors(struct error_data *ed)
 
 /* ------------------------------------------------------------------------- */
 
+enum ignore_whitespace { PARSE_WHITESPACE, IGNORE_WHITESPACE };
+
 struct lexer {
 	const char *text;
 	size_t      size;
 	bool        owns_memory;
 	const char *offset;
-	uint32_t    row;
-	uint32_t    col;
+
+	/* set by lexer_start_mapped(), unmapped by lexer_free() */
+	struct os_mapped_file mapping;
+
+	/* Byte offset of the start of every line, built by the first
+	 * lexer_get_position() call.  Positions are only needed for
+	 * diagnostics, so tokens just point into the text and nothing keeps
+	 * track of rows and columns while lexing. */
+	DARRAY(size_t) line_starts;
+
+	/* set by lexer_validate_utf8(), after which characters are decoded
+	 * without being checked again */
+	bool utf8_valid;
+
+	/* Result of the last lexer_peek_token() call. A peek followed by a get
+	 * of the same token in the same whitespace mode commits this instead
+	 * of scanning the text again. Only valid while peek_offset matches the
+	 * current offset. */
+	struct base_token      peek_token;
+	const char            *peek_offset;
+	enum ignore_whitespace peek_iws;
+	bool                   peek_result;
 };
 
 static inline void lexer_init(struct lexer *lex)
 {
 	memset(lex, 0, sizeof(struct lexer));
-	lex->row = 1;
-	lex->col = 1;
 }
 
 static inline void lexer_free(struct lexer *lex)
@@ -274,6 +298,8 @@ static inline void lexer_free(struct lexer *lex)
 	if (lex->owns_memory) {
 		bfree((char *)lex->text);
 	}
+	os_munmap_file(&lex->mapping);
+	da_free(lex->line_starts);
 	lexer_init(lex);
 }
 
@@ -295,38 +321,104 @@ static inline void lexer_start_static(struct lexer *lex, const char *text, size_
 	lex->offset      = lex->text;
 }
 
+/* takes ownership of the mapping and lexes directly over it */
+static inline void lexer_start_mapped(struct lexer *lex, struct os_mapped_file *file)
+{
+	lexer_free(lex);
+	lex->mapping     = *file;
+	lex->text        = file->data;
+	lex->size        = file->size;
+	lex->owns_memory = false;
+	lex->offset      = lex->text;
+	memset(file, 0, sizeof(*file));
+}
+
 static inline void lexer_reset(struct lexer *lex)
 {
 	lex->offset = lex->text;
-	lex->row    = 1;
-	lex->col    = 1;
 }
 
 static inline void lexer_reset_to_token(struct lexer *lexx, struct base_token *token)
 {
-	if (token->text.array) {
+	if (token->text.array)
 		lexx->offset = token->text.array;
-		lexx->row    = token->row;
-		lexx->col    = token->col;
-	}
 }
 
 static inline void lexer_pass_token(struct lexer *lexx, struct base_token *token)
 {
-	if (token->next_offset) {
+	if (token->next_offset)
 		lexx->offset = token->next_offset;
-		lexx->row    = token->next_row;
-		lexx->col    = token->next_col;
-	}
 }
 
-enum ignore_whitespace { PARSE_WHITESPACE, IGNORE_WHITESPACE };
+/* moves the lexer to the given offset.  lets callers that scan the text
+ * themselves skip the token loop */
+static inline void lexer_skip_to(struct lexer *lexx, const char *offset)
+{
+	lexx->offset = offset;
+}
+
+/*
+ * Bulk skipping, for text the parsers don't need tokens for (comments, the
+ * bodies of strings).  Like the token functions these stop at a NUL, and
+ * return false if they hit it or the end of the text.
+ */
+
+/* moves the lexer to the next of the given bytes, which must be ASCII */
+EXPORT bool lexer_skip_to_any(struct lexer *lex, const char *bytes);
+
+/* moves the lexer past the next newline */
+EXPORT bool lexer_skip_line(struct lexer *lex);
+
+/* moves the lexer past the character at its offset */
+EXPORT bool lexer_skip_char(struct lexer *lex);
+
+/* checks that the whole text is valid UTF-8, once, so the lexer can decode
+ * it unchecked from then on.  on failure the byte offset of the first
+ * invalid sequence is stored in error_offset, if it isn't NULL */
+EXPORT bool lexer_validate_utf8(struct lexer *lex, size_t *error_offset);
+
+/* replaces remove bytes at offset with the given text, and moves the lexer
+ * back to the start.  the lexer gets a copy of its own if it didn't own the
+ * text, and stays validated if only valid UTF-8 was put in and cut into */
+EXPORT void lexer_replace(struct lexer *lex, size_t offset, size_t remove, const char *text, size_t size);
+
+/* 1-based row and column (in codepoints) of a position in the lexer's text.
+ * positions outside the text resolve to the lexer's current offset */
+EXPORT void lexer_get_position(struct lexer *lex, const char *offset, uint32_t *row, uint32_t *col);
 
 EXPORT bool lexer_peek_token(struct lexer *lex, struct base_token *t, enum ignore_whitespace iws);
 EXPORT bool lexer_get_token(struct lexer *lex, struct base_token *t, enum ignore_whitespace iws);
 EXPORT bool lexer_peek_char(struct lexer *lex, struct base_token *t);
 EXPORT bool lexer_get_char(struct lexer *lex, struct base_token *t);
 
+/* ------------------------------------------------------------------------- */
+
+/*
+ * Pipelined lexing.  The lexer runs on a thread of its own and hands its
+ * tokens over through a ring, so a consumer that does real work per token
+ * runs alongside the scanning instead of after it.  The lexer belongs to the
+ * pipe's thread until lexer_pipe_stop(), and mustn't be touched before then.
+ */
+
+struct lexer_pipe {
+	struct lexer          *lex;
+	enum ignore_whitespace iws;
+	struct spsc_ring       tokens;
+	os_thread_t           *thread;
+	volatile bool          stop;
+	bool                   done;
+};
+
+/* capacity is in tokens, 0 for the default */
+EXPORT bool lexer_pipe_start(struct lexer_pipe *pipe, struct lexer *lex, enum ignore_whitespace iws, size_t capacity);
+
+/* blocks until the next token is available.  returns false at the end of the
+ * text, the same as lexer_get_token */
+EXPORT bool lexer_pipe_next(struct lexer_pipe *pipe, struct base_token *t);
+
+/* may be called before all tokens are consumed, which stops the lexer early */
+EXPORT void lexer_pipe_stop(struct lexer_pipe *pipe);
+
 #ifdef __cplusplus
 }
 #endif
@@ -15,10 +15,462 @@
  */
 
 #include "platform.h"
+#include "bmem.h"
+#include "darray.h"
+#include "dstr.h"
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 void os_breakpoint(void)
 {
 	raise(SIGTRAP);
 }
+
+uint64_t os_gettime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000000ULL) + (uint64_t)ts.tv_nsec;
+}
+
+static bool mmap_file_copy(const char *path, struct os_mapped_file *file)
+{
+	size_t size;
+	char  *data = os_quick_read_utf8_file(path, &size);
+
+	/* os_fread_utf8 returns NULL for empty files as well */
+	file->copy = data;
+	file->data = data ? data : "";
+	file->size = data ? size : 0;
+	return true;
+}
+
+bool os_mmap_file(const char *path, struct os_mapped_file *file)
+{
+	struct stat st;
+	size_t      page_size;
+	size_t      file_size;
+	size_t      map_size;
+	size_t      offset;
+	char       *base;
+	int         fd;
+
+	memset(file, 0, sizeof(*file));
+
+	if (!path)
+		return false;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return false;
+
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return false;
+	}
+
+	/* pipes and friends can't be mapped */
+	if (!S_ISREG(st.st_mode)) {
+		close(fd);
+		return mmap_file_copy(path, file);
+	}
+
+	file_size = (size_t)st.st_size;
+	if (!file_size) {
+		close(fd);
+		file->data = "";
+		return true;
+	}
+
+	/* the tail of the last page of a file mapping reads as zero, but if the
+	 * file size is an exact multiple of the page size there is no tail.
+	 * reserve one extra anonymous page after the file so the terminator is
+	 * always there, then map the file over the start of the reservation. */
+	page_size = (size_t)sysconf(_SC_PAGESIZE);
+	map_size  = ((file_size + page_size - 1) & ~(page_size - 1)) + page_size;
+
+	base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return mmap_file_copy(path, file);
+	}
+
+	if (mmap(base, file_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+		munmap(base, map_size);
+		close(fd);
+		return mmap_file_copy(path, file);
+	}
+
+	close(fd);
+	madvise(base, file_size, MADV_SEQUENTIAL);
+
+	offset = (file_size >= 3 && memcmp(base, "\xEF\xBB\xBF", 3) == 0) ? 3 : 0;
+
+	file->base     = base;
+	file->map_size = map_size;
+	file->data     = base + offset;
+	file->size     = file_size - offset;
+	return true;
+}
+
+void os_munmap_file(struct os_mapped_file *file)
+{
+	if (file->base)
+		munmap(file->base, file->map_size);
+	bfree(file->copy);
+	memset(file, 0, sizeof(*file));
+}
+
+struct os_dir {
+	DIR             *dir;
+	struct dstr      path;
+	struct os_dirent out;
+};
+
+os_dir_t *os_opendir(const char *path)
+{
+	os_dir_t *dir;
+	DIR      *dirp;
+
+	if (!path)
+		return NULL;
+
+	dirp = opendir(path);
+	if (!dirp)
+		return NULL;
+
+	dir      = bzalloc(sizeof(*dir));
+	dir->dir = dirp;
+	dstr_copy(&dir->path, path);
+	return dir;
+}
+
+static bool is_dir(os_dir_t *dir, const char *name)
+{
+	struct stat st;
+	size_t      path_size = dir->path.size;
+	bool        result;
+
+	dstr_cat_ch(&dir->path, '/');
+	dstr_cat(&dir->path, name);
+	result = stat(dir->path.array, &st) == 0 && S_ISDIR(st.st_mode);
+	dstr_resize(&dir->path, path_size);
+	return result;
+}
+
+struct os_dirent *os_readdir(os_dir_t *dir)
+{
+	struct dirent *ent;
+
+	if (!dir)
+		return NULL;
+
+	do {
+		ent = readdir(dir->dir);
+		if (!ent)
+			return NULL;
+	} while (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0);
+
+	strncpy(dir->out.d_name, ent->d_name, sizeof(dir->out.d_name) - 1);
+	dir->out.d_name[sizeof(dir->out.d_name) - 1] = 0;
+
+	/* d_type is a hint that not all file systems fill in, and symlinks are
+	 * followed like everything else that opens paths */
+	if (ent->d_type == DT_DIR)
+		dir->out.directory = true;
+	else if (ent->d_type == DT_UNKNOWN || ent->d_type == DT_LNK)
+		dir->out.directory = is_dir(dir, ent->d_name);
+	else
+		dir->out.directory = false;
+
+	return &dir->out;
+}
+
+void os_closedir(os_dir_t *dir)
+{
+	if (dir) {
+		closedir(dir->dir);
+		dstr_free(&dir->path);
+		bfree(dir);
+	}
+}
+
+int os_mkdir(const char *path)
+{
+	if (mkdir(path, 0755) == 0)
+		return MKDIR_SUCCESS;
+
+	return errno == EEXIST ? MKDIR_EXISTS : MKDIR_ERROR;
+}
+
+bool os_rename(const char *old_path, const char *new_path)
+{
+	return rename(old_path, new_path) == 0;
+}
+
+bool os_unlink(const char *path)
+{
+	return unlink(path) == 0;
+}
+
+bool os_rmdir(const char *path)
+{
+	return rmdir(path) == 0;
+}
+
+#ifdef __linux__
+
+/* inotify isn't recursive, so every directory gets a watch of its own, and
+ * new ones are added as directories turn up */
+struct os_watch_dir {
+	int         wd;
+	struct dstr path; /* as reported, empty for the root if it's "." */
+};
+
+struct os_watch {
+	int fd;
+	DARRAY(struct os_watch_dir) dirs;
+	struct dstr root;
+	struct dstr path;
+};
+
+#define WATCH_MASK                                                                                                     \
+	(IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_DONT_FOLLOW | IN_ONLYDIR)
+
+static struct os_watch_dir *find_watch_dir(os_watch_t *watch, int wd)
+{
+	size_t i;
+
+	for (i = 0; i < watch->dirs.size; i++) {
+		if (watch->dirs.array[i].wd == wd)
+			return &watch->dirs.array[i];
+	}
+	return NULL;
+}
+
+static void remove_watch_dir(os_watch_t *watch, size_t idx)
+{
+	dstr_free(&watch->dirs.array[idx].path);
+	da_erase(watch->dirs, idx);
+}
+
+static void add_watch_dirs(os_watch_t *watch, const char *path)
+{
+	struct os_watch_dir *dir;
+	struct os_dirent    *ent;
+	os_dir_t            *dirp;
+	struct dstr          sub = {0};
+	int                  wd;
+
+	wd = inotify_add_watch(watch->fd, *path ? path : ".", WATCH_MASK);
+	if (wd < 0)
+		return;
+
+	/* the same directory can turn up twice, moved in while being scanned */
+	dir = find_watch_dir(watch, wd);
+	if (!dir) {
+		dir     = da_push_back_new(watch->dirs);
+		dir->wd = wd;
+	}
+	dstr_copy(&dir->path, path);
+
+	/* subdirectories are only picked up after the watch, so anything made
+	 * in between is still reported */
+	dirp = os_opendir(*path ? path : ".");
+	while ((ent = os_readdir(dirp)) != NULL) {
+		if (!ent->directory || *ent->d_name == '.')
+			continue;
+
+		dstr_copy(&sub, path);
+		if (sub.size)
+			dstr_cat_ch(&sub, '/');
+		dstr_cat(&sub, ent->d_name);
+		add_watch_dirs(watch, sub.array);
+	}
+	os_closedir(dirp);
+	dstr_free(&sub);
+}
+
+/* a directory that was moved away keeps its watches, which would report it
+ * by its old path, so they go along with everything under it */
+static void remove_watch_dirs(os_watch_t *watch, const struct dstr *path)
+{
+	size_t i = watch->dirs.size;
+
+	while (i--) {
+		struct dstr *dir_path = &watch->dirs.array[i].path;
+
+		if (dstr_cmp(dir_path, path->array) == 0 ||
+		    (dir_path->size > path->size && astrcmp_n(dir_path->array, path->array, path->size) == 0 &&
+		     dir_path->array[path->size] == '/')) {
+			inotify_rm_watch(watch->fd, watch->dirs.array[i].wd);
+			remove_watch_dir(watch, i);
+		}
+	}
+}
+
+os_watch_t *os_watch_create(const char *path)
+{
+	os_watch_t *watch;
+	int         fd;
+
+	if (!path)
+		return NULL;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	watch     = bzalloc(sizeof(*watch));
+	watch->fd = fd;
+	dstr_copy(&watch->root, strcmp(path, ".") == 0 ? "" : path);
+
+	add_watch_dirs(watch, watch->root.array ? watch->root.array : "");
+	if (!watch->dirs.size) {
+		os_watch_destroy(watch);
+		return NULL;
+	}
+
+	return watch;
+}
+
+void os_watch_destroy(os_watch_t *watch)
+{
+	if (watch) {
+		while (watch->dirs.size)
+			remove_watch_dir(watch, watch->dirs.size - 1);
+		da_free(watch->dirs);
+		dstr_free(&watch->root);
+		dstr_free(&watch->path);
+		close(watch->fd);
+		bfree(watch);
+	}
+}
+
+static bool handle_watch_event(os_watch_t                 *watch,
+                               const struct inotify_event *event,
+                               os_watch_cb_t               callback,
+                               void                       *param)
+{
+	struct os_watch_dir *dir;
+	bool                 removed;
+
+	if (event->mask & IN_Q_OVERFLOW) {
+		callback(param, watch->root.size ? watch->root.array : ".", OS_WATCH_CHANGED);
+		return true;
+	}
+
+	dir = find_watch_dir(watch, event->wd);
+	if (!dir)
+		return false;
+
+	if (event->mask & IN_IGNORED) {
+		remove_watch_dir(watch, (size_t)(dir - watch->dirs.array));
+		return false;
+	}
+
+	/* events about the directory itself are reported by its parent */
+	if (!event->len || *event->name == '.')
+		return false;
+
+	dstr_copy_dstr(&watch->path, &dir->path);
+	if (watch->path.size)
+		dstr_cat_ch(&watch->path, '/');
+	dstr_cat(&watch->path, event->name);
+
+	removed = (event->mask & (IN_MOVED_FROM | IN_DELETE)) != 0;
+	if (event->mask & IN_ISDIR) {
+		if (removed)
+			remove_watch_dirs(watch, &watch->path);
+		else
+			add_watch_dirs(watch, watch->path.array);
+	}
+
+	callback(param, watch->path.array, removed ? OS_WATCH_REMOVED : OS_WATCH_CHANGED);
+	return true;
+}
+
+int os_watch_wait(os_watch_t *watch, uint32_t timeout_ms, os_watch_cb_t callback, void *param)
+{
+	char          buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	struct pollfd pfd;
+	int           count = 0;
+	int           ret;
+
+	if (!watch)
+		return -1;
+
+	pfd.fd      = watch->fd;
+	pfd.events  = POLLIN;
+	pfd.revents = 0;
+
+	do {
+		ret = poll(&pfd, 1, timeout_ms == UINT32_MAX ? -1 : (int)(timeout_ms > INT32_MAX ? INT32_MAX : timeout_ms));
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0)
+		return -1;
+	if (ret == 0)
+		return 0;
+
+	for (;;) {
+		ssize_t size = read(watch->fd, buf, sizeof(buf));
+		ssize_t offset;
+
+		if (size < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN)
+				break;
+			return -1;
+		}
+
+		for (offset = 0; offset < size;) {
+			const struct inotify_event *event = (const struct inotify_event *)(buf + offset);
+
+			if (handle_watch_event(watch, event, callback, param))
+				count++;
+			offset += (ssize_t)(sizeof(*event) + event->len);
+		}
+	}
+
+	return count;
+}
+
+#else
+
+/* FSEvents needs a run loop, which nothing here has yet */
+os_watch_t *os_watch_create(const char *path)
+{
+	UNUSED_PARAMETER(path);
+	return NULL;
+}
+
+void os_watch_destroy(os_watch_t *watch)
+{
+	UNUSED_PARAMETER(watch);
+}
+
+int os_watch_wait(os_watch_t *watch, uint32_t timeout_ms, os_watch_cb_t callback, void *param)
+{
+	UNUSED_PARAMETER(watch);
+	UNUSED_PARAMETER(timeout_ms);
+	UNUSED_PARAMETER(callback);
+	UNUSED_PARAMETER(param);
+	return -1;
+}
+
+#endif
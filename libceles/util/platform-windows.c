@@ -15,8 +15,409 @@
  */
 
 #include "platform.h"
+#include "bmem.h"
+#include "dstr.h"
+
+#include <string.h>
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 
 void os_breakpoint(void)
 {
 	__debugbreak();
 }
+
+uint64_t os_gettime_ns(void)
+{
+	static LARGE_INTEGER freq = {0};
+	LARGE_INTEGER        count;
+	uint64_t             seconds;
+	uint64_t             remainder;
+
+	if (!freq.QuadPart)
+		QueryPerformanceFrequency(&freq);
+
+	QueryPerformanceCounter(&count);
+
+	/* split to avoid overflowing the multiplication on long uptimes */
+	seconds   = (uint64_t)(count.QuadPart / freq.QuadPart);
+	remainder = (uint64_t)(count.QuadPart % freq.QuadPart);
+	return seconds * 1000000000ULL + remainder * 1000000000ULL / (uint64_t)freq.QuadPart;
+}
+
+static bool mmap_file_copy(const char *path, struct os_mapped_file *file)
+{
+	size_t size;
+	char  *data = os_quick_read_utf8_file(path, &size);
+
+	/* os_fread_utf8 returns NULL for empty files as well */
+	file->copy = data;
+	file->data = data ? data : "";
+	file->size = data ? size : 0;
+	return true;
+}
+
+bool os_mmap_file(const char *path, struct os_mapped_file *file)
+{
+	LARGE_INTEGER file_size;
+	SYSTEM_INFO   info;
+	wchar_t      *wpath = NULL;
+	HANDLE        handle;
+	HANDLE        mapping;
+	const char   *base;
+	size_t        offset;
+
+	memset(file, 0, sizeof(*file));
+
+	if (!path)
+		return false;
+
+	os_utf8_to_wcs_ptr(path, 0, &wpath);
+	handle = CreateFileW(wpath,
+	                     GENERIC_READ,
+	                     FILE_SHARE_READ,
+	                     NULL,
+	                     OPEN_EXISTING,
+	                     FILE_FLAG_SEQUENTIAL_SCAN,
+	                     NULL);
+	bfree(wpath);
+
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	if (!GetFileSizeEx(handle, &file_size)) {
+		CloseHandle(handle);
+		return false;
+	}
+
+	if (!file_size.QuadPart) {
+		CloseHandle(handle);
+		file->data = "";
+		return true;
+	}
+
+	/* views are zero filled from the end of the file to the end of the last
+	 * page.  a file that fills its last page exactly has no room for the
+	 * terminator, and views can't be extended with anonymous memory the way
+	 * they can with mmap, so read those instead */
+	GetSystemInfo(&info);
+	if ((file_size.QuadPart % info.dwPageSize) == 0) {
+		CloseHandle(handle);
+		return mmap_file_copy(path, file);
+	}
+
+	mapping = CreateFileMappingW(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(handle);
+	if (!mapping)
+		return mmap_file_copy(path, file);
+
+	base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!base)
+		return mmap_file_copy(path, file);
+
+	offset = (file_size.QuadPart >= 3 && memcmp(base, "\xEF\xBB\xBF", 3) == 0) ? 3 : 0;
+
+	file->base     = (void *)base;
+	file->map_size = (size_t)file_size.QuadPart;
+	file->data     = base + offset;
+	file->size     = (size_t)file_size.QuadPart - offset;
+	return true;
+}
+
+void os_munmap_file(struct os_mapped_file *file)
+{
+	if (file->base)
+		UnmapViewOfFile(file->base);
+	bfree(file->copy);
+	memset(file, 0, sizeof(*file));
+}
+
+struct os_dir {
+	HANDLE           handle;
+	WIN32_FIND_DATAW data;
+	bool             first;
+	struct os_dirent out;
+};
+
+os_dir_t *os_opendir(const char *path)
+{
+	struct dstr pattern = {0};
+	wchar_t    *wpattern;
+	os_dir_t   *dir;
+
+	if (!path)
+		return NULL;
+
+	dstr_copy(&pattern, path);
+	dstr_cat(&pattern, "/*");
+	os_utf8_to_wcs_ptr(pattern.array, pattern.size, &wpattern);
+	dstr_free(&pattern);
+
+	dir         = bzalloc(sizeof(*dir));
+	dir->handle = FindFirstFileW(wpattern, &dir->data);
+	dir->first  = true;
+	bfree(wpattern);
+
+	if (dir->handle == INVALID_HANDLE_VALUE) {
+		bfree(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+struct os_dirent *os_readdir(os_dir_t *dir)
+{
+	if (!dir)
+		return NULL;
+
+	for (;;) {
+		if (dir->first) {
+			dir->first = false;
+		} else if (!FindNextFileW(dir->handle, &dir->data)) {
+			return NULL;
+		}
+
+		if (wcscmp(dir->data.cFileName, L".") != 0 && wcscmp(dir->data.cFileName, L"..") != 0)
+			break;
+	}
+
+	os_wcs_to_utf8(dir->data.cFileName, 0, dir->out.d_name, sizeof(dir->out.d_name));
+	dir->out.directory = (dir->data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) != 0;
+	return &dir->out;
+}
+
+void os_closedir(os_dir_t *dir)
+{
+	if (dir) {
+		FindClose(dir->handle);
+		bfree(dir);
+	}
+}
+
+int os_mkdir(const char *path)
+{
+	wchar_t *wpath = NULL;
+	BOOL     success;
+	DWORD    error;
+
+	if (!os_utf8_to_wcs_ptr(path, 0, &wpath))
+		return MKDIR_ERROR;
+
+	success = CreateDirectoryW(wpath, NULL);
+	error   = GetLastError();
+	bfree(wpath);
+
+	if (success)
+		return MKDIR_SUCCESS;
+
+	return error == ERROR_ALREADY_EXISTS ? MKDIR_EXISTS : MKDIR_ERROR;
+}
+
+bool os_rename(const char *old_path, const char *new_path)
+{
+	wchar_t *wold = NULL;
+	wchar_t *wnew = NULL;
+	bool     success;
+
+	os_utf8_to_wcs_ptr(old_path, 0, &wold);
+	os_utf8_to_wcs_ptr(new_path, 0, &wnew);
+	success = wold && wnew && MoveFileExW(wold, wnew, MOVEFILE_REPLACE_EXISTING);
+	bfree(wold);
+	bfree(wnew);
+	return success;
+}
+
+bool os_unlink(const char *path)
+{
+	wchar_t *wpath = NULL;
+	bool     success;
+
+	os_utf8_to_wcs_ptr(path, 0, &wpath);
+	success = wpath && DeleteFileW(wpath);
+	bfree(wpath);
+	return success;
+}
+
+bool os_rmdir(const char *path)
+{
+	wchar_t *wpath = NULL;
+	bool     success;
+
+	os_utf8_to_wcs_ptr(path, 0, &wpath);
+	success = wpath && RemoveDirectoryW(wpath);
+	bfree(wpath);
+	return success;
+}
+
+/* unlike inotify, one handle covers the whole tree */
+struct os_watch {
+	HANDLE      dir;
+	OVERLAPPED  overlapped;
+	struct dstr root; /* as reported, empty if it's "." */
+	struct dstr path;
+	DWORD       buffer[16384]; /* FILE_NOTIFY_INFORMATION has to be DWORD aligned */
+};
+
+#define WATCH_FILTER (FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE)
+
+static bool start_watch(os_watch_t *watch)
+{
+	ResetEvent(watch->overlapped.hEvent);
+	return !!ReadDirectoryChangesW(watch->dir,
+	                               watch->buffer,
+	                               sizeof(watch->buffer),
+	                               TRUE,
+	                               WATCH_FILTER,
+	                               NULL,
+	                               &watch->overlapped,
+	                               NULL);
+}
+
+os_watch_t *os_watch_create(const char *path)
+{
+	wchar_t    *wpath = NULL;
+	os_watch_t *watch;
+
+	if (!path || !os_utf8_to_wcs_ptr(path, 0, &wpath))
+		return NULL;
+
+	watch      = bzalloc(sizeof(*watch));
+	watch->dir = CreateFileW(wpath,
+	                         FILE_LIST_DIRECTORY,
+	                         FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+	                         NULL,
+	                         OPEN_EXISTING,
+	                         FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+	                         NULL);
+	bfree(wpath);
+
+	if (watch->dir == INVALID_HANDLE_VALUE) {
+		bfree(watch);
+		return NULL;
+	}
+
+	dstr_copy(&watch->root, strcmp(path, ".") == 0 ? "" : path);
+	watch->overlapped.hEvent = CreateEventW(NULL, TRUE, FALSE, NULL);
+	if (!watch->overlapped.hEvent || !start_watch(watch)) {
+		os_watch_destroy(watch);
+		return NULL;
+	}
+
+	return watch;
+}
+
+void os_watch_destroy(os_watch_t *watch)
+{
+	if (watch) {
+		DWORD size;
+
+		/* the pending read writes to the buffer, so it has to be done
+		 * with before the buffer is freed */
+		if (CancelIo(watch->dir))
+			GetOverlappedResult(watch->dir, &watch->overlapped, &size, TRUE);
+		if (watch->overlapped.hEvent)
+			CloseHandle(watch->overlapped.hEvent);
+		CloseHandle(watch->dir);
+		dstr_free(&watch->root);
+		dstr_free(&watch->path);
+		bfree(watch);
+	}
+}
+
+static bool is_hidden_path(const char *path)
+{
+	const char *slash;
+
+	for (;;) {
+		if (*path == '.')
+			return true;
+
+		slash = strchr(path, '/');
+		if (!slash)
+			return false;
+		path = slash + 1;
+	}
+}
+
+static bool report_change(os_watch_t *watch, const FILE_NOTIFY_INFORMATION *info, os_watch_cb_t callback, void *param)
+{
+	enum os_watch_action action;
+	char                *name = NULL;
+	char                *c;
+
+	switch (info->Action) {
+	case FILE_ACTION_ADDED:
+	case FILE_ACTION_MODIFIED:
+	case FILE_ACTION_RENAMED_NEW_NAME:
+		action = OS_WATCH_CHANGED;
+		break;
+	case FILE_ACTION_REMOVED:
+	case FILE_ACTION_RENAMED_OLD_NAME:
+		action = OS_WATCH_REMOVED;
+		break;
+	default:
+		return false;
+	}
+
+	if (!os_wcs_to_utf8_ptr(info->FileName, info->FileNameLength / sizeof(WCHAR), &name)) {
+		bfree(name);
+		return false;
+	}
+
+	for (c = name; *c; c++) {
+		if (*c == '\\')
+			*c = '/';
+	}
+
+	/* the whole tree is watched, so hidden directories are filtered here */
+	if (is_hidden_path(name)) {
+		bfree(name);
+		return false;
+	}
+
+	dstr_copy_dstr(&watch->path, &watch->root);
+	if (watch->path.size)
+		dstr_cat_ch(&watch->path, '/');
+	dstr_cat(&watch->path, name);
+	bfree(name);
+
+	callback(param, watch->path.array, action);
+	return true;
+}
+
+int os_watch_wait(os_watch_t *watch, uint32_t timeout_ms, os_watch_cb_t callback, void *param)
+{
+	const uint8_t *data;
+	DWORD          size  = 0;
+	int            count = 0;
+
+	if (!watch)
+		return -1;
+
+	/* INFINITE is UINT32_MAX as well */
+	if (WaitForSingleObject(watch->overlapped.hEvent, timeout_ms) != WAIT_OBJECT_0)
+		return 0;
+	if (!GetOverlappedResult(watch->dir, &watch->overlapped, &size, FALSE))
+		return -1;
+
+	/* an empty result means the buffer overflowed and the changes are lost */
+	if (!size) {
+		callback(param, watch->root.size ? watch->root.array : ".", OS_WATCH_CHANGED);
+		count++;
+	}
+
+	for (data = (const uint8_t *)watch->buffer; size;) {
+		const FILE_NOTIFY_INFORMATION *info = (const FILE_NOTIFY_INFORMATION *)data;
+
+		if (report_change(watch, info, callback, param))
+			count++;
+		if (!info->NextEntryOffset)
+			break;
+		data += info->NextEntryOffset;
+	}
+
+	return start_watch(watch) ? count : -1;
+}
@@ -22,6 +22,13 @@
 #include <stdlib.h>
 #include <locale.h>
 
+#ifdef ENABLE_TESTS
+#include <setjmp.h>
+#include <cmocka.h>
+#include "bmem.h"
+#include "darray.h"
+#endif
+
 #ifdef _MSC_VER
 #define NORETURN __declspec(noreturn)
 #else
@@ -75,7 +82,6 @@ int64_t os_ftelli64(FILE *file)
 size_t os_fread_utf8(FILE *file, char **pstr)
 {
 	size_t size = 0;
-	size_t len  = 0;
 
 	*pstr = NULL;
 
@@ -116,7 +122,7 @@ size_t os_fread_utf8(FILE *file, char **pstr)
 		*pstr = utf8str;
 	}
 
-	return len;
+	return size;
 }
 
 char *os_quick_read_utf8_file(const char *path, size_t *p_size)
@@ -162,6 +168,32 @@ bool os_quick_write_utf8_file(const char *path, const char *str, size_t len, boo
 	return true;
 }
 
+int os_mkdirs(const char *path)
+{
+	struct dstr dir = {0};
+	char       *sep;
+	int         result;
+
+	if (!path || !*path)
+		return MKDIR_ERROR;
+
+	dstr_copy(&dir, path);
+	for (sep = dir.array + 1; *sep; sep++) {
+		if (*sep != '/' && *sep != '\\')
+			continue;
+
+		/* failures for parents (drive letters, existing paths without
+		 * access) show up when creating the last component anyway */
+		*sep = 0;
+		os_mkdir(dir.array);
+		*sep = '/';
+	}
+
+	result = os_mkdir(dir.array);
+	dstr_free(&dir);
+	return result;
+}
+
 size_t os_utf8_to_wcs(const char *str, size_t len, wchar_t *dst, size_t dst_size)
 {
 	size_t in_len;
@@ -329,3 +361,104 @@ int os_dtostr(double value, char *dst, size_t size)
 
 	return (int)length;
 }
+
+#ifdef ENABLE_TESTS
+
+struct watch_test {
+	DARRAY(char *) changed;
+	DARRAY(char *) removed;
+};
+
+static void watch_test_callback(void *param, const char *path, enum os_watch_action action)
+{
+	struct watch_test *test = param;
+	char              *copy = bstrdup(path);
+
+	if (action == OS_WATCH_REMOVED)
+		da_push_back(test->removed, &copy);
+	else
+		da_push_back(test->changed, &copy);
+}
+
+static bool watch_test_saw(char **paths, size_t count, const char *path)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (strstr(paths[i], path))
+			return true;
+	}
+	return false;
+}
+
+/* events can take a moment to arrive, so this waits for a specific one */
+static bool watch_test_wait(os_watch_t *watch, struct watch_test *test, const char *path, bool removed)
+{
+	int tries;
+
+	for (tries = 0; tries < 50; tries++) {
+		if (removed ? watch_test_saw(test->removed.array, test->removed.size, path)
+		            : watch_test_saw(test->changed.array, test->changed.size, path))
+			return true;
+
+		if (os_watch_wait(watch, 100, watch_test_callback, test) < 0)
+			return false;
+	}
+	return false;
+}
+
+void platform_test_watch(void **state)
+{
+	struct watch_test test = {0};
+	os_watch_t       *watch;
+	size_t            i;
+
+	os_mkdir("watch-test");
+	watch = os_watch_create("watch-test");
+#if !defined(__linux__) && !defined(_WIN32)
+	if (!watch) {
+		os_rmdir("watch-test");
+		return;
+	}
+#endif
+	assert_non_null(watch);
+
+	/* nothing has happened yet */
+	assert_int_equal(os_watch_wait(watch, 0, watch_test_callback, &test), 0);
+
+	assert_true(os_quick_write_utf8_file("watch-test/a.celes", "a", 1, false));
+	assert_true(watch_test_wait(watch, &test, "watch-test/a.celes", false));
+
+	/* new directories are watched as well */
+	assert_int_not_equal(os_mkdir("watch-test/sub"), MKDIR_ERROR);
+	assert_true(watch_test_wait(watch, &test, "watch-test/sub", false));
+	assert_true(os_quick_write_utf8_file("watch-test/sub/b.celes", "b", 1, false));
+	assert_true(watch_test_wait(watch, &test, "watch-test/sub/b.celes", false));
+
+	/* hidden ones aren't */
+	assert_int_not_equal(os_mkdir("watch-test/.hidden"), MKDIR_ERROR);
+	assert_true(os_quick_write_utf8_file("watch-test/.hidden/c.celes", "c", 1, false));
+
+	assert_true(os_unlink("watch-test/a.celes"));
+	assert_true(watch_test_wait(watch, &test, "watch-test/a.celes", true));
+	assert_false(watch_test_saw(test.changed.array, test.changed.size, ".hidden"));
+
+	os_watch_destroy(watch);
+
+	os_unlink("watch-test/.hidden/c.celes");
+	os_unlink("watch-test/sub/b.celes");
+	assert_true(os_rmdir("watch-test/.hidden"));
+	assert_true(os_rmdir("watch-test/sub"));
+	assert_true(os_rmdir("watch-test"));
+
+	for (i = 0; i < test.changed.size; i++)
+		bfree(test.changed.array[i]);
+	for (i = 0; i < test.removed.size; i++)
+		bfree(test.removed.array[i]);
+	da_free(test.changed);
+	da_free(test.removed);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
@@ -34,12 +34,85 @@ EXPORT size_t  os_fread_utf8(FILE *file, char **pstr);
 EXPORT char *os_quick_read_utf8_file(const char *path, size_t *size);
 EXPORT bool  os_quick_write_utf8_file(const char *path, const char *str, size_t len, bool marker);
 
+/*
+ * Read-only view of a UTF-8 file.  data points past the BOM if present and is
+ * always followed by a NUL, like the strings returned by os_fread_utf8, but in
+ * the common case the contents are mapped from the page cache rather than
+ * copied.  Files that cannot be mapped are read into memory instead.  The
+ * file must not be truncated while it is mapped.
+ */
+struct os_mapped_file {
+	const char *data;
+	size_t      size; /* excluding the BOM and terminator */
+
+	void  *base;
+	size_t map_size;
+	char  *copy;
+};
+
+EXPORT bool os_mmap_file(const char *path, struct os_mapped_file *file);
+EXPORT void os_munmap_file(struct os_mapped_file *file);
+
+#define MKDIR_EXISTS 1
+#define MKDIR_SUCCESS 0
+#define MKDIR_ERROR -1
+
+EXPORT int  os_mkdir(const char *path);
+EXPORT int  os_mkdirs(const char *path); /* creates missing parents as well */
+EXPORT bool os_rename(const char *old_path, const char *new_path); /* atomically replaces new_path */
+EXPORT bool os_unlink(const char *path);
+EXPORT bool os_rmdir(const char *path); /* only if it's empty */
+
+typedef struct os_dir os_dir_t;
+
+struct os_dirent {
+	char d_name[256];
+	bool directory;
+};
+
+/* entries are returned in no particular order, without "." and ".." */
+EXPORT os_dir_t         *os_opendir(const char *path);
+EXPORT struct os_dirent *os_readdir(os_dir_t *dir);
+EXPORT void              os_closedir(os_dir_t *dir);
+
+/*
+ * Recursive directory watch, on inotify or ReadDirectoryChangesW.  Paths are
+ * reported the way they'd be built walking the tree with os_opendir from the
+ * watched path, or relative to it if that's ".".  Directories whose names
+ * start with '.' aren't watched, the same as they aren't searched for
+ * sources, so .git and editor swap files don't wake anyone up.
+ *
+ * Only the path is reported, not what happened to it.  A changed directory
+ * may contain files that were never reported on their own, and if events are
+ * lost the watched path itself is reported, so callers should rescan
+ * whatever directories they're given.  A removed directory is reported once,
+ * not once for everything that was in it.
+ */
+typedef struct os_watch os_watch_t;
+
+enum os_watch_action {
+	OS_WATCH_CHANGED, /* created, written, or moved in */
+	OS_WATCH_REMOVED, /* deleted or moved out */
+};
+
+typedef void (*os_watch_cb_t)(void *param, const char *path, enum os_watch_action action);
+
+/* returns NULL if the path can't be watched, or watching isn't supported */
+EXPORT os_watch_t *os_watch_create(const char *path);
+EXPORT void        os_watch_destroy(os_watch_t *watch);
+
+/* waits up to timeout_ms (UINT32_MAX for no limit) for changes and reports
+ * all that are pending.  returns the number reported, or -1 if it broke */
+EXPORT int os_watch_wait(os_watch_t *watch, uint32_t timeout_ms, os_watch_cb_t callback, void *param);
+
 EXPORT size_t os_utf8_to_wcs(const char *str, size_t len, wchar_t *dst, size_t dst_size);
 EXPORT size_t os_wcs_to_utf8(const wchar_t *str, size_t len, char *dst, size_t dst_size);
 
 EXPORT size_t os_utf8_to_wcs_ptr(const char *str, size_t len, wchar_t **pstr);
 EXPORT size_t os_wcs_to_utf8_ptr(const wchar_t *str, size_t len, char **pstr);
 
+EXPORT uint64_t os_gettime_ns(void);
+
 EXPORT double os_strtod(const char *str);
 EXPORT int os_dtostr(double value, char *dst, size_t size);
 
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "ring-queue.h"
+#include "bmem.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+static size_t ring_capacity(size_t capacity)
+{
+	size_t pow2 = 2;
+
+	while (pow2 < capacity)
+		pow2 <<= 1;
+	return pow2;
+}
+
+void spsc_ring_init(struct spsc_ring *ring, size_t item_size, size_t capacity)
+{
+	memset(ring, 0, sizeof(*ring));
+
+	capacity        = ring_capacity(capacity);
+	ring->items     = bmalloc(capacity * item_size);
+	ring->mask      = capacity - 1;
+	ring->item_size = item_size;
+}
+
+void spsc_ring_free(struct spsc_ring *ring)
+{
+	bfree(ring->items);
+	memset(ring, 0, sizeof(*ring));
+}
+
+void mpmc_ring_init(struct mpmc_ring *ring, size_t item_size, size_t capacity)
+{
+	size_t i;
+
+	memset(ring, 0, sizeof(*ring));
+
+	/* keeps the sequence numbers of the cells after the first aligned */
+	capacity        = ring_capacity(capacity);
+	ring->cell_size = (sizeof(size_t) + item_size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+	ring->cells     = bmalloc(capacity * ring->cell_size);
+	ring->mask      = capacity - 1;
+	ring->item_size = item_size;
+
+	for (i = 0; i < capacity; i++)
+		*mpmc_ring_cell(ring, i) = i;
+}
+
+void mpmc_ring_free(struct mpmc_ring *ring)
+{
+	bfree(ring->cells);
+	memset(ring, 0, sizeof(*ring));
+}
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+/* the threads yield rather than spin while they wait, since they may well
+ * outnumber the cores */
+#define TEST_ITEMS 100000
+#define TEST_THREADS 4
+
+static void *test_spsc_producer(void *param)
+{
+	struct spsc_ring *ring = param;
+	uint32_t          i;
+
+	for (i = 0; i < TEST_ITEMS; i++) {
+		while (!spsc_ring_push(ring, &i))
+			os_thread_yield();
+	}
+
+	return NULL;
+}
+
+void ring_test_spsc(void **state)
+{
+	struct spsc_ring ring;
+	os_thread_t     *thread;
+	uint32_t         val;
+	uint32_t         i;
+	int              round;
+
+	spsc_ring_init(&ring, sizeof(uint32_t), 5);
+	assert_int_equal(spsc_ring_capacity(&ring), 8);
+	assert_false(spsc_ring_pop(&ring, &val));
+
+	/* a few times around, to wrap the positions */
+	for (round = 0; round < 3; round++) {
+		for (i = 0; i < 8; i++)
+			assert_true(spsc_ring_push(&ring, &i));
+		assert_false(spsc_ring_push(&ring, &i));
+
+		for (i = 0; i < 5; i++) {
+			assert_true(spsc_ring_pop(&ring, &val));
+			assert_int_equal(val, i);
+		}
+
+		/* freed up slots can be used right away */
+		val = 100;
+		assert_true(spsc_ring_push(&ring, &val));
+
+		for (i = 5; i < 8; i++) {
+			assert_true(spsc_ring_pop(&ring, &val));
+			assert_int_equal(val, i);
+		}
+		assert_true(spsc_ring_pop(&ring, &val));
+		assert_int_equal(val, 100);
+		assert_false(spsc_ring_pop(&ring, &val));
+	}
+
+	spsc_ring_free(&ring);
+
+	/* and across threads, in order */
+	spsc_ring_init(&ring, sizeof(uint32_t), 64);
+	thread = os_thread_create(test_spsc_producer, &ring);
+	assert_non_null(thread);
+
+	for (i = 0; i < TEST_ITEMS; i++) {
+		while (!spsc_ring_pop(&ring, &val))
+			os_thread_yield();
+		assert_int_equal(val, i);
+	}
+
+	os_thread_join(thread);
+	assert_false(spsc_ring_pop(&ring, &val));
+	spsc_ring_free(&ring);
+
+	UNUSED_PARAMETER(state);
+}
+
+struct test_mpmc {
+	struct mpmc_ring ring;
+	volatile long    next_producer;
+	volatile long    consumed;
+	volatile long    out_of_order; /* checked once the threads are done, cmocka can't fail in them */
+	volatile long    seen[TEST_THREADS][TEST_ITEMS / TEST_THREADS];
+};
+
+static void *test_mpmc_producer(void *param)
+{
+	struct test_mpmc *test     = param;
+	uint32_t          producer = (uint32_t)os_atomic_inc_long(&test->next_producer) - 1;
+	uint32_t          i;
+
+	for (i = 0; i < TEST_ITEMS / TEST_THREADS; i++) {
+		uint32_t val = (producer << 24) | i;
+		while (!mpmc_ring_push(&test->ring, &val))
+			os_thread_yield();
+	}
+
+	return NULL;
+}
+
+static void *test_mpmc_consumer(void *param)
+{
+	struct test_mpmc *test = param;
+	long              last[TEST_THREADS];
+	uint32_t          val;
+	size_t            i;
+
+	for (i = 0; i < TEST_THREADS; i++)
+		last[i] = -1;
+
+	while (os_atomic_load_long(&test->consumed) < TEST_ITEMS) {
+		if (!mpmc_ring_pop(&test->ring, &val)) {
+			os_thread_yield();
+			continue;
+		}
+
+		uint32_t producer = val >> 24;
+		long     idx      = (long)(val & 0xFFFFFF);
+
+		/* the ring is first in, first out, so each consumer must see the
+		 * items of each producer in order */
+		if (idx <= last[producer])
+			os_atomic_inc_long(&test->out_of_order);
+		last[producer] = idx;
+
+		os_atomic_inc_long(&test->seen[producer][idx]);
+		os_atomic_inc_long(&test->consumed);
+	}
+
+	return NULL;
+}
+
+void ring_test_mpmc(void **state)
+{
+	struct test_mpmc *test = bzalloc(sizeof(*test));
+	os_thread_t      *producers[TEST_THREADS];
+	os_thread_t      *consumers[TEST_THREADS];
+	uint32_t          val;
+	uint32_t          i;
+	size_t            j;
+
+	mpmc_ring_init(&test->ring, sizeof(uint32_t), 4);
+	assert_int_equal(mpmc_ring_capacity(&test->ring), 4);
+	assert_false(mpmc_ring_pop(&test->ring, &val));
+
+	for (i = 0; i < 10; i++) {
+		for (j = 0; j < 4; j++) {
+			val = i * 4 + (uint32_t)j;
+			assert_true(mpmc_ring_push(&test->ring, &val));
+		}
+		assert_false(mpmc_ring_push(&test->ring, &val));
+
+		for (j = 0; j < 4; j++) {
+			assert_true(mpmc_ring_pop(&test->ring, &val));
+			assert_int_equal(val, i * 4 + j);
+		}
+		assert_false(mpmc_ring_pop(&test->ring, &val));
+	}
+
+	mpmc_ring_free(&test->ring);
+
+	mpmc_ring_init(&test->ring, sizeof(uint32_t), 256);
+	for (j = 0; j < TEST_THREADS; j++) {
+		consumers[j] = os_thread_create(test_mpmc_consumer, test);
+		producers[j] = os_thread_create(test_mpmc_producer, test);
+	}
+	for (j = 0; j < TEST_THREADS; j++) {
+		os_thread_join(producers[j]);
+		os_thread_join(consumers[j]);
+	}
+
+	/* every item exactly once, and in order */
+	assert_int_equal(test->out_of_order, 0);
+	assert_int_equal(test->consumed, TEST_ITEMS);
+	for (j = 0; j < TEST_THREADS; j++) {
+		for (i = 0; i < TEST_ITEMS / TEST_THREADS; i++)
+			assert_int_equal(test->seen[j][i], 1);
+	}
+	assert_false(mpmc_ring_pop(&test->ring, &val));
+
+	mpmc_ring_free(&test->ring);
+	bfree(test);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
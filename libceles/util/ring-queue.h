@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "util-defs.h"
+#include "threading.h"
+
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Bounded lock-free rings of fixed size items, for handing work from one
+ * thread to another without a lock.  Unlike circlebuf they never grow: a full
+ * ring fails the push, and it's up to the caller to wait or go elsewhere.
+ *
+ * The positions are free running counters that are only masked when indexing,
+ * so the capacity is always rounded up to a power of two.  Fields written by
+ * different threads are padded apart so they don't share a cache line.
+ */
+
+#define RING_CACHE_LINE 64
+
+/* ------------------------------------------------------------------------- */
+/* Single producer, single consumer                                          */
+
+struct spsc_ring {
+	uint8_t *items;
+	size_t   mask;
+	size_t   item_size;
+	char     pad0[RING_CACHE_LINE];
+
+	/* written by the producer.  next_head runs ahead of head by the items
+	 * pushed but not yet published, and it keeps the last tail it saw so
+	 * it only has to look at the consumer's line when the ring seems full */
+	volatile size_t head;
+	size_t          next_head;
+	size_t          cached_tail;
+	char            pad1[RING_CACHE_LINE];
+
+	/* written by the consumer, likewise */
+	volatile size_t tail;
+	size_t          cached_head;
+	char            pad2[RING_CACHE_LINE];
+};
+
+EXPORT void spsc_ring_init(struct spsc_ring *ring, size_t item_size, size_t capacity);
+EXPORT void spsc_ring_free(struct spsc_ring *ring);
+
+static inline size_t spsc_ring_capacity(const struct spsc_ring *ring)
+{
+	return ring->mask + 1;
+}
+
+/* makes every deferred push visible to the consumer.  producer only */
+static inline void spsc_ring_publish(struct spsc_ring *ring)
+{
+	os_atomic_store_size_release(&ring->head, ring->next_head);
+}
+
+/* pushes without publishing, so a producer with many small items can publish
+ * them in batches and the consumer's cache doesn't have to fetch the head
+ * for every one of them.  producer only */
+static inline bool spsc_ring_push_deferred(struct spsc_ring *ring, const void *item)
+{
+	size_t head = ring->next_head;
+
+	if (head - ring->cached_tail > ring->mask) {
+		ring->cached_tail = os_atomic_load_size_acquire(&ring->tail);
+		if (head - ring->cached_tail > ring->mask)
+			return false;
+	}
+
+	memcpy(ring->items + (head & ring->mask) * ring->item_size, item, ring->item_size);
+	ring->next_head = head + 1;
+	return true;
+}
+
+/* producer only */
+static inline bool spsc_ring_push(struct spsc_ring *ring, const void *item)
+{
+	if (!spsc_ring_push_deferred(ring, item))
+		return false;
+
+	spsc_ring_publish(ring);
+	return true;
+}
+
+/* consumer only */
+static inline bool spsc_ring_pop(struct spsc_ring *ring, void *item)
+{
+	size_t tail = os_atomic_load_size_relaxed(&ring->tail);
+
+	if (tail == ring->cached_head) {
+		ring->cached_head = os_atomic_load_size_acquire(&ring->head);
+		if (tail == ring->cached_head)
+			return false;
+	}
+
+	memcpy(item, ring->items + (tail & ring->mask) * ring->item_size, ring->item_size);
+	os_atomic_store_size_release(&ring->tail, tail + 1);
+	return true;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Multiple producers, multiple consumers                                    */
+
+/*
+ * Every cell has a sequence number saying whose turn it is: a producer may
+ * fill the cell at position pos once its sequence is pos, and a consumer may
+ * empty it once it's pos + 1.  Producers and consumers each claim positions
+ * with a compare and swap on their own counter, so they only contend with
+ * each other, and only over the same cell when the ring is full or empty.
+ */
+
+struct mpmc_ring {
+	uint8_t *cells; /* each a size_t sequence number followed by the item */
+	size_t   mask;
+	size_t   item_size;
+	size_t   cell_size;
+	char     pad0[RING_CACHE_LINE];
+
+	volatile size_t head;
+	char            pad1[RING_CACHE_LINE];
+
+	volatile size_t tail;
+	char            pad2[RING_CACHE_LINE];
+};
+
+EXPORT void mpmc_ring_init(struct mpmc_ring *ring, size_t item_size, size_t capacity);
+EXPORT void mpmc_ring_free(struct mpmc_ring *ring);
+
+static inline size_t mpmc_ring_capacity(const struct mpmc_ring *ring)
+{
+	return ring->mask + 1;
+}
+
+static inline volatile size_t *mpmc_ring_cell(struct mpmc_ring *ring, size_t pos)
+{
+	return (volatile size_t *)(ring->cells + (pos & ring->mask) * ring->cell_size);
+}
+
+static inline bool mpmc_ring_push(struct mpmc_ring *ring, const void *item)
+{
+	volatile size_t *cell;
+	size_t           pos = os_atomic_load_size_relaxed(&ring->head);
+
+	for (;;) {
+		cell = mpmc_ring_cell(ring, pos);
+
+		ptrdiff_t diff = (ptrdiff_t)(os_atomic_load_size_acquire(cell) - pos);
+		if (diff == 0) {
+			if (os_atomic_compare_swap_size(&ring->head, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return false; /* the consumers haven't gotten to it yet, so full */
+		}
+
+		pos = os_atomic_load_size_relaxed(&ring->head);
+	}
+
+	memcpy((void *)(cell + 1), item, ring->item_size);
+	os_atomic_store_size_release(cell, pos + 1);
+	return true;
+}
+
+static inline bool mpmc_ring_pop(struct mpmc_ring *ring, void *item)
+{
+	volatile size_t *cell;
+	size_t           pos = os_atomic_load_size_relaxed(&ring->tail);
+
+	for (;;) {
+		cell = mpmc_ring_cell(ring, pos);
+
+		ptrdiff_t diff = (ptrdiff_t)(os_atomic_load_size_acquire(cell) - (pos + 1));
+		if (diff == 0) {
+			if (os_atomic_compare_swap_size(&ring->tail, pos, pos + 1))
+				break;
+		} else if (diff < 0) {
+			return false; /* not filled yet, so empty */
+		}
+
+		pos = os_atomic_load_size_relaxed(&ring->tail);
+	}
+
+	memcpy(item, (const void *)(cell + 1), ring->item_size);
+	os_atomic_store_size_release(cell, pos + ring->mask + 1);
+	return true;
+}
+
+#ifdef __cplusplus
+}
+#endif
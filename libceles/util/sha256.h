@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "util-defs.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* SHA-256, for content hashes that have to hold up across builds and
+ * machines.  The tables use FNV-1a from hash.h instead. */
+
+#define SHA256_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_SIZE * 2 + 1)
+
+struct sha256_ctx {
+	uint32_t state[8];
+	uint64_t size;
+	uint8_t  block[64];
+};
+
+EXPORT void sha256_init(struct sha256_ctx *ctx);
+EXPORT void sha256_update(struct sha256_ctx *ctx, const void *data, size_t size);
+EXPORT void sha256_final(struct sha256_ctx *ctx, uint8_t digest[SHA256_SIZE]);
+
+EXPORT void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]);
+EXPORT void sha256_to_hex(const uint8_t digest[SHA256_SIZE], char hex[SHA256_HEX_SIZE]);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "stats.h"
+#include "threading.h"
+
+#ifdef ENABLE_TESTS
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+static const char *phase_names[STATS_PHASE_COUNT] = {
+	"toml_load",
+	"find_sources",
+	"file_read",
+	"parse",
+	"cache_lookup",
+	"cache_store",
+};
+
+static const char *counter_names[STATS_COUNTER_COUNT] = {
+	"tokens",
+	"bytes_lexed",
+	"hash_probes",
+	"allocs",
+	"alloc_bytes",
+};
+
+const char *stats_phase_name(enum stats_phase phase)
+{
+	return phase < STATS_PHASE_COUNT ? phase_names[phase] : NULL;
+}
+
+const char *stats_counter_name(enum stats_counter counter)
+{
+	return counter < STATS_COUNTER_COUNT ? counter_names[counter] : NULL;
+}
+
+#ifdef ENABLE_STATS
+
+struct stats_node {
+	struct stats       stats;
+	struct stats_node *next;
+};
+
+STATS_THREAD_LOCAL struct stats *stats_thread_block = NULL;
+
+/* blocks are never freed, threads may come and go but their counts stay */
+static struct stats_node *volatile blocks = NULL;
+
+struct stats *stats_register_thread(void)
+{
+	/* not bmalloc, which would count itself and end up back here */
+	struct stats_node *node = calloc(1, sizeof(*node));
+
+	if (!node) {
+		os_breakpoint();
+		abort();
+	}
+
+	do {
+		node->next = os_atomic_load_ptr((void *volatile *)&blocks);
+	} while (!os_atomic_compare_swap_ptr((void *volatile *)&blocks, node->next, node));
+
+	stats_thread_block = &node->stats;
+	return stats_thread_block;
+}
+
+void stats_collect(struct stats *totals)
+{
+	struct stats_node *node = os_atomic_load_ptr((void *volatile *)&blocks);
+	size_t             i;
+
+	memset(totals, 0, sizeof(*totals));
+
+	for (; node; node = node->next) {
+		for (i = 0; i < STATS_PHASE_COUNT; i++) {
+			totals->phase_ns[i] += node->stats.phase_ns[i];
+			totals->phase_calls[i] += node->stats.phase_calls[i];
+		}
+		for (i = 0; i < STATS_COUNTER_COUNT; i++)
+			totals->counters[i] += node->stats.counters[i];
+	}
+}
+
+void stats_reset(void)
+{
+	struct stats_node *node = os_atomic_load_ptr((void *volatile *)&blocks);
+
+	for (; node; node = node->next)
+		memset(&node->stats, 0, sizeof(node->stats));
+}
+
+#else
+
+void stats_collect(struct stats *totals)
+{
+	memset(totals, 0, sizeof(*totals));
+}
+
+void stats_reset(void) {}
+
+#endif
+
+/* ========================================================================= */
+
+#ifdef ENABLE_TESTS
+
+static void *count_thread(void *param)
+{
+	STATS_PHASE_START(timer);
+	STATS_ADD(STATS_TOKENS, 10);
+	STATS_PHASE_END(timer, STATS_PHASE_PARSE);
+
+	UNUSED_PARAMETER(param);
+	return NULL;
+}
+
+void stats_test_collect(void **state)
+{
+	struct stats totals;
+	os_thread_t *thread;
+
+	assert_string_equal(stats_phase_name(STATS_PHASE_FILE_READ), "file_read");
+	assert_string_equal(stats_counter_name(STATS_ALLOC_BYTES), "alloc_bytes");
+	assert_null(stats_phase_name(STATS_PHASE_COUNT));
+
+	stats_reset();
+
+	STATS_ADD(STATS_TOKENS, 5);
+	thread = os_thread_create(count_thread, NULL);
+	os_thread_join(thread);
+
+	stats_collect(&totals);
+
+	if (STATS_ENABLED) {
+		assert_int_equal(totals.counters[STATS_TOKENS], 15);
+		assert_int_equal(totals.phase_calls[STATS_PHASE_PARSE], 1);
+		assert_int_equal(totals.counters[STATS_BYTES_LEXED], 0);
+	} else {
+		assert_int_equal(totals.counters[STATS_TOKENS], 0);
+		assert_int_equal(totals.phase_calls[STATS_PHASE_PARSE], 0);
+	}
+
+	stats_reset();
+	stats_collect(&totals);
+	assert_int_equal(totals.counters[STATS_TOKENS], 0);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
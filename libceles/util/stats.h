@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Build statistics: phase timers and event counters.
+ *
+ * Only compiled in with ENABLE_STATS.  Without it the STATS_* macros expand
+ * to nothing, so instrumented code is exactly what it would be without them,
+ * and stats_collect() reports zeros.
+ *
+ * Each thread counts into its own block, so the hot paths never touch shared
+ * memory.  stats_collect() sums all of them, which is only meaningful once
+ * the threads doing the counting are done (e.g. after job_pool_wait()).
+ * Phase times are summed over threads too, so with several threads they add
+ * up to more than the wall clock time.
+ */
+
+enum stats_phase {
+	STATS_PHASE_TOML_LOAD,
+	STATS_PHASE_FIND_SOURCES,
+	STATS_PHASE_FILE_READ,
+	STATS_PHASE_PARSE, /* lexing and tree building, which happen together */
+	STATS_PHASE_CACHE_LOOKUP,
+	STATS_PHASE_CACHE_STORE,
+	STATS_PHASE_COUNT
+};
+
+enum stats_counter {
+	STATS_TOKENS,
+	STATS_BYTES_LEXED,
+	STATS_HASH_PROBES, /* hash map groups probed */
+	STATS_ALLOCS,      /* bmalloc/brealloc calls */
+	STATS_ALLOC_BYTES,
+	STATS_COUNTER_COUNT
+};
+
+struct stats {
+	uint64_t phase_ns[STATS_PHASE_COUNT];
+	uint64_t phase_calls[STATS_PHASE_COUNT];
+	uint64_t counters[STATS_COUNTER_COUNT];
+};
+
+/* snake_case names, usable as JSON keys */
+EXPORT const char *stats_phase_name(enum stats_phase phase);
+EXPORT const char *stats_counter_name(enum stats_counter counter);
+
+EXPORT void stats_collect(struct stats *totals);
+EXPORT void stats_reset(void);
+
+#ifdef ENABLE_STATS
+
+#ifdef _MSC_VER
+#define STATS_THREAD_LOCAL __declspec(thread)
+#else
+#define STATS_THREAD_LOCAL __thread
+#endif
+
+extern STATS_THREAD_LOCAL struct stats *stats_thread_block;
+
+EXPORT struct stats *stats_register_thread(void);
+
+static inline struct stats *stats_local(void)
+{
+	struct stats *block = stats_thread_block;
+	return block ? block : stats_register_thread();
+}
+
+static inline void stats_add_phase(enum stats_phase phase, uint64_t start_ns)
+{
+	struct stats *block = stats_local();
+	block->phase_ns[phase] += os_gettime_ns() - start_ns;
+	block->phase_calls[phase]++;
+}
+
+#define STATS_ENABLED true
+#define STATS_ADD(counter, n) (stats_local()->counters[counter] += (uint64_t)(n))
+#define STATS_PHASE_START(timer) uint64_t timer = os_gettime_ns()
+#define STATS_PHASE_END(timer, phase) stats_add_phase(phase, timer)
+
+#else
+
+#define STATS_ENABLED false
+#define STATS_ADD(counter, n) ((void)0)
+#define STATS_PHASE_START(timer)
+#define STATS_PHASE_END(timer, phase) ((void)0)
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "threading.h"
+#include "bmem.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+struct os_thread {
+	pthread_t thread;
+};
+
+struct os_mutex {
+	pthread_mutex_t mutex;
+};
+
+/* unnamed posix semaphores aren't available everywhere, so both of these are
+ * built on a mutex and condition variable */
+struct os_sem {
+	pthread_mutex_t mutex;
+	pthread_cond_t  cond;
+	unsigned int    value;
+};
+
+struct os_event {
+	pthread_mutex_t    mutex;
+	pthread_cond_t     cond;
+	enum os_event_type type;
+	bool               signalled;
+};
+
+os_thread_t *os_thread_create(os_thread_func_t func, void *param)
+{
+	os_thread_t *thread = bmalloc(sizeof(*thread));
+
+	if (pthread_create(&thread->thread, NULL, func, param) != 0) {
+		bfree(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void *os_thread_join(os_thread_t *thread)
+{
+	void *ret = NULL;
+
+	if (thread) {
+		pthread_join(thread->thread, &ret);
+		bfree(thread);
+	}
+
+	return ret;
+}
+
+void os_thread_yield(void)
+{
+	sched_yield();
+}
+
+size_t os_get_logical_cores(void)
+{
+	long cores = sysconf(_SC_NPROCESSORS_ONLN);
+	return cores > 0 ? (size_t)cores : 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_mutex_t *os_mutex_create(void)
+{
+	os_mutex_t *mutex = bmalloc(sizeof(*mutex));
+	pthread_mutex_init(&mutex->mutex, NULL);
+	return mutex;
+}
+
+void os_mutex_destroy(os_mutex_t *mutex)
+{
+	if (mutex) {
+		pthread_mutex_destroy(&mutex->mutex);
+		bfree(mutex);
+	}
+}
+
+void os_mutex_lock(os_mutex_t *mutex)
+{
+	pthread_mutex_lock(&mutex->mutex);
+}
+
+void os_mutex_unlock(os_mutex_t *mutex)
+{
+	pthread_mutex_unlock(&mutex->mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_sem_t *os_sem_create(unsigned int value)
+{
+	os_sem_t *sem = bmalloc(sizeof(*sem));
+	pthread_mutex_init(&sem->mutex, NULL);
+	pthread_cond_init(&sem->cond, NULL);
+	sem->value = value;
+	return sem;
+}
+
+void os_sem_destroy(os_sem_t *sem)
+{
+	if (sem) {
+		pthread_cond_destroy(&sem->cond);
+		pthread_mutex_destroy(&sem->mutex);
+		bfree(sem);
+	}
+}
+
+void os_sem_post(os_sem_t *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	sem->value++;
+	pthread_cond_signal(&sem->cond);
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+void os_sem_wait(os_sem_t *sem)
+{
+	pthread_mutex_lock(&sem->mutex);
+	while (!sem->value)
+		pthread_cond_wait(&sem->cond, &sem->mutex);
+	sem->value--;
+	pthread_mutex_unlock(&sem->mutex);
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_event_t *os_event_create(enum os_event_type type)
+{
+	os_event_t *event = bmalloc(sizeof(*event));
+	pthread_mutex_init(&event->mutex, NULL);
+	pthread_cond_init(&event->cond, NULL);
+	event->type      = type;
+	event->signalled = false;
+	return event;
+}
+
+void os_event_destroy(os_event_t *event)
+{
+	if (event) {
+		pthread_cond_destroy(&event->cond);
+		pthread_mutex_destroy(&event->mutex);
+		bfree(event);
+	}
+}
+
+void os_event_signal(os_event_t *event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->signalled = true;
+	if (event->type == OS_EVENT_TYPE_AUTO)
+		pthread_cond_signal(&event->cond);
+	else
+		pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->mutex);
+}
+
+void os_event_wait(os_event_t *event)
+{
+	pthread_mutex_lock(&event->mutex);
+	while (!event->signalled)
+		pthread_cond_wait(&event->cond, &event->mutex);
+	if (event->type == OS_EVENT_TYPE_AUTO)
+		event->signalled = false;
+	pthread_mutex_unlock(&event->mutex);
+}
+
+void os_event_reset(os_event_t *event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->signalled = false;
+	pthread_mutex_unlock(&event->mutex);
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "threading.h"
+#include "bmem.h"
+
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <process.h>
+
+struct os_thread {
+	HANDLE           handle;
+	os_thread_func_t func;
+	void            *param;
+	void            *ret;
+};
+
+struct os_mutex {
+	SRWLOCK lock;
+};
+
+struct os_sem {
+	HANDLE handle;
+};
+
+struct os_event {
+	HANDLE handle;
+};
+
+static unsigned __stdcall thread_entry(void *data)
+{
+	os_thread_t *thread = data;
+	thread->ret         = thread->func(thread->param);
+	return 0;
+}
+
+os_thread_t *os_thread_create(os_thread_func_t func, void *param)
+{
+	os_thread_t *thread = bzalloc(sizeof(*thread));
+
+	thread->func   = func;
+	thread->param  = param;
+	thread->handle = (HANDLE)_beginthreadex(NULL, 0, thread_entry, thread, 0, NULL);
+	if (!thread->handle) {
+		bfree(thread);
+		return NULL;
+	}
+
+	return thread;
+}
+
+void *os_thread_join(os_thread_t *thread)
+{
+	void *ret = NULL;
+
+	if (thread) {
+		WaitForSingleObject(thread->handle, INFINITE);
+		CloseHandle(thread->handle);
+		ret = thread->ret;
+		bfree(thread);
+	}
+
+	return ret;
+}
+
+void os_thread_yield(void)
+{
+	SwitchToThread();
+}
+
+size_t os_get_logical_cores(void)
+{
+	DWORD cores = GetActiveProcessorCount(ALL_PROCESSOR_GROUPS);
+	return cores ? (size_t)cores : 1;
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_mutex_t *os_mutex_create(void)
+{
+	os_mutex_t *mutex = bmalloc(sizeof(*mutex));
+	InitializeSRWLock(&mutex->lock);
+	return mutex;
+}
+
+void os_mutex_destroy(os_mutex_t *mutex)
+{
+	bfree(mutex);
+}
+
+void os_mutex_lock(os_mutex_t *mutex)
+{
+	AcquireSRWLockExclusive(&mutex->lock);
+}
+
+void os_mutex_unlock(os_mutex_t *mutex)
+{
+	ReleaseSRWLockExclusive(&mutex->lock);
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_sem_t *os_sem_create(unsigned int value)
+{
+	os_sem_t *sem = bmalloc(sizeof(*sem));
+
+	sem->handle = CreateSemaphore(NULL, (LONG)value, 0x7FFFFFFF, NULL);
+	if (!sem->handle) {
+		bfree(sem);
+		return NULL;
+	}
+
+	return sem;
+}
+
+void os_sem_destroy(os_sem_t *sem)
+{
+	if (sem) {
+		CloseHandle(sem->handle);
+		bfree(sem);
+	}
+}
+
+void os_sem_post(os_sem_t *sem)
+{
+	ReleaseSemaphore(sem->handle, 1, NULL);
+}
+
+void os_sem_wait(os_sem_t *sem)
+{
+	WaitForSingleObject(sem->handle, INFINITE);
+}
+
+/* ------------------------------------------------------------------------- */
+
+os_event_t *os_event_create(enum os_event_type type)
+{
+	os_event_t *event = bmalloc(sizeof(*event));
+
+	event->handle = CreateEvent(NULL, type == OS_EVENT_TYPE_MANUAL, FALSE, NULL);
+	if (!event->handle) {
+		bfree(event);
+		return NULL;
+	}
+
+	return event;
+}
+
+void os_event_destroy(os_event_t *event)
+{
+	if (event) {
+		CloseHandle(event->handle);
+		bfree(event);
+	}
+}
+
+void os_event_signal(os_event_t *event)
+{
+	SetEvent(event->handle);
+}
+
+void os_event_wait(os_event_t *event)
+{
+	WaitForSingleObject(event->handle, INFINITE);
+}
+
+void os_event_reset(os_event_t *event)
+{
+	ResetEvent(event->handle);
+}
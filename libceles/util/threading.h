@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2024 Lain Bailey <lain@obsproject.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#pragma once
+
+#include "util-defs.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* Atomics (sequentially consistent)                                         */
+
+#ifdef _MSC_VER
+
+static inline long os_atomic_inc_long(volatile long *val)
+{
+	return _InterlockedIncrement(val);
+}
+
+static inline long os_atomic_dec_long(volatile long *val)
+{
+	return _InterlockedDecrement(val);
+}
+
+static inline long os_atomic_add_long(volatile long *val, long n)
+{
+	return _InterlockedExchangeAdd(val, n) + n;
+}
+
+static inline long os_atomic_load_long(volatile long *val)
+{
+	return _InterlockedCompareExchange(val, 0, 0);
+}
+
+static inline void os_atomic_store_long(volatile long *val, long n)
+{
+	_InterlockedExchange(val, n);
+}
+
+static inline bool os_atomic_compare_swap_long(volatile long *val, long old_val, long new_val)
+{
+	return _InterlockedCompareExchange(val, new_val, old_val) == old_val;
+}
+
+static inline void *os_atomic_load_ptr(void *volatile *val)
+{
+	return _InterlockedCompareExchangePointer(val, NULL, NULL);
+}
+
+static inline bool os_atomic_compare_swap_ptr(void *volatile *val, void *old_val, void *new_val)
+{
+	return _InterlockedCompareExchangePointer(val, new_val, old_val) == old_val;
+}
+
+static inline bool os_atomic_load_bool(volatile bool *val)
+{
+	return !!_InterlockedCompareExchange8((volatile char *)val, 0, 0);
+}
+
+static inline void os_atomic_store_bool(volatile bool *val, bool b)
+{
+	_InterlockedExchange8((volatile char *)val, (char)b);
+}
+
+#else
+
+static inline long os_atomic_inc_long(volatile long *val)
+{
+	return __atomic_add_fetch(val, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline long os_atomic_dec_long(volatile long *val)
+{
+	return __atomic_sub_fetch(val, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline long os_atomic_add_long(volatile long *val, long n)
+{
+	return __atomic_add_fetch(val, n, __ATOMIC_SEQ_CST);
+}
+
+static inline long os_atomic_load_long(volatile long *val)
+{
+	return __atomic_load_n(val, __ATOMIC_SEQ_CST);
+}
+
+static inline void os_atomic_store_long(volatile long *val, long n)
+{
+	__atomic_store_n(val, n, __ATOMIC_SEQ_CST);
+}
+
+static inline bool os_atomic_compare_swap_long(volatile long *val, long old_val, long new_val)
+{
+	return __atomic_compare_exchange_n(val, &old_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline void *os_atomic_load_ptr(void *volatile *val)
+{
+	return __atomic_load_n(val, __ATOMIC_SEQ_CST);
+}
+
+static inline bool os_atomic_compare_swap_ptr(void *volatile *val, void *old_val, void *new_val)
+{
+	return __atomic_compare_exchange_n(val, &old_val, new_val, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline bool os_atomic_load_bool(volatile bool *val)
+{
+	return __atomic_load_n(val, __ATOMIC_SEQ_CST);
+}
+
+static inline void os_atomic_store_bool(volatile bool *val, bool b)
+{
+	__atomic_store_n(val, b, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* Atomics (acquire/release), for lock-free structures that publish data     */
+/* with one store and pick it up with one load                               */
+
+#ifdef _MSC_VER
+
+/* the interlocked functions are full barriers, which is stronger than needed
+ * but keeps this simple */
+#ifdef _WIN64
+static inline size_t os_atomic_load_size_acquire(volatile size_t *val)
+{
+	return (size_t)_InterlockedCompareExchange64((volatile __int64 *)val, 0, 0);
+}
+
+static inline void os_atomic_store_size_release(volatile size_t *val, size_t n)
+{
+	_InterlockedExchange64((volatile __int64 *)val, (__int64)n);
+}
+
+static inline bool os_atomic_compare_swap_size(volatile size_t *val, size_t old_val, size_t new_val)
+{
+	return _InterlockedCompareExchange64((volatile __int64 *)val, (__int64)new_val, (__int64)old_val) ==
+	       (__int64)old_val;
+}
+#else
+static inline size_t os_atomic_load_size_acquire(volatile size_t *val)
+{
+	return (size_t)_InterlockedCompareExchange((volatile long *)val, 0, 0);
+}
+
+static inline void os_atomic_store_size_release(volatile size_t *val, size_t n)
+{
+	_InterlockedExchange((volatile long *)val, (long)n);
+}
+
+static inline bool os_atomic_compare_swap_size(volatile size_t *val, size_t old_val, size_t new_val)
+{
+	return _InterlockedCompareExchange((volatile long *)val, (long)new_val, (long)old_val) == (long)old_val;
+}
+#endif
+
+static inline size_t os_atomic_load_size_relaxed(volatile size_t *val)
+{
+	return *val;
+}
+
+static inline void os_cpu_relax(void)
+{
+#ifdef _M_ARM64
+	__yield();
+#else
+	_mm_pause();
+#endif
+}
+
+#else
+
+static inline size_t os_atomic_load_size_acquire(volatile size_t *val)
+{
+	return __atomic_load_n(val, __ATOMIC_ACQUIRE);
+}
+
+static inline void os_atomic_store_size_release(volatile size_t *val, size_t n)
+{
+	__atomic_store_n(val, n, __ATOMIC_RELEASE);
+}
+
+/* weak, so it may fail spuriously and has to be called in a loop */
+static inline bool os_atomic_compare_swap_size(volatile size_t *val, size_t old_val, size_t new_val)
+{
+	return __atomic_compare_exchange_n(val, &old_val, new_val, true, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+}
+
+/* for loads that don't order anything else, such as of a value only the
+ * calling thread writes to, or one that's checked by a compare and swap */
+static inline size_t os_atomic_load_size_relaxed(volatile size_t *val)
+{
+	return __atomic_load_n(val, __ATOMIC_RELAXED);
+}
+
+static inline void os_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ volatile("yield");
+#endif
+}
+
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* Threads and synchronization                                               */
+
+typedef struct os_thread os_thread_t;
+typedef struct os_mutex  os_mutex_t;
+typedef struct os_sem    os_sem_t;
+typedef struct os_event  os_event_t;
+
+typedef void *(*os_thread_func_t)(void *param);
+
+enum os_event_type {
+	OS_EVENT_TYPE_AUTO,  /* wakes one waiter, then resets itself */
+	OS_EVENT_TYPE_MANUAL /* stays signalled until reset */
+};
+
+EXPORT os_thread_t *os_thread_create(os_thread_func_t func, void *param);
+EXPORT void        *os_thread_join(os_thread_t *thread); /* also frees the thread */
+EXPORT size_t       os_get_logical_cores(void);
+EXPORT void         os_thread_yield(void);
+
+EXPORT os_mutex_t *os_mutex_create(void);
+EXPORT void        os_mutex_destroy(os_mutex_t *mutex);
+EXPORT void        os_mutex_lock(os_mutex_t *mutex);
+EXPORT void        os_mutex_unlock(os_mutex_t *mutex);
+
+EXPORT os_sem_t *os_sem_create(unsigned int value);
+EXPORT void      os_sem_destroy(os_sem_t *sem);
+EXPORT void      os_sem_post(os_sem_t *sem);
+EXPORT void      os_sem_wait(os_sem_t *sem);
+
+EXPORT os_event_t *os_event_create(enum os_event_type type);
+EXPORT void        os_event_destroy(os_event_t *event);
+EXPORT void        os_event_signal(os_event_t *event);
+EXPORT void        os_event_wait(os_event_t *event);
+EXPORT void        os_event_reset(os_event_t *event);
+
+#ifdef __cplusplus
+}
+#endif
@@ -23,7 +23,8 @@
 #include "bmem.h"
 #include "lexer.h"
 #include "dstr.h"
-#include "hash.h"
+#include "hash-map.h"
+#include "stats.h"
 
 #ifdef ENABLE_TESTS
 #include <setjmp.h>
@@ -41,11 +42,12 @@ enum parse_error {
 	PARSE_UNIMPLEMENTED,
 	PARSE_INVALID_IDENTIFIER,
 	PARSE_KEY_ALREADY_EXISTS,
+	PARSE_INVALID_UTF8,
 };
 
 #define ERROR(error)                                                                                                   \
 	do {                                                                                                           \
-		error_data_add(&parser->errors, parser->file, token.row, token.col, error, LEX_ERROR);                 \
+		toml_parser_error(parser, token.text.array, error);                                                    \
 	} while (false)
 
 #define ERROR_EOF()                                                                                                    \
@@ -66,6 +68,49 @@ enum parse_error {
 		return PARSE_UNEXPECTED_TEXT;                                                                          \
 	} while (false)
 
+/*
+ * Everything a parsed document allocates that doesn't need its own lifetime
+ * (tables, arrays, strings and keys) comes from the document's arena.  Each
+ * table and array holds a reference to the document, so the arena is freed
+ * once the last of them is released.
+ *
+ * Lazily parsed documents also keep their source, which the sections of
+ * their tables are parsed from on first access, and collect the errors found
+ * doing so.
+ */
+struct toml_doc {
+	long          refs;
+	struct barena arena;
+
+	struct os_mapped_file mapping;
+	const char           *file;
+	struct error_data     errors;
+};
+
+static struct toml_doc *toml_doc_create(void)
+{
+	struct toml_doc *doc = bzalloc(sizeof(*doc));
+	doc->refs            = 1;
+	barena_init(&doc->arena, 0);
+	return doc;
+}
+
+static inline struct toml_doc *toml_doc_addref(struct toml_doc *doc)
+{
+	doc->refs++;
+	return doc;
+}
+
+static void toml_doc_release(struct toml_doc *doc)
+{
+	if (doc && --doc->refs == 0) {
+		os_munmap_file(&doc->mapping);
+		error_data_free(&doc->errors);
+		barena_free(&doc->arena);
+		bfree(doc);
+	}
+}
+
 struct toml_value {
 	enum toml_type type;
 	union {
@@ -85,20 +130,22 @@ static void toml_value_free(void *data)
 		toml_release(value->data.table);
 	} else if (value->type == TOML_TYPE_ARRAY) {
 		toml_array_release(value->data.array);
-	} else if (value->type == TOML_TYPE_STRING) {
-		bfree(value->data.string);
 	}
+
+	/* strings belong to the document's arena */
 }
 
 struct toml_array {
-	long refs;
+	long             refs;
+	struct toml_doc *doc;
 	DARRAY(toml_value_t) values;
 };
 
-static inline toml_array_t *toml_array_create(void)
+static inline toml_array_t *toml_array_create(struct toml_doc *doc)
 {
-	struct toml_array *array = bzalloc(sizeof(*array));
+	struct toml_array *array = barena_zalloc(&doc->arena, sizeof(*array));
 	array->refs              = 1;
+	array->doc               = toml_doc_addref(doc);
 	return array;
 }
 
@@ -112,49 +159,63 @@ static void toml_array_free(struct toml_array *array)
 }
 
 struct toml_table {
-	long         refs;
-	hash_table_t values;
-	bool         is_inline;
+	long             refs;
+	struct toml_doc *doc;
+	hash_map_t       values;
+	bool             is_inline;
+
+	/* where the key/value pairs of a lazily parsed table start in the
+	 * source, not parsed yet.  usually one, more with dotted headers */
+	DARRAY(const char *) sections;
 };
 
-static toml_t *toml_table_create(void)
+static toml_t *toml_table_create(struct toml_doc *doc)
 {
-	toml_t *table = bmalloc(sizeof(*table));
+	toml_t *table = barena_zalloc(&doc->arena, sizeof(*table));
 	table->refs   = 1;
-	hash_table_init(&table->values, sizeof(struct toml_value), toml_value_free);
+	table->doc    = toml_doc_addref(doc);
+	hash_map_init(&table->values, sizeof(struct toml_value), toml_value_free);
 	return table;
 }
 
+/* the table itself lives in the document's arena, so releasing the document
+ * has to come last */
 static void toml_table_destroy(void *data)
 {
 	if (data) {
 		struct toml_table *table = data;
-		hash_table_free(&table->values);
-		bfree(table);
+		hash_map_free(&table->values);
+		da_free(table->sections);
+		toml_doc_release(table->doc);
 	}
 }
 
+/* components point into the source text, or into the document for keys that
+ * had to be unescaped.  nearly every key has only a few of them, which are
+ * kept inline */
 struct toml_id {
-	DARRAY(struct dstr) path;
+	DARRAY_INLINE(struct strref, 4) path;
 };
 
 static inline void toml_id_init(struct toml_id *id)
 {
-	memset(id, 0, sizeof(*id));
+	da_init(id->path);
 }
 
 static inline void toml_id_free(struct toml_id *id)
 {
-	size_t i = 0;
-	for (i = 0; i < id->path.size; i++) {
-		dstr_free(&id->path.array[i]);
-	}
 	da_free(id->path);
-	memset(id, 0, sizeof(*id));
+}
+
+static inline void toml_id_move(struct toml_id *dst, struct toml_id *src)
+{
+	da_move(dst->path, src->path);
 }
 
 struct toml_parser {
 	const char        *file;
+	struct toml_doc   *doc;
+	struct dstr        scratch;
 	struct lexer       lexx;
 	struct toml_id     cur_table_id;
 	struct toml_table *cur_table;
@@ -164,17 +225,36 @@ struct toml_parser {
 	struct error_data errors;
 };
 
+/* streaming parsers don't build tables, they only use the document's arena
+ * for keys that had to be unescaped */
+static inline void toml_parser_init(struct toml_parser *parser, const char *file, bool build_tables)
+{
+	memset(parser, 0, sizeof(*parser));
+	toml_id_init(&parser->cur_table_id);
+
+	parser->file = file;
+	parser->doc  = toml_doc_create();
+	if (build_tables) {
+		parser->cur_table = toml_table_create(parser->doc);
+		parser->root      = parser->cur_table;
+	}
+}
+
 static inline void toml_parser_init_move(struct toml_parser *parser,
                                          const char         *file,
                                          char               *file_data,
                                          size_t              file_size)
 {
-	memset(parser, 0, sizeof(*parser));
-
-	parser->file = file;
+	toml_parser_init(parser, file, true);
 	lexer_start_move(&parser->lexx, file_data, file_size);
-	parser->cur_table = toml_table_create();
-	parser->root      = parser->cur_table;
+}
+
+static inline void toml_parser_init_mapped(struct toml_parser   *parser,
+                                           const char            *file,
+                                           struct os_mapped_file *mapping)
+{
+	toml_parser_init(parser, file, true);
+	lexer_start_mapped(&parser->lexx, mapping);
 }
 
 static inline void toml_parser_init_static(struct toml_parser *parser,
@@ -182,22 +262,45 @@ static inline void toml_parser_init_static(struct toml_parser *parser,
                                            const char         *file_data,
                                            size_t              file_size)
 {
-	memset(parser, 0, sizeof(*parser));
-
-	parser->file = file;
+	toml_parser_init(parser, file, true);
 	lexer_start_static(&parser->lexx, file_data, file_size);
-	parser->cur_table = toml_table_create();
-	parser->root      = parser->cur_table;
 }
 
 static inline void toml_parser_free(struct toml_parser *parser)
 {
 	lexer_free(&parser->lexx);
 	toml_id_free(&parser->cur_table_id);
+	if (parser->cur_table != parser->root) {
+		toml_release(parser->cur_table);
+	}
 	toml_release(parser->root);
+	toml_doc_release(parser->doc);
+	dstr_free(&parser->scratch);
 	error_data_free(&parser->errors);
 }
 
+/* the position is only worked out here, when there is something to report */
+static void toml_parser_error(struct toml_parser *parser, const char *offset, const char *error)
+{
+	uint32_t row;
+	uint32_t col;
+
+	lexer_get_position(&parser->lexx, offset, &row, &col);
+	error_data_add(&parser->errors, parser->file, row, col, error, LEX_ERROR);
+}
+
+/* copies a string to the document */
+static char *toml_parser_store_string(struct toml_parser *parser, const struct strref *str)
+{
+	return barena_strdup_n(&parser->doc->arena, str->array ? str->array : "", str->size);
+}
+
+/* keys are copied to the document once and borrowed by the tables */
+static hash_key_t toml_parser_store_key(struct toml_parser *parser, const struct strref *key)
+{
+	return hash_key_n(toml_parser_store_string(parser, key), key->size);
+}
+
 static enum parse_error expect_eol(struct toml_parser *parser)
 {
 	struct base_token token;
@@ -392,10 +495,76 @@ static enum parse_error parse_string_literal(struct toml_parser *parser, struct
 	ERROR_EOF();
 }
 
+/* returns the closing delimiter of a single line string if nothing in it needs
+ * to be unescaped, otherwise NULL */
+static const char *scan_plain_string(const struct lexer *lexx, char delimiter, bool escapes)
+{
+	const char *cur = lexx->offset;
+	const char *end = lexx->text + lexx->size;
+
+	for (; cur < end; cur++) {
+		char ch = *cur;
+
+		if (ch == delimiter) {
+			return cur;
+		}
+		if (ch == '\n' || ch == '\r' || (escapes && ch == '\\')) {
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Parses a basic or literal string.  Most strings contain no escape codes, so
+ * those are returned as a slice of the source text without copying.  The rest
+ * are unescaped into the scratch buffer, in which case *in_scratch is set and
+ * the result is only valid until the scratch buffer is used again.
+ */
+static enum parse_error parse_string_ref(struct toml_parser *parser, struct strref *str, bool *in_scratch)
+{
+	struct base_token token;
+	const char       *end;
+	enum parse_error  error;
+	char              delimiter;
+
+	lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE); /* known delimiter */
+	delimiter   = (char)token.ch;
+	*in_scratch = false;
+
+	if (astrcmp_n(token.text.array, delimiter == '"' ? "\"\"\"" : "'''", 3) != 0) {
+		lexer_get_token(&parser->lexx, NULL, IGNORE_WHITESPACE);
+
+		end = scan_plain_string(&parser->lexx, delimiter, delimiter == '"');
+		if (end) {
+			strref_set(str, parser->lexx.offset, (size_t)(end - parser->lexx.offset));
+			lexer_skip_to(&parser->lexx, end + 1);
+			return PARSE_SUCCESS;
+		}
+
+		lexer_reset_to_token(&parser->lexx, &token);
+	}
+
+	dstr_clear(&parser->scratch);
+	if (delimiter == '"') {
+		error = parse_string(parser, &parser->scratch);
+	} else {
+		error = parse_string_literal(parser, &parser->scratch);
+	}
+	if (error != PARSE_SUCCESS) {
+		return error;
+	}
+
+	strref_set(str, parser->scratch.array, parser->scratch.size);
+	*in_scratch = true;
+	return PARSE_SUCCESS;
+}
+
 static enum parse_error parse_number(struct toml_parser *parser, struct toml_value *value)
 {
 	struct base_token token;
-	struct dstr       str            = {0};
+	struct dstr      *str            = &parser->scratch;
 	bool              found_decimal  = false;
 	bool              found_exponent = false;
 	bool              found_number   = false;
@@ -403,6 +572,7 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 	enum parse_error  err;
 
 	value->type = TOML_TYPE_INTEGER;
+	dstr_clear(str);
 
 	if (!lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
 		ERROR_EOF();
@@ -412,7 +582,7 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 		lexer_pass_token(&parser->lexx, &token);
 
 		if (token.ch == '-') {
-			dstr_cat_ch(&str, '-');
+			dstr_cat_ch(str, '-');
 		}
 
 		if (!lexer_peek_token(&parser->lexx, &token, PARSE_WHITESPACE)) {
@@ -443,13 +613,13 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 
 	while (lexer_peek_char(&parser->lexx, &token)) {
 		if (token.type == BASE_TOKEN_WHITESPACE) {
-			if (!dstr_is_empty(&str)) {
+			if (!dstr_is_empty(str)) {
 				break;
 			}
 
 		} else if (token.type == BASE_TOKEN_DIGIT) {
 			found_number = true;
-			dstr_cat_strref(&str, &token.text);
+			dstr_cat_strref(str, &token.text);
 
 			if ((token.ch - '0') >= base) {
 				ERROR_UNEXPECTED_TEXT();
@@ -459,7 +629,7 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 			/* parse exponent */
 			if (base == 10 && found_number && !found_exponent && towlower(token.ch) == 'e') {
 				found_exponent = true;
-				dstr_cat_ch(&str, 'e');
+				dstr_cat_ch(str, 'e');
 				lexer_pass_token(&parser->lexx, &token);
 
 				/* parse +/- if any */
@@ -468,7 +638,7 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 				}
 				if (token.ch == '+' || token.ch == '-') {
 					lexer_pass_token(&parser->lexx, &token);
-					dstr_cat_strref(&str, &token.text);
+					dstr_cat_strref(str, &token.text);
 				}
 
 				err = next_char_is_digit(parser);
@@ -481,7 +651,7 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 			} else if (base == 16) { /* if hex, parse A-F */
 				wint_t ch = towlower(token.ch);
 				if (ch >= 'a' && ch <= 'f') {
-					dstr_cat_strref(&str, &token.text);
+					dstr_cat_strref(str, &token.text);
 				} else {
 					ERROR_UNEXPECTED_TEXT();
 				}
@@ -494,7 +664,7 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 			/* parse decimal */
 			if (token.ch == '.' && base == 10 && found_number && !found_decimal && !found_exponent) {
 				found_decimal = true;
-				dstr_cat_ch(&str, '.');
+				dstr_cat_ch(str, '.');
 				lexer_pass_token(&parser->lexx, &token);
 
 				err = next_char_is_digit(parser);
@@ -520,16 +690,16 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 		lexer_pass_token(&parser->lexx, &token);
 	}
 
-	if (dstr_is_empty(&str)) {
+	if (dstr_is_empty(str)) {
 		ERROR_EOF();
 	}
 
 	if (found_decimal || found_exponent) { /* float */
 		value->type      = TOML_TYPE_REAL;
-		value->data.real = strtod(str.array, NULL);
+		value->data.real = strtod(str->array, NULL);
 	} else { /* integer */
 		value->type         = TOML_TYPE_INTEGER;
-		value->data.integer = strtoll(str.array, NULL, base);
+		value->data.integer = strtoll(str->array, NULL, base);
 	}
 
 	return PARSE_SUCCESS;
@@ -537,29 +707,29 @@ static enum parse_error parse_number(struct toml_parser *parser, struct toml_val
 
 static void parse_comment(struct toml_parser *parser)
 {
-	struct base_token token;
-
-	while (lexer_get_token(&parser->lexx, &token, PARSE_WHITESPACE)) {
-		if (token.ws_type == WHITESPACE_TYPE_NEWLINE) {
-			return;
-		}
-	}
+	lexer_skip_line(&parser->lexx);
 }
 
-static enum parse_error parse_singular_identifier(struct toml_parser *parser, struct dstr *id, wint_t delimiter)
+static enum parse_error parse_singular_identifier(struct toml_parser *parser, struct strref *id, wint_t delimiter)
 {
 	struct base_token token;
 	bool              first = true;
 
+	strref_clear(id);
+
 	if (!lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
 		goto eof;
 	}
 
-	if (token.ch == '"') {
-		return parse_string(parser, id);
+	if (token.ch == '"' || token.ch == '\'') {
+		bool             in_scratch;
+		enum parse_error error = parse_string_ref(parser, id, &in_scratch);
 
-	} else if (token.ch == '\'') {
-		return parse_string_literal(parser, id);
+		/* the path outlives the scratch buffer */
+		if (error == PARSE_SUCCESS && in_scratch) {
+			strref_set(id, toml_parser_store_string(parser, id), id->size);
+		}
+		return error;
 	}
 
 	while (lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
@@ -584,8 +754,9 @@ static enum parse_error parse_singular_identifier(struct toml_parser *parser, st
 
 		first = false;
 
+		/* bare keys are contiguous, so they're a slice of the source */
 		lexer_get_token(&parser->lexx, NULL, IGNORE_WHITESPACE);
-		dstr_cat_strref(id, &token.text);
+		strref_connect(id, &token.text);
 	}
 
 eof:
@@ -595,7 +766,7 @@ eof:
 static enum parse_error parse_identifier(struct toml_parser *parser, struct toml_id *id, wint_t delimiter)
 {
 	struct base_token token;
-	struct dstr       sub_id = {0};
+	struct strref     sub_id = {0};
 	enum parse_error  error;
 
 	if (delimiter == '=' && !pass_whitespace(parser)) {
@@ -604,9 +775,11 @@ static enum parse_error parse_identifier(struct toml_parser *parser, struct toml
 
 	while ((error = parse_singular_identifier(parser, &sub_id, delimiter)) == PARSE_SUCCESS) {
 		da_push_back(id->path, &sub_id);
-		dstr_init(&sub_id);
 
-		lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE);
+		/* a quoted key can end right at the end of the text */
+		if (!lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
+			ERROR_EOF();
+		}
 		if (token.passed_newline) {
 			ERROR_EOL();
 		}
@@ -630,7 +803,9 @@ static enum parse_error parse_identifier(struct toml_parser *parser, struct toml
 	return error;
 }
 
-static enum parse_error parse_value(struct toml_parser *parser, struct toml_value *value)
+/* string values are left in str, which points into the source or the scratch
+ * buffer, and only stay valid until the next string is parsed */
+static enum parse_error parse_value_ref(struct toml_parser *parser, struct toml_value *value, struct strref *str)
 {
 	struct base_token token;
 
@@ -642,11 +817,13 @@ static enum parse_error parse_value(struct toml_parser *parser, struct toml_valu
 	}
 
 	if (strref_cmp(&token.text, "true") == 0) {
+		lexer_get_token(&parser->lexx, NULL, IGNORE_WHITESPACE);
 		value->type         = TOML_TYPE_BOOLEAN;
 		value->data.boolean = true;
 		return PARSE_SUCCESS;
 
 	} else if (strref_cmp(&token.text, "false") == 0) {
+		lexer_get_token(&parser->lexx, NULL, IGNORE_WHITESPACE);
 		value->type         = TOML_TYPE_BOOLEAN;
 		value->data.boolean = false;
 		return PARSE_SUCCESS;
@@ -659,26 +836,14 @@ static enum parse_error parse_value(struct toml_parser *parser, struct toml_valu
 		/* TODO */
 		return PARSE_UNIMPLEMENTED;
 
-	} else if (token.ch == '"') {
-		struct dstr str = {0};
-
-		enum parse_error error = parse_string(parser, &str);
-		if (error != PARSE_SUCCESS) {
-			return error;
-		}
-		value->type        = TOML_TYPE_STRING;
-		value->data.string = str.array;
-		return PARSE_SUCCESS;
-
-	} else if (token.ch == '\'') {
-		struct dstr str = {0};
-
-		enum parse_error error = parse_string_literal(parser, &str);
+	} else if (token.ch == '"' || token.ch == '\'') {
+		bool             in_scratch;
+		enum parse_error error = parse_string_ref(parser, str, &in_scratch);
 		if (error != PARSE_SUCCESS) {
 			return error;
 		}
 		value->type        = TOML_TYPE_STRING;
-		value->data.string = str.array;
+		value->data.string = NULL;
 		return PARSE_SUCCESS;
 
 	} else if (token.ch == '+' || token.ch == '-') {
@@ -699,19 +864,35 @@ static enum parse_error parse_value(struct toml_parser *parser, struct toml_valu
 	ERROR_UNEXPECTED_TEXT();
 }
 
+#ifdef ENABLE_TESTS
+/* parse_value_ref with the string stored, for the tests.  the parser calls
+ * parse_value_ref itself, since streaming never stores strings */
+static enum parse_error parse_value(struct toml_parser *parser, struct toml_value *value)
+{
+	struct strref    str;
+	enum parse_error error = parse_value_ref(parser, value, &str);
+
+	if (error == PARSE_SUCCESS && value->type == TOML_TYPE_STRING) {
+		value->data.string = toml_parser_store_string(parser, &str);
+	}
+	return error;
+}
+#endif
+
 static bool get_subtable_and_subkey(struct toml_parser *parser,
                                     struct toml_table  *table,
                                     struct toml_id     *id,
                                     struct toml_table **p_subtable,
-                                    struct dstr       **p_subkey)
+                                    struct strref     **p_subkey)
 {
 	struct toml_table *cur_subtable = table;
-	struct dstr       *cur_subkey   = &id->path.array[0];
+	struct strref     *cur_subkey   = &id->path.array[0];
 	size_t             i;
 
 	for (i = 1; i < id->path.size; i++) {
-		struct dstr       *key          = &id->path.array[i];
-		struct toml_value *cur_subvalue = hash_table_get(&cur_subtable->values, cur_subkey->array);
+		struct strref     *key          = &id->path.array[i];
+		struct toml_value *cur_subvalue =
+		        hash_map_get_n(&cur_subtable->values, cur_subkey->array, cur_subkey->size);
 
 		if (cur_subvalue) {
 			if (cur_subvalue->type != TOML_TYPE_TABLE) {
@@ -720,9 +901,9 @@ static bool get_subtable_and_subkey(struct toml_parser *parser,
 		} else {
 			struct toml_value new_subvalue;
 			new_subvalue.type       = TOML_TYPE_TABLE;
-			new_subvalue.data.table = toml_table_create();
-			cur_subvalue            = hash_table_set_n(
-                                &cur_subtable->values, cur_subkey->array, cur_subkey->size, &new_subvalue);
+			new_subvalue.data.table = toml_table_create(parser->doc);
+			cur_subvalue            = hash_map_set_borrowed(
+                                &cur_subtable->values, toml_parser_store_key(parser, cur_subkey), &new_subvalue);
 		}
 
 		cur_subtable = cur_subvalue->data.table;
@@ -739,16 +920,17 @@ static bool insert_table_header(struct toml_parser *parser, struct toml_table *r
 {
 	struct toml_table *cur_subtable = root;
 	struct toml_id    *id           = &parser->cur_table_id;
-	struct dstr       *cur_subkey   = &id->path.array[0];
+	struct strref     *cur_subkey   = &id->path.array[0];
 	struct toml_value  new_value;
 	size_t             i;
 
 	new_value.type       = TOML_TYPE_TABLE;
 	new_value.data.table = parser->cur_table;
 
-	for (i = 1; i < id->path.size - 1; i++) {
-		struct dstr       *key          = &id->path.array[i];
-		struct toml_value *cur_subvalue = hash_table_get(&cur_subtable->values, cur_subkey->array);
+	for (i = 1; i < id->path.size; i++) {
+		struct strref     *key          = &id->path.array[i];
+		struct toml_value *cur_subvalue =
+		        hash_map_get_n(&cur_subtable->values, cur_subkey->array, cur_subkey->size);
 
 		if (cur_subvalue) {
 			if (cur_subvalue->type == TOML_TYPE_ARRAY) {
@@ -766,9 +948,9 @@ static bool insert_table_header(struct toml_parser *parser, struct toml_table *r
 		} else {
 			struct toml_value new_subvalue;
 			new_subvalue.type       = TOML_TYPE_TABLE;
-			new_subvalue.data.table = toml_table_create();
-			cur_subvalue            = hash_table_set_n(
-                                &cur_subtable->values, cur_subkey->array, cur_subkey->size, &new_subvalue);
+			new_subvalue.data.table = toml_table_create(parser->doc);
+			cur_subvalue            = hash_map_set_borrowed(
+                                &cur_subtable->values, toml_parser_store_key(parser, cur_subkey), &new_subvalue);
 		}
 
 		cur_subtable = cur_subvalue->data.table;
@@ -776,7 +958,8 @@ static bool insert_table_header(struct toml_parser *parser, struct toml_table *r
 	}
 
 	if (parser->is_table_array) {
-		struct toml_value *array_val = hash_table_get(&cur_subtable->values, cur_subkey->array);
+		struct toml_value *array_val =
+		        hash_map_get_n(&cur_subtable->values, cur_subkey->array, cur_subkey->size);
 		struct toml_array *array     = array_val->data.array;
 
 		if (array_val->type != TOML_TYPE_ARRAY || array->values.array[0].type != TOML_TYPE_TABLE) {
@@ -785,27 +968,28 @@ static bool insert_table_header(struct toml_parser *parser, struct toml_table *r
 
 		da_push_back(array->values, &new_value);
 	} else {
-		if (hash_table_get(&cur_subtable->values, cur_subkey->array)) {
+		if (hash_map_get_n(&cur_subtable->values, cur_subkey->array, cur_subkey->size)) {
 			return false;
 		}
 
-		hash_table_set_n(&cur_subtable->values, cur_subkey->array, cur_subkey->size, &new_value);
+		hash_map_set_borrowed(&cur_subtable->values, toml_parser_store_key(parser, cur_subkey), &new_value);
 	}
 
 	parser->cur_table = NULL;
 	return true;
 }
 
-static enum parse_error parse_key_pair(struct toml_parser *parser, struct toml_table *table)
+/* the part of a key/value pair both parsers share.  the caller frees id, and
+ * string values are left in str as with parse_value_ref */
+static enum parse_error parse_key_value(struct toml_parser *parser,
+                                        struct toml_id     *id,
+                                        struct toml_value  *value,
+                                        struct strref      *str)
 {
-	struct base_token  token;
-	struct toml_id     id       = {0};
-	struct toml_value  value    = {0};
-	struct toml_table *subtable = NULL;
-	struct dstr       *subkey   = NULL;
-	enum parse_error   error;
+	struct base_token token;
+	enum parse_error  error;
 
-	error = parse_identifier(parser, &id, '=');
+	error = parse_identifier(parser, id, '=');
 	if (error != PARSE_SUCCESS) {
 		return error;
 	}
@@ -822,9 +1006,27 @@ static enum parse_error parse_key_pair(struct toml_parser *parser, struct toml_t
 		ERROR_EOL();
 	}
 
-	error = parse_value(parser, &value);
+	return parse_value_ref(parser, value, str);
+}
+
+static enum parse_error parse_key_pair(struct toml_parser *parser, struct toml_table *table)
+{
+	struct base_token  token    = {0}; /* errors are reported at the current offset */
+	struct toml_id     id;
+	struct toml_value  value    = {0};
+	struct strref      str      = {0};
+	struct toml_table *subtable = NULL;
+	struct strref     *subkey   = NULL;
+	enum parse_error   error;
+
+	toml_id_init(&id);
+	error = parse_key_value(parser, &id, &value, &str);
 	if (error != PARSE_SUCCESS) {
-		return error;
+		goto fail;
+	}
+
+	if (value.type == TOML_TYPE_STRING) {
+		value.data.string = toml_parser_store_string(parser, &str);
 	}
 
 	subtable = table;
@@ -837,14 +1039,14 @@ static enum parse_error parse_key_pair(struct toml_parser *parser, struct toml_t
 		goto fail;
 	}
 
-	struct toml_value *existing = toml_table_get_value(subtable, subkey->array);
+	struct toml_value *existing = hash_map_get_n(&subtable->values, subkey->array, subkey->size);
 	if (existing) {
 		ERROR("Key already exists (Improve this error later)");
 		error = PARSE_KEY_ALREADY_EXISTS;
 		goto fail;
 	}
 
-	hash_table_set_n(&subtable->values, subkey->array, subkey->size, &value);
+	hash_map_set_borrowed(&subtable->values, toml_parser_store_key(parser, subkey), &value);
 	memset(&value, 0, sizeof(value));
 
 fail:
@@ -853,15 +1055,13 @@ fail:
 	return error;
 }
 
-static enum parse_error parse_table_header(struct toml_parser *parser, struct toml_table *root)
+/* the part of a table header both parsers share.  the caller frees id */
+static enum parse_error parse_table_id(struct toml_parser *parser, struct toml_id *id, bool *table_array)
 {
-	struct base_token  token;
-	struct toml_id     id          = {0};
-	struct toml_table *subtable    = NULL;
-	struct dstr       *subkey      = NULL;
-	bool               table_array = false;
-	enum parse_error   error;
+	struct base_token token;
+	enum parse_error  error;
 
+	*table_array = false;
 	lexer_get_token(&parser->lexx, NULL, IGNORE_WHITESPACE); /* '[' */
 
 	if (!lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
@@ -869,25 +1069,36 @@ static enum parse_error parse_table_header(struct toml_parser *parser, struct to
 	}
 
 	if (token.ch == '[') { /* table array */
-		table_array = true;
+		*table_array = true;
 		if (!lexer_get_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
 			ERROR_EOF();
 		}
 	}
 
-	error = parse_identifier(parser, &id, ']');
+	error = parse_identifier(parser, id, ']');
 	if (error != PARSE_SUCCESS) {
 		return error;
 	}
 
-	if (table_array) {
+	if (*table_array) {
 		error = expect_next_char(parser, ']', IGNORE_WHITESPACE);
 		if (error != PARSE_SUCCESS) {
-			goto fail;
+			return error;
 		}
 	}
 
-	error = expect_next_char(parser, ']', IGNORE_WHITESPACE);
+	return expect_next_char(parser, ']', IGNORE_WHITESPACE);
+}
+
+static enum parse_error parse_table_header(struct toml_parser *parser, struct toml_table *root)
+{
+	struct base_token token = {0}; /* errors are reported at the current offset */
+	struct toml_id    id;
+	bool              table_array;
+	enum parse_error  error;
+
+	toml_id_init(&id);
+	error = parse_table_id(parser, &id, &table_array);
 	if (error != PARSE_SUCCESS) {
 		goto fail;
 	}
@@ -901,8 +1112,8 @@ static enum parse_error parse_table_header(struct toml_parser *parser, struct to
 		}
 	}
 
-	parser->cur_table    = toml_table_create();
-	parser->cur_table_id = id;
+	parser->cur_table = toml_table_create(parser->doc);
+	toml_id_move(&parser->cur_table_id, &id);
 	return PARSE_SUCCESS;
 
 fail:
@@ -915,6 +1126,12 @@ static enum parse_error parse_toml_data(struct toml_parser *parser)
 	struct strref     table_key;
 	struct base_token token;
 	enum parse_error  error;
+	size_t            error_offset;
+
+	if (!lexer_validate_utf8(&parser->lexx, &error_offset)) {
+		toml_parser_error(parser, parser->lexx.text + error_offset, "Invalid UTF-8");
+		return PARSE_INVALID_UTF8;
+	}
 
 	while (lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
 		struct toml_table *table;
@@ -937,33 +1154,507 @@ static enum parse_error parse_toml_data(struct toml_parser *parser)
 		}
 	}
 
-	insert_table_header(parser, parser->root);
+	if (parser->cur_table != parser->root) {
+		insert_table_header(parser, parser->root);
+	}
+	return PARSE_SUCCESS;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Lazy parsing                                                              */
+
+/* skips the rest of a key/value pair without parsing it.  only strings need
+ * any care, since they're all that can span lines or hide a '#' */
+static bool skip_key_pair(struct toml_parser *parser)
+{
+	struct lexer *lexx = &parser->lexx;
+	const char   *end  = lexx->text + lexx->size;
+
+	while (lexer_skip_to_any(lexx, "\"'#\n")) {
+		const char *cur       = lexx->offset;
+		char        delimiter = *cur;
+		bool        multiline;
+
+		if (delimiter == '\n') {
+			lexer_skip_to(lexx, cur + 1);
+			return true;
+		} else if (delimiter == '#') {
+			return lexer_skip_line(lexx);
+		}
+
+		multiline = end - cur >= 3 && cur[1] == delimiter && cur[2] == delimiter;
+		cur += multiline ? 3 : 1;
+
+		for (; cur < end; cur++) {
+			if (*cur == '\\' && delimiter == '"') {
+				cur++;
+			} else if (*cur == delimiter) {
+				if (!multiline)
+					break;
+				if (end - cur >= 3 && cur[1] == delimiter && cur[2] == delimiter)
+					break;
+			} else if (*cur == '\n' && !multiline) {
+				break; /* unterminated, which is reported when it's parsed */
+			}
+		}
+
+		if (cur >= end) {
+			lexer_skip_to(lexx, end);
+			return false;
+		}
+
+		lexer_skip_to(lexx, *cur == '\n' ? cur : cur + (multiline ? 3 : 1));
+	}
+
+	return false;
+}
+
+/* builds every table from the headers, but only records where their key/value
+ * pairs are instead of parsing them */
+static enum parse_error parse_toml_structure(struct toml_parser *parser)
+{
+	struct base_token token;
+	enum parse_error  error;
+	size_t            error_offset;
+
+	if (!lexer_validate_utf8(&parser->lexx, &error_offset)) {
+		toml_parser_error(parser, parser->lexx.text + error_offset, "Invalid UTF-8");
+		return PARSE_INVALID_UTF8;
+	}
+
+	da_push_back(parser->root->sections, &parser->lexx.text);
+
+	while (lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
+		if (token.ch == '[') {
+			error = parse_table_header(parser, parser->root);
+			if (error != PARSE_SUCCESS) {
+				return error;
+			}
+
+			da_push_back(parser->cur_table->sections, &parser->lexx.offset);
+
+		} else if (token.ch == '#') {
+			parse_comment(parser);
+
+		} else {
+			lexer_skip_to(&parser->lexx, token.text.array);
+			skip_key_pair(parser);
+		}
+	}
+
+	if (parser->cur_table != parser->root) {
+		insert_table_header(parser, parser->root);
+	}
+	return PARSE_SUCCESS;
+}
+
+/* a section runs until the next header, and stops early at its first error */
+static void parse_table_section(struct toml_parser *parser, struct toml_table *table, const char *section)
+{
+	struct base_token token;
+
+	lexer_skip_to(&parser->lexx, section);
+
+	while (lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE) && token.ch != '[') {
+		if (token.ch == '#') {
+			parse_comment(parser);
+		} else if (parse_key_pair(parser, table) != PARSE_SUCCESS) {
+			break;
+		}
+	}
+}
+
+static void toml_table_parse_sections(struct toml_table *table)
+{
+	struct toml_doc   *doc = table->doc;
+	struct toml_parser parser;
+	size_t             i;
+
+	memset(&parser, 0, sizeof(parser));
+	toml_id_init(&parser.cur_table_id);
+
+	parser.file      = doc->file;
+	parser.doc       = toml_doc_addref(doc);
+	parser.root      = toml_addref(table);
+	parser.cur_table = parser.root;
+
+	/* already checked by the structural pass */
+	lexer_start_static(&parser.lexx, doc->mapping.data, doc->mapping.size);
+	parser.lexx.utf8_valid = true;
+
+	/* parsing only ever touches the tables' maps directly, not through the
+	 * accessors, so this can't be re-entered */
+	for (i = 0; i < table->sections.size; i++)
+		parse_table_section(&parser, table, table->sections.array[i]);
+	da_free(table->sections);
+
+	error_data_append(&doc->errors, &parser.errors);
+	toml_parser_free(&parser);
+}
+
+/* every accessor goes through here */
+static inline hash_map_t *toml_table_values(struct toml_table *table)
+{
+	if (table->sections.size)
+		toml_table_parse_sections(table);
+	return &table->values;
+}
+
+/* ------------------------------------------------------------------------- */
+/* Streaming                                                                 */
+
+static enum parse_error emit_table_header(struct toml_parser *parser,
+                                          toml_event_func_t   func,
+                                          void               *param,
+                                          bool               *stopped)
+{
+	struct toml_event event = {0};
+	struct toml_id    id;
+	bool              table_array;
+	enum parse_error  error;
+
+	toml_id_init(&id);
+	error = parse_table_id(parser, &id, &table_array);
+	if (error == PARSE_SUCCESS) {
+		event.type      = table_array ? TOML_EVENT_TABLE_ARRAY : TOML_EVENT_TABLE;
+		event.path      = id.path.array;
+		event.path_size = id.path.size;
+		*stopped        = !func(param, &event);
+	}
+
+	toml_id_free(&id);
+	return error;
+}
+
+static enum parse_error emit_key_value(struct toml_parser *parser, toml_event_func_t func, void *param, bool *stopped)
+{
+	struct toml_event event = {0};
+	struct toml_value value = {0};
+	struct strref     str   = {0};
+	struct toml_id    id;
+	enum parse_error  error;
+
+	toml_id_init(&id);
+	error = parse_key_value(parser, &id, &value, &str);
+	if (error == PARSE_SUCCESS) {
+		event.type       = TOML_EVENT_VALUE;
+		event.path       = id.path.array;
+		event.path_size  = id.path.size;
+		event.value_type = value.type;
+
+		switch (value.type) {
+		case TOML_TYPE_STRING:
+			event.value.string = str;
+			break;
+		case TOML_TYPE_INTEGER:
+			event.value.integer = value.data.integer;
+			break;
+		case TOML_TYPE_REAL:
+			event.value.real = value.data.real;
+			break;
+		case TOML_TYPE_BOOLEAN:
+			event.value.boolean = value.data.boolean;
+			break;
+		default:
+			break;
+		}
+
+		*stopped = !func(param, &event);
+	}
+
+	toml_id_free(&id);
+	return error;
+}
+
+static enum parse_error parse_toml_stream(struct toml_parser *parser,
+                                          toml_event_func_t   func,
+                                          void               *param,
+                                          bool               *stopped)
+{
+	struct base_token token;
+	enum parse_error  error;
+	size_t            error_offset;
+
+	*stopped = false;
+
+	if (!lexer_validate_utf8(&parser->lexx, &error_offset)) {
+		toml_parser_error(parser, parser->lexx.text + error_offset, "Invalid UTF-8");
+		return PARSE_INVALID_UTF8;
+	}
+
+	while (!*stopped && lexer_peek_token(&parser->lexx, &token, IGNORE_WHITESPACE)) {
+		if (token.ch == '[') {
+			error = emit_table_header(parser, func, param, stopped);
+		} else if (token.ch == '#') {
+			parse_comment(parser);
+			continue;
+		} else {
+			error = emit_key_value(parser, func, param, stopped);
+		}
+
+		if (error != PARSE_SUCCESS) {
+			return error;
+		}
+
+		/* unescaped keys are only needed until their event is handled */
+		barena_clear(&parser->doc->arena);
+	}
+
 	return PARSE_SUCCESS;
 }
 
+static int toml_parse_stream_internal(struct toml_parser *parser,
+                                      toml_event_func_t   func,
+                                      void               *param,
+                                      char              **errors)
+{
+	bool stopped;
+	bool success;
+
+	success = parse_toml_stream(parser, func, param, &stopped) == PARSE_SUCCESS;
+	STATS_ADD(STATS_BYTES_LEXED, (size_t)(parser->lexx.offset - parser->lexx.text));
+
+	if (!success && errors && parser->errors.errors.size) {
+		*errors = error_data_buildstring(&parser->errors);
+	}
+
+	toml_parser_free(parser);
+
+	if (!success)
+		return TOML_ERROR;
+	return stopped ? TOML_STOPPED : TOML_SUCCESS;
+}
+
+int toml_parse_stream(const char *file, toml_event_func_t func, void *param, char **errors)
+{
+	struct toml_parser    parser;
+	struct os_mapped_file mapping;
+	int                   result;
+
+	STATS_PHASE_START(timer);
+
+	if (!os_mmap_file(file, &mapping)) {
+		return TOML_FILE_NOT_FOUND;
+	}
+
+	toml_parser_init(&parser, file, false);
+	lexer_start_mapped(&parser.lexx, &mapping);
+	result = toml_parse_stream_internal(&parser, func, param, errors);
+
+	STATS_PHASE_END(timer, STATS_PHASE_TOML_LOAD);
+	return result;
+}
+
+int toml_parse_stream_string(const char *text, size_t size, toml_event_func_t func, void *param, char **errors)
+{
+	struct toml_parser parser;
+	int                result;
+
+	STATS_PHASE_START(timer);
+
+	toml_parser_init(&parser, "string", false);
+	lexer_start_static(&parser.lexx, text, size);
+	result = toml_parse_stream_internal(&parser, func, param, errors);
+
+	STATS_PHASE_END(timer, STATS_PHASE_TOML_LOAD);
+	return result;
+}
+
 /* ------------------------------------------------------------------------- */
 /* Tables                                                                    */
 
+/* parses everything and hands the root over to *toml, or sets it to NULL on
+ * failure.  frees the parser either way */
+static int toml_parse_internal(struct toml_parser *parser, toml_t **toml, char **errors)
+{
+	bool success = parse_toml_data(parser) == PARSE_SUCCESS;
+	STATS_ADD(STATS_BYTES_LEXED, parser->lexx.size);
+
+	if (!success) {
+		if (errors && parser->errors.errors.size) {
+			*errors = error_data_buildstring(&parser->errors);
+		}
+		*toml = NULL;
+	} else {
+		*toml = toml_addref(parser->root);
+	}
+
+	toml_parser_free(parser);
+	return success ? TOML_SUCCESS : TOML_ERROR;
+}
+
 int toml_open(toml_t **toml, const char *file, char **errors)
 {
-	struct toml_parser parser;
-	char              *file_data;
-	size_t             size;
-	bool               success;
+	struct toml_parser    parser;
+	struct os_mapped_file mapping;
+	int                   result;
 
 	if (!toml) {
 		return TOML_ERROR;
 	}
-	file_data = os_quick_read_utf8_file(file, &size);
-	if (!file_data) {
+
+	STATS_PHASE_START(timer);
+
+	if (!os_mmap_file(file, &mapping)) {
 		return TOML_FILE_NOT_FOUND;
 	}
-	if (!*file_data) {
-		return TOML_SUCCESS;
+
+	/* everything the document keeps is copied to its arena, so the
+	 * mapping only has to live as long as the parser */
+	toml_parser_init_mapped(&parser, file, &mapping);
+	result = toml_parse_internal(&parser, toml, errors);
+
+	STATS_PHASE_END(timer, STATS_PHASE_TOML_LOAD);
+	return result;
+}
+
+int toml_parse_buffer(toml_t **toml, const char *data, size_t size, const char *name, char **errors)
+{
+	struct toml_parser parser;
+	int                result;
+
+	if (!toml) {
+		return TOML_ERROR;
+	}
+
+	STATS_PHASE_START(timer);
+
+	toml_parser_init_static(&parser, name ? name : "buffer", data, size);
+	result = toml_parse_internal(&parser, toml, errors);
+
+	STATS_PHASE_END(timer, STATS_PHASE_TOML_LOAD);
+	return result;
+}
+
+/* counts the tables and arrays under a table, or returns false if anything
+ * holds a reference to one of them besides its parent */
+static bool toml_count_unshared(struct toml_table *table, long *count);
+
+static bool toml_count_unshared_value(struct toml_value *value, long *count)
+{
+	if (value->type == TOML_TYPE_TABLE) {
+		return value->data.table->refs == 1 && toml_count_unshared(value->data.table, count);
+
+	} else if (value->type == TOML_TYPE_ARRAY) {
+		struct toml_array *array = value->data.array;
+		size_t             i;
+
+		if (array->refs != 1) {
+			return false;
+		}
+
+		(*count)++;
+		for (i = 0; i < array->values.size; i++) {
+			if (!toml_count_unshared_value(&array->values.array[i], count)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static bool toml_count_unshared(struct toml_table *table, long *count)
+{
+	size_t i;
+
+	(*count)++;
+	for (i = 0; i < hash_map_count(&table->values); i++) {
+		if (!toml_count_unshared_value(hash_map_get_idx(&table->values, i, NULL), count)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* the document can only be reused if nothing but the caller's reference to
+ * the root can see it.  every table and array holds a reference to the
+ * document, so that's when those are all it has */
+static bool toml_doc_reusable(struct toml_table *root)
+{
+	long count = 0;
+
+	if (root->refs != 1 || root->doc->mapping.data) {
+		return false;
 	}
 
-	toml_parser_init_move(&parser, file, file_data, size);
-	success = parse_toml_data(&parser) != PARSE_SUCCESS;
+	return toml_count_unshared(root, &count) && root->doc->refs == count;
+}
+
+int toml_reparse(toml_t **toml, const char *data, size_t size, const char *name, char **errors)
+{
+	struct toml_parser parser;
+	struct toml_table *root;
+	struct toml_doc   *doc;
+	hash_map_t         values;
+	int                result;
+
+	if (!toml) {
+		return TOML_ERROR;
+	}
+
+	root = *toml;
+	if (!root || root->sections.size || !toml_doc_reusable(root)) {
+		toml_release(root);
+		return toml_parse_buffer(toml, data, size, name, errors);
+	}
+
+	STATS_PHASE_START(timer);
+
+	/* the root itself lives in the arena, so its map is taken out, emptied
+	 * (which releases everything else), and given to a new root */
+	doc    = root->doc;
+	values = root->values;
+	hash_map_clear(&values);
+	barena_clear(&doc->arena);
+
+	memset(&parser, 0, sizeof(parser));
+	toml_id_init(&parser.cur_table_id);
+
+	root         = barena_zalloc(&doc->arena, sizeof(*root));
+	root->refs   = 1;
+	root->doc    = doc; /* takes over the old root's reference */
+	root->values = values;
+
+	parser.file      = name ? name : "buffer";
+	parser.doc       = toml_doc_addref(doc);
+	parser.root      = root;
+	parser.cur_table = root;
+	lexer_start_static(&parser.lexx, data, size);
+
+	result = toml_parse_internal(&parser, toml, errors);
+
+	STATS_PHASE_END(timer, STATS_PHASE_TOML_LOAD);
+	return result;
+}
+
+int toml_open_lazy(toml_t **toml, const char *file, char **errors)
+{
+	struct toml_parser    parser;
+	struct os_mapped_file mapping;
+	bool                  success;
+
+	if (!toml) {
+		return TOML_ERROR;
+	}
+
+	STATS_PHASE_START(timer);
+
+	if (!os_mmap_file(file, &mapping)) {
+		return TOML_FILE_NOT_FOUND;
+	}
+
+	/* the document keeps the mapping, since its sections are parsed from
+	 * it later on */
+	toml_parser_init(&parser, file, true);
+	parser.doc->mapping = mapping;
+	parser.doc->file    = barena_strdup_n(&parser.doc->arena, file, strlen(file));
+	parser.file         = parser.doc->file;
+	lexer_start_static(&parser.lexx, mapping.data, mapping.size);
+
+	success = parse_toml_structure(&parser) == PARSE_SUCCESS;
+	STATS_ADD(STATS_BYTES_LEXED, parser.lexx.size);
 
 	if (!success) {
 		if (errors && parser.errors.errors.size) {
@@ -975,9 +1666,18 @@ int toml_open(toml_t **toml, const char *file, char **errors)
 	}
 
 	toml_parser_free(&parser);
+	STATS_PHASE_END(timer, STATS_PHASE_TOML_LOAD);
 	return success ? TOML_SUCCESS : TOML_ERROR;
 }
 
+char *toml_get_errors(toml_t *toml)
+{
+	if (!toml || !toml->doc->errors.errors.size) {
+		return NULL;
+	}
+	return error_data_buildstring(&toml->doc->errors);
+}
+
 toml_t *toml_addref(toml_t *toml)
 {
 	if (toml && toml->refs) {
@@ -1004,66 +1704,111 @@ long toml_release(toml_t *toml)
 
 size_t toml_table_get_pair_count(toml_t *toml)
 {
-	return toml ? toml->values.size : 0;
+	return toml ? hash_map_count(toml_table_values(toml)) : 0;
 }
 
 struct toml_pair toml_table_get_pair(toml_t *toml, size_t idx)
 {
 	struct toml_pair pair;
-	pair.value = hash_table_get_idx(&toml->values, idx, &pair.key);
+	pair.value = hash_map_get_idx(toml_table_values(toml), idx, &pair.key);
 	return pair;
 }
 
 toml_value_t *toml_table_get_value(toml_t *toml, const char *key)
 {
-	return hash_table_get(&toml->values, key);
+	return toml_table_get_value_k(toml, hash_key(key));
 }
 
 enum toml_type toml_table_get_type(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? value->type : TOML_TYPE_INVALID;
+	return toml_table_get_type_k(toml, hash_key(key));
 }
 
 const char *toml_table_get_string(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? (value->type == TOML_TYPE_STRING ? value->data.string : NULL) : NULL;
+	return toml_table_get_string_k(toml, hash_key(key));
 }
 
 int64_t toml_table_get_int(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? (value->type == TOML_TYPE_INTEGER ? value->data.integer : 0) : 0;
+	return toml_table_get_int_k(toml, hash_key(key));
 }
 
 bool toml_table_get_bool(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? (value->type == TOML_TYPE_BOOLEAN ? value->data.boolean : false) : false;
+	return toml_table_get_bool_k(toml, hash_key(key));
 }
 
 double toml_table_get_double(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? (value->type == TOML_TYPE_REAL ? value->data.real : 0.0) : 0.0;
+	return toml_table_get_double_k(toml, hash_key(key));
 }
 
 toml_t *toml_table_get_table(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? (value->type == TOML_TYPE_TABLE ? value->data.table : NULL) : NULL;
+	return toml_table_get_table_k(toml, hash_key(key));
 }
 
 toml_array_t *toml_table_get_array(toml_t *toml, const char *key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, key);
-	return value ? (value->type == TOML_TYPE_ARRAY ? value->data.array : NULL) : NULL;
+	return toml_table_get_array_k(toml, hash_key(key));
 }
 
 bool toml_table_has_value(toml_t *toml, const char *key)
 {
-	return !!hash_table_get(&toml->values, key);
+	return toml_table_has_value_k(toml, hash_key(key));
+}
+
+toml_value_t *toml_table_get_value_k(toml_t *toml, hash_key_t key)
+{
+	return hash_map_get_prehashed(toml_table_values(toml), key);
+}
+
+enum toml_type toml_table_get_type_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? value->type : TOML_TYPE_INVALID;
+}
+
+const char *toml_table_get_string_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? (value->type == TOML_TYPE_STRING ? value->data.string : NULL) : NULL;
+}
+
+int64_t toml_table_get_int_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? (value->type == TOML_TYPE_INTEGER ? value->data.integer : 0) : 0;
+}
+
+bool toml_table_get_bool_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? (value->type == TOML_TYPE_BOOLEAN ? value->data.boolean : false) : false;
+}
+
+double toml_table_get_double_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? (value->type == TOML_TYPE_REAL ? value->data.real : 0.0) : 0.0;
+}
+
+toml_t *toml_table_get_table_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? (value->type == TOML_TYPE_TABLE ? value->data.table : NULL) : NULL;
+}
+
+toml_array_t *toml_table_get_array_k(toml_t *toml, hash_key_t key)
+{
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), key);
+	return value ? (value->type == TOML_TYPE_ARRAY ? value->data.array : NULL) : NULL;
+}
+
+bool toml_table_has_value_k(toml_t *toml, hash_key_t key)
+{
+	return !!hash_map_get_prehashed(toml_table_values(toml), key);
 }
 
 /* ------------------------------------------------------------------------- */
@@ -1087,7 +1832,7 @@ long toml_array_release(toml_array_t *array)
 		}
 
 		toml_array_free(array);
-		bfree(array);
+		toml_doc_release(array->doc);
 	}
 
 	return 0;
@@ -1186,16 +1931,53 @@ toml_array_t *toml_value_get_array(toml_value_t *value)
 /* Sub-table access (just helper functions, usually used for the base table) */
 
 static struct toml_value *toml_get_subtable_value_inline(toml_t        *toml,
-                                                         const char    *table,
-                                                         const char    *key,
+                                                         hash_key_t     table,
+                                                         hash_key_t     key,
                                                          enum toml_type type)
 {
-	struct toml_value *value = hash_table_get(&toml->values, table);
-	value = (value->type == TOML_TYPE_TABLE) ? hash_table_get(&value->data.table->values, key) : NULL;
-	return (value->type == type) ? value : NULL;
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), table);
+	value                    = (value && value->type == TOML_TYPE_TABLE)
+	                                   ? hash_map_get_prehashed(toml_table_values(value->data.table), key)
+	                                   : NULL;
+	return (value && value->type == type) ? value : NULL;
 }
 
 const char *toml_get_string(toml_t *toml, const char *table, const char *key)
+{
+	return toml_get_string_k(toml, hash_key(table), hash_key(key));
+}
+
+int64_t toml_get_int(toml_t *toml, const char *table, const char *key)
+{
+	return toml_get_int_k(toml, hash_key(table), hash_key(key));
+}
+
+bool toml_get_bool(toml_t *toml, const char *table, const char *key)
+{
+	return toml_get_bool_k(toml, hash_key(table), hash_key(key));
+}
+
+double toml_get_double(toml_t *toml, const char *table, const char *key)
+{
+	return toml_get_double_k(toml, hash_key(table), hash_key(key));
+}
+
+toml_t *toml_get_table(toml_t *toml, const char *table, const char *key)
+{
+	return toml_get_table_k(toml, hash_key(table), hash_key(key));
+}
+
+toml_array_t *toml_get_array(toml_t *toml, const char *table, const char *key)
+{
+	return toml_get_array_k(toml, hash_key(table), hash_key(key));
+}
+
+bool toml_has_user_value(toml_t *toml, const char *table, const char *key)
+{
+	return toml_has_user_value_k(toml, hash_key(table), hash_key(key));
+}
+
+const char *toml_get_string_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
 	if (!toml) {
 		return NULL;
@@ -1204,7 +1986,7 @@ const char *toml_get_string(toml_t *toml, const char *table, const char *key)
 	return value ? value->data.string : NULL;
 }
 
-int64_t toml_get_int(toml_t *toml, const char *table, const char *key)
+int64_t toml_get_int_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
 	if (!toml) {
 		return 0;
@@ -1213,25 +1995,25 @@ int64_t toml_get_int(toml_t *toml, const char *table, const char *key)
 	return value ? value->data.integer : 0;
 }
 
-bool toml_get_bool(toml_t *toml, const char *table, const char *key)
+bool toml_get_bool_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
 	if (!toml) {
 		return false;
 	}
 	struct toml_value *value = toml_get_subtable_value_inline(toml, table, key, TOML_TYPE_BOOLEAN);
-	return value ? value->data.integer : false;
+	return value ? value->data.boolean : false;
 }
 
-double toml_get_double(toml_t *toml, const char *table, const char *key)
+double toml_get_double_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
 	if (!toml) {
 		return 0.0;
 	}
 	struct toml_value *value = toml_get_subtable_value_inline(toml, table, key, TOML_TYPE_REAL);
-	return value ? value->data.integer : 0.0;
+	return value ? value->data.real : 0.0;
 }
 
-toml_t *toml_get_table(toml_t *toml, const char *table, const char *key)
+toml_t *toml_get_table_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
 	if (!toml) {
 		return NULL;
@@ -1240,7 +2022,7 @@ toml_t *toml_get_table(toml_t *toml, const char *table, const char *key)
 	return value ? value->data.table : NULL;
 }
 
-toml_array_t *toml_get_array(toml_t *toml, const char *table, const char *key)
+toml_array_t *toml_get_array_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
 	if (!toml) {
 		return NULL;
@@ -1249,10 +2031,15 @@ toml_array_t *toml_get_array(toml_t *toml, const char *table, const char *key)
 	return value ? value->data.array : NULL;
 }
 
-bool toml_has_user_value(toml_t *toml, const char *table, const char *key)
+bool toml_has_user_value_k(toml_t *toml, hash_key_t table, hash_key_t key)
 {
-	struct toml_value *value = hash_table_get(&toml->values, table);
-	value = (value->type == TOML_TYPE_TABLE) ? hash_table_get(&value->data.table->values, key) : NULL;
+	if (!toml) {
+		return false;
+	}
+	struct toml_value *value = hash_map_get_prehashed(toml_table_values(toml), table);
+	value                    = (value && value->type == TOML_TYPE_TABLE)
+	                                   ? hash_map_get_prehashed(toml_table_values(value->data.table), key)
+	                                   : NULL;
 	return !!value;
 }
 
@@ -1471,6 +2258,59 @@ void toml_test_parse_string_literal(void **state)
 	UNUSED_PARAMETER(state);
 }
 
+void toml_test_parse_string_ref(void **state)
+{
+	struct toml_parser *parser = NULL;
+	struct base_token   token;
+	struct strref       out;
+	bool                in_scratch;
+	uint32_t            row;
+	uint32_t            col;
+
+	/* plain strings are slices of the source */
+	generate_parser_mock(&parser, "\"bl\xC3\xA4\" x");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_SUCCESS);
+	assert_false(in_scratch);
+	assert_true(out.array == parser->lexx.text + 1);
+	assert_int_equal(strref_cmp(&out, "bl\xC3\xA4"), 0);
+	assert_true(lexer_get_token(&parser->lexx, &token, IGNORE_WHITESPACE));
+	lexer_get_position(&parser->lexx, token.text.array, &row, &col);
+	assert_int_equal(row, 1);
+	assert_int_equal(col, 7);
+
+	generate_parser_mock(&parser, "'bla\\nbla'");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_SUCCESS);
+	assert_false(in_scratch);
+	assert_int_equal(strref_cmp(&out, "bla\\nbla"), 0);
+
+	generate_parser_mock(&parser, "\"\"");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_SUCCESS);
+	assert_false(in_scratch);
+	assert_int_equal(out.size, 0);
+
+	/* escapes and multiline strings are unescaped into the scratch buffer */
+	generate_parser_mock(&parser, "\"bla\\nbla\"");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_SUCCESS);
+	assert_true(in_scratch);
+	assert_int_equal(strref_cmp(&out, "bla\nbla"), 0);
+
+	generate_parser_mock(&parser, "'''bla'''");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_SUCCESS);
+	assert_true(in_scratch);
+	assert_int_equal(strref_cmp(&out, "bla"), 0);
+
+	/* errors still come from the regular parsing functions */
+	generate_parser_mock(&parser, "\"bla\nbla\"");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_EOL);
+
+	generate_parser_mock(&parser, "'bla");
+	assert_int_equal(parse_string_ref(parser, &out, &in_scratch), PARSE_EOF);
+
+	parser_mock_destroy(parser);
+
+	UNUSED_PARAMETER(state);
+}
+
 void toml_test_parse_number(void **state)
 {
 	struct toml_parser *parser = NULL;
@@ -1544,50 +2384,43 @@ void toml_test_parse_number(void **state)
 void toml_test_parse_singular_identifier(void **state)
 {
 	struct toml_parser *parser = NULL;
-	struct dstr         out    = {0};
+	struct strref       out    = {0};
 
 	generate_parser_mock(&parser, "");
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_EOF);
-	dstr_clear(&out);
 
 	/* ignore string parsing branches because those are passthrough and are already tested */
 
 	generate_parser_mock(&parser, "b*la");
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_UNEXPECTED_TEXT);
-	dstr_clear(&out);
 
 	generate_parser_mock(&parser, "-Bla_5-3- bla"); /* add space at end */
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_SUCCESS);
-	assert_int_equal(dstr_cmp(&out, "-Bla_5-3-"), 0);
-	dstr_clear(&out);
+	assert_int_equal(strref_cmp(&out, "-Bla_5-3-"), 0);
 
 	generate_parser_mock(&parser, "-Bla_5-3="); /* parse with delimiter */
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_SUCCESS);
-	assert_int_equal(dstr_cmp(&out, "-Bla_5-3"), 0);
-	dstr_clear(&out);
+	assert_int_equal(strref_cmp(&out, "-Bla_5-3"), 0);
 
 	generate_parser_mock(&parser, "test123._bla");
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_SUCCESS);
-	assert_int_equal(dstr_cmp(&out, "test123"), 0);
-	dstr_clear(&out);
+	assert_int_equal(strref_cmp(&out, "test123"), 0);
 
 	generate_parser_mock(&parser, "b*la");
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_UNEXPECTED_TEXT);
-	dstr_clear(&out);
 
 	generate_parser_mock(&parser, "bla");
 	assert_int_equal(parse_singular_identifier(parser, &out, '='), PARSE_EOF);
-	dstr_clear(&out);
 
-	dstr_free(&out);
 	parser_mock_destroy(parser);
 }
 
 void toml_test_parse_identifier(void **state)
 {
 	struct toml_parser *parser = NULL;
-	struct toml_id      id     = {0};
+	struct toml_id      id;
 
+	toml_id_init(&id);
 	generate_parser_mock(&parser, "");
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_EOF);
 	toml_id_free(&id);
@@ -1600,6 +2433,10 @@ void toml_test_parse_identifier(void **state)
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_EOF);
 	toml_id_free(&id);
 
+	generate_parser_mock(&parser, "\"bla\"");
+	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_EOF);
+	toml_id_free(&id);
+
 	generate_parser_mock(&parser, "\"bla\".\n'bla'=");
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_EOL);
 	toml_id_free(&id);
@@ -1615,60 +2452,68 @@ void toml_test_parse_identifier(void **state)
 	generate_parser_mock(&parser, "-Bla_5-3="); /* parse with delimiter */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 1);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
 	toml_id_free(&id);
 
 	generate_parser_mock(&parser, "-Bla_5-3 ="); /* parse with space */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 1);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
 	toml_id_free(&id);
 
 	/* parse two identifiers */
 	generate_parser_mock(&parser, "-Bla_5-3.bla_12345-="); /* parse with delimiter */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 2);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[1], "bla_12345-"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "bla_12345-"), 0);
 	toml_id_free(&id);
 
 	generate_parser_mock(&parser, "-Bla_5-3.bla_12345- ="); /* parse with space */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 2);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[1], "bla_12345-"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "bla_12345-"), 0);
 	toml_id_free(&id);
 
 	generate_parser_mock(&parser, "  -Bla_5-3 .\tbla_12345- ="); /* parse with spaces */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 2);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[1], "bla_12345-"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "bla_12345-"), 0);
 	toml_id_free(&id);
 
 	/* parse three identifiers */
 	generate_parser_mock(&parser, "-Bla_5-3.bla_12345-.bla4321="); /* parse with delimiter */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 3);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[1], "bla_12345-"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[2], "bla4321"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "bla_12345-"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[2], "bla4321"), 0);
 	toml_id_free(&id);
 
 	generate_parser_mock(&parser, "-Bla_5-3.bla_12345-.bla4321 ="); /* parse with space */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 3);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[1], "bla_12345-"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[2], "bla4321"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "bla_12345-"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[2], "bla4321"), 0);
 	toml_id_free(&id);
 
 	generate_parser_mock(&parser, "  -Bla_5-3 .\tbla_12345- .   \tbla4321 ="); /* parse with spaces */
 	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
 	assert_int_equal(id.path.size, 3);
-	assert_int_equal(dstr_cmp(&id.path.array[0], "-Bla_5-3"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[1], "bla_12345-"), 0);
-	assert_int_equal(dstr_cmp(&id.path.array[2], "bla4321"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[0], "-Bla_5-3"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "bla_12345-"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[2], "bla4321"), 0);
+	toml_id_free(&id);
+
+	/* quoted keys with escapes are unescaped into the document */
+	generate_parser_mock(&parser, "\"a\\tb\".'c'=");
+	assert_int_equal(parse_identifier(parser, &id, '='), PARSE_SUCCESS);
+	assert_int_equal(id.path.size, 2);
+	assert_int_equal(strref_cmp(&id.path.array[0], "a\tb"), 0);
+	assert_int_equal(strref_cmp(&id.path.array[1], "c"), 0);
 	toml_id_free(&id);
 
 	/* ------------------------------------------------------- */
@@ -1815,12 +2660,201 @@ void test_parse_key_pair(void **state)
 	struct toml_id      id = {0};
 
 	generate_parser_mock(&parser, "bla = \n 'bla'");
-	assert_int_eq(parse_key_pair(parser, parser->root), PARSE_EOL);
+	assert_int_equal(parse_key_pair(parser, parser->root), PARSE_EOL);
 
 	generate_parser_mock(&parser, "bla = \n 'bla'");
-	assert_int_eq(parse_key_pair(parser, parser->root), PARSE_EOL);
+	assert_int_equal(parse_key_pair(parser, parser->root), PARSE_EOL);
 
 	parser_mock_destroy(parser);
 }
 
+struct test_stream {
+	struct dstr log;
+	size_t      events;
+	size_t      stop_after;
+};
+
+static bool test_stream_event(void *param, const struct toml_event *event)
+{
+	struct test_stream *test = param;
+	size_t              i;
+
+	if (event->type == TOML_EVENT_TABLE) {
+		dstr_cat(&test->log, "[");
+	} else if (event->type == TOML_EVENT_TABLE_ARRAY) {
+		dstr_cat(&test->log, "[[");
+	}
+
+	for (i = 0; i < event->path_size; i++) {
+		if (i)
+			dstr_cat_ch(&test->log, '.');
+		dstr_ncat(&test->log, event->path[i].array, event->path[i].size);
+	}
+
+	if (event->type == TOML_EVENT_VALUE) {
+		switch (event->value_type) {
+		case TOML_TYPE_STRING:
+			dstr_catf(&test->log, "='%.*s'", (int)event->value.string.size, event->value.string.array);
+			break;
+		case TOML_TYPE_INTEGER:
+			dstr_catf(&test->log, "=%" PRId64, event->value.integer);
+			break;
+		case TOML_TYPE_REAL:
+			dstr_catf(&test->log, "=%g", event->value.real);
+			break;
+		case TOML_TYPE_BOOLEAN:
+			dstr_cat(&test->log, event->value.boolean ? "=true" : "=false");
+			break;
+		default:
+			dstr_cat(&test->log, "=?");
+			break;
+		}
+	}
+
+	dstr_cat_ch(&test->log, ';');
+	return ++test->events != test->stop_after;
+}
+
+void toml_test_parse_stream(void **state)
+{
+	static const char text[] = "# a lockfile\n"
+	                           "version = 3\n"
+	                           "enabled = true\n"
+	                           "\n"
+	                           "[[package]]\n"
+	                           "name = \"celes\"\n"
+	                           "source.\"git url\" = 'https://example.com'\n"
+	                           "escaped = \"tab\\there\"\n"
+	                           "\n"
+	                           "[package.meta]\n"
+	                           "ratio = 0.5\n";
+
+	struct test_stream test   = {0};
+	char              *errors = NULL;
+
+	assert_int_equal(toml_parse_stream_string(text, sizeof(text) - 1, test_stream_event, &test, &errors),
+	                 TOML_SUCCESS);
+	assert_null(errors);
+	assert_string_equal(test.log.array,
+	                    "version=3;enabled=true;[[package;name='celes';source.git url='https://example.com';"
+	                    "escaped='tab\there';[package.meta;ratio=0.5;");
+
+	/* the callback can stop it early */
+	dstr_free(&test.log);
+	test.events     = 0;
+	test.stop_after = 3;
+	assert_int_equal(toml_parse_stream_string(text, sizeof(text) - 1, test_stream_event, &test, &errors),
+	                 TOML_STOPPED);
+	assert_string_equal(test.log.array, "version=3;enabled=true;[[package;");
+
+	/* errors come back the same way as from toml_open */
+	dstr_free(&test.log);
+	test.events     = 0;
+	test.stop_after = 0;
+	assert_int_equal(toml_parse_stream_string("a = 1\nb = \n2\n", 14, test_stream_event, &test, &errors),
+	                 TOML_ERROR);
+	assert_non_null(errors);
+	assert_string_equal(test.log.array, "a=1;");
+
+	bfree(errors);
+	dstr_free(&test.log);
+	UNUSED_PARAMETER(state);
+}
+
+void toml_test_open_lazy(void **state)
+{
+	static const char text[] = "name = \"root\" # [NotATable]\n"
+	                           "text = \"\"\"\n"
+	                           "[NotATable]\n"
+	                           "\"\"\"\n"
+	                           "\n"
+	                           "[Build]\n"
+	                           "Name = \"celes\"\n"
+	                           "SourceDir = 'src'\n"
+	                           "\n"
+	                           "[Other]\n"
+	                           "broken = \n"
+	                           "\n"
+	                           "[Other.Sub]\n"
+	                           "x = 1\n";
+
+	const char *path   = "toml-test-lazy.toml";
+	toml_t     *toml   = NULL;
+	char       *errors = NULL;
+
+	assert_true(os_quick_write_utf8_file(path, text, sizeof(text) - 1, false));
+
+	/* the broken key is only found by parsing everything */
+	assert_int_equal(toml_open(&toml, path, &errors), TOML_ERROR);
+	assert_null(toml);
+	bfree(errors);
+	errors = NULL;
+
+	assert_int_equal(toml_open_lazy(&toml, path, &errors), TOML_SUCCESS);
+	assert_non_null(toml);
+	assert_null(errors);
+
+	assert_string_equal(toml_get_string_k(toml, HASH_KEY("Build"), HASH_KEY("Name")), "celes");
+	assert_string_equal(toml_get_string(toml, "Build", "SourceDir"), "src");
+	assert_null(toml_get_errors(toml));
+
+	/* headers in strings and comments are skipped */
+	assert_string_equal(toml_table_get_string(toml, "name"), "root");
+	assert_int_equal(toml_table_get_type(toml, "text"), TOML_TYPE_STRING);
+	assert_false(toml_table_has_value(toml, "NotATable"));
+	assert_int_equal(toml_table_get_pair_count(toml), 4);
+
+	/* errors turn up when the table is touched */
+	assert_int_equal(toml_get_int(toml, "Other", "broken"), 0);
+	errors = toml_get_errors(toml);
+	assert_non_null(errors);
+	bfree(errors);
+
+	assert_int_equal(toml_table_get_int(toml_get_table(toml, "Other", "Sub"), "x"), 1);
+
+	toml_release(toml);
+	os_unlink(path);
+	UNUSED_PARAMETER(state);
+}
+
+void toml_test_reparse(void **state)
+{
+	char        text[] = "[Build]\nName = \"celes\"\n[Other]\nx = 1\n";
+	const char *next   = "[Build]\nName = \"next\"\n";
+	toml_t     *toml   = NULL;
+	toml_t     *held   = NULL;
+	char       *errors = NULL;
+	void       *doc;
+
+	/* the buffer is only needed during the call */
+	assert_int_equal(toml_parse_buffer(&toml, text, sizeof(text) - 1, NULL, &errors), TOML_SUCCESS);
+	assert_non_null(toml);
+	memset(text, 'x', sizeof(text) - 1);
+	assert_string_equal(toml_get_string(toml, "Build", "Name"), "celes");
+
+	/* nothing else refers to the document, so it's reused */
+	doc = toml->doc;
+	assert_int_equal(toml_reparse(&toml, next, strlen(next), "next.toml", &errors), TOML_SUCCESS);
+	assert_ptr_equal(toml->doc, doc);
+	assert_string_equal(toml_get_string(toml, "Build", "Name"), "next");
+	assert_false(toml_table_has_value(toml, "Other"));
+
+	/* a table held elsewhere keeps the old document alive */
+	held = toml_addref(toml_table_get_table(toml, "Build"));
+	assert_non_null(held);
+	assert_int_equal(toml_reparse(&toml, "a = 1\n", 6, NULL, &errors), TOML_SUCCESS);
+	assert_int_equal(toml_table_get_int(toml, "a"), 1);
+	assert_string_equal(toml_table_get_string(held, "Name"), "next");
+	toml_release(held);
+
+	/* a failed parse leaves nothing */
+	assert_int_equal(toml_reparse(&toml, "a = \n", 5, "bad.toml", &errors), TOML_ERROR);
+	assert_null(toml);
+	assert_non_null(errors);
+	assert_non_null(strstr(errors, "bad.toml"));
+	bfree(errors);
+
+	UNUSED_PARAMETER(state);
+}
+
 #endif
@@ -17,6 +17,8 @@
 #pragma once
 
 #include "util-defs.h"
+#include "hash.h"
+#include "lexer.h"
 
 /*
  * Generic ini-style toml file functions
@@ -52,11 +54,93 @@ enum toml_type {
 };
 
 #define TOML_SUCCESS 0
+#define TOML_STOPPED 1 /* a streaming callback asked to stop */
 #define TOML_FILE_NOT_FOUND -1
 #define TOML_ERROR -2
 
 EXPORT int toml_open(toml_t **toml, const char *file, char **errors);
 
+/* parses a document from memory.  the data is only read during the call, so
+ * it can be freed right after.  name is used in error messages */
+EXPORT int toml_parse_buffer(toml_t **toml, const char *data, size_t size, const char *name, char **errors);
+
+/*
+ * Replaces *toml with a newly parsed document.  If nothing but *toml holds a
+ * reference to any part of the old document, its memory is reused for the new
+ * one, otherwise the old one is released and this is the same as
+ * toml_parse_buffer.  On failure *toml is set to NULL either way.
+ */
+EXPORT int toml_reparse(toml_t **toml, const char *data, size_t size, const char *name, char **errors);
+
+/*
+ * Like toml_open, but only scans the structure of the file up front: tables
+ * are created for every header, and the key/value pairs of a table are only
+ * parsed once something accesses it.  Opening is then mostly proportional to
+ * what's read rather than to the size of the file.  The file stays mapped
+ * until the document is released.
+ *
+ * Only errors in the headers make this fail.  Errors in a table's key/value
+ * pairs are found when it's first accessed, and can be fetched afterward with
+ * toml_get_errors.
+ *
+ * Since a table is parsed by whatever first reads it, reading a lazy document
+ * modifies it.  Don't read one from more than one thread at a time without a
+ * lock, or else touch every table first (toml_table_get_pair_count parses
+ * the table it's given) before handing it to other threads.
+ */
+EXPORT int toml_open_lazy(toml_t **toml, const char *file, char **errors);
+
+/* the errors found so far parsing the tables of a lazily opened document, or
+ * NULL if there were none.  free with bfree */
+EXPORT char *toml_get_errors(toml_t *toml);
+
+/* ------------------------------------------------------------------------- */
+/* Streaming                                                                 */
+
+/*
+ * Parses without building any tables, calling back once per table header and
+ * once per key/value pair in document order.  For callers that only need a
+ * few keys, or that read large generated files once.
+ *
+ * Everything an event points to (the path, string values) only lives until
+ * the callback returns, and strings are not NUL terminated.  Keys aren't
+ * checked for duplicates, since that would take the tables this avoids.
+ */
+
+enum toml_event_type {
+	TOML_EVENT_TABLE,       /* [table] */
+	TOML_EVENT_TABLE_ARRAY, /* [[table]], once per element */
+	TOML_EVENT_VALUE,       /* key = value */
+};
+
+struct toml_event {
+	enum toml_event_type type;
+
+	/* parts of the dotted key: the full name of a table, or the key of a
+	 * value relative to the last table */
+	const struct strref *path;
+	size_t               path_size;
+
+	/* values only */
+	enum toml_type value_type;
+	union {
+		struct strref string;
+		int64_t       integer;
+		double        real;
+		bool          boolean;
+	} value;
+};
+
+/* return false to stop parsing, which makes the parse return TOML_STOPPED */
+typedef bool (*toml_event_func_t)(void *param, const struct toml_event *event);
+
+EXPORT int toml_parse_stream(const char *file, toml_event_func_t func, void *param, char **errors);
+EXPORT int toml_parse_stream_string(const char        *text,
+                                    size_t             size,
+                                    toml_event_func_t  func,
+                                    void              *param,
+                                    char             **errors);
+
 /* ------------------------------------------------------------------------- */
 /* Tables                                                                    */
 
@@ -77,6 +161,18 @@ EXPORT toml_array_t  *toml_table_get_array(toml_t *toml, const char *key);
 
 EXPORT bool toml_table_has_value(toml_t *toml, const char *key);
 
+/* pre-hashed key variants of the above, see hash_key_t in hash.h */
+EXPORT toml_value_t  *toml_table_get_value_k(toml_t *toml, hash_key_t key);
+EXPORT enum toml_type toml_table_get_type_k(toml_t *toml, hash_key_t key);
+EXPORT const char    *toml_table_get_string_k(toml_t *toml, hash_key_t key);
+EXPORT int64_t        toml_table_get_int_k(toml_t *toml, hash_key_t key);
+EXPORT bool           toml_table_get_bool_k(toml_t *toml, hash_key_t key);
+EXPORT double         toml_table_get_double_k(toml_t *toml, hash_key_t key);
+EXPORT toml_t        *toml_table_get_table_k(toml_t *toml, hash_key_t key);
+EXPORT toml_array_t  *toml_table_get_array_k(toml_t *toml, hash_key_t key);
+
+EXPORT bool toml_table_has_value_k(toml_t *toml, hash_key_t key);
+
 /* ------------------------------------------------------------------------- */
 /* Arrays                                                                    */
 
@@ -115,6 +211,17 @@ EXPORT toml_array_t *toml_get_array(toml_t *toml, const char *table, const char
 
 EXPORT bool toml_has_user_value(toml_t *toml, const char *table, const char *key);
 
+/* pre-hashed key variants of the above, e.g.
+ * toml_get_string_k(config, HASH_KEY("Build"), HASH_KEY("Name")) */
+EXPORT const char   *toml_get_string_k(toml_t *toml, hash_key_t table, hash_key_t key);
+EXPORT int64_t       toml_get_int_k(toml_t *toml, hash_key_t table, hash_key_t key);
+EXPORT bool          toml_get_bool_k(toml_t *toml, hash_key_t table, hash_key_t key);
+EXPORT double        toml_get_double_k(toml_t *toml, hash_key_t table, hash_key_t key);
+EXPORT toml_t       *toml_get_table_k(toml_t *toml, hash_key_t table, hash_key_t key);
+EXPORT toml_array_t *toml_get_array_k(toml_t *toml, hash_key_t table, hash_key_t key);
+
+EXPORT bool toml_has_user_value_k(toml_t *toml, hash_key_t table, hash_key_t key);
+
 #ifdef __cplusplus
 }
 #endif
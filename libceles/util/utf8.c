@@ -14,9 +14,441 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #include <wchar.h>
+#include <string.h>
 
 #include "utf8.h"
 
+#ifdef ENABLE_TESTS
+#include "dstr.h"
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define UTF8_SSE2
+
+/* the lookup validator needs pshufb, which is picked at run time so that
+ * baseline x86-64 builds still get it */
+#if defined(__GNUC__) || defined(_MSC_VER)
+#include <tmmintrin.h>
+#define UTF8_SSSE3
+#ifdef _MSC_VER
+#include <intrin.h>
+#define UTF8_TARGET_SSSE3
+#else
+#define UTF8_TARGET_SSSE3 __attribute__((target("ssse3")))
+#endif
+#endif
+
+#elif defined(__ARM_NEON) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define UTF8_NEON
+#endif
+
+/* ------------------------------------------------------------------------- */
+/* ASCII runs                                                                */
+
+/* true if none of the 16 bytes at p have the high bit set */
+static inline bool is_ascii_block(const uint8_t *p)
+{
+#if defined(UTF8_SSE2)
+	return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *)p)) == 0;
+#elif defined(UTF8_NEON)
+	uint8x16_t high = vtstq_u8(vld1q_u8(p), vdupq_n_u8(0x80));
+	return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(high), 4)), 0) == 0;
+#else
+	uint64_t a, b;
+	memcpy(&a, p, sizeof(a));
+	memcpy(&b, p + 8, sizeof(b));
+	return ((a | b) & 0x8080808080808080ULL) == 0;
+#endif
+}
+
+/* length of the run of ASCII bytes at the start of str */
+static size_t ascii_run(const char *str, size_t size)
+{
+	const uint8_t *p   = (const uint8_t *)str;
+	const uint8_t *end = p + size;
+
+	while (end - p >= 16 && is_ascii_block(p))
+		p += 16;
+	while (p < end && *p < 0x80)
+		p++;
+
+	return (size_t)(p - (const uint8_t *)str);
+}
+
+/* widens a run of ASCII bytes to wide characters */
+static void widen_ascii(const char *in, size_t size, wchar_t *out)
+{
+	const uint8_t *p   = (const uint8_t *)in;
+	const uint8_t *end = p + size;
+
+#if defined(UTF8_SSE2)
+	const __m128i zero = _mm_setzero_si128();
+
+	for (; end - p >= 16; p += 16, out += 16) {
+		__m128i v  = _mm_loadu_si128((const __m128i *)p);
+		__m128i lo = _mm_unpacklo_epi8(v, zero);
+		__m128i hi = _mm_unpackhi_epi8(v, zero);
+
+		if (sizeof(wchar_t) == 2) {
+			_mm_storeu_si128((__m128i *)out, lo);
+			_mm_storeu_si128((__m128i *)(out + 8), hi);
+		} else {
+			_mm_storeu_si128((__m128i *)out, _mm_unpacklo_epi16(lo, zero));
+			_mm_storeu_si128((__m128i *)(out + 4), _mm_unpackhi_epi16(lo, zero));
+			_mm_storeu_si128((__m128i *)(out + 8), _mm_unpacklo_epi16(hi, zero));
+			_mm_storeu_si128((__m128i *)(out + 12), _mm_unpackhi_epi16(hi, zero));
+		}
+	}
+#endif
+
+	while (p < end)
+		*out++ = (wchar_t)*p++;
+}
+
+/* length of the run of wide characters below 0x80 at the start of in, which
+ * are narrowed to out along the way if it isn't NULL */
+static size_t narrow_ascii_run(const wchar_t *in, size_t size, char *out)
+{
+	const wchar_t *w   = in;
+	const wchar_t *end = in + size;
+
+#if defined(UTF8_SSE2)
+	if (sizeof(wchar_t) == 2) {
+		const __m128i high = _mm_set1_epi16(~0x7F);
+
+		for (; end - w >= 16; w += 16) {
+			__m128i a   = _mm_loadu_si128((const __m128i *)w);
+			__m128i b   = _mm_loadu_si128((const __m128i *)(w + 8));
+			__m128i any = _mm_and_si128(_mm_or_si128(a, b), high);
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF)
+				break;
+
+			if (out) {
+				_mm_storeu_si128((__m128i *)out, _mm_packus_epi16(a, b));
+				out += 16;
+			}
+		}
+	} else if (sizeof(wchar_t) == 4) {
+		const __m128i high = _mm_set1_epi32(~0x7F);
+
+		for (; end - w >= 16; w += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i *)w);
+			__m128i b = _mm_loadu_si128((const __m128i *)(w + 4));
+			__m128i c = _mm_loadu_si128((const __m128i *)(w + 8));
+			__m128i d = _mm_loadu_si128((const __m128i *)(w + 12));
+			__m128i any = _mm_and_si128(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), high);
+
+			if (_mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) != 0xFFFF)
+				break;
+
+			if (out) {
+				__m128i bytes = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+				_mm_storeu_si128((__m128i *)out, bytes);
+				out += 16;
+			}
+		}
+	}
+#endif
+
+	for (; w < end && (uint32_t)*w < 0x80; w++) {
+		if (out)
+			*out++ = (char)*w;
+	}
+
+	return (size_t)(w - in);
+}
+
+/* ------------------------------------------------------------------------- */
+/* Validation                                                                */
+
+/* size of the valid sequence at p, or 0 if it isn't one */
+static inline size_t valid_sequence_size(const uint8_t *p, const uint8_t *end)
+{
+	size_t  avail = (size_t)(end - p);
+	uint8_t lead  = p[0];
+	uint8_t lo    = 0x80;
+	uint8_t hi    = 0xBF;
+
+	if (lead < 0x80)
+		return 1;
+
+	/* continuation bytes, and 0xC0/0xC1 which only start overlong forms */
+	if (lead < 0xC2)
+		return 0;
+
+	if (lead < 0xE0)
+		return (avail >= 2 && (p[1] & 0xC0) == 0x80) ? 2 : 0;
+
+	if (lead < 0xF0) {
+		if (lead == 0xE0)
+			lo = 0xA0; /* overlong */
+		else if (lead == 0xED)
+			hi = 0x9F; /* surrogates */
+
+		return (avail >= 3 && p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80) ? 3 : 0;
+	}
+
+	if (lead < 0xF5) {
+		if (lead == 0xF0)
+			lo = 0x90; /* overlong */
+		else if (lead == 0xF4)
+			hi = 0x8F; /* above U+10FFFF */
+
+		return (avail >= 4 && p[1] >= lo && p[1] <= hi && (p[2] & 0xC0) == 0x80 && (p[3] & 0xC0) == 0x80)
+		               ? 4
+		               : 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Validates from p, which must be the start of a character, skipping ASCII
+ * blocks whole and checking everything else a sequence at a time.  Returns
+ * NULL if the rest of the text is valid, or the first invalid sequence.
+ */
+static const uint8_t *validate_scalar(const uint8_t *p, const uint8_t *end)
+{
+	while (p < end) {
+		size_t size;
+
+		if (end - p >= 16 && is_ascii_block(p)) {
+			p += 16;
+			continue;
+		}
+
+		size = valid_sequence_size(p, end);
+		if (!size)
+			return p;
+		p += size;
+	}
+
+	return NULL;
+}
+
+/*
+ * Everything before block was found valid, except that a sequence may run on
+ * into it.  Returns the start of that sequence, or block itself if a
+ * character starts there, so the scalar validator can take over from it.
+ */
+static const uint8_t *character_boundary(const uint8_t *start, const uint8_t *block)
+{
+	const uint8_t *p;
+
+	for (p = block; p > start && block - p < 3;) {
+		uint8_t lead = *--p;
+		size_t  size;
+
+		if ((lead & 0xC0) == 0x80)
+			continue;
+
+		size = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+		return (size_t)(block - p) < size ? p : block;
+	}
+
+	return block;
+}
+
+#if defined(UTF8_SSSE3)
+
+/*
+ * The lookup validator from "Validating UTF-8 In Less Than One Instruction
+ * Per Byte" (Keiser and Lemire), as used by simdjson.  Nearly every error is
+ * decided by the first two bytes of a sequence, so three 16 entry tables
+ * indexed by the high and low nibble of the previous byte and the high
+ * nibble of the current one classify every byte pair at once, each bit
+ * standing for one kind of error.  Only the third and fourth bytes of
+ * sequences need a separate check.
+ */
+#define TOO_SHORT (1 << 0)      /* lead byte followed by ASCII or another lead byte */
+#define TOO_LONG (1 << 1)       /* ASCII followed by a continuation byte */
+#define OVERLONG_3 (1 << 2)     /* 11100000 100xxxxx */
+#define TOO_LARGE (1 << 3)      /* 11110100 1001xxxx and above */
+#define SURROGATE (1 << 4)      /* 11101101 101xxxxx */
+#define OVERLONG_2 (1 << 5)     /* 1100000x 10xxxxxx */
+#define TOO_LARGE_1000 (1 << 6) /* 11110101 1000xxxx and above */
+#define OVERLONG_4 (1 << 6)     /* 11110000 1000xxxx */
+#define TWO_CONTS (1 << 7)      /* continuation byte not expected here */
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+static const uint8_t byte_1_high_table[16] = {
+        /* 0xxxxxxx, ASCII */
+        TOO_LONG,
+        TOO_LONG,
+        TOO_LONG,
+        TOO_LONG,
+        TOO_LONG,
+        TOO_LONG,
+        TOO_LONG,
+        TOO_LONG,
+        /* 10xxxxxx, continuation */
+        TWO_CONTS,
+        TWO_CONTS,
+        TWO_CONTS,
+        TWO_CONTS,
+        /* 110xxxxx, 1110xxxx, 1111xxxx, lead bytes */
+        TOO_SHORT | OVERLONG_2,
+        TOO_SHORT,
+        TOO_SHORT | OVERLONG_3 | SURROGATE,
+        TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+};
+
+static const uint8_t byte_1_low_table[16] = {
+        CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+        CARRY | OVERLONG_2,
+        CARRY,
+        CARRY,
+        CARRY | TOO_LARGE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+        CARRY | TOO_LARGE | TOO_LARGE_1000,
+};
+
+static const uint8_t byte_2_high_table[16] = {
+        /* 0xxxxxxx, ASCII */
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        /* 1000xxxx, 1001xxxx, 101xxxxx, continuation */
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+        /* 11xxxxxx, lead bytes */
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+        TOO_SHORT,
+};
+
+/* anything at least this large at the end of a block starts a sequence that
+ * continues into the next one */
+static const uint8_t incomplete_table[16] = {
+        0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1,
+};
+
+/*
+ * Returns the first block with an error in it, or where the blocks ended.
+ * Sequences cut off at the end of the last block are left for the scalar
+ * validator to finish.
+ */
+UTF8_TARGET_SSSE3 static const uint8_t *validate_ssse3(const uint8_t *p, const uint8_t *end)
+{
+	const __m128i byte_1_high    = _mm_loadu_si128((const __m128i *)byte_1_high_table);
+	const __m128i byte_1_low     = _mm_loadu_si128((const __m128i *)byte_1_low_table);
+	const __m128i byte_2_high    = _mm_loadu_si128((const __m128i *)byte_2_high_table);
+	const __m128i incomplete_min = _mm_loadu_si128((const __m128i *)incomplete_table);
+
+	const __m128i nibble     = _mm_set1_epi8(0x0F);
+	__m128i       prev       = _mm_setzero_si128();
+	__m128i       incomplete = _mm_setzero_si128();
+
+	for (; end - p >= 16; p += 16) {
+		__m128i input = _mm_loadu_si128((const __m128i *)p);
+		__m128i error;
+
+		if (_mm_movemask_epi8(input) == 0) {
+			/* an ASCII block is only an error if the previous
+			 * block ended in the middle of a sequence */
+			error = incomplete;
+		} else {
+			__m128i prev1 = _mm_alignr_epi8(input, prev, 15);
+			__m128i prev2 = _mm_alignr_epi8(input, prev, 14);
+			__m128i prev3 = _mm_alignr_epi8(input, prev, 13);
+
+			__m128i b1h = _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+			__m128i b1l = _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, nibble));
+			__m128i b2h = _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+			__m128i cls = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+			/* continuation bytes following a continuation byte are
+			 * fine if they're the third or fourth of a sequence */
+			__m128i third  = _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80)));
+			__m128i fourth = _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80)));
+			__m128i must   = _mm_and_si128(_mm_or_si128(third, fourth), _mm_set1_epi8((char)0x80));
+
+			error      = _mm_xor_si128(must, cls);
+			incomplete = _mm_subs_epu8(input, incomplete_min);
+		}
+
+		if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF)
+			return p;
+
+		prev = input;
+	}
+
+	return p;
+}
+
+#undef TOO_SHORT
+#undef TOO_LONG
+#undef OVERLONG_3
+#undef TOO_LARGE
+#undef SURROGATE
+#undef OVERLONG_2
+#undef TOO_LARGE_1000
+#undef OVERLONG_4
+#undef TWO_CONTS
+#undef CARRY
+
+static bool cpu_has_ssse3(void)
+{
+#if defined(__SSSE3__)
+	return true;
+#elif defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 1);
+	return (info[2] & (1 << 9)) != 0;
+#else
+	return __builtin_cpu_supports("ssse3");
+#endif
+}
+
+#endif
+
+bool utf8_validate(const char *str, size_t size, size_t *error_offset)
+{
+	const uint8_t *start = (const uint8_t *)str;
+	const uint8_t *end   = start + size;
+	const uint8_t *p     = start;
+	const uint8_t *error;
+
+#if defined(UTF8_SSSE3)
+	/* the blocks only say whether there's an error, so the scalar
+	 * validator runs from the last character boundary to find where it
+	 * is, and to finish off the tail */
+	if (size >= 16 && cpu_has_ssse3())
+		p = character_boundary(start, validate_ssse3(start, end));
+#endif
+
+	error = validate_scalar(p, end);
+	if (!error)
+		return true;
+
+	if (error_offset)
+		*error_offset = (size_t)(error - start);
+	return false;
+}
+
 #ifdef _WIN32
 
 #include <windows.h>
@@ -29,8 +461,9 @@ static inline bool has_utf8_bom(const char *in_char)
 
 size_t utf8_to_wchar(const char *in, size_t insize, wchar_t *out, size_t outsize, int flags)
 {
-	int i_insize = (int)insize;
-	int ret;
+	int    i_insize = (int)insize;
+	size_t run;
+	int    ret;
 
 	if (i_insize == 0)
 		i_insize = (int)strlen(in);
@@ -43,24 +476,52 @@ size_t utf8_to_wchar(const char *in, size_t insize, wchar_t *out, size_t outsize
 		}
 	}
 
-	ret = MultiByteToWideChar(CP_UTF8, 0, in, i_insize, out, (int)outsize);
+	/* most paths are plain ASCII, which doesn't need the API at all */
+	run = ascii_run(in, (size_t)i_insize);
+	if (out) {
+		if (outsize < run)
+			return 0;
+		widen_ascii(in, run, out);
+		out += run;
+		outsize -= run;
+	}
+	if (run == (size_t)i_insize)
+		return run;
+	if (out && !outsize)
+		return 0;
+
+	ret = MultiByteToWideChar(CP_UTF8, 0, in + run, i_insize - (int)run, out, (int)outsize);
 
 	UNUSED_PARAMETER(flags);
-	return (ret > 0) ? (size_t)ret : 0;
+	return (ret > 0) ? run + (size_t)ret : 0;
 }
 
 size_t wchar_to_utf8(const wchar_t *in, size_t insize, char *out, size_t outsize, int flags)
 {
-	int i_insize = (int)insize;
-	int ret;
+	int    i_insize = (int)insize;
+	size_t run;
+	int    ret;
 
 	if (i_insize == 0)
 		i_insize = (int)wcslen(in);
 
-	ret = WideCharToMultiByte(CP_UTF8, 0, in, i_insize, out, (int)outsize, NULL, NULL);
+	/* out has to have room for whatever is narrowed directly */
+	run = narrow_ascii_run(in, (out && outsize < (size_t)i_insize) ? outsize : (size_t)i_insize, out);
+	if (run == (size_t)i_insize)
+		return run;
+	if (out) {
+		out += run;
+		outsize -= run;
+
+		/* a size of zero would make the API return the size needed */
+		if (!outsize)
+			return 0;
+	}
+
+	ret = WideCharToMultiByte(CP_UTF8, 0, in + run, i_insize - (int)run, out, (int)outsize, NULL, NULL);
 
 	UNUSED_PARAMETER(flags);
-	return (ret > 0) ? (size_t)ret : 0;
+	return (ret > 0) ? run + (size_t)ret : 0;
 }
 
 #else
@@ -144,6 +605,24 @@ size_t utf8_to_wchar(const char *in, size_t insize, wchar_t *out, size_t outsize
 		if (!*p && insize == 0)
 			break;
 
+		/* ASCII is copied a run at a time.  only when the size is given,
+		 * as the runs are read a block at a time */
+		if (insize != 0 && *p < 0x80) {
+			size_t run = ascii_run((const char *)p, (size_t)(lim - p));
+
+			if (out && (size_t)(wlim - out) < run)
+				run = (size_t)(wlim - out);
+			if (run) {
+				if (out) {
+					widen_ascii((const char *)p, run, out);
+					out += run;
+				}
+				total += run;
+				n = run;
+				continue;
+			}
+		}
+
 		if (utf8_forbidden(*p) != 0 && (flags & UTF8_IGNORE_ERROR) == 0)
 			return 0;
 
@@ -273,6 +752,22 @@ size_t wchar_to_utf8(const wchar_t *in, size_t insize, char *out, size_t outsize
 		if (!*w && insize == 0)
 			break;
 
+		if (insize != 0 && (uint32_t)*w < 0x80) {
+			size_t run = (size_t)(wlim - w);
+
+			if (out && (size_t)(lim - p) < run)
+				run = (size_t)(lim - p);
+
+			run = narrow_ascii_run(w, run, out ? (char *)p : NULL);
+			if (run) {
+				if (out)
+					p += run;
+				total += run;
+				w += run - 1;
+				continue;
+			}
+		}
+
 		if (wchar_forbidden(*w) != 0) {
 			if ((flags & UTF8_IGNORE_ERROR) == 0)
 				return 0;
@@ -363,3 +858,140 @@ size_t wchar_to_utf8(const wchar_t *in, size_t insize, char *out, size_t outsize
 }
 
 #endif
+
+#ifdef ENABLE_TESTS
+
+static void check_invalid(const char *str, size_t size, size_t expected_offset)
+{
+	size_t offset = (size_t)-1;
+	assert_false(utf8_validate(str, size, &offset));
+	assert_int_equal(offset, expected_offset);
+}
+
+void utf8_test_validate(void **state)
+{
+	static const char *valid[] = {
+	        "",
+	        "plain ascii",
+	        "\xC2\x80\xDF\xBF",                 /* U+0080, U+07FF */
+	        "\xE0\xA0\x80\xEF\xBF\xBF",         /* U+0800, U+FFFF */
+	        "\xED\x9F\xBF\xEE\x80\x80",         /* either side of the surrogates */
+	        "\xF0\x90\x80\x80\xF4\x8F\xBF\xBF", /* U+10000, U+10FFFF */
+	        "\xEF\xBB\xBF bom",
+	};
+	static const char *invalid[] = {
+	        "\x80",                 /* stray continuation byte */
+	        "\xC0\x80",             /* overlong NUL */
+	        "\xC1\xBF",             /* overlong 2 byte */
+	        "\xE0\x9F\xBF",         /* overlong 3 byte */
+	        "\xF0\x8F\xBF\xBF",     /* overlong 4 byte */
+	        "\xED\xA0\x80",         /* surrogate */
+	        "\xF4\x90\x80\x80",     /* above U+10FFFF */
+	        "\xF5\x80\x80\x80",     /* lead byte that can't appear */
+	        "\xF8\x88\x80\x80\x80", /* 5 byte sequence */
+	        "\xE2\x82",             /* cut off */
+	        "\xE2\x82x",            /* ASCII where a continuation should be */
+	};
+	struct dstr str = {0};
+	size_t      i;
+	size_t      pad;
+
+	for (i = 0; i < sizeof(valid) / sizeof(valid[0]); i++)
+		assert_true(utf8_validate(valid[i], strlen(valid[i]), NULL));
+
+	/* the error is where the invalid sequence starts */
+	check_invalid("\xC3\xA9\xA9", 3, 2);
+	check_invalid("ab\xE2\x82\xC3\xA9", 6, 2);
+
+	/* at every position within and across the blocks the validator works
+	 * in, after both ASCII and multibyte text */
+	for (i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		for (pad = 0; pad < 40; pad++) {
+			size_t at;
+
+			dstr_resize(&str, 0);
+			while (str.size < pad)
+				dstr_cat(&str, (pad & 1) && pad - str.size >= 2 ? "\xC3\xA9" : "a");
+
+			at = str.size;
+			dstr_cat(&str, invalid[i]);
+			check_invalid(str.array, str.size, at);
+
+			dstr_cat(&str, " followed by enough text to fill another block");
+			check_invalid(str.array, str.size, at);
+		}
+	}
+
+	dstr_free(&str);
+	UNUSED_PARAMETER(state);
+}
+
+/* the block validator has to agree with the scalar one on everything */
+void utf8_test_validate_blocks(void **state)
+{
+	static const uint8_t bytes[] = {'a', 0x00, 0x7F, 0x80, 0x8F, 0x90, 0x9F, 0xA0, 0xBF, 0xC0, 0xC2,
+	                                0xDF, 0xE0, 0xE1, 0xED, 0xEF, 0xF0, 0xF1, 0xF4, 0xF5, 0xFF};
+	static const char *chars[]   = {"a", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80"};
+	uint32_t           seed      = 1;
+	char               buf[80];
+	int                i;
+
+	for (i = 0; i < 20000; i++) {
+		const uint8_t *error;
+		size_t         size = 0;
+		size_t         offset;
+		bool           valid;
+
+		/* mostly valid text, so errors land anywhere in it */
+		while (size < sizeof(buf) - 4) {
+			seed = seed * 1103515245 + 12345;
+			if ((seed >> 16) % 64 == 0) {
+				buf[size++] = (char)bytes[(seed >> 8) % sizeof(bytes)];
+			} else {
+				const char *ch = chars[(seed >> 12) % 4];
+				memcpy(buf + size, ch, strlen(ch));
+				size += strlen(ch);
+			}
+		}
+
+		error = validate_scalar((const uint8_t *)buf, (const uint8_t *)buf + size);
+		valid = utf8_validate(buf, size, &offset);
+
+		assert_int_equal(valid, error == NULL);
+		if (!valid)
+			assert_int_equal(offset, (size_t)((const char *)error - buf));
+	}
+
+	UNUSED_PARAMETER(state);
+}
+
+void utf8_test_transcode(void **state)
+{
+	const char *text = "a path with enough ASCII for a few blocks \xC3\xA9\xE2\x82\xAC\xF0\x9F\x98\x80 and more after it";
+	wchar_t     wide[128];
+	char        narrow[128];
+	size_t      wide_size;
+	size_t      size;
+
+	wide_size = utf8_to_wchar(text, strlen(text), NULL, 0, 0);
+	assert_int_equal(utf8_to_wchar(text, strlen(text), wide, 128, 0), wide_size);
+	assert_int_equal(wide[0], 'a');
+	assert_int_equal(wide[42], 0xE9);
+	assert_int_equal(wide[43], 0x20AC);
+	if (sizeof(wchar_t) == 4)
+		assert_int_equal(wide[44], 0x1F600);
+	assert_int_equal(wide[wide_size - 1], 't');
+
+	size = wchar_to_utf8(wide, wide_size, NULL, 0, 0);
+	assert_int_equal(size, strlen(text));
+	assert_int_equal(wchar_to_utf8(wide, wide_size, narrow, sizeof(narrow), 0), size);
+	assert_memory_equal(narrow, text, size);
+
+	/* not enough room for everything */
+	assert_int_equal(utf8_to_wchar(text, strlen(text), wide, 20, 0), 0);
+	assert_int_equal(wchar_to_utf8(wide, wide_size, narrow, 20, 0), 0);
+
+	UNUSED_PARAMETER(state);
+}
+
+#endif
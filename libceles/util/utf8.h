@@ -16,6 +16,9 @@
 
 #pragma once
 
+#include <wchar.h>
+#include "util-defs.h"
+
 /*
  * utf8: implementation of UTF-8 charset encoding (RFC3629).
  */
@@ -30,6 +33,14 @@ extern "C" {
 size_t utf8_to_wchar(const char *in, size_t insize, wchar_t *out, size_t outsize, int flags);
 size_t wchar_to_utf8(const wchar_t *in, size_t insize, char *out, size_t outsize, int flags);
 
+/*
+ * Strict RFC3629 validation: overlong forms, surrogates, code points above
+ * U+10FFFF, and 5 and 6 byte sequences are all rejected.  On failure the
+ * byte offset of the start of the first invalid sequence is stored in
+ * error_offset, if it isn't NULL.
+ */
+EXPORT bool utf8_validate(const char *str, size_t size, size_t *error_offset);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void atom_test_intern(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(atom_test_intern),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
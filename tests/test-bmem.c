@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void bmem_test_arena(void **state);
+extern void bmem_test_darray_inline(void **state);
+extern void bmem_test_tracking(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(bmem_test_arena),
+	        cmocka_unit_test(bmem_test_darray_inline),
+	        cmocka_unit_test(bmem_test_tracking),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
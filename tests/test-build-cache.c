@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void build_cache_test_store_load(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(build_cache_test_store_load),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void dstr_test_reuse(void **state);
+extern void dstr_test_printf(void **state);
+extern void dstr_test_arena(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(dstr_test_reuse),
+	        cmocka_unit_test(dstr_test_printf),
+	        cmocka_unit_test(dstr_test_arena),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
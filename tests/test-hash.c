@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void hash_test_table(void **state);
+extern void hash_test_literal_keys(void **state);
+extern void hash_map_test_map(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(hash_test_table),
+	        cmocka_unit_test(hash_test_literal_keys),
+	        cmocka_unit_test(hash_map_test_map),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void job_pool_test_run(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(job_pool_test_run),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
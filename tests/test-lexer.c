@@ -0,0 +1,27 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void lexer_test_ascii_fast_path(void **state);
+extern void lexer_test_mapped(void **state);
+extern void lexer_test_pipe(void **state);
+extern void lexer_test_positions(void **state);
+extern void lexer_test_replace(void **state);
+extern void lexer_test_skip(void **state);
+extern void lexer_test_utf8(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(lexer_test_ascii_fast_path),
+	        cmocka_unit_test(lexer_test_mapped),
+	        cmocka_unit_test(lexer_test_pipe),
+	        cmocka_unit_test(lexer_test_positions),
+	        cmocka_unit_test(lexer_test_replace),
+	        cmocka_unit_test(lexer_test_skip),
+	        cmocka_unit_test(lexer_test_utf8),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,27 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void parser_test_build_tree(void **state);
+extern void parser_test_intern_idents(void **state);
+extern void parser_test_arena(void **state);
+extern void parser_test_edit(void **state);
+extern void parser_test_edit_empty(void **state);
+extern void parser_test_limits(void **state);
+extern void parser_test_nesting(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(parser_test_build_tree),
+	        cmocka_unit_test(parser_test_intern_idents),
+	        cmocka_unit_test(parser_test_arena),
+	        cmocka_unit_test(parser_test_edit),
+	        cmocka_unit_test(parser_test_edit_empty),
+	        cmocka_unit_test(parser_test_limits),
+	        cmocka_unit_test(parser_test_nesting),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
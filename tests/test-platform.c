@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void platform_test_watch(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(platform_test_watch),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,17 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void ring_test_spsc(void **state);
+extern void ring_test_mpmc(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(ring_test_spsc),
+	        cmocka_unit_test(ring_test_mpmc),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
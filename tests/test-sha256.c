@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void sha256_test_digest(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(sha256_test_digest),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void stats_test_collect(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(stats_test_collect),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
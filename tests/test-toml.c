@@ -10,10 +10,14 @@ extern void toml_test_parse_multiline_string(void **state);
 extern void toml_test_parse_string(void **state);
 extern void toml_test_parse_multiline_string_literal(void **state);
 extern void toml_test_parse_string_literal(void **state);
+extern void toml_test_parse_string_ref(void **state);
 extern void toml_test_parse_number(void **state);
 extern void toml_test_parse_singular_identifier(void **state);
 extern void toml_test_parse_identifier(void **state);
 extern void toml_test_parse_value(void **state);
+extern void toml_test_parse_stream(void **state);
+extern void toml_test_open_lazy(void **state);
+extern void toml_test_reparse(void **state);
 
 int main()
 {
@@ -25,10 +29,14 @@ int main()
 		cmocka_unit_test(toml_test_parse_string),
 		cmocka_unit_test(toml_test_parse_multiline_string_literal),
 		cmocka_unit_test(toml_test_parse_string_literal),
+		cmocka_unit_test(toml_test_parse_string_ref),
 		cmocka_unit_test(toml_test_parse_number),
 		cmocka_unit_test(toml_test_parse_singular_identifier),
 		cmocka_unit_test(toml_test_parse_identifier),
 		cmocka_unit_test(toml_test_parse_value),
+		cmocka_unit_test(toml_test_parse_stream),
+		cmocka_unit_test(toml_test_open_lazy),
+		cmocka_unit_test(toml_test_reparse),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);
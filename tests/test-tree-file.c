@@ -0,0 +1,15 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void tree_file_test_view(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(tree_file_test_view),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}
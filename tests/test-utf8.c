@@ -0,0 +1,19 @@
+#include <stddef.h>
+#include <stdarg.h>
+#include <setjmp.h>
+#include <cmocka.h>
+
+extern void utf8_test_validate(void **state);
+extern void utf8_test_validate_blocks(void **state);
+extern void utf8_test_transcode(void **state);
+
+int main()
+{
+	const struct CMUnitTest tests[] = {
+	        cmocka_unit_test(utf8_test_validate),
+	        cmocka_unit_test(utf8_test_validate_blocks),
+	        cmocka_unit_test(utf8_test_transcode),
+	};
+
+	return cmocka_run_group_tests(tests, NULL, NULL);
+}